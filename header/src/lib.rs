@@ -74,6 +74,22 @@ pub mod syscalls {
         Recvmsg,
         GetAddrinfo,
         FreeAddrinfo,
+        AtomicRequeue,
+        PthreadMutexLock,
+        PthreadMutexUnlock,
+        Fsync,
+        Mmap,
+        Munmap,
+        Msync,
+        Readv,
+        Writev,
+        Pread,
+        Pwrite,
+        Sendmmsg,
+        Recvmmsg,
+        EpollCreate1,
+        EpollCtl,
+        EpollWait,
         LastNR,
     }
 }
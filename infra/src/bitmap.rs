@@ -0,0 +1,151 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A two-level bitmap of up to usize::BITS^2 bits for picking the lowest
+// set bit in constant time, e.g. the highest ready priority. Bits are
+// kept in GROUPS words, and a summary word tells which words are not
+// empty, so finding the first bit takes two trailing_zeros. With a
+// single group, the summary is left out at compile time.
+
+const WORD_BITS: usize = usize::BITS as usize;
+
+/// The number of groups needed for `bits` bits.
+pub const fn groups_for(bits: usize) -> usize {
+    bits.div_ceil(WORD_BITS)
+}
+
+#[derive(Debug, Clone)]
+pub struct PriorityBitmap<const GROUPS: usize> {
+    summary: usize,
+    groups: [usize; GROUPS],
+}
+
+impl<const GROUPS: usize> PriorityBitmap<GROUPS> {
+    pub const CAPACITY: usize = GROUPS * WORD_BITS;
+    const CHECK: () = assert!(GROUPS >= 1 && GROUPS <= WORD_BITS);
+
+    pub const fn new() -> Self {
+        #[allow(clippy::let_unit_value)]
+        let _ = Self::CHECK;
+        Self {
+            summary: 0,
+            groups: [0; GROUPS],
+        }
+    }
+
+    #[inline]
+    pub fn set(&mut self, bit: usize) {
+        debug_assert!(bit < Self::CAPACITY);
+        let g = bit / WORD_BITS;
+        self.groups[g] |= 1 << (bit % WORD_BITS);
+        if GROUPS > 1 {
+            self.summary |= 1 << g;
+        }
+    }
+
+    #[inline]
+    pub fn clear(&mut self, bit: usize) {
+        debug_assert!(bit < Self::CAPACITY);
+        let g = bit / WORD_BITS;
+        self.groups[g] &= !(1 << (bit % WORD_BITS));
+        if GROUPS > 1 && self.groups[g] == 0 {
+            self.summary &= !(1 << g);
+        }
+    }
+
+    #[inline]
+    pub fn is_set(&self, bit: usize) -> bool {
+        self.groups[bit / WORD_BITS] & (1 << (bit % WORD_BITS)) != 0
+    }
+
+    #[inline]
+    pub fn is_empty(&self) -> bool {
+        if GROUPS > 1 {
+            self.summary == 0
+        } else {
+            self.groups[0] == 0
+        }
+    }
+
+    /// The lowest bit set.
+    #[inline]
+    pub fn first(&self) -> Option<usize> {
+        let g = if GROUPS > 1 {
+            if self.summary == 0 {
+                return None;
+            }
+            self.summary.trailing_zeros() as usize
+        } else {
+            0
+        };
+        let word = self.groups[g];
+        if word == 0 {
+            return None;
+        }
+        Some(g * WORD_BITS + word.trailing_zeros() as usize)
+    }
+}
+
+impl<const GROUPS: usize> Default for PriorityBitmap<GROUPS> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_single_group() {
+        let mut b = PriorityBitmap::<1>::new();
+        assert_eq!(b.first(), None);
+        b.set(7);
+        b.set(3);
+        assert_eq!(b.first(), Some(3));
+        b.clear(3);
+        assert_eq!(b.first(), Some(7));
+        b.clear(7);
+        assert!(b.is_empty());
+    }
+
+    #[test]
+    fn test_two_levels() {
+        const N: usize = 256;
+        let mut b = PriorityBitmap::<{ groups_for(N) }>::new();
+        assert!(PriorityBitmap::<{ groups_for(N) }>::CAPACITY >= N);
+        for bit in (0..N).rev() {
+            b.set(bit);
+            assert_eq!(b.first(), Some(bit));
+        }
+        for bit in 0..N {
+            assert!(b.is_set(bit));
+            assert_eq!(b.first(), Some(bit));
+            b.clear(bit);
+        }
+        assert!(b.is_empty());
+        assert_eq!(b.first(), None);
+    }
+
+    #[test]
+    fn test_summary_kept_with_other_bits_in_group() {
+        let mut b = PriorityBitmap::<{ groups_for(200) }>::new();
+        b.set(130);
+        b.set(131);
+        b.clear(130);
+        assert_eq!(b.first(), Some(131));
+        b.set(5);
+        assert_eq!(b.first(), Some(5));
+    }
+}
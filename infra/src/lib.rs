@@ -28,10 +28,13 @@
 #![feature(ptr_as_uninit)]
 #![feature(slice_as_chunks)]
 
+pub mod bitmap;
 pub mod intrusive;
 pub mod list;
+pub mod ring;
 pub mod ringbuffer;
 pub mod spinarc;
 pub mod string;
+pub mod ticketlock;
 pub mod tinyarc;
 pub mod tinyrwlock;
@@ -0,0 +1,704 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! Typed lock-free rings of a fixed capacity.
+//!
+//! [`Spsc`] has one producer and one consumer, each a handle which is
+//! either split from the ring or claimed from a shared reference, so
+//! exclusivity is checked rather than promised. [`Mpsc`] has any number
+//! of producers and one consumer at a time.
+//!
+//! Positions count up and wrap around `usize`, the capacity must be a
+//! power of two. The head and tail are on separate cache lines so that
+//! the producer and the consumer don't invalidate each other's line.
+//!
+//! Nothing blocks here. To sleep on a ring, wait on [`Spsc::pushed`] or
+//! [`Mpsc::pushed`] with `atomic_wait`, and wake it after pushing.
+
+use core::{
+    cell::UnsafeCell,
+    mem::MaybeUninit,
+    ops::Deref,
+    ptr, slice,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+/// Pad and align a value to a cache line.
+#[cfg_attr(target_pointer_width = "32", repr(align(32)))]
+#[cfg_attr(target_pointer_width = "64", repr(align(64)))]
+#[derive(Debug, Default)]
+pub struct CachePadded<T>(T);
+
+impl<T> CachePadded<T> {
+    pub const fn new(value: T) -> Self {
+        Self(value)
+    }
+}
+
+impl<T> Deref for CachePadded<T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        &self.0
+    }
+}
+
+/// A single producer, single consumer ring.
+pub struct Spsc<T, const N: usize> {
+    // Next position to pop, written by the consumer.
+    head: CachePadded<AtomicUsize>,
+    // Next position to push, written by the producer.
+    tail: CachePadded<AtomicUsize>,
+    has_producer: AtomicBool,
+    has_consumer: AtomicBool,
+    buf: [UnsafeCell<MaybeUninit<T>>; N],
+}
+
+unsafe impl<T: Send, const N: usize> Send for Spsc<T, N> {}
+unsafe impl<T: Send, const N: usize> Sync for Spsc<T, N> {}
+
+/// The producer of a [`Spsc`].
+pub struct Producer<'a, T, const N: usize> {
+    ring: &'a Spsc<T, N>,
+    // Cached head, only reloaded when too few slots look free.
+    head: usize,
+    claimed: bool,
+}
+
+/// The consumer of a [`Spsc`].
+pub struct Consumer<'a, T, const N: usize> {
+    ring: &'a Spsc<T, N>,
+    // Cached tail, only reloaded when too few values look pushed.
+    tail: usize,
+    claimed: bool,
+}
+
+unsafe impl<T: Send, const N: usize> Send for Producer<'_, T, N> {}
+unsafe impl<T: Send, const N: usize> Send for Consumer<'_, T, N> {}
+
+impl<T, const N: usize> Spsc<T, N> {
+    const CAPACITY_IS_POWER_OF_TWO: () = assert!(N.is_power_of_two());
+
+    pub const fn new() -> Self {
+        #[allow(clippy::let_unit_value)]
+        let _ = Self::CAPACITY_IS_POWER_OF_TWO;
+        Self {
+            head: CachePadded::new(AtomicUsize::new(0)),
+            tail: CachePadded::new(AtomicUsize::new(0)),
+            has_producer: AtomicBool::new(false),
+            has_consumer: AtomicBool::new(false),
+            buf: [const { UnsafeCell::new(MaybeUninit::uninit()) }; N],
+        }
+    }
+
+    /// Split the ring into its producer and consumer.
+    pub fn split(&mut self) -> (Producer<'_, T, N>, Consumer<'_, T, N>) {
+        let ring = &*self;
+        (
+            Producer {
+                ring,
+                head: ring.head.load(Ordering::Acquire),
+                claimed: false,
+            },
+            Consumer {
+                ring,
+                tail: ring.tail.load(Ordering::Acquire),
+                claimed: false,
+            },
+        )
+    }
+
+    /// Claim the producer, None if it's taken. It's released on drop.
+    pub fn producer(&self) -> Option<Producer<'_, T, N>> {
+        if self.has_producer.swap(true, Ordering::Acquire) {
+            return None;
+        }
+        Some(Producer {
+            ring: self,
+            head: self.head.load(Ordering::Acquire),
+            claimed: true,
+        })
+    }
+
+    /// Claim the consumer, None if it's taken. It's released on drop.
+    pub fn consumer(&self) -> Option<Consumer<'_, T, N>> {
+        if self.has_consumer.swap(true, Ordering::Acquire) {
+            return None;
+        }
+        Some(Consumer {
+            ring: self,
+            tail: self.tail.load(Ordering::Acquire),
+            claimed: true,
+        })
+    }
+
+    /// The count of values pushed, bumped on every commit.
+    pub fn pushed(&self) -> &AtomicUsize {
+        &self.tail
+    }
+
+    /// The count of values popped, bumped on every release.
+    pub fn popped(&self) -> &AtomicUsize {
+        &self.head
+    }
+
+    pub const fn capacity(&self) -> usize {
+        N
+    }
+
+    pub fn len(&self) -> usize {
+        let head = self.head.load(Ordering::Acquire);
+        self.tail.load(Ordering::Acquire).wrapping_sub(head)
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    pub fn is_full(&self) -> bool {
+        self.len() >= N
+    }
+
+    fn slot(&self, pos: usize) -> *mut T {
+        self.buf[pos % N].get().cast()
+    }
+}
+
+impl<T, const N: usize> Default for Spsc<T, N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T, const N: usize> Drop for Spsc<T, N> {
+    fn drop(&mut self) {
+        let tail = *self.tail.0.get_mut();
+        let mut pos = *self.head.0.get_mut();
+        while pos != tail {
+            // SAFETY: Values between the head and the tail are pushed
+            // and not popped.
+            unsafe { ptr::drop_in_place(self.slot(pos)) };
+            pos = pos.wrapping_add(1);
+        }
+    }
+}
+
+impl<T, const N: usize> Producer<'_, T, N> {
+    // Free slots, contiguous ones if `contiguous`. The head is only
+    // reloaded if fewer than `want` slots look free.
+    fn free(&mut self, want: usize, contiguous: bool) -> usize {
+        let tail = self.ring.tail.load(Ordering::Relaxed);
+        if N - tail.wrapping_sub(self.head) < want {
+            self.head = self.ring.head.load(Ordering::Acquire);
+        }
+        let free = N - tail.wrapping_sub(self.head);
+        if contiguous {
+            free.min(N - tail % N)
+        } else {
+            free
+        }
+    }
+
+    pub fn push(&mut self, value: T) -> Result<(), T> {
+        if self.free(1, false) == 0 {
+            return Err(value);
+        }
+        let tail = self.ring.tail.load(Ordering::Relaxed);
+        // SAFETY: The slot is free and only the producer writes it.
+        unsafe { self.ring.slot(tail).write(value) };
+        self.ring
+            .tail
+            .store(tail.wrapping_add(1), Ordering::Release);
+        Ok(())
+    }
+
+    /// Push as many of `values` as fit, the consumer sees them at once.
+    /// Return the number pushed.
+    pub fn push_n(&mut self, values: &[T]) -> usize
+    where
+        T: Copy,
+    {
+        let n = values.len().min(self.free(values.len(), false));
+        let tail = self.ring.tail.load(Ordering::Relaxed);
+        for (i, v) in values[..n].iter().enumerate() {
+            // SAFETY: The n slots from the tail are free.
+            unsafe { self.ring.slot(tail.wrapping_add(i)).write(*v) };
+        }
+        self.ring
+            .tail
+            .store(tail.wrapping_add(n), Ordering::Release);
+        n
+    }
+
+    /// Free slots after the tail, up to the end of the buffer, to be
+    /// written in place and published by [`commit`](Self::commit).
+    pub fn reserve(&mut self) -> &mut [MaybeUninit<T>] {
+        let n = self.free(N, true);
+        let tail = self.ring.tail.load(Ordering::Relaxed);
+        // SAFETY: The slots are free, contiguous, and only the producer
+        // accesses them until they're committed.
+        unsafe { slice::from_raw_parts_mut(self.ring.slot(tail).cast(), n) }
+    }
+
+    /// Publish the first `n` slots returned by the last reserve.
+    ///
+    /// # Safety
+    /// - The `n` slots must be initialized.
+    pub unsafe fn commit(&mut self, n: usize) {
+        debug_assert!(n <= self.free(n, true));
+        let tail = self.ring.tail.load(Ordering::Relaxed);
+        self.ring
+            .tail
+            .store(tail.wrapping_add(n), Ordering::Release);
+    }
+}
+
+impl<T, const N: usize> Drop for Producer<'_, T, N> {
+    fn drop(&mut self) {
+        if self.claimed {
+            self.ring.has_producer.store(false, Ordering::Release);
+        }
+    }
+}
+
+impl<T, const N: usize> Consumer<'_, T, N> {
+    // Values to pop, contiguous ones if `contiguous`. The tail is only
+    // reloaded if fewer than `want` values look pushed.
+    fn available(&mut self, want: usize, contiguous: bool) -> usize {
+        let head = self.ring.head.load(Ordering::Relaxed);
+        if self.tail.wrapping_sub(head) < want {
+            self.tail = self.ring.tail.load(Ordering::Acquire);
+        }
+        let available = self.tail.wrapping_sub(head);
+        if contiguous {
+            available.min(N - head % N)
+        } else {
+            available
+        }
+    }
+
+    pub fn pop(&mut self) -> Option<T> {
+        if self.available(1, false) == 0 {
+            return None;
+        }
+        let head = self.ring.head.load(Ordering::Relaxed);
+        // SAFETY: The slot is pushed and only the consumer reads it.
+        let value = unsafe { self.ring.slot(head).read() };
+        self.ring
+            .head
+            .store(head.wrapping_add(1), Ordering::Release);
+        Some(value)
+    }
+
+    /// Pop into `out` as many values as there are, the slots are freed
+    /// at once. Return the number popped.
+    pub fn pop_n(&mut self, out: &mut [T]) -> usize
+    where
+        T: Copy,
+    {
+        let n = out.len().min(self.available(out.len(), false));
+        let head = self.ring.head.load(Ordering::Relaxed);
+        for (i, v) in out[..n].iter_mut().enumerate() {
+            // SAFETY: The n slots from the head are pushed.
+            *v = unsafe { self.ring.slot(head.wrapping_add(i)).read() };
+        }
+        self.ring
+            .head
+            .store(head.wrapping_add(n), Ordering::Release);
+        n
+    }
+
+    /// Values after the head, up to the end of the buffer, to be read
+    /// in place and freed by [`release`](Self::release).
+    pub fn peek(&mut self) -> &[T] {
+        let n = self.available(N, true);
+        let head = self.ring.head.load(Ordering::Relaxed);
+        // SAFETY: The slots are pushed, contiguous, and the producer
+        // doesn't touch them until they're released.
+        unsafe { slice::from_raw_parts(self.ring.slot(head), n) }
+    }
+
+    /// Drop the first `n` values returned by the last peek and free
+    /// their slots.
+    pub fn release(&mut self, n: usize) {
+        assert!(n <= self.available(n, true));
+        let head = self.ring.head.load(Ordering::Relaxed);
+        for i in 0..n {
+            // SAFETY: The slot is pushed and not read out.
+            unsafe { ptr::drop_in_place(self.ring.slot(head.wrapping_add(i))) };
+        }
+        self.ring
+            .head
+            .store(head.wrapping_add(n), Ordering::Release);
+    }
+}
+
+impl<T, const N: usize> Drop for Consumer<'_, T, N> {
+    fn drop(&mut self) {
+        if self.claimed {
+            self.ring.has_consumer.store(false, Ordering::Release);
+        }
+    }
+}
+
+struct Slot<T> {
+    // The position the slot is free for, or one after the position
+    // it's pushed at.
+    seq: AtomicUsize,
+    value: UnsafeCell<MaybeUninit<T>>,
+}
+
+/// A bounded multi producer, single consumer ring.
+///
+/// Producers claim positions by moving the tail, and publish every
+/// slot through its sequence. The consumer is claimed for every pop, a
+/// second consumer at a time finds the ring empty.
+pub struct Mpsc<T, const N: usize> {
+    head: CachePadded<AtomicUsize>,
+    tail: CachePadded<AtomicUsize>,
+    consuming: AtomicBool,
+    buf: [Slot<T>; N],
+}
+
+unsafe impl<T: Send, const N: usize> Send for Mpsc<T, N> {}
+unsafe impl<T: Send, const N: usize> Sync for Mpsc<T, N> {}
+
+impl<T, const N: usize> Mpsc<T, N> {
+    const CAPACITY_IS_POWER_OF_TWO: () = assert!(N.is_power_of_two());
+
+    pub const fn new() -> Self {
+        #[allow(clippy::let_unit_value)]
+        let _ = Self::CAPACITY_IS_POWER_OF_TWO;
+        let mut buf = [const {
+            Slot {
+                seq: AtomicUsize::new(0),
+                value: UnsafeCell::new(MaybeUninit::uninit()),
+            }
+        }; N];
+        let mut i = 0;
+        while i < N {
+            buf[i].seq = AtomicUsize::new(i);
+            i += 1;
+        }
+        Self {
+            head: CachePadded::new(AtomicUsize::new(0)),
+            tail: CachePadded::new(AtomicUsize::new(0)),
+            consuming: AtomicBool::new(false),
+            buf,
+        }
+    }
+
+    /// The count of positions claimed by producers. A value may not be
+    /// visible yet right after it's bumped.
+    pub fn pushed(&self) -> &AtomicUsize {
+        &self.tail
+    }
+
+    pub const fn capacity(&self) -> usize {
+        N
+    }
+
+    pub fn len(&self) -> usize {
+        let head = self.head.load(Ordering::Acquire);
+        self.tail.load(Ordering::Acquire).wrapping_sub(head).min(N)
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    fn slot(&self, pos: usize) -> &Slot<T> {
+        &self.buf[pos % N]
+    }
+
+    // Claim up to `n` positions, return the first and the number.
+    fn claim(&self, n: usize) -> (usize, usize) {
+        let mut tail = self.tail.load(Ordering::Relaxed);
+        loop {
+            let used = tail.wrapping_sub(self.head.load(Ordering::Acquire));
+            // The head is newer than the tail, reload it.
+            if used > N {
+                tail = self.tail.load(Ordering::Relaxed);
+                continue;
+            }
+            let k = n.min(N - used);
+            if k == 0 {
+                return (tail, 0);
+            }
+            // Slots are freed in order, all are free if the last is.
+            let last = tail.wrapping_add(k - 1);
+            let seq = self.slot(last).seq.load(Ordering::Acquire);
+            if seq != last {
+                if (seq as isize).wrapping_sub(last as isize) < 0 {
+                    // Not popped yet.
+                    return (tail, 0);
+                }
+                tail = self.tail.load(Ordering::Relaxed);
+                continue;
+            }
+            match self.tail.compare_exchange_weak(
+                tail,
+                tail.wrapping_add(k),
+                Ordering::Relaxed,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => return (tail, k),
+                Err(t) => tail = t,
+            }
+        }
+    }
+
+    // SAFETY: `pos` must be claimed and not published.
+    unsafe fn publish(&self, pos: usize, value: T) {
+        let slot = self.slot(pos);
+        (*slot.value.get()).write(value);
+        slot.seq.store(pos.wrapping_add(1), Ordering::Release);
+    }
+
+    pub fn push(&self, value: T) -> Result<(), T> {
+        let (pos, n) = self.claim(1);
+        if n == 0 {
+            return Err(value);
+        }
+        // SAFETY: Claimed above.
+        unsafe { self.publish(pos, value) };
+        Ok(())
+    }
+
+    /// Push as many of `values` as fit with one claim. Return the
+    /// number pushed.
+    pub fn push_n(&self, values: &[T]) -> usize
+    where
+        T: Copy,
+    {
+        let (pos, n) = self.claim(values.len());
+        for (i, v) in values[..n].iter().enumerate() {
+            // SAFETY: Claimed above.
+            unsafe { self.publish(pos.wrapping_add(i), *v) };
+        }
+        n
+    }
+
+    // Pop up to `n` values published, call `f` with each.
+    fn consume(&self, n: usize, mut f: impl FnMut(T)) -> usize {
+        if n == 0 || self.consuming.swap(true, Ordering::Acquire) {
+            return 0;
+        }
+        let head = self.head.load(Ordering::Relaxed);
+        let mut popped = 0;
+        while popped < n {
+            let pos = head.wrapping_add(popped);
+            let slot = self.slot(pos);
+            if slot.seq.load(Ordering::Acquire) != pos.wrapping_add(1) {
+                break;
+            }
+            // SAFETY: Published, and only the consumer reads it.
+            f(unsafe { (*slot.value.get()).assume_init_read() });
+            slot.seq.store(pos.wrapping_add(N), Ordering::Release);
+            popped += 1;
+        }
+        self.head
+            .store(head.wrapping_add(popped), Ordering::Release);
+        self.consuming.store(false, Ordering::Release);
+        popped
+    }
+
+    pub fn pop(&self) -> Option<T> {
+        let mut value = None;
+        self.consume(1, |v| value = Some(v));
+        value
+    }
+
+    /// Pop into `out` as many values as are published. Return the
+    /// number popped.
+    pub fn pop_n(&self, out: &mut [T]) -> usize {
+        let mut i = 0;
+        self.consume(out.len(), |v| {
+            out[i] = v;
+            i += 1;
+        })
+    }
+}
+
+impl<T, const N: usize> Default for Mpsc<T, N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl<T, const N: usize> Drop for Mpsc<T, N> {
+    fn drop(&mut self) {
+        while self.pop().is_some() {}
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::{sync::Arc, thread, vec::Vec};
+
+    #[test]
+    fn test_spsc_push_pop() {
+        let mut ring = Spsc::<u32, 4>::new();
+        let (mut p, mut c) = ring.split();
+        for round in 0..3 {
+            for i in 0..4 {
+                assert_eq!(p.push(round * 4 + i), Ok(()));
+            }
+            assert_eq!(p.push(42), Err(42));
+            for i in 0..4 {
+                assert_eq!(c.pop(), Some(round * 4 + i));
+            }
+            assert_eq!(c.pop(), None);
+        }
+    }
+
+    #[test]
+    fn test_spsc_claim() {
+        let ring = Spsc::<u8, 8>::new();
+        let p = ring.producer().unwrap();
+        assert!(ring.producer().is_none());
+        drop(p);
+        assert!(ring.producer().is_some());
+        let _c = ring.consumer().unwrap();
+        assert!(ring.consumer().is_none());
+    }
+
+    #[test]
+    fn test_spsc_push_n_pop_n() {
+        let ring = Spsc::<u8, 8>::new();
+        let mut p = ring.producer().unwrap();
+        let mut c = ring.consumer().unwrap();
+        let mut out = [0u8; 8];
+        assert_eq!(p.push_n(&[1, 2, 3, 4, 5]), 5);
+        assert_eq!(c.pop_n(&mut out[..3]), 3);
+        assert_eq!(&out[..3], &[1, 2, 3]);
+        // Wraps around.
+        assert_eq!(p.push_n(&[6, 7, 8, 9, 10, 11, 12]), 6);
+        assert!(ring.is_full());
+        assert_eq!(c.pop_n(&mut out), 8);
+        assert_eq!(out, [4, 5, 6, 7, 8, 9, 10, 11]);
+        assert!(ring.is_empty());
+    }
+
+    #[test]
+    fn test_spsc_reserve_commit() {
+        let ring = Spsc::<u8, 8>::new();
+        let mut p = ring.producer().unwrap();
+        let mut c = ring.consumer().unwrap();
+        assert_eq!(p.push_n(&[0; 6]), 6);
+        assert_eq!(c.pop_n(&mut [0; 6]), 6);
+        // Only the slots up to the end of the buffer are contiguous.
+        let slots = p.reserve();
+        assert_eq!(slots.len(), 2);
+        slots[0].write(1);
+        slots[1].write(2);
+        unsafe { p.commit(2) };
+        assert_eq!(p.reserve().len(), 6);
+        assert_eq!(c.peek(), &[1, 2]);
+        c.release(2);
+        assert!(ring.is_empty());
+        assert_eq!(ring.popped().load(Ordering::Relaxed), 8);
+    }
+
+    #[test]
+    fn test_spsc_drops_values() {
+        let value = Arc::new(0);
+        {
+            let ring = Spsc::<Arc<i32>, 4>::new();
+            let mut p = ring.producer().unwrap();
+            p.push(value.clone()).unwrap();
+            p.push(value.clone()).unwrap();
+            ring.consumer().unwrap().release(1);
+            assert_eq!(Arc::strong_count(&value), 2);
+        }
+        assert_eq!(Arc::strong_count(&value), 1);
+    }
+
+    #[test]
+    fn test_spsc_concurrent() {
+        let ring = Arc::new(Spsc::<usize, 16>::new());
+        let producer = {
+            let ring = ring.clone();
+            thread::spawn(move || {
+                let mut p = ring.producer().unwrap();
+                let mut i = 0;
+                while i < 10000 {
+                    let batch: Vec<usize> = (i..(i + 7).min(10000)).collect();
+                    i += p.push_n(&batch);
+                }
+            })
+        };
+        let mut c = ring.consumer().unwrap();
+        let mut expected = 0;
+        let mut out = [0; 5];
+        while expected < 10000 {
+            let n = c.pop_n(&mut out);
+            for v in &out[..n] {
+                assert_eq!(*v, expected);
+                expected += 1;
+            }
+        }
+        producer.join().unwrap();
+    }
+
+    #[test]
+    fn test_mpsc_push_pop() {
+        let ring = Mpsc::<u32, 4>::new();
+        for round in 0..3 {
+            assert_eq!(ring.push_n(&[0, 1, 2]), 3);
+            assert_eq!(ring.push(3), Ok(()));
+            assert_eq!(ring.push(42), Err(42));
+            assert_eq!(ring.len(), 4);
+            let mut out = [0; 3];
+            assert_eq!(ring.pop_n(&mut out), 3);
+            assert_eq!(out, [0, 1, 2]);
+            assert_eq!(ring.pop(), Some(3));
+            assert_eq!(ring.pop(), None, "round {}", round);
+        }
+    }
+
+    #[test]
+    fn test_mpsc_concurrent() {
+        const PRODUCERS: usize = 4;
+        const COUNT: usize = 2000;
+        let ring = Arc::new(Mpsc::<(usize, usize), 32>::new());
+        let producers: Vec<_> = (0..PRODUCERS)
+            .map(|id| {
+                let ring = ring.clone();
+                thread::spawn(move || {
+                    for i in 0..COUNT {
+                        while ring.push((id, i)).is_err() {
+                            thread::yield_now();
+                        }
+                    }
+                })
+            })
+            .collect();
+        // Values of a producer come in order.
+        let mut next = [0; PRODUCERS];
+        let mut total = 0;
+        while total < PRODUCERS * COUNT {
+            if let Some((id, i)) = ring.pop() {
+                assert_eq!(i, next[id]);
+                next[id] += 1;
+                total += 1;
+            }
+        }
+        for p in producers {
+            p.join().unwrap();
+        }
+        assert!(ring.is_empty());
+    }
+}
@@ -64,6 +64,11 @@ impl BoxedRingBuffer {
         self.inner.capacity()
     }
 
+    /// Returns the number of bytes in the buffer
+    pub fn len(&self) -> usize {
+        self.inner.len()
+    }
+
     /// Returns true if the buffer is empty
     pub fn is_empty(&self) -> bool {
         self.inner.is_empty()
@@ -221,6 +226,19 @@ impl RingBuffer {
         n == end
     }
 
+    /// Return the number of bytes in the buffer.
+    pub fn len(&self) -> usize {
+        let len = self.len.load(Ordering::Relaxed);
+        let start = self.start.load(Ordering::Relaxed);
+        let end = self.end.load(Ordering::Relaxed);
+
+        if end >= start {
+            end - start
+        } else {
+            end + len * 2 - start
+        }
+    }
+
     /// Check if buffer is empty.
     pub fn is_empty(&self) -> bool {
         let start = self.start.load(Ordering::Relaxed);
@@ -1079,6 +1097,31 @@ mod tests {
         assert!(rb.is_empty());
     }
 
+    #[test]
+    fn test_boxed_ringbuffer_len() {
+        let rb = BoxedRingBuffer::new(4);
+        assert_eq!(rb.len(), 0);
+        for _ in 0..3 {
+            let mut writer = unsafe { rb.writer() };
+            assert!(writer.push_one(1));
+            assert!(writer.push_one(2));
+            assert!(writer.push_one(3));
+            assert_eq!(rb.len(), 3);
+            let mut reader = unsafe { rb.reader() };
+            assert_eq!(reader.pop_one(), Some(1));
+            assert_eq!(reader.pop_one(), Some(2));
+            assert_eq!(rb.len(), 1);
+            assert_eq!(reader.pop_one(), Some(3));
+        }
+        // Wrapped around once the end passes the start.
+        let mut writer = unsafe { rb.writer() };
+        for i in 0..4 {
+            assert!(writer.push_one(i));
+        }
+        assert_eq!(rb.len(), 4);
+        assert!(rb.is_full());
+    }
+
     #[test]
     fn test_concurrent_boxed_ringbuffer() {
         let rb = Arc::new(BoxedRingBuffer::new(16));
@@ -0,0 +1,333 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+//! A fair spin lock which grants the lock in the order it's requested.
+//!
+//! Every locker takes a ticket and waits until its ticket is served,
+//! so no locker can be starved by others. Waiters only read the
+//! `serving` counter while spinning, and the owner writes it once on
+//! unlocking.
+
+use crate::intrusive::Adapter;
+use core::{
+    cell::UnsafeCell,
+    fmt,
+    marker::PhantomData,
+    ops::{Deref, DerefMut},
+    sync::atomic::Ordering,
+};
+
+// Tickets wrap around, they only have to outnumber the lockers
+// holding or waiting for the lock at the same time. On 32-bit targets
+// tickets are bytes to keep the lock small, so no more than 255 lockers
+// may hold or wait for a lock at once.
+#[cfg(target_pointer_width = "32")]
+type AtomicTicket = core::sync::atomic::AtomicU8;
+
+#[cfg(target_pointer_width = "64")]
+type AtomicTicket = core::sync::atomic::AtomicUsize;
+
+pub struct TicketLock<T: ?Sized> {
+    next: AtomicTicket,
+    serving: AtomicTicket,
+    data: UnsafeCell<T>,
+}
+
+pub struct TicketLockGuard<'a, T: 'a + ?Sized> {
+    serving: &'a AtomicTicket,
+    data: *mut T,
+}
+
+unsafe impl<T: ?Sized + Send> Send for TicketLock<T> {}
+unsafe impl<T: ?Sized + Send> Sync for TicketLock<T> {}
+
+unsafe impl<T: ?Sized + Send + Sync> Send for TicketLockGuard<'_, T> {}
+unsafe impl<T: ?Sized + Send + Sync> Sync for TicketLockGuard<'_, T> {}
+
+impl<T> TicketLock<T> {
+    #[inline]
+    pub const fn new(data: T) -> Self {
+        Self {
+            next: AtomicTicket::new(0),
+            serving: AtomicTicket::new(0),
+            data: UnsafeCell::new(data),
+        }
+    }
+
+    #[inline]
+    pub fn into_inner(self) -> T {
+        self.data.into_inner()
+    }
+
+    #[inline(always)]
+    pub fn as_mut_ptr(&self) -> *mut T {
+        self.data.get()
+    }
+}
+
+impl<T: ?Sized> TicketLock<T> {
+    #[inline]
+    fn guard(&self) -> TicketLockGuard<'_, T> {
+        TicketLockGuard {
+            serving: &self.serving,
+            data: self.data.get(),
+        }
+    }
+
+    // Take a ticket and wait for it to be served. Return the guard
+    // and how many times we have spun.
+    #[inline]
+    pub fn lock_and_count(&self) -> (TicketLockGuard<'_, T>, usize) {
+        let ticket = self.next.fetch_add(1, Ordering::Relaxed);
+        let mut spins = 0;
+        while self.serving.load(Ordering::Acquire) != ticket {
+            spins += 1;
+            core::hint::spin_loop();
+        }
+        (self.guard(), spins)
+    }
+
+    #[inline]
+    pub fn lock(&self) -> TicketLockGuard<'_, T> {
+        self.lock_and_count().0
+    }
+
+    // Only take a ticket if it would be served right now.
+    #[inline]
+    pub fn try_lock(&self) -> Option<TicketLockGuard<'_, T>> {
+        let serving = self.serving.load(Ordering::Relaxed);
+        self.next
+            .compare_exchange(
+                serving,
+                serving.wrapping_add(1),
+                Ordering::Acquire,
+                Ordering::Relaxed,
+            )
+            .ok()?;
+        Some(self.guard())
+    }
+
+    #[inline]
+    pub fn is_locked(&self) -> bool {
+        self.next.load(Ordering::Relaxed) != self.serving.load(Ordering::Relaxed)
+    }
+
+    // Number of lockers holding or waiting for the lock.
+    #[inline]
+    pub fn queue_len(&self) -> usize {
+        self.next
+            .load(Ordering::Relaxed)
+            .wrapping_sub(self.serving.load(Ordering::Relaxed)) as usize
+    }
+
+    #[inline]
+    pub fn get_mut(&mut self) -> &mut T {
+        self.data.get_mut()
+    }
+}
+
+impl<T: ?Sized + fmt::Debug> fmt::Debug for TicketLock<T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match self.try_lock() {
+            Some(guard) => write!(f, "TicketLock {{ data: ")
+                .and_then(|()| (*guard).fmt(f))
+                .and_then(|()| write!(f, "}}")),
+            None => write!(f, "TicketLock {{ <locked> }}"),
+        }
+    }
+}
+
+impl<T: Default> Default for TicketLock<T> {
+    fn default() -> Self {
+        Self::new(Default::default())
+    }
+}
+
+impl<T: ?Sized + fmt::Debug> fmt::Debug for TicketLockGuard<'_, T> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        fmt::Debug::fmt(&**self, f)
+    }
+}
+
+impl<T: ?Sized> Deref for TicketLockGuard<'_, T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        // Safety: We know statically that only we are referencing data
+        unsafe { &*self.data }
+    }
+}
+
+impl<T: ?Sized> DerefMut for TicketLockGuard<'_, T> {
+    fn deref_mut(&mut self) -> &mut T {
+        // Safety: We know statically that only we are referencing data
+        unsafe { &mut *self.data }
+    }
+}
+
+impl<T: ?Sized> Drop for TicketLockGuard<'_, T> {
+    fn drop(&mut self) {
+        // Only the owner writes `serving`.
+        let next = self.serving.load(Ordering::Relaxed).wrapping_add(1);
+        self.serving.store(next, Ordering::Release);
+    }
+}
+
+// Intrusive version of TicketLock protecting the struct it's embedded
+// in, see IRwLock.
+#[derive(Default, Debug)]
+pub struct ITicketLock<T: Sized, A: Adapter> {
+    lock: TicketLock<()>,
+    _t: PhantomData<T>,
+    _a: PhantomData<A>,
+}
+
+impl<T: Sized, A: Adapter> ITicketLock<T, A> {
+    pub const fn const_new() -> Self {
+        Self {
+            lock: TicketLock::new(()),
+            _t: PhantomData,
+            _a: PhantomData,
+        }
+    }
+
+    pub const fn new() -> Self {
+        Self::const_new()
+    }
+
+    #[inline]
+    fn this_mut(&self) -> *mut T {
+        let ptr = self as *const _ as *mut u8;
+        unsafe { ptr.sub(A::offset()) as *mut T }
+    }
+
+    #[inline]
+    fn rebind<'a>(&'a self, g: TicketLockGuard<'a, ()>) -> TicketLockGuard<'a, T> {
+        let serving = g.serving;
+        core::mem::forget(g);
+        TicketLockGuard {
+            serving,
+            data: self.this_mut(),
+        }
+    }
+
+    #[inline]
+    pub fn lock_and_count(&self) -> (TicketLockGuard<'_, T>, usize) {
+        let (g, spins) = self.lock.lock_and_count();
+        (self.rebind(g), spins)
+    }
+
+    #[inline]
+    pub fn lock(&self) -> TicketLockGuard<'_, T> {
+        self.lock_and_count().0
+    }
+
+    #[inline]
+    pub fn try_lock(&self) -> Option<TicketLockGuard<'_, T>> {
+        let g = self.lock.try_lock()?;
+        Some(self.rebind(g))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::{sync::Arc, thread, vec::Vec};
+
+    #[test]
+    fn test_lock_unlock() {
+        let l = TicketLock::new(0);
+        assert!(!l.is_locked());
+        {
+            let mut g = l.lock();
+            *g += 1;
+            assert!(l.is_locked());
+            assert_eq!(l.queue_len(), 1);
+            assert!(l.try_lock().is_none());
+        }
+        assert!(!l.is_locked());
+        let g = l.try_lock();
+        assert!(g.is_some());
+        assert_eq!(*g.unwrap(), 1);
+        assert_eq!(l.into_inner(), 1);
+    }
+
+    #[test]
+    fn test_ticket_wraps_around() {
+        // Start with the last ticket, so that the first lock wraps
+        // `next` and its unlock wraps `serving`.
+        let last = AtomicTicket::new(0).into_inner().wrapping_sub(1);
+        let l = TicketLock {
+            next: AtomicTicket::new(last),
+            serving: AtomicTicket::new(last),
+            data: UnsafeCell::new(()),
+        };
+        {
+            let _g = l.lock();
+            assert_eq!(l.next.load(Ordering::Relaxed), 0);
+            assert!(l.is_locked());
+            assert_eq!(l.queue_len(), 1);
+            assert!(l.try_lock().is_none());
+        }
+        assert_eq!(l.serving.load(Ordering::Relaxed), 0);
+        assert!(!l.is_locked());
+        for _ in 0..4 {
+            drop(l.lock());
+            drop(l.try_lock().unwrap());
+        }
+        assert!(!l.is_locked());
+        assert_eq!(l.queue_len(), 0);
+    }
+
+    #[test]
+    fn test_contended() {
+        const N: usize = 4;
+        const M: usize = 1000;
+        let l = Arc::new(TicketLock::new(0usize));
+        let mut children = Vec::new();
+        for _ in 0..N {
+            let l = l.clone();
+            children.push(thread::spawn(move || {
+                for _ in 0..M {
+                    *l.lock() += 1;
+                }
+            }));
+        }
+        for c in children {
+            assert!(c.join().is_ok());
+        }
+        assert_eq!(*l.lock(), N * M);
+    }
+
+    crate::impl_simple_intrusive_adapter!(OffsetOfLock, Counter, lock);
+
+    #[derive(Default, Debug)]
+    struct Counter {
+        val: usize,
+        lock: ITicketLock<Counter, OffsetOfLock>,
+    }
+
+    #[test]
+    fn test_intrusive() {
+        let c = Counter::default();
+        c.lock.lock().val += 1;
+        {
+            let (mut g, spins) = c.lock.lock_and_count();
+            assert_eq!(spins, 0);
+            g.val += 1;
+            assert!(c.lock.try_lock().is_none());
+        }
+        assert_eq!(c.lock.try_lock().unwrap().val, 2);
+    }
+}
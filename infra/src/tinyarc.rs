@@ -286,6 +286,15 @@ impl<T: Sized, A: Adapter> TinyArcList<T, A> {
         true
     }
 
+    // Detach `me` which must be either detached or linked in this list.
+    pub fn remove(&mut self, me: &TinyArc<T>) -> bool {
+        if !Self::detach(me) {
+            return false;
+        }
+        self.len -= 1;
+        true
+    }
+
     pub fn clear(&mut self) -> usize {
         let mut c = 0;
         for i in TinyArcListIterator::<T, A>::new(&self.head, Some(NonNull::from_ref(&self.tail))) {
@@ -478,6 +487,30 @@ mod tests {
         assert!(l.is_empty());
     }
 
+    #[test]
+    fn test_push_and_remove() {
+        type Ty = TinyArc<Thread>;
+        type CslList = TinyArcList<Thread, OffsetOfCsl>;
+        let n = 4;
+        let mut l = CslList::default();
+        l.init();
+        let mut v = [const { None }; 4];
+        for i in 0..n {
+            let t = Ty::new(Thread::new(i));
+            assert!(l.push_back(t.clone()));
+            v[i] = Some(t);
+        }
+        let t = v[1].as_ref().unwrap();
+        assert!(l.remove(t));
+        assert!(!l.remove(t));
+        assert_eq!(Ty::strong_count(t), 1);
+        assert_eq!(l.len(), n - 1);
+        for i in [0, 2, 3] {
+            assert_eq!(l.pop_front().unwrap().id, i);
+        }
+        assert!(l.is_empty());
+    }
+
     #[test]
     fn test_push_and_drop() {
         type Ty = TinyArc<Thread>;
@@ -0,0 +1,68 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Microbenchmarks of the kernel, run on the board like the integration
+// test. Every result is printed as a line of
+//
+//   BENCH,<name>,<iterations>,<total cycles>,<cycles per iteration>
+//
+// with cycles from get_sys_cycles(), so that runs of every board config
+// can be collected and compared by scripts.
+
+#![no_main]
+#![no_std]
+
+extern crate alloc;
+extern crate rsrt;
+use blueos::time;
+use semihosting::println;
+
+mod bench_alloc;
+mod bench_net;
+mod bench_sched;
+mod bench_timer;
+mod bench_vfs;
+
+/// Run `f` `iters` times and report the cycles taken.
+pub(crate) fn bench<F: FnMut(usize)>(name: &str, iters: usize, mut f: F) {
+    let start = time::get_sys_cycles();
+    for i in 0..iters {
+        f(i);
+    }
+    report(name, iters, time::get_sys_cycles() - start);
+}
+
+/// Report `cycles` taken by `iters` iterations measured by the caller.
+pub(crate) fn report(name: &str, iters: usize, cycles: u64) {
+    println!(
+        "BENCH,{},{},{},{}",
+        name,
+        iters,
+        cycles,
+        cycles / iters.max(1) as u64
+    );
+}
+
+#[no_mangle]
+fn main() -> i32 {
+    println!("Kernel benchmark start...");
+    println!("BENCH,name,iterations,cycles,cycles_per_iteration");
+    bench_sched::run();
+    bench_timer::run();
+    bench_alloc::run();
+    bench_vfs::run();
+    bench_net::run();
+    println!("Kernel benchmark end.");
+    0
+}
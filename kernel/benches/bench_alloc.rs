@@ -0,0 +1,67 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::report;
+use alloc::{
+    alloc::{alloc, dealloc, Layout},
+    format,
+    vec::Vec,
+};
+use blueos::time;
+
+#[cfg(allocator = "tlsf")]
+const BACKEND: &str = "tlsf";
+#[cfg(allocator = "slab")]
+const BACKEND: &str = "slab";
+#[cfg(allocator = "llff")]
+const BACKEND: &str = "llff";
+#[cfg(allocator = "buddy")]
+const BACKEND: &str = "buddy";
+
+const BATCH: usize = 64;
+const ROUNDS: usize = 16;
+
+// Allocate a batch of blocks of `size` and free them, in the order
+// most kernel objects live and die.
+fn alloc_free(size: usize) {
+    let layout = Layout::from_size_align(size, core::mem::size_of::<usize>()).unwrap();
+    let mut ptrs = Vec::with_capacity(BATCH);
+    let (mut alloc_cycles, mut free_cycles) = (0, 0);
+    for _ in 0..ROUNDS {
+        let start = time::get_sys_cycles();
+        for _ in 0..BATCH {
+            // SAFETY: The layout has a non-zero size.
+            ptrs.push(unsafe { alloc(layout) });
+        }
+        let mid = time::get_sys_cycles();
+        for p in ptrs.drain(..).rev() {
+            assert!(!p.is_null());
+            // SAFETY: Allocated above with the same layout.
+            unsafe { dealloc(p, layout) };
+        }
+        alloc_cycles += mid - start;
+        free_cycles += time::get_sys_cycles() - mid;
+    }
+    let n = BATCH * ROUNDS;
+    report(&format!("alloc_{}_{}", BACKEND, size), n, alloc_cycles);
+    report(&format!("free_{}_{}", BACKEND, size), n, free_cycles);
+}
+
+pub(crate) fn run() {
+    let mut size = 16;
+    while size <= 4096 {
+        alloc_free(size);
+        size <<= 1;
+    }
+}
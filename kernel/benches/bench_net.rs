@@ -0,0 +1,190 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::report;
+use alloc::{boxed::Box, format, vec};
+use blueos::{
+    allocator, net, scheduler,
+    sync::{atomic_wait, atomic_wake},
+    thread::{Builder, Entry, Stack},
+    time,
+};
+use core::{
+    ffi::c_void,
+    mem,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+const STACK_SIZE: usize = 16 << 10;
+const CHUNK: usize = 1024;
+const TCP_BYTES: usize = 256 << 10;
+const DATAGRAMS: usize = 256;
+// Empty polls after the client is done before the rest is taken as lost.
+const IDLE_POLLS: usize = 100;
+
+// Network syscalls need more stack than the default.
+fn spawn(f: impl FnOnce() + Send + 'static) {
+    let base = allocator::malloc_align(STACK_SIZE, 16) as usize;
+    let t = Builder::new(Entry::Closure(Box::new(f)))
+        .set_stack(Stack::Raw {
+            base,
+            size: STACK_SIZE,
+        })
+        .build();
+    t.lock().set_cleanup(Entry::Closure(Box::new(move || {
+        allocator::free_align(base as *mut u8, 16);
+    })));
+    scheduler::queue_ready_thread(t.state(), t);
+}
+
+fn loopback(port: u16) -> libc::sockaddr_in {
+    let mut addr: libc::sockaddr_in = unsafe { mem::zeroed() };
+    addr.sin_len = mem::size_of::<libc::sockaddr_in>() as u8;
+    addr.sin_family = libc::AF_INET as libc::sa_family_t;
+    addr.sin_port = port.to_be();
+    addr.sin_addr.s_addr = u32::from_be_bytes([127, 0, 0, 1]).to_be();
+    addr
+}
+
+fn bind(fd: i32, port: u16) {
+    let addr = loopback(port);
+    let ret = net::syscalls::bind(
+        fd,
+        &addr as *const _ as *const libc::sockaddr,
+        mem::size_of::<libc::sockaddr>() as libc::socklen_t,
+    );
+    assert_eq!(ret, 0);
+}
+
+fn wait_for(flag: &AtomicUsize) -> usize {
+    loop {
+        let n = flag.load(Ordering::Acquire);
+        if n != 0 {
+            return n;
+        }
+        let _ = atomic_wait(flag, 0, None);
+    }
+}
+
+fn set(flag: &'static AtomicUsize, n: usize) {
+    flag.store(n, Ordering::Release);
+    let _ = atomic_wake(flag, 1);
+}
+
+// Stream TCP_BYTES from a client to a server over loopback. Cycles are
+// counted from connecting until the server has got all of them.
+fn tcp_throughput() {
+    const PORT: u16 = 5201;
+    static LISTENING: AtomicUsize = AtomicUsize::new(0);
+    static RECEIVED: AtomicUsize = AtomicUsize::new(0);
+    spawn(|| {
+        let fd = net::syscalls::socket(libc::AF_INET, libc::SOCK_STREAM, 0);
+        assert!(fd >= 0);
+        bind(fd, PORT);
+        assert_eq!(net::syscalls::listen(fd, 0), 0);
+        set(&LISTENING, 1);
+        let fd = net::syscalls::accept(fd, core::ptr::null(), 0);
+        let mut buf = vec![0u8; CHUNK];
+        let mut total = 0;
+        while total < TCP_BYTES {
+            let n = net::syscalls::recv(fd, buf.as_mut_ptr() as *mut c_void, CHUNK, 0);
+            if n <= 0 {
+                break;
+            }
+            total += n as usize;
+        }
+        net::syscalls::shutdown(fd, 0);
+        // Never 0, so that a short transfer still wakes the client.
+        set(&RECEIVED, total.max(1));
+    });
+    wait_for(&LISTENING);
+    let fd = net::syscalls::socket(libc::AF_INET, libc::SOCK_STREAM, 0);
+    assert!(fd >= 0);
+    let addr = loopback(PORT);
+    let start = time::get_sys_cycles();
+    let ret = net::syscalls::connect(
+        fd,
+        &addr as *const _ as *const libc::sockaddr,
+        mem::size_of::<libc::sockaddr>() as libc::socklen_t,
+    );
+    assert_eq!(ret, 0);
+    let buf = vec![0xa5u8; CHUNK];
+    let mut sent = 0;
+    while sent < TCP_BYTES {
+        let n = net::syscalls::send(fd, buf.as_ptr() as *const c_void, CHUNK, 0);
+        assert!(n > 0);
+        sent += n as usize;
+    }
+    let received = wait_for(&RECEIVED);
+    let cycles = time::get_sys_cycles() - start;
+    net::syscalls::shutdown(fd, 0);
+    // Iterations are KiB received.
+    report(&format!("tcp_loopback_{}", CHUNK), received >> 10, cycles);
+}
+
+// Send DATAGRAMS datagrams of CHUNK bytes to a server over loopback,
+// the ones received are the iterations.
+fn udp_throughput() {
+    const PORT: u16 = 5202;
+    static BOUND: AtomicUsize = AtomicUsize::new(0);
+    static SENT: AtomicUsize = AtomicUsize::new(0);
+    static RECEIVED: AtomicUsize = AtomicUsize::new(0);
+    spawn(|| {
+        let fd = net::syscalls::socket(libc::AF_INET, libc::SOCK_DGRAM | libc::SO_NONBLOCK, 0);
+        assert!(fd >= 0);
+        bind(fd, PORT);
+        set(&BOUND, 1);
+        let mut buf = vec![0u8; CHUNK];
+        let (mut count, mut idle) = (0, 0);
+        while count < DATAGRAMS && idle < IDLE_POLLS {
+            let n = net::syscalls::recv(fd, buf.as_mut_ptr() as *mut c_void, CHUNK, 0);
+            if n > 0 {
+                count += 1;
+                continue;
+            }
+            if SENT.load(Ordering::Acquire) != 0 {
+                idle += 1;
+            }
+            scheduler::yield_me();
+        }
+        net::syscalls::shutdown(fd, 0);
+        set(&RECEIVED, count + 1);
+    });
+    wait_for(&BOUND);
+    let fd = net::syscalls::socket(libc::AF_INET, libc::SOCK_DGRAM, 0);
+    assert!(fd >= 0);
+    let addr = loopback(PORT);
+    let buf = vec![0xa5u8; CHUNK];
+    let start = time::get_sys_cycles();
+    for _ in 0..DATAGRAMS {
+        net::syscalls::sendto(
+            fd,
+            buf.as_ptr() as *const c_void,
+            CHUNK,
+            0,
+            &addr as *const _ as *const libc::sockaddr,
+            mem::size_of::<libc::sockaddr>() as libc::socklen_t,
+        );
+    }
+    set(&SENT, 1);
+    let received = wait_for(&RECEIVED) - 1;
+    let cycles = time::get_sys_cycles() - start;
+    net::syscalls::shutdown(fd, 0);
+    report(&format!("udp_loopback_{}", CHUNK), received, cycles);
+}
+
+pub(crate) fn run() {
+    tcp_throughput();
+    udp_throughput();
+}
@@ -0,0 +1,129 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::bench;
+use blueos::{
+    scheduler,
+    sync::{atomic_wait, atomic_wake, Semaphore},
+    thread,
+};
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+const ROUNDS: usize = 1000;
+
+// Wait until `flag` is set by the partner thread exiting.
+fn join(flag: &AtomicUsize) {
+    while flag.load(Ordering::Acquire) == 0 {
+        let _ = atomic_wait(flag, 0, None);
+    }
+}
+
+fn done(flag: &'static AtomicUsize) {
+    flag.store(1, Ordering::Release);
+    let _ = atomic_wake(flag, 1);
+}
+
+// Two threads passing a turn back and forth, yielding while waiting.
+fn yield_ping_pong() {
+    static TURN: AtomicUsize = AtomicUsize::new(0);
+    static DONE: AtomicUsize = AtomicUsize::new(0);
+    thread::spawn(|| {
+        for i in 0..ROUNDS {
+            while TURN.load(Ordering::Acquire) != 2 * i + 1 {
+                scheduler::yield_me();
+            }
+            TURN.store(2 * i + 2, Ordering::Release);
+        }
+        done(&DONE);
+    });
+    bench("yield_ping_pong", ROUNDS, |i| {
+        TURN.store(2 * i + 1, Ordering::Release);
+        while TURN.load(Ordering::Acquire) != 2 * i + 2 {
+            scheduler::yield_me();
+        }
+    });
+    join(&DONE);
+}
+
+// Two threads handing a token over by a pair of semaphores.
+fn semaphore_handoff() {
+    static PING: Semaphore = Semaphore::const_new(1);
+    static PONG: Semaphore = Semaphore::const_new(1);
+    static DONE: AtomicUsize = AtomicUsize::new(0);
+    PING.init();
+    PONG.init();
+    // Take the initial resources, so that both start empty.
+    PING.acquire_notimeout();
+    PONG.acquire_notimeout();
+    thread::spawn(|| {
+        for _ in 0..ROUNDS {
+            PING.acquire_notimeout();
+            PONG.release();
+        }
+        done(&DONE);
+    });
+    bench("semaphore_handoff", ROUNDS, |_| {
+        PING.release();
+        PONG.acquire_notimeout();
+    });
+    join(&DONE);
+}
+
+// Two threads waking each other with atomic_wait and atomic_wake.
+fn futex_ping_pong() {
+    static WORD: AtomicUsize = AtomicUsize::new(0);
+    static DONE: AtomicUsize = AtomicUsize::new(0);
+    thread::spawn(|| {
+        for i in 0..ROUNDS {
+            while WORD.load(Ordering::Acquire) != 2 * i + 1 {
+                let _ = atomic_wait(&WORD, 2 * i, None);
+            }
+            WORD.store(2 * i + 2, Ordering::Release);
+            let _ = atomic_wake(&WORD, 1);
+        }
+        done(&DONE);
+    });
+    bench("futex_ping_pong", ROUNDS, |i| {
+        WORD.store(2 * i + 1, Ordering::Release);
+        let _ = atomic_wake(&WORD, 1);
+        while WORD.load(Ordering::Acquire) != 2 * i + 2 {
+            let _ = atomic_wait(&WORD, 2 * i + 1, None);
+        }
+    });
+    join(&DONE);
+}
+
+// The cost of atomic_wake with nobody waiting, the fast path of unlocks.
+fn futex_wake_empty() {
+    let word = AtomicUsize::new(0);
+    bench("futex_wake_empty", ROUNDS * 10, |_| {
+        let _ = atomic_wake(&word, 1);
+    });
+}
+
+// The cost of atomic_wait returning at once on a changed value.
+fn futex_wait_mismatch() {
+    let word = AtomicUsize::new(1);
+    bench("futex_wait_mismatch", ROUNDS * 10, |_| {
+        let _ = atomic_wait(&word, 0, None);
+    });
+}
+
+pub(crate) fn run() {
+    yield_ping_pong();
+    semaphore_handoff();
+    futex_ping_pong();
+    futex_wake_empty();
+    futex_wait_mismatch();
+}
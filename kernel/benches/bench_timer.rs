@@ -0,0 +1,54 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::report;
+use alloc::{boxed::Box, format, vec::Vec};
+use blueos::time::{self, timer::Timer};
+
+// Far enough not to fire while measured, spread over the wheel levels.
+fn interval(i: usize) -> usize {
+    1000 + i.wrapping_mul(7919) % 100_000
+}
+
+// Start and stop `n` pending timers, so the cost of the wheel with
+// many timers queued shows.
+fn timer_add_remove(n: usize) {
+    let timers: Vec<_> = (0..n)
+        .map(|i| Timer::new_hard_oneshot(interval(i), Box::new(|| {})))
+        .collect();
+    let start = time::get_sys_cycles();
+    for t in timers.iter() {
+        t.start();
+    }
+    report(
+        &format!("timer_add_{}", n),
+        n,
+        time::get_sys_cycles() - start,
+    );
+    let start = time::get_sys_cycles();
+    for t in timers.iter().rev() {
+        t.stop();
+    }
+    report(
+        &format!("timer_remove_{}", n),
+        n,
+        time::get_sys_cycles() - start,
+    );
+}
+
+pub(crate) fn run() {
+    for n in [16, 256, 1024] {
+        timer_add_remove(n);
+    }
+}
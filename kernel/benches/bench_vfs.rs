@@ -0,0 +1,90 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::bench;
+use alloc::{ffi::CString, format, string::String, vec};
+use blueos::vfs::syscalls::{
+    close, lseek, mkdir, open, pread, pwrite, read, rmdir, stat, unlink, write, Stat,
+};
+use core::{ffi::c_char, mem::MaybeUninit};
+use libc::{O_CREAT, O_RDWR, SEEK_SET};
+
+const LOOKUPS: usize = 256;
+const BLOCK: usize = 512;
+const BLOCKS: usize = 64;
+
+fn c_path(path: &str) -> CString {
+    CString::new(path).unwrap()
+}
+
+// Look a file up through `depth` directories.
+fn path_lookup(depth: usize) {
+    let mut dirs = vec![];
+    let mut path = String::from("/bench");
+    for i in 0..depth {
+        path.push_str(&format!("/d{}", i));
+        dirs.push(c_path(&path));
+    }
+    for dir in dirs.iter() {
+        assert_eq!(mkdir(dir.as_ptr() as *const c_char, 0o755), 0);
+    }
+    let leaf = dirs.last().unwrap();
+    let mut st = MaybeUninit::<Stat>::uninit();
+    bench(&format!("path_lookup_depth_{}", depth), LOOKUPS, |_| {
+        assert_eq!(stat(leaf.as_ptr() as *const c_char, st.as_mut_ptr()), 0);
+    });
+    for dir in dirs.iter().rev() {
+        assert_eq!(rmdir(dir.as_ptr() as *const c_char), 0);
+    }
+}
+
+// Write and read a file of BLOCKS blocks in order, then at random.
+fn file_io(fs: &str, dir: &str) {
+    let path = c_path(&format!("{}bench.dat", dir));
+    let fd = open(path.as_ptr() as *const c_char, O_CREAT | O_RDWR, 0o644);
+    assert!(fd >= 0);
+    let mut buf = vec![0x5au8; BLOCK];
+    bench(&format!("{}_seq_write_{}", fs, BLOCK), BLOCKS, |_| {
+        assert_eq!(write(fd, buf.as_ptr(), BLOCK), BLOCK as isize);
+    });
+    assert_eq!(lseek(fd, 0, SEEK_SET), 0);
+    bench(&format!("{}_seq_read_{}", fs, BLOCK), BLOCKS, |_| {
+        assert_eq!(read(fd, buf.as_mut_ptr(), BLOCK), BLOCK as isize);
+    });
+    // A fixed permutation, the same on every run.
+    let offset = |i: usize| ((i * 37 + 11) % BLOCKS * BLOCK) as i64;
+    bench(&format!("{}_rand_write_{}", fs, BLOCK), BLOCKS, |i| {
+        assert_eq!(pwrite(fd, buf.as_ptr(), BLOCK, offset(i)), BLOCK as isize);
+    });
+    bench(&format!("{}_rand_read_{}", fs, BLOCK), BLOCKS, |i| {
+        assert_eq!(
+            pread(fd, buf.as_mut_ptr(), BLOCK, offset(i)),
+            BLOCK as isize
+        );
+    });
+    close(fd);
+    unlink(path.as_ptr() as *const c_char);
+}
+
+pub(crate) fn run() {
+    let root = c_path("/bench");
+    assert_eq!(mkdir(root.as_ptr() as *const c_char, 0o755), 0);
+    for depth in [1, 4, 8, 16] {
+        path_lookup(depth);
+    }
+    rmdir(root.as_ptr() as *const c_char);
+    file_io("tmpfs", "/");
+    #[cfg(virtio)]
+    file_io("fatfs", "/fat/");
+}
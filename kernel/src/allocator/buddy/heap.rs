@@ -0,0 +1,245 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The heap of the buddy backend. Allocations of a page or more, or
+// aligned to a page, are served by the buddy allocator directly, so
+// they are physically contiguous and don't fragment the pool of small
+// blocks. Small blocks come from a TLSF heap which is supplied with
+// chunks of pages lent by the buddy allocator on demand.
+
+use super::{order_of_size, BuddyAllocator, PAGE_SIZE};
+use crate::{
+    allocator::{block, tlsf::heap::TlsfHeap, MemoryInfo},
+    sync::spinlock::SpinLock,
+};
+use const_default::ConstDefault;
+use core::{alloc::Layout, mem, ptr::NonNull};
+
+// Order of chunks lent to the TLSF heap, i.e., 64 KiB.
+const CHUNK_ORDER: usize = 4;
+
+struct BuddyHeap {
+    pages: BuddyAllocator,
+    small: TlsfHeap,
+    // Bytes of blocks allocated from the buddy allocator directly.
+    page_allocated: usize,
+    maximum: usize,
+}
+
+impl BuddyHeap {
+    #[inline]
+    fn is_large(layout: &Layout) -> bool {
+        layout.size() >= PAGE_SIZE || layout.align() >= PAGE_SIZE
+    }
+
+    #[inline]
+    fn allocated(&self) -> usize {
+        self.page_allocated + self.small.allocated()
+    }
+
+    #[inline]
+    fn update_maximum(&mut self) {
+        self.maximum = self.maximum.max(self.allocated());
+    }
+
+    // Lend a chunk of pages to the TLSF heap which is large enough to
+    // hold `layout`.
+    fn grow(&mut self, layout: &Layout) -> Option<()> {
+        let min_order = order_of_size(layout.size() + layout.align() + 4 * block::GRANULARITY);
+        let chunk = self
+            .pages
+            .alloc(min_order.max(CHUNK_ORDER))
+            .or_else(|| self.pages.alloc(min_order))?;
+        let order = self.pages.order_of(chunk).unwrap();
+        self.pages.lend(chunk);
+        let block = NonNull::slice_from_raw_parts(chunk, PAGE_SIZE << order);
+        // SAFETY: The chunk is owned by the TLSF heap from now on.
+        unsafe { self.small.insert_free_block_ptr(block) };
+        Some(())
+    }
+
+    fn allocate(&mut self, layout: &Layout) -> Option<NonNull<u8>> {
+        let ptr = if Self::is_large(layout) {
+            let order = order_of_size(layout.size());
+            let ptr = self.pages.alloc_aligned(order, layout.align())?;
+            self.page_allocated += PAGE_SIZE << order;
+            ptr
+        } else {
+            match self.small.allocate(layout) {
+                Some(ptr) => ptr,
+                None => {
+                    self.grow(layout)?;
+                    self.small.allocate(layout)?
+                }
+            }
+        };
+        self.update_maximum();
+        Some(ptr)
+    }
+
+    unsafe fn deallocate(&mut self, ptr: NonNull<u8>, align: Option<usize>) {
+        if self.pages.is_lent(ptr) {
+            match align {
+                Some(align) => self.small.deallocate(ptr, align),
+                None => self.small.deallocate_unknown_align(ptr),
+            };
+            return;
+        }
+        let order = self.pages.free(ptr);
+        self.page_allocated -= PAGE_SIZE << order;
+    }
+
+    // Size of the payload of the allocation at `ptr`.
+    unsafe fn size_of(&self, ptr: NonNull<u8>) -> usize {
+        if self.pages.is_lent(ptr) {
+            return block::size_of_allocation_unknown_align(ptr).unwrap();
+        }
+        PAGE_SIZE << self.pages.order_of(ptr).unwrap()
+    }
+
+    unsafe fn reallocate(
+        &mut self,
+        ptr: NonNull<u8>,
+        new_layout: &Layout,
+        align: Option<usize>,
+    ) -> Option<NonNull<u8>> {
+        if self.pages.is_lent(ptr) && !Self::is_large(new_layout) {
+            let new_ptr = match align {
+                Some(_) => self.small.reallocate(ptr, new_layout),
+                None => self.small.reallocate_unknown_align(ptr, new_layout.size()),
+            };
+            if new_ptr.is_some() {
+                self.update_maximum();
+                return new_ptr;
+            }
+        } else if !self.pages.is_lent(ptr)
+            && Self::is_large(new_layout)
+            && self.pages.order_of(ptr) == Some(order_of_size(new_layout.size()))
+            && ptr.as_ptr() as usize & (new_layout.align() - 1) == 0
+        {
+            return Some(ptr);
+        }
+        // Move across the buddy allocator and the TLSF heap.
+        let old_size = self.size_of(ptr);
+        let new_ptr = self.allocate(new_layout)?;
+        core::ptr::copy_nonoverlapping(
+            ptr.as_ptr(),
+            new_ptr.as_ptr(),
+            old_size.min(new_layout.size()),
+        );
+        self.deallocate(ptr, align);
+        Some(new_ptr)
+    }
+}
+
+pub(crate) struct Heap {
+    heap: SpinLock<BuddyHeap>,
+}
+
+impl Heap {
+    // Create a new UNINITIALIZED heap allocator
+    pub const fn new() -> Self {
+        Heap {
+            heap: SpinLock::new(BuddyHeap {
+                pages: BuddyAllocator::new(),
+                small: ConstDefault::DEFAULT,
+                page_allocated: 0,
+                maximum: 0,
+            }),
+        }
+    }
+
+    // Initializes the heap
+    pub unsafe fn init(&self, start_addr: usize, size: usize) {
+        let mut heap = self.heap.irqsave_lock();
+        heap.pages.init(start_addr, size);
+    }
+
+    // try to allocate memory with the given layout
+    pub fn alloc(&self, layout: Layout) -> Option<NonNull<u8>> {
+        let mut heap = self.heap.irqsave_lock();
+        heap.allocate(&layout)
+    }
+
+    // deallocate the memory pointed by ptr with the given layout
+    pub unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        let mut heap = self.heap.irqsave_lock();
+        heap.deallocate(NonNull::new_unchecked(ptr), Some(layout.align()));
+    }
+
+    // Allocate blocks of the same layout with the heap locked once.
+    // Return the number of blocks allocated.
+    pub fn alloc_batch(&self, layout: Layout, blocks: &mut [*mut u8]) -> usize {
+        let mut heap = self.heap.irqsave_lock();
+        for (i, block) in blocks.iter_mut().enumerate() {
+            let Some(ptr) = heap.allocate(&layout) else {
+                return i;
+            };
+            *block = ptr.as_ptr();
+        }
+        blocks.len()
+    }
+
+    // Deallocate blocks of the same layout with the heap locked once.
+    pub unsafe fn dealloc_batch(&self, blocks: &[*mut u8], layout: Layout) {
+        let mut heap = self.heap.irqsave_lock();
+        for ptr in blocks {
+            heap.deallocate(NonNull::new_unchecked(*ptr), Some(layout.align()));
+        }
+    }
+
+    pub unsafe fn deallocate_unknown_align(&self, ptr: *mut u8) {
+        let mut heap = self.heap.irqsave_lock();
+        heap.deallocate(NonNull::new_unchecked(ptr), None);
+    }
+
+    // reallocate memory with the given size and layout
+    pub unsafe fn realloc(
+        &self,
+        ptr: *mut u8,
+        layout: Layout,
+        new_size: usize,
+    ) -> Option<NonNull<u8>> {
+        let new_layout = Layout::from_size_align_unchecked(new_size, layout.align());
+        let mut heap = self.heap.irqsave_lock();
+        heap.reallocate(
+            NonNull::new_unchecked(ptr),
+            &new_layout,
+            Some(layout.align()),
+        )
+    }
+
+    // reallocate memory with the given size but with out align
+    pub unsafe fn realloc_unknown_align(
+        &self,
+        ptr: *mut u8,
+        new_size: usize,
+    ) -> Option<NonNull<u8>> {
+        let new_layout = Layout::from_size_align_unchecked(new_size, mem::size_of::<usize>());
+        let mut heap = self.heap.irqsave_lock();
+        heap.reallocate(NonNull::new_unchecked(ptr), &new_layout, None)
+    }
+
+    // Retrieves various statistics about the current state of the heap's memory usage.
+    pub fn memory_info(&self) -> MemoryInfo {
+        let heap = self.heap.irqsave_lock();
+        MemoryInfo {
+            total: heap.pages.total_pages() * PAGE_SIZE,
+            used: heap.allocated(),
+            max_used: heap.maximum,
+            pages: heap.pages.info(),
+            ..Default::default()
+        }
+    }
+}
@@ -0,0 +1,472 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A binary buddy allocator of physically contiguous pages. A block of
+// order k spans 2^k pages and is aligned to its size relative to the
+// first managed page. Free blocks of each order are kept in a doubly
+// linked list threaded through the free pages themselves, and a bitmap
+// per order tells whether a block is free, so finding the buddy to
+// coalesce with is O(1) and alloc/free are O(NR_ORDERS).
+//
+// Metadata, i.e., the bitmaps and one byte per page recording the
+// order of allocated blocks, is carved from the front of the managed
+// region.
+
+pub mod heap;
+
+use core::ptr::{self, NonNull};
+
+pub const PAGE_SHIFT: usize = 12;
+pub const PAGE_SIZE: usize = 1 << PAGE_SHIFT;
+// Blocks span up to 2^(NR_ORDERS - 1) pages, i.e., 4 MiB.
+pub const NR_ORDERS: usize = 11;
+
+const BITS: usize = usize::BITS as usize;
+// Layout of the per-page byte. Only head pages of allocated blocks
+// have ALLOCATED set, and UNALIGNED if the block is a run of pages not
+// aligned to its size. All pages of a block lent to another heap have
+// LENT set.
+const ALLOCATED: u8 = 0x80;
+const LENT: u8 = 0x40;
+const UNALIGNED: u8 = 0x20;
+const ORDER_MASK: u8 = 0x0f;
+
+#[repr(C)]
+struct FreeBlock {
+    next: *mut FreeBlock,
+    prev: *mut FreeBlock,
+}
+
+#[derive(Default, Debug, Clone, Copy)]
+pub struct BuddyInfo {
+    pub total_pages: usize,
+    pub free_pages: usize,
+    // Number of free blocks of each order.
+    pub free_blocks: [usize; NR_ORDERS],
+}
+
+impl BuddyInfo {
+    // Order of the largest free block, None if there is no free page.
+    pub fn largest_free_order(&self) -> Option<usize> {
+        self.free_blocks.iter().rposition(|&n| n != 0)
+    }
+
+    // Percentage of free pages not in the largest free block order, 0
+    // means no fragmentation at all.
+    pub fn fragmentation(&self) -> usize {
+        let Some(order) = self.largest_free_order() else {
+            return 0;
+        };
+        let largest = self.free_blocks[order] << order;
+        100 - largest * 100 / self.free_pages
+    }
+}
+
+pub struct BuddyAllocator {
+    // Address of the first managed page.
+    base: usize,
+    nr_pages: usize,
+    nr_free: usize,
+    free_lists: [*mut FreeBlock; NR_ORDERS],
+    free_blocks: [usize; NR_ORDERS],
+    // Bitmaps of all orders, the one of order k starts at bit
+    // bitmap_offsets[k].
+    bitmap: *mut usize,
+    bitmap_offsets: [usize; NR_ORDERS],
+    page_flags: *mut u8,
+}
+
+// SAFETY: The allocator owns the memory it manages and is protected by
+// the lock of the heap.
+unsafe impl Send for BuddyAllocator {}
+unsafe impl Sync for BuddyAllocator {}
+
+// Smallest order whose blocks can hold `pages` pages.
+#[inline]
+pub const fn order_of_pages(pages: usize) -> usize {
+    if pages <= 1 {
+        return 0;
+    }
+    (usize::BITS - (pages - 1).leading_zeros()) as usize
+}
+
+#[inline]
+pub const fn order_of_size(size: usize) -> usize {
+    order_of_pages(size.div_ceil(PAGE_SIZE))
+}
+
+impl BuddyAllocator {
+    pub const fn new() -> Self {
+        Self {
+            base: 0,
+            nr_pages: 0,
+            nr_free: 0,
+            free_lists: [ptr::null_mut(); NR_ORDERS],
+            free_blocks: [0; NR_ORDERS],
+            bitmap: ptr::null_mut(),
+            bitmap_offsets: [0; NR_ORDERS],
+            page_flags: ptr::null_mut(),
+        }
+    }
+
+    // Manage [start, start + size). The region must not be touched by
+    // anyone else afterwards.
+    pub unsafe fn init(&mut self, start: usize, size: usize) {
+        let end = start + size;
+        // Size metadata for the upper bound of pages.
+        let max_pages = size / PAGE_SIZE;
+        let mut bits = 0;
+        for (k, offset) in self.bitmap_offsets.iter_mut().enumerate() {
+            *offset = bits;
+            bits += (max_pages >> k) + 1;
+        }
+        let bitmap_words = bits.div_ceil(BITS);
+        let meta_size = bitmap_words * core::mem::size_of::<usize>() + max_pages;
+        let start_aligned = start.next_multiple_of(core::mem::align_of::<usize>());
+        self.bitmap = start_aligned as *mut usize;
+        self.page_flags = self.bitmap.add(bitmap_words) as *mut u8;
+        ptr::write_bytes(self.bitmap as *mut u8, 0, meta_size);
+        self.base = (start_aligned + meta_size).next_multiple_of(PAGE_SIZE);
+        self.nr_pages = end.saturating_sub(self.base) / PAGE_SIZE;
+        // Release pages as the largest blocks they can form.
+        let mut idx = 0;
+        while idx < self.nr_pages {
+            let mut order = NR_ORDERS - 1;
+            while idx & ((1 << order) - 1) != 0 || idx + (1 << order) > self.nr_pages {
+                order -= 1;
+            }
+            self.push(idx, order);
+            idx += 1 << order;
+        }
+        self.nr_free = self.nr_pages;
+    }
+
+    #[inline]
+    pub fn total_pages(&self) -> usize {
+        self.nr_pages
+    }
+
+    #[inline]
+    pub fn free_pages(&self) -> usize {
+        self.nr_free
+    }
+
+    pub fn info(&self) -> BuddyInfo {
+        BuddyInfo {
+            total_pages: self.nr_pages,
+            free_pages: self.nr_free,
+            free_blocks: self.free_blocks,
+        }
+    }
+
+    #[inline]
+    fn page_addr(&self, idx: usize) -> usize {
+        self.base + (idx << PAGE_SHIFT)
+    }
+
+    #[inline]
+    fn page_index(&self, addr: usize) -> usize {
+        (addr - self.base) >> PAGE_SHIFT
+    }
+
+    #[inline]
+    pub fn contains(&self, addr: usize) -> bool {
+        addr >= self.base && addr < self.page_addr(self.nr_pages)
+    }
+
+    #[inline]
+    fn bit(&self, idx: usize, order: usize) -> (usize, usize) {
+        let bit = self.bitmap_offsets[order] + (idx >> order);
+        (bit / BITS, 1 << (bit % BITS))
+    }
+
+    #[inline]
+    fn is_free(&self, idx: usize, order: usize) -> bool {
+        let (word, mask) = self.bit(idx, order);
+        unsafe { *self.bitmap.add(word) & mask != 0 }
+    }
+
+    #[inline]
+    fn set_free(&mut self, idx: usize, order: usize, free: bool) {
+        let (word, mask) = self.bit(idx, order);
+        unsafe {
+            let w = self.bitmap.add(word);
+            if free {
+                *w |= mask;
+            } else {
+                *w &= !mask;
+            }
+        }
+    }
+
+    #[inline]
+    fn flags(&self, idx: usize) -> *mut u8 {
+        unsafe { self.page_flags.add(idx) }
+    }
+
+    fn push(&mut self, idx: usize, order: usize) {
+        let block = self.page_addr(idx) as *mut FreeBlock;
+        let head = self.free_lists[order];
+        unsafe {
+            (*block).next = head;
+            (*block).prev = ptr::null_mut();
+            if !head.is_null() {
+                (*head).prev = block;
+            }
+        }
+        self.free_lists[order] = block;
+        self.free_blocks[order] += 1;
+        self.set_free(idx, order, true);
+    }
+
+    fn unlink(&mut self, idx: usize, order: usize) {
+        let block = self.page_addr(idx) as *mut FreeBlock;
+        unsafe {
+            let (next, prev) = ((*block).next, (*block).prev);
+            if prev.is_null() {
+                self.free_lists[order] = next;
+            } else {
+                (*prev).next = next;
+            }
+            if !next.is_null() {
+                (*next).prev = prev;
+            }
+        }
+        self.free_blocks[order] -= 1;
+        self.set_free(idx, order, false);
+    }
+
+    // Allocate a block of 2^order pages.
+    pub fn alloc(&mut self, order: usize) -> Option<NonNull<u8>> {
+        if order >= NR_ORDERS {
+            return None;
+        }
+        let mut k = (order..NR_ORDERS).find(|&k| !self.free_lists[k].is_null())?;
+        let idx = self.page_index(self.free_lists[k] as usize);
+        self.unlink(idx, k);
+        // Split and release upper halves.
+        while k > order {
+            k -= 1;
+            self.push(idx + (1 << k), k);
+        }
+        unsafe { *self.flags(idx) = ALLOCATED | order as u8 };
+        self.nr_free -= 1 << order;
+        NonNull::new(self.page_addr(idx) as *mut u8)
+    }
+
+    // Allocate a block of 2^order pages aligned to `align`. Blocks are
+    // only aligned to their size relative to the first page, so unless
+    // that is enough, a block larger by the alignment is allocated and
+    // the pages around the aligned run are released.
+    pub fn alloc_aligned(&mut self, order: usize, align: usize) -> Option<NonNull<u8>> {
+        if self.base & (align - 1) == 0 && align <= PAGE_SIZE << order {
+            return self.alloc(order);
+        }
+        let pages = 1 << order;
+        let outer = order_of_pages(pages + align / PAGE_SIZE - 1);
+        let ptr = self.alloc(outer)?;
+        let idx = self.page_index(ptr.as_ptr() as usize);
+        let start = self.page_index((ptr.as_ptr() as usize).next_multiple_of(align));
+        unsafe { *self.flags(idx) = 0 };
+        self.release_range(idx, start);
+        self.release_range(start + pages, idx + (1 << outer));
+        unsafe { *self.flags(start) = ALLOCATED | UNALIGNED | order as u8 };
+        NonNull::new(self.page_addr(start) as *mut u8)
+    }
+
+    // Order of the allocated block starting at `ptr`.
+    pub fn order_of(&self, ptr: NonNull<u8>) -> Option<usize> {
+        let addr = ptr.as_ptr() as usize;
+        if !self.contains(addr) || addr & (PAGE_SIZE - 1) != 0 {
+            return None;
+        }
+        let flags = unsafe { *self.flags(self.page_index(addr)) };
+        if flags & ALLOCATED == 0 {
+            return None;
+        }
+        Some((flags & ORDER_MASK) as usize)
+    }
+
+    // Mark the allocated block at `ptr` as lent to another heap.
+    pub fn lend(&mut self, ptr: NonNull<u8>) {
+        let order = self.order_of(ptr).unwrap();
+        let idx = self.page_index(ptr.as_ptr() as usize);
+        for i in idx..idx + (1 << order) {
+            unsafe { *self.flags(i) |= LENT };
+        }
+    }
+
+    // If `ptr` points into a block lent to another heap.
+    #[inline]
+    pub fn is_lent(&self, ptr: NonNull<u8>) -> bool {
+        let addr = ptr.as_ptr() as usize;
+        self.contains(addr) && unsafe { *self.flags(self.page_index(addr)) & LENT != 0 }
+    }
+
+    // Free the block allocated at `ptr` and coalesce it with its free
+    // buddies. Return the order of the block.
+    pub unsafe fn free(&mut self, ptr: NonNull<u8>) -> usize {
+        let order = self.order_of(ptr).expect("not an allocated block");
+        let idx = self.page_index(ptr.as_ptr() as usize);
+        let unaligned = *self.flags(idx) & UNALIGNED != 0;
+        for i in idx..idx + (1 << order) {
+            *self.flags(i) = 0;
+        }
+        if unaligned {
+            self.release_range(idx, idx + (1 << order));
+        } else {
+            self.release(idx, order);
+        }
+        order
+    }
+
+    // Release pages [from, to) as the largest blocks they can form.
+    fn release_range(&mut self, from: usize, to: usize) {
+        let mut idx = from;
+        while idx < to {
+            let mut order = 0;
+            while order < NR_ORDERS - 1 && idx & ((2 << order) - 1) == 0 && idx + (2 << order) <= to
+            {
+                order += 1;
+            }
+            self.release(idx, order);
+            idx += 1 << order;
+        }
+    }
+
+    // Put the block of 2^order pages at `idx` back and coalesce it with
+    // its free buddies.
+    fn release(&mut self, mut idx: usize, order: usize) {
+        self.nr_free += 1 << order;
+        let mut k = order;
+        while k < NR_ORDERS - 1 {
+            let buddy = idx ^ (1 << k);
+            if buddy + (1 << k) > self.nr_pages || !self.is_free(buddy, k) {
+                break;
+            }
+            self.unlink(buddy, k);
+            idx &= buddy;
+            k += 1;
+        }
+        self.push(idx, k);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use alloc::vec::Vec;
+    use blueos_test_macro::test;
+
+    #[repr(C, align(4096))]
+    struct Pool([u8; 32 * PAGE_SIZE]);
+
+    fn with_pool(f: impl FnOnce(&mut BuddyAllocator)) {
+        let mut pool = alloc::boxed::Box::<Pool>::new_uninit();
+        let mut b = BuddyAllocator::new();
+        unsafe { b.init(pool.as_mut_ptr() as usize, core::mem::size_of::<Pool>()) };
+        f(&mut b);
+    }
+
+    #[test]
+    fn test_order_of_pages() {
+        assert_eq!(order_of_pages(0), 0);
+        assert_eq!(order_of_pages(1), 0);
+        assert_eq!(order_of_pages(2), 1);
+        assert_eq!(order_of_pages(3), 2);
+        assert_eq!(order_of_size(PAGE_SIZE + 1), 1);
+    }
+
+    #[test]
+    fn test_buddy_split_and_coalesce() {
+        with_pool(|b| {
+            // One page is taken by metadata.
+            assert_eq!(b.total_pages(), 31);
+            let before = b.info();
+            let p0 = b.alloc(0).unwrap();
+            let p1 = b.alloc(0).unwrap();
+            let p3 = b.alloc(3).unwrap();
+            assert_eq!(
+                p3.as_ptr() as usize % (8 * PAGE_SIZE),
+                b.base % (8 * PAGE_SIZE)
+            );
+            assert_eq!(b.order_of(p3), Some(3));
+            assert_eq!(b.free_pages(), 31 - 10);
+            unsafe {
+                assert_eq!(b.free(p1), 0);
+                assert_eq!(b.free(p3), 3);
+                assert_eq!(b.free(p0), 0);
+            }
+            let after = b.info();
+            assert_eq!(after.free_pages, 31);
+            assert_eq!(after.free_blocks, before.free_blocks);
+            assert_eq!(after.fragmentation(), before.fragmentation());
+        });
+    }
+
+    #[test]
+    fn test_buddy_exhaust() {
+        with_pool(|b| {
+            let mut pages = Vec::new();
+            while let Some(p) = b.alloc(0) {
+                pages.push(p);
+            }
+            assert_eq!(pages.len(), 31);
+            assert_eq!(b.info().largest_free_order(), None);
+            assert!(b.alloc(0).is_none());
+            for p in pages.iter().step_by(2) {
+                unsafe { b.free(*p) };
+            }
+            // Every other page is free, nothing can be coalesced.
+            assert_eq!(b.info().largest_free_order(), Some(0));
+            assert!(b.alloc(1).is_none());
+            for p in pages.iter().skip(1).step_by(2) {
+                unsafe { b.free(*p) };
+            }
+            assert_eq!(b.free_pages(), 31);
+            assert_eq!(b.info().largest_free_order(), Some(4));
+        });
+    }
+
+    #[test]
+    fn test_buddy_alloc_aligned() {
+        with_pool(|b| {
+            let before = b.info();
+            // The first page follows the metadata page, so blocks are
+            // only aligned to one page.
+            for (order, align) in [(0, 4 * PAGE_SIZE), (1, 8 * PAGE_SIZE), (2, 2 * PAGE_SIZE)] {
+                let p = b.alloc_aligned(order, align).unwrap();
+                assert_eq!(p.as_ptr() as usize % align, 0);
+                assert_eq!(b.order_of(p), Some(order));
+                assert_eq!(b.free_pages(), 31 - (1 << order));
+                unsafe { assert_eq!(b.free(p), order) };
+                assert_eq!(b.info().free_blocks, before.free_blocks);
+            }
+            assert!(b.alloc_aligned(0, 64 * PAGE_SIZE).is_none());
+        });
+    }
+
+    #[test]
+    fn test_buddy_lend() {
+        with_pool(|b| {
+            let p = b.alloc(2).unwrap();
+            assert!(!b.is_lent(p));
+            b.lend(p);
+            let inner = unsafe { NonNull::new_unchecked(p.as_ptr().add(3 * PAGE_SIZE + 8)) };
+            assert!(b.is_lent(inner));
+            unsafe { b.free(p) };
+            assert!(!b.is_lent(inner));
+        });
+    }
+}
@@ -0,0 +1,375 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Object caches for hot kernel objects, in the spirit of kmem_cache.
+// A cache hands out objects of one layout from slabs taken from the
+// heap. A slab is aligned to its size, so the slab an object belongs to
+// is found by masking the object address. Objects are raw memory, no
+// constructor or destructor runs on reuse.
+//
+// Caches of typed kernel objects are looked up by the exact layout of
+// an allocation, so those objects are cached however they are
+// allocated, e.g., by Arc::new, and a deallocation always reaches the
+// cache the object is allocated from. Caches of plain buffers, whose
+// layout any allocation may share, are allocated from explicitly.
+//
+// Slabs are colored, i.e., the first object of consecutive slabs is
+// shifted by a cache line, so that objects of the same index in
+// different slabs don't compete for the same cache sets. One empty
+// slab is kept for reuse, further ones are returned to the heap.
+
+use super::HEAP;
+use crate::{sync::SpinLock, thread::Thread, time::timer::Timer, types::ArcInner};
+use alloc::vec::Vec;
+use core::{
+    alloc::Layout,
+    mem,
+    ptr::{self, NonNull},
+};
+
+const COLOR_ALIGN: usize = 32;
+// A slab holds at least this many objects.
+const MIN_OBJECTS: usize = 4;
+const MIN_SLAB_SIZE: usize = 1024;
+const KEEP_EMPTY: usize = 1;
+
+pub static KMEM_CACHES: [KmemCache; 2] = [
+    KmemCache::new("thread", Layout::new::<ArcInner<Thread>>()),
+    KmemCache::new("timer", Layout::new::<ArcInner<Timer>>()),
+];
+
+pub const SOCKET_BUFFER_SIZE: usize = 1024;
+
+// Buffers of TCP sockets.
+pub static SOCKET_BUFFER_CACHE: KmemCache = KmemCache::new("socket_buffer", unsafe {
+    Layout::from_size_align_unchecked(SOCKET_BUFFER_SIZE, 1)
+});
+
+#[derive(Default, Debug, Clone)]
+pub struct KmemCacheInfo {
+    pub name: &'static str,
+    pub object_size: usize,
+    pub slab_size: usize,
+    pub objects_per_slab: usize,
+    pub slabs: usize,
+    pub active_objects: usize,
+}
+
+struct FreeObject {
+    next: *mut FreeObject,
+}
+
+#[repr(C)]
+struct SlabHdr {
+    next: *mut SlabHdr,
+    prev: *mut SlabHdr,
+    free: *mut FreeObject,
+    inuse: usize,
+}
+
+const HDR_SIZE: usize = mem::size_of::<SlabHdr>().next_multiple_of(COLOR_ALIGN);
+
+// A doubly linked list of slabs.
+struct SlabList {
+    head: *mut SlabHdr,
+    len: usize,
+}
+
+impl SlabList {
+    const fn new() -> Self {
+        Self {
+            head: ptr::null_mut(),
+            len: 0,
+        }
+    }
+
+    unsafe fn push(&mut self, slab: *mut SlabHdr) {
+        (*slab).prev = ptr::null_mut();
+        (*slab).next = self.head;
+        if !self.head.is_null() {
+            (*self.head).prev = slab;
+        }
+        self.head = slab;
+        self.len += 1;
+    }
+
+    unsafe fn unlink(&mut self, slab: *mut SlabHdr) {
+        let (next, prev) = ((*slab).next, (*slab).prev);
+        if prev.is_null() {
+            self.head = next;
+        } else {
+            (*prev).next = next;
+        }
+        if !next.is_null() {
+            (*next).prev = prev;
+        }
+        self.len -= 1;
+    }
+}
+
+struct Slabs {
+    // Slabs with both free and used objects.
+    partial: SlabList,
+    empty: SlabList,
+    // Full slabs are on no list.
+    nr_slabs: usize,
+    nr_active: usize,
+    next_color: usize,
+}
+
+// SAFETY: Slabs are only accessed with the cache locked.
+unsafe impl Send for Slabs {}
+
+pub struct KmemCache {
+    name: &'static str,
+    layout: Layout,
+    object_size: usize,
+    // Offset of the first object in a slab of color 0.
+    first_offset: usize,
+    color_align: usize,
+    nr_colors: usize,
+    slab_size: usize,
+    objects_per_slab: usize,
+    slabs: SpinLock<Slabs>,
+}
+
+impl KmemCache {
+    pub const fn new(name: &'static str, layout: Layout) -> Self {
+        let align = if layout.align() > mem::align_of::<FreeObject>() {
+            layout.align()
+        } else {
+            mem::align_of::<FreeObject>()
+        };
+        let size = if layout.size() > mem::size_of::<FreeObject>() {
+            layout.size()
+        } else {
+            mem::size_of::<FreeObject>()
+        };
+        let object_size = size.next_multiple_of(align);
+        let first_offset = HDR_SIZE.next_multiple_of(align);
+        let mut slab_size = (first_offset + MIN_OBJECTS * object_size).next_power_of_two();
+        if slab_size < MIN_SLAB_SIZE {
+            slab_size = MIN_SLAB_SIZE;
+        }
+        let objects_per_slab = (slab_size - first_offset) / object_size;
+        let left = slab_size - first_offset - objects_per_slab * object_size;
+        let color_align = if align > COLOR_ALIGN {
+            align
+        } else {
+            COLOR_ALIGN
+        };
+        Self {
+            name,
+            layout,
+            object_size,
+            first_offset,
+            color_align,
+            nr_colors: left / color_align + 1,
+            slab_size,
+            objects_per_slab,
+            slabs: SpinLock::new(Slabs {
+                partial: SlabList::new(),
+                empty: SlabList::new(),
+                nr_slabs: 0,
+                nr_active: 0,
+                next_color: 0,
+            }),
+        }
+    }
+
+    #[inline]
+    fn slab_layout(&self) -> Layout {
+        // SAFETY: slab_size is a power of two.
+        unsafe { Layout::from_size_align_unchecked(self.slab_size, self.slab_size) }
+    }
+
+    // Carve a new slab from the heap.
+    fn grow(&self, s: &mut Slabs) -> Option<*mut SlabHdr> {
+        let base = HEAP.alloc(self.slab_layout())?.as_ptr();
+        let color = s.next_color;
+        s.next_color = (color + 1) % self.nr_colors;
+        let slab = base as *mut SlabHdr;
+        let mut free = ptr::null_mut();
+        let first = self.first_offset + color * self.color_align;
+        // Link objects in address order.
+        for i in (0..self.objects_per_slab).rev() {
+            let obj = unsafe { base.add(first + i * self.object_size) } as *mut FreeObject;
+            unsafe { (*obj).next = free };
+            free = obj;
+        }
+        unsafe {
+            slab.write(SlabHdr {
+                next: ptr::null_mut(),
+                prev: ptr::null_mut(),
+                free,
+                inuse: 0,
+            })
+        };
+        s.nr_slabs += 1;
+        Some(slab)
+    }
+
+    pub fn alloc(&self) -> Option<NonNull<u8>> {
+        let mut s = self.slabs.irqsave_lock();
+        let slab = if !s.partial.head.is_null() {
+            s.partial.head
+        } else {
+            let slab = if !s.empty.head.is_null() {
+                let slab = s.empty.head;
+                unsafe { s.empty.unlink(slab) };
+                slab
+            } else {
+                self.grow(&mut s)?
+            };
+            unsafe { s.partial.push(slab) };
+            slab
+        };
+        unsafe {
+            let obj = (*slab).free;
+            (*slab).free = (*obj).next;
+            (*slab).inuse += 1;
+            if (*slab).free.is_null() {
+                s.partial.unlink(slab);
+            }
+            s.nr_active += 1;
+            NonNull::new(obj as *mut u8)
+        }
+    }
+
+    // SAFETY: `ptr` must be allocated from this cache.
+    pub unsafe fn free(&self, ptr: *mut u8) {
+        let slab = (ptr as usize & !(self.slab_size - 1)) as *mut SlabHdr;
+        let obj = ptr as *mut FreeObject;
+        let mut s = self.slabs.irqsave_lock();
+        let was_full = (*slab).free.is_null();
+        (*obj).next = (*slab).free;
+        (*slab).free = obj;
+        (*slab).inuse -= 1;
+        s.nr_active -= 1;
+        if was_full {
+            s.partial.push(slab);
+        }
+        if (*slab).inuse != 0 {
+            return;
+        }
+        s.partial.unlink(slab);
+        if s.empty.len < KEEP_EMPTY {
+            s.empty.push(slab);
+            return;
+        }
+        s.nr_slabs -= 1;
+        HEAP.dealloc(slab as *mut u8, self.slab_layout());
+    }
+
+    // Return all empty slabs to the heap.
+    pub fn shrink(&self) -> usize {
+        let mut s = self.slabs.irqsave_lock();
+        let mut n = 0;
+        while !s.empty.head.is_null() {
+            let slab = s.empty.head;
+            unsafe {
+                s.empty.unlink(slab);
+                HEAP.dealloc(slab as *mut u8, self.slab_layout());
+            }
+            s.nr_slabs -= 1;
+            n += 1;
+        }
+        n
+    }
+
+    pub fn info(&self) -> KmemCacheInfo {
+        let s = self.slabs.irqsave_lock();
+        KmemCacheInfo {
+            name: self.name,
+            object_size: self.object_size,
+            slab_size: self.slab_size,
+            objects_per_slab: self.objects_per_slab,
+            slabs: s.nr_slabs,
+            active_objects: s.nr_active,
+        }
+    }
+}
+
+#[inline]
+pub(super) fn find(layout: &Layout) -> Option<&'static KmemCache> {
+    KMEM_CACHES.iter().find(|c| c.layout == *layout)
+}
+
+pub fn kmem_cache_info() -> Vec<KmemCacheInfo> {
+    KMEM_CACHES
+        .iter()
+        .chain([&SOCKET_BUFFER_CACHE])
+        .map(KmemCache::info)
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use blueos_test_macro::test;
+
+    #[repr(align(64))]
+    struct Object([u8; 200]);
+
+    #[test]
+    fn test_kmem_cache_alloc_free() {
+        static CACHE: KmemCache = KmemCache::new("test", Layout::new::<Object>());
+        assert!(CACHE.objects_per_slab >= MIN_OBJECTS);
+        let n = CACHE.objects_per_slab * 2 + 1;
+        let mut objs = Vec::new();
+        for i in 0..n {
+            let obj = CACHE.alloc().unwrap();
+            assert_eq!(obj.as_ptr() as usize % 64, 0);
+            unsafe { obj.as_ptr().write_bytes(i as u8, mem::size_of::<Object>()) };
+            objs.push(obj);
+        }
+        let info = CACHE.info();
+        assert_eq!(info.slabs, 3);
+        assert_eq!(info.active_objects, n);
+        for obj in objs.iter() {
+            unsafe { CACHE.free(obj.as_ptr()) };
+        }
+        let info = CACHE.info();
+        assert_eq!(info.active_objects, 0);
+        assert_eq!(info.slabs, KEEP_EMPTY);
+        assert_eq!(CACHE.shrink(), KEEP_EMPTY);
+        assert_eq!(CACHE.info().slabs, 0);
+    }
+
+    #[test]
+    fn test_kmem_cache_coloring() {
+        static CACHE: KmemCache = KmemCache::new("test", Layout::new::<[usize; 20]>());
+        if CACHE.nr_colors < 2 {
+            return;
+        }
+        let a = CACHE.alloc().unwrap().as_ptr() as usize;
+        // Fill the first slab up so that the next object comes from a
+        // new slab.
+        let mut objs = Vec::new();
+        for _ in 1..CACHE.objects_per_slab {
+            objs.push(CACHE.alloc().unwrap());
+        }
+        let b = CACHE.alloc().unwrap().as_ptr() as usize;
+        let mask = CACHE.slab_size - 1;
+        assert_ne!(a & mask, b & mask);
+        unsafe {
+            CACHE.free(a as *mut u8);
+            CACHE.free(b as *mut u8);
+            for obj in objs {
+                CACHE.free(obj.as_ptr());
+            }
+        }
+        CACHE.shrink();
+    }
+}
@@ -43,6 +43,24 @@ impl LlffHeap {
         (*heap).deallocate(NonNull::new_unchecked(ptr), &layout);
     }
 
+    pub fn alloc_batch(&self, layout: Layout, blocks: &mut [*mut u8]) -> usize {
+        let mut heap = self.heap.irqsave_lock();
+        for (i, block) in blocks.iter_mut().enumerate() {
+            let Some(ptr) = (*heap).allocate_first_fit(&layout) else {
+                return i;
+            };
+            *block = ptr.as_ptr();
+        }
+        blocks.len()
+    }
+
+    pub unsafe fn dealloc_batch(&self, blocks: &[*mut u8], layout: Layout) {
+        let mut heap = self.heap.irqsave_lock();
+        for ptr in blocks {
+            (*heap).deallocate(NonNull::new_unchecked(*ptr), &layout);
+        }
+    }
+
     pub unsafe fn deallocate_unknown_align(&self, ptr: *mut u8) {
         let mut heap = self.heap.irqsave_lock();
         (*heap).deallocate_unknown_align(NonNull::new_unchecked(ptr));
@@ -75,6 +93,7 @@ impl LlffHeap {
             total: (*heap).total(),
             used: (*heap).allocated(),
             max_used: (*heap).maximum(),
+            ..Default::default()
         }
     }
 }
@@ -0,0 +1,247 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Per-core magazines of small blocks in front of the heap. Every core
+// keeps a magazine of free blocks for each size class, so most small
+// allocations and deallocations only touch core-local memory with
+// interrupts disabled, without taking the heap lock. An empty magazine
+// is refilled and a full one is flushed by half a magazine of blocks
+// with the heap locked once.
+//
+// Cached blocks are ordinary heap blocks of the class size, so a block
+// can be freed on any core, or returned to the heap directly.
+
+use super::{MemoryInfo, HEAP};
+use crate::{arch, support::DisableInterruptGuard};
+use blueos_kconfig::NUM_CORES;
+use core::{
+    alloc::Layout,
+    cell::UnsafeCell,
+    ptr::NonNull,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+pub const NR_CLASSES: usize = 5;
+// The smallest class holds blocks of 16 bytes.
+const MIN_CLASS_SHIFT: usize = 4;
+const MAX_CLASS_SIZE: usize = class_size(NR_CLASSES - 1);
+// Blocks of all classes are aligned to this, layouts asking for larger
+// alignment bypass the magazines.
+const CLASS_ALIGN: usize = 2 * core::mem::size_of::<usize>();
+const MAGAZINE_SIZE: usize = blueos_kconfig::MAGAZINE_SIZE;
+const BATCH: usize = if MAGAZINE_SIZE > 1 {
+    MAGAZINE_SIZE / 2
+} else {
+    1
+};
+
+#[derive(Default, Debug, Clone, Copy)]
+pub struct MagazineInfo {
+    pub size: usize,
+    // Allocations served by magazines.
+    pub hits: usize,
+    // Allocations that had to refill an empty magazine.
+    pub misses: usize,
+    // Times a full magazine is flushed to the heap.
+    pub flushes: usize,
+    // Blocks sitting in magazines.
+    pub cached: usize,
+}
+
+const fn class_size(class: usize) -> usize {
+    1 << (class + MIN_CLASS_SHIFT)
+}
+
+#[inline]
+fn class_of(layout: &Layout) -> Option<usize> {
+    let size = layout.size();
+    if size == 0 || size > MAX_CLASS_SIZE || layout.align() > CLASS_ALIGN {
+        return None;
+    }
+    let shift = (usize::BITS - (size - 1).leading_zeros()) as usize;
+    Some(shift.saturating_sub(MIN_CLASS_SHIFT))
+}
+
+#[inline]
+fn class_layout(class: usize) -> Layout {
+    // SAFETY: Class sizes and CLASS_ALIGN are powers of two.
+    unsafe { Layout::from_size_align_unchecked(class_size(class), CLASS_ALIGN) }
+}
+
+struct Magazine {
+    len: usize,
+    blocks: [*mut u8; MAGAZINE_SIZE],
+}
+
+impl Magazine {
+    const fn new() -> Self {
+        Self {
+            len: 0,
+            blocks: [core::ptr::null_mut(); MAGAZINE_SIZE],
+        }
+    }
+}
+
+// Only written by the owner core, but read by anyone reporting memory
+// info, so plain loads and stores suffice.
+struct ClassStats {
+    hits: AtomicUsize,
+    misses: AtomicUsize,
+    flushes: AtomicUsize,
+    cached: AtomicUsize,
+}
+
+impl ClassStats {
+    const fn new() -> Self {
+        Self {
+            hits: AtomicUsize::new(0),
+            misses: AtomicUsize::new(0),
+            flushes: AtomicUsize::new(0),
+            cached: AtomicUsize::new(0),
+        }
+    }
+}
+
+#[inline]
+fn bump(counter: &AtomicUsize) {
+    counter.store(counter.load(Ordering::Relaxed) + 1, Ordering::Relaxed);
+}
+
+// Padded to avoid false sharing between cores.
+#[cfg_attr(target_pointer_width = "32", repr(align(32)))]
+#[cfg_attr(target_pointer_width = "64", repr(align(64)))]
+struct CoreCache {
+    magazines: UnsafeCell<[Magazine; NR_CLASSES]>,
+    stats: [ClassStats; NR_CLASSES],
+}
+
+// SAFETY: Magazines are only accessed by the owner core with interrupts
+// disabled.
+unsafe impl Sync for CoreCache {}
+
+impl CoreCache {
+    const fn new() -> Self {
+        Self {
+            magazines: UnsafeCell::new([const { Magazine::new() }; NR_CLASSES]),
+            stats: [const { ClassStats::new() }; NR_CLASSES],
+        }
+    }
+}
+
+static CACHES: [CoreCache; NUM_CORES] = [const { CoreCache::new() }; NUM_CORES];
+
+pub(super) fn alloc(layout: Layout) -> Option<NonNull<u8>> {
+    let Some(class) = class_of(&layout) else {
+        return HEAP.alloc(layout);
+    };
+    let _dig = DisableInterruptGuard::new();
+    let cache = &CACHES[arch::current_cpu_id()];
+    // SAFETY: Interrupts are disabled, no one else is touching
+    // magazines of current core.
+    let mag = unsafe { &mut (*cache.magazines.get())[class] };
+    let stats = &cache.stats[class];
+    if mag.len == 0 {
+        bump(&stats.misses);
+        mag.len = HEAP.alloc_batch(class_layout(class), &mut mag.blocks[..BATCH]);
+        if mag.len == 0 {
+            return None;
+        }
+    } else {
+        bump(&stats.hits);
+    }
+    mag.len -= 1;
+    stats.cached.store(mag.len, Ordering::Relaxed);
+    NonNull::new(mag.blocks[mag.len])
+}
+
+pub(super) unsafe fn dealloc(ptr: *mut u8, layout: Layout) {
+    let Some(class) = class_of(&layout) else {
+        return HEAP.dealloc(ptr, layout);
+    };
+    let _dig = DisableInterruptGuard::new();
+    let cache = &CACHES[arch::current_cpu_id()];
+    let mag = &mut (*cache.magazines.get())[class];
+    let stats = &cache.stats[class];
+    if mag.len == MAGAZINE_SIZE {
+        // Return the coldest blocks and keep the recently freed ones.
+        HEAP.dealloc_batch(&mag.blocks[..BATCH], class_layout(class));
+        mag.blocks.copy_within(BATCH.., 0);
+        mag.len -= BATCH;
+        bump(&stats.flushes);
+    }
+    mag.blocks[mag.len] = ptr;
+    mag.len += 1;
+    stats.cached.store(mag.len, Ordering::Relaxed);
+}
+
+// Sum up statistics of all cores. Cached blocks are counted as used
+// by the heap.
+pub(super) fn fill_memory_info(info: &mut MemoryInfo) {
+    info.cached = 0;
+    for (class, m) in info.magazines.iter_mut().enumerate() {
+        *m = MagazineInfo {
+            size: class_size(class),
+            ..Default::default()
+        };
+        for cache in CACHES.iter() {
+            let s = &cache.stats[class];
+            m.hits += s.hits.load(Ordering::Relaxed);
+            m.misses += s.misses.load(Ordering::Relaxed);
+            m.flushes += s.flushes.load(Ordering::Relaxed);
+            m.cached += s.cached.load(Ordering::Relaxed);
+        }
+        info.cached += m.cached * m.size;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use alloc::vec::Vec;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_class_of() {
+        let layout = |size, align| Layout::from_size_align(size, align).unwrap();
+        assert_eq!(class_of(&layout(0, 1)), None);
+        assert_eq!(class_of(&layout(1, 1)), Some(0));
+        assert_eq!(class_of(&layout(16, 8)), Some(0));
+        assert_eq!(class_of(&layout(17, 8)), Some(1));
+        assert_eq!(class_of(&layout(MAX_CLASS_SIZE, 4)), Some(NR_CLASSES - 1));
+        assert_eq!(class_of(&layout(MAX_CLASS_SIZE + 1, 4)), None);
+        assert_eq!(class_of(&layout(8, CLASS_ALIGN * 2)), None);
+    }
+
+    #[test]
+    fn test_magazine_alloc_dealloc() {
+        let layout = Layout::from_size_align(24, 8).unwrap();
+        let mut blocks = Vec::new();
+        for _ in 0..MAGAZINE_SIZE * 2 {
+            let ptr = alloc(layout).unwrap();
+            assert_eq!(ptr.as_ptr() as usize % CLASS_ALIGN, 0);
+            unsafe { ptr.as_ptr().write_bytes(0xa5, layout.size()) };
+            blocks.push(ptr);
+        }
+        for ptr in blocks.iter() {
+            unsafe { dealloc(ptr.as_ptr(), layout) };
+        }
+        let mut info = MemoryInfo::default();
+        fill_memory_info(&mut info);
+        let m = &info.magazines[class_of(&layout).unwrap()];
+        assert_eq!(m.size, 32);
+        assert!(m.cached > 0 && m.cached <= MAGAZINE_SIZE * NUM_CORES);
+        assert!(m.hits + m.misses >= MAGAZINE_SIZE * 2);
+        assert!(m.misses > 0);
+    }
+}
@@ -19,7 +19,7 @@ use alloc::alloc::Layout;
 use core::{alloc::GlobalAlloc, ptr};
 
 pub mod block;
-#[cfg(any(allocator = "tlsf", allocator = "slab"))]
+#[cfg(any(allocator = "tlsf", allocator = "slab", allocator = "buddy"))]
 pub(crate) mod tlsf;
 #[cfg(allocator = "tlsf")]
 pub(crate) use tlsf::heap::Heap;
@@ -34,25 +34,92 @@ pub(crate) mod slab;
 #[cfg(allocator = "slab")]
 pub(crate) use slab::heap::Heap;
 
+#[cfg(allocator = "buddy")]
+pub(crate) mod buddy;
+#[cfg(allocator = "buddy")]
+pub(crate) use buddy::heap::Heap;
+#[cfg(allocator = "buddy")]
+pub use buddy::BuddyInfo;
+
+#[cfg(kmem_cache)]
+pub mod kmem_cache;
+#[cfg(kmem_cache)]
+pub use kmem_cache::{
+    kmem_cache_info, KmemCache, KmemCacheInfo, SOCKET_BUFFER_CACHE, SOCKET_BUFFER_SIZE,
+};
+
+#[cfg(allocator_magazine)]
+mod magazine;
+#[cfg(allocator_magazine)]
+pub use magazine::{MagazineInfo, NR_CLASSES as NR_MAGAZINE_CLASSES};
+
+#[cfg(alloc_stats)]
+mod stats;
+#[cfg(alloc_stats)]
+pub use stats::{alloc_stats, AllocClassInfo, AllocStats, NR_ALLOC_CLASSES};
+
 pub struct KernelAllocator;
 static_arc! {
    HEAP(Heap, Heap::new()),
 }
 
+// Rust allocations go through object caches and per-core magazines if
+// enabled, and are counted with ALLOC_STATS. C allocations don't carry
+// the layout on free, so they always go to the heap.
+#[inline]
+fn cached_alloc(layout: Layout) -> Option<ptr::NonNull<u8>> {
+    #[cfg(alloc_stats)]
+    let start = crate::time::get_sys_cycles();
+    let ptr = uncounted_alloc(layout);
+    #[cfg(alloc_stats)]
+    stats::record_alloc(&layout, ptr.is_some(), start);
+    ptr
+}
+
+#[inline]
+unsafe fn cached_dealloc(ptr: *mut u8, layout: Layout) {
+    #[cfg(alloc_stats)]
+    stats::record_dealloc(&layout);
+    uncounted_dealloc(ptr, layout);
+}
+
+#[inline]
+fn uncounted_alloc(layout: Layout) -> Option<ptr::NonNull<u8>> {
+    #[cfg(kmem_cache)]
+    if let Some(cache) = kmem_cache::find(&layout) {
+        return cache.alloc();
+    }
+    #[cfg(allocator_magazine)]
+    return magazine::alloc(layout);
+    #[cfg(not(allocator_magazine))]
+    return HEAP.alloc(layout);
+}
+
+#[inline]
+unsafe fn uncounted_dealloc(ptr: *mut u8, layout: Layout) {
+    #[cfg(kmem_cache)]
+    if let Some(cache) = kmem_cache::find(&layout) {
+        return cache.free(ptr);
+    }
+    #[cfg(allocator_magazine)]
+    magazine::dealloc(ptr, layout);
+    #[cfg(not(allocator_magazine))]
+    HEAP.dealloc(ptr, layout);
+}
+
 unsafe impl GlobalAlloc for KernelAllocator {
     unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
-        HEAP.alloc(layout)
-            .map_or(ptr::null_mut(), |ptr| ptr.as_ptr())
+        cached_alloc(layout).map_or(ptr::null_mut(), |ptr| ptr.as_ptr())
     }
 
     unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
-        HEAP.dealloc(ptr, layout);
+        cached_dealloc(ptr, layout);
     }
 }
 
 impl KernelAllocator {
     pub fn memory_info(&self) -> MemoryInfo {
-        HEAP.memory_info()
+        memory_info()
     }
 }
 
@@ -67,14 +134,14 @@ mod allocator_api {
         fn allocate(&self, layout: Layout) -> Result<NonNull<[u8]>, AllocError> {
             match layout.size() {
                 0 => Ok(NonNull::slice_from_raw_parts(layout.dangling(), 0)),
-                size => HEAP.alloc(layout).map_or(Err(AllocError), |allocation| {
+                size => cached_alloc(layout).map_or(Err(AllocError), |allocation| {
                     Ok(NonNull::slice_from_raw_parts(allocation, size))
                 }),
             }
         }
         unsafe fn deallocate(&self, ptr: NonNull<u8>, layout: Layout) {
             if layout.size() != 0 {
-                HEAP.dealloc(ptr.as_ptr(), layout);
+                cached_dealloc(ptr.as_ptr(), layout);
             }
         }
     }
@@ -93,10 +160,22 @@ pub struct MemoryInfo {
     pub total: usize,
     pub used: usize,
     pub max_used: usize,
+    // Bytes sitting in per-core magazines, included in `used`.
+    #[cfg(allocator_magazine)]
+    pub cached: usize,
+    #[cfg(allocator_magazine)]
+    pub magazines: [MagazineInfo; NR_MAGAZINE_CLASSES],
+    // Free blocks of each order, telling how fragmented the pages are.
+    #[cfg(allocator = "buddy")]
+    pub pages: BuddyInfo,
 }
 
 pub fn memory_info() -> MemoryInfo {
-    HEAP.memory_info()
+    #[allow(unused_mut)]
+    let mut info = HEAP.memory_info();
+    #[cfg(allocator_magazine)]
+    magazine::fill_memory_info(&mut info);
+    info
 }
 
 /// Allocate memory on heap and returns a pointer to it.
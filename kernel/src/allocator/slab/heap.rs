@@ -50,6 +50,28 @@ impl Heap {
         heap.deallocate(NonNull::new_unchecked(ptr), &layout);
     }
 
+    // Allocate blocks of the same layout with the heap locked once.
+    // Return the number of blocks allocated.
+    pub fn alloc_batch(&self, layout: Layout, blocks: &mut [*mut u8]) -> usize {
+        let mut heap = self.heap.irqsave_lock();
+        for (i, block) in blocks.iter_mut().enumerate() {
+            let Some(ptr) = heap.allocate(&layout) else {
+                return i;
+            };
+            *block = ptr.as_ptr();
+        }
+        blocks.len()
+    }
+
+    // Deallocate blocks of the same layout with the heap locked once.
+    // Safety: the blocks must be valid pointers.
+    pub unsafe fn dealloc_batch(&self, blocks: &[*mut u8], layout: Layout) {
+        let mut heap = self.heap.irqsave_lock();
+        for ptr in blocks {
+            heap.deallocate(NonNull::new_unchecked(*ptr), &layout);
+        }
+    }
+
     // deallocate the memory pointed by ptr with out align
     // Safety: the ptr must be a valid pointer.
     pub unsafe fn deallocate_unknown_align(&self, ptr: *mut u8) {
@@ -90,6 +112,7 @@ impl Heap {
             total: heap.total(),
             used: heap.allocated(),
             max_used: heap.maximum(),
+            ..Default::default()
         }
     }
 }
@@ -0,0 +1,145 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Counters of Rust heap allocations by power of two size classes, only
+// collected with ALLOC_STATS. Sizes are the requested ones, before
+// rounding by caches or the heap. An allocation failing while the heap
+// has more free bytes than asked for is counted as a fragmentation
+// failure.
+
+use super::HEAP;
+use crate::time;
+use core::{
+    alloc::Layout,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+pub const NR_ALLOC_CLASSES: usize = 16;
+
+struct Class {
+    allocs: AtomicUsize,
+    frees: AtomicUsize,
+    failures: AtomicUsize,
+}
+
+static CLASSES: [Class; NR_ALLOC_CLASSES] = [const {
+    Class {
+        allocs: AtomicUsize::new(0),
+        frees: AtomicUsize::new(0),
+        failures: AtomicUsize::new(0),
+    }
+}; NR_ALLOC_CLASSES];
+static LIVE: AtomicUsize = AtomicUsize::new(0);
+static PEAK: AtomicUsize = AtomicUsize::new(0);
+static FRAG_FAILURES: AtomicUsize = AtomicUsize::new(0);
+static SLOWEST_CYCLES: AtomicUsize = AtomicUsize::new(0);
+static SLOWEST_SIZE: AtomicUsize = AtomicUsize::new(0);
+
+#[derive(Default, Debug, Clone, Copy)]
+pub struct AllocClassInfo {
+    // Sizes up to this, the last class holds all larger ones.
+    pub size: usize,
+    pub allocs: usize,
+    pub frees: usize,
+    pub failures: usize,
+}
+
+#[derive(Default, Debug, Clone, Copy)]
+pub struct AllocStats {
+    pub classes: [AllocClassInfo; NR_ALLOC_CLASSES],
+    // Requested bytes not freed yet, and the most of them ever.
+    pub live: usize,
+    pub peak: usize,
+    pub frag_failures: usize,
+    pub slowest_cycles: usize,
+    pub slowest_size: usize,
+}
+
+#[inline]
+fn class_of(size: usize) -> usize {
+    let bits = (usize::BITS - size.saturating_sub(1).leading_zeros()) as usize;
+    bits.min(NR_ALLOC_CLASSES - 1)
+}
+
+#[inline]
+pub(super) fn record_alloc(layout: &Layout, ok: bool, start: u64) {
+    let class = &CLASSES[class_of(layout.size())];
+    if !ok {
+        class.failures.fetch_add(1, Ordering::Relaxed);
+        let info = HEAP.memory_info();
+        if info.total.saturating_sub(info.used) >= layout.size() {
+            FRAG_FAILURES.fetch_add(1, Ordering::Relaxed);
+        }
+        return;
+    }
+    class.allocs.fetch_add(1, Ordering::Relaxed);
+    let live = LIVE.fetch_add(layout.size(), Ordering::Relaxed) + layout.size();
+    PEAK.fetch_max(live, Ordering::Relaxed);
+    let cycles = time::get_sys_cycles().saturating_sub(start) as usize;
+    if SLOWEST_CYCLES.fetch_max(cycles, Ordering::Relaxed) < cycles {
+        SLOWEST_SIZE.store(layout.size(), Ordering::Relaxed);
+    }
+}
+
+#[inline]
+pub(super) fn record_dealloc(layout: &Layout) {
+    CLASSES[class_of(layout.size())]
+        .frees
+        .fetch_add(1, Ordering::Relaxed);
+    LIVE.fetch_sub(layout.size(), Ordering::Relaxed);
+}
+
+pub fn alloc_stats() -> AllocStats {
+    AllocStats {
+        classes: core::array::from_fn(|i| AllocClassInfo {
+            size: 1 << i,
+            allocs: CLASSES[i].allocs.load(Ordering::Relaxed),
+            frees: CLASSES[i].frees.load(Ordering::Relaxed),
+            failures: CLASSES[i].failures.load(Ordering::Relaxed),
+        }),
+        live: LIVE.load(Ordering::Relaxed),
+        peak: PEAK.load(Ordering::Relaxed),
+        frag_failures: FRAG_FAILURES.load(Ordering::Relaxed),
+        slowest_cycles: SLOWEST_CYCLES.load(Ordering::Relaxed),
+        slowest_size: SLOWEST_SIZE.load(Ordering::Relaxed),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use alloc::boxed::Box;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_class_of() {
+        assert_eq!(class_of(1), 0);
+        assert_eq!(class_of(2), 1);
+        assert_eq!(class_of(3), 2);
+        assert_eq!(class_of(4096), 12);
+        assert_eq!(class_of(usize::MAX), NR_ALLOC_CLASSES - 1);
+    }
+
+    #[test]
+    fn test_alloc_counted() {
+        let class = class_of(100);
+        let before = alloc_stats().classes[class];
+        let b = Box::new([0u8; 100]);
+        drop(b);
+        let after = alloc_stats().classes[class];
+        assert!(after.allocs > before.allocs);
+        assert!(after.frees > before.frees);
+        assert!(alloc_stats().peak >= 100);
+    }
+}
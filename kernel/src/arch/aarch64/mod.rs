@@ -26,7 +26,10 @@ pub(crate) mod psci;
 pub(crate) mod registers;
 pub(crate) mod vector;
 
+extern crate alloc;
 use crate::{arch::registers::mpidr_el1::MPIDR_EL1, scheduler};
+#[cfg(scheduler = "percore")]
+use alloc::boxed::Box;
 use core::{
     fmt,
     mem::offset_of,
@@ -39,6 +42,9 @@ use scheduler::ContextSwitchHookHolder;
 use tock_registers::interfaces::Readable;
 
 pub(crate) const NR_SWITCH: usize = !0;
+// SGI used to ask a remote core to look at its ready queue again.
+#[cfg(scheduler = "percore")]
+pub(crate) const RESCHEDULE_SGI: irq::IrqNumber = irq::IrqNumber::new(0);
 
 pub(crate) static READY_CORES: AtomicU8 = AtomicU8::new(0);
 
@@ -429,6 +435,12 @@ pub(crate) extern "C" fn idle() {
     unsafe { core::arch::asm!("wfi", options(nostack)) };
 }
 
+// wfi is woken up by a pending irq even with local irq disabled.
+#[inline]
+pub(crate) extern "C" fn idle_irq_disabled() {
+    idle();
+}
+
 #[inline]
 pub(crate) extern "C" fn current_sp() -> usize {
     let x: usize;
@@ -436,6 +448,15 @@ pub(crate) extern "C" fn current_sp() -> usize {
     x
 }
 
+// The pc an exception is taken at, only meaningful in exception
+// handlers.
+#[inline]
+pub(crate) extern "C" fn interrupted_pc() -> usize {
+    let x: usize;
+    unsafe { core::arch::asm!("mrs {}, elr_el1", out(reg) x, options(nostack, nomem)) };
+    x
+}
+
 #[inline]
 pub extern "C" fn disable_local_irq_save() -> usize {
     let old: usize;
@@ -473,6 +494,34 @@ pub extern "C" fn local_irq_enabled() -> bool {
 #[inline]
 pub extern "C" fn pend_switch_context() {}
 
+#[cfg(scheduler = "percore")]
+struct RescheduleIrq;
+
+#[cfg(scheduler = "percore")]
+impl irq::IrqHandler for RescheduleIrq {
+    fn handle(&mut self) {
+        // Taking the SGI is enough to bring the core out of `wfi` in
+        // the idle loop, which then picks up the newly queued thread.
+        scheduler::yield_me_now_or_later();
+    }
+}
+
+// Must be invoked on every core after the GIC cpu interface is set up.
+#[cfg(scheduler = "percore")]
+pub(crate) fn init_reschedule_ipi() {
+    let cpu_id = current_cpu_id();
+    if cpu_id == 0 {
+        let _ = irq::register_handler(RESCHEDULE_SGI, Box::new(RescheduleIrq));
+    }
+    irq::enable_irq_with_priority(RESCHEDULE_SGI, cpu_id, irq::Priority::Normal);
+}
+
+#[cfg(scheduler = "percore")]
+#[inline]
+pub(crate) fn send_reschedule_ipi(cpu_id: usize) {
+    irq::send_sgi(RESCHEDULE_SGI, 1 << cpu_id);
+}
+
 pub fn secondary_cpu_setup(psci_base: u32) {
     atomic::fence(Ordering::SeqCst);
     for i in 1..blueos_kconfig::NUM_CORES {
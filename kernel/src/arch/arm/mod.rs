@@ -439,6 +439,29 @@ pub extern "C" fn idle() {
     unsafe { core::arch::asm!("wfi") }
 }
 
+// Wait for an irq while local irq is disabled. BASEPRI masked irqs
+// can't wake wfi up, so mask with PRIMASK instead, which still lets a
+// pending irq wake wfi up. BASEPRI is set back before PRIMASK is
+// cleared, so the irq is taken once local irq is enabled.
+#[inline]
+pub(crate) extern "C" fn idle_irq_disabled() {
+    unsafe {
+        core::arch::asm!(
+            "
+            mrs {old}, basepri
+            cpsid i
+            msr basepri, {zero}
+            wfi
+            msr basepri, {old}
+            cpsie i
+            ",
+            old = out(reg) _,
+            zero = in(reg) 0,
+            options(nostack)
+        )
+    }
+}
+
 #[inline]
 pub extern "C" fn current_sp() -> usize {
     let x: usize;
@@ -460,6 +483,19 @@ pub extern "C" fn current_psp() -> usize {
     x
 }
 
+// The pc of the thread an exception is taken from, read from the frame
+// stacked on psp. Exceptions preempting other handlers stack their frame
+// on msp, the pc of the thread below is returned then.
+#[inline]
+pub extern "C" fn interrupted_pc() -> usize {
+    let psp = current_psp();
+    if psp == 0 {
+        return 0;
+    }
+    // SAFETY: The stacked frame is r0-r3, r12, lr, pc and xpsr.
+    unsafe { ((psp as *const usize).add(6)).read_volatile() }
+}
+
 #[naked]
 pub extern "C" fn switch_context_with_hook(
     saved_sp_mut: *mut u8,
@@ -541,6 +577,11 @@ pub extern "C" fn current_cpu_id() -> usize {
     0
 }
 
+// Cortex-M is single core, there is no remote core to kick.
+#[cfg(scheduler = "percore")]
+#[inline]
+pub(crate) fn send_reschedule_ipi(_cpu_id: usize) {}
+
 #[inline]
 pub extern "C" fn local_irq_enabled() -> bool {
     let x: usize;
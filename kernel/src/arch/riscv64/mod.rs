@@ -63,6 +63,12 @@ fn decrement_isr_level(hart: usize) -> usize {
 #[inline]
 pub(crate) extern "C" fn pend_switch_context() {}
 
+#[cfg(scheduler = "percore")]
+#[inline]
+pub(crate) fn send_reschedule_ipi(hart: usize) {
+    crate::boards::send_ipi(hart);
+}
+
 #[inline]
 pub(crate) extern "C" fn is_in_interrupt() -> bool {
     let n = disable_local_irq_save();
@@ -241,6 +247,12 @@ pub(crate) extern "C" fn idle() {
     unsafe { core::arch::asm!("wfi", options(nostack)) };
 }
 
+// wfi is woken up by a pending irq even with local irq disabled.
+#[inline]
+pub(crate) extern "C" fn idle_irq_disabled() {
+    idle();
+}
+
 #[inline]
 pub(crate) extern "C" fn disable_local_irq_save() -> usize {
     compiler_fence(Ordering::SeqCst);
@@ -271,6 +283,14 @@ pub(crate) extern "C" fn current_sp() -> usize {
     x
 }
 
+// The pc a trap is taken at, only meaningful in trap handlers.
+#[inline]
+pub(crate) extern "C" fn interrupted_pc() -> usize {
+    let x: usize;
+    unsafe { core::arch::asm!("csrr {}, mepc", out(reg) x, options(nostack, nomem)) };
+    x
+}
+
 #[inline(always)]
 pub(crate) extern "C" fn switch_context(saved_sp_mut: *mut u8, to_sp: usize) {
     switch_context_with_hook(saved_sp_mut, to_sp, core::ptr::null_mut());
@@ -16,7 +16,7 @@ use super::{
     disable_local_irq, enable_local_irq, enter_irq, leave_irq, Context, IsrContext, NR_SWITCH,
 };
 use crate::{
-    boards::{handle_plic_irq, set_timeout_after},
+    boards::{clear_ipi, handle_plic_irq, set_timeout_after},
     debug, rv64_restore_context, rv64_restore_context_epilogue, rv64_save_context,
     rv64_save_context_prologue, scheduler,
     scheduler::ContextSwitchHookHolder,
@@ -30,6 +30,7 @@ use core::{
 };
 
 pub(crate) const INTERRUPT_MASK: usize = 1usize << 63;
+pub(crate) const SOFT_INT: usize = INTERRUPT_MASK | 0x3;
 pub(crate) const TIMER_INT: usize = INTERRUPT_MASK | 0x7;
 pub(crate) const ECALL: usize = 0xB;
 pub(crate) const EXTERN_INT: usize = INTERRUPT_MASK | 0xB;
@@ -215,6 +216,12 @@ extern "C" fn handle_trap(ctx: &mut Context, mcause: usize, mtval: usize) -> usi
             handle_plic_irq(ctx, mcause, mtval);
             sp
         }
+        SOFT_INT => {
+            // Reschedule request from another hart, returning from
+            // the trap is enough to leave `wfi` of the idle loop.
+            clear_ipi(super::current_cpu_id());
+            sp
+        }
         TIMER_INT => {
             crate::time::handle_tick_increment();
             sp
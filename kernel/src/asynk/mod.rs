@@ -12,148 +12,337 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-// Asynk contains a simple executor, however runs fast.
+// Asynk is a multi-threaded executor. There is a poller thread per core,
+// each with its own run queue. A tasklet is only polled after its waker
+// is woken. A woken tasklet is pushed to the inbox of the run queue of
+// the current core, which is a lock-free stack, so tasklets can be woken
+// from interrupt handlers. Pollers move their inbox to their local
+// queue, and steal from other run queues when theirs is empty.
+//
+// The state of a tasklet tells whether it is queued or being polled, so
+// a tasklet is never queued twice nor polled by two pollers at a time.
+// A tasklet woken while being polled is polled again.
 
 extern crate alloc;
 use crate::{
+    arch,
     config::MAX_THREAD_PRIORITY,
-    scheduler, static_arc,
-    support::ArcBufferingQueue,
-    sync::{atomic_wait, ISpinLock, SpinLockGuard},
+    scheduler,
+    sync::{atomic_wait, SpinLock},
     thread::{self, Entry, SystemThreadStorage, ThreadKind, ThreadNode},
-    types::{impl_simple_intrusive_adapter, Arc, IlistHead},
 };
-use alloc::boxed::Box;
+use alloc::{boxed::Box, collections::VecDeque, sync::Arc, task::Wake};
+use blueos_kconfig::NUM_CORES;
 use core::{
+    cell::UnsafeCell,
+    ffi::c_void,
     future::Future,
     mem::MaybeUninit,
     pin::Pin,
-    sync::atomic::{AtomicUsize, Ordering},
+    ptr,
+    sync::atomic::{AtomicPtr, AtomicUsize, Ordering},
     task::{Context, Poll, Waker},
 };
 
-impl_simple_intrusive_adapter!(TaskletNode, Tasklet, node);
-impl_simple_intrusive_adapter!(TaskletLock, Tasklet, lock);
+mod reactor;
+pub use reactor::{sleep, Event, Sleep, Wait};
+
+// Not queued, waits for its waker.
+const IDLE: usize = 0;
+// In a run queue.
+const SCHEDULED: usize = 1;
+// Being polled.
+const RUNNING: usize = 2;
+// Woken while being polled.
+const NOTIFIED: usize = 3;
+const DONE: usize = 4;
+
+type BoxedFuture = Pin<Box<dyn Future<Output = ()> + Send>>;
 
 pub struct Tasklet {
-    pub node: IlistHead<Tasklet, TaskletNode>,
-    lock: ISpinLock<Tasklet, TaskletLock>,
-    future: Pin<Box<dyn Future<Output = ()>>>,
-    blocked: Option<ThreadNode>,
+    state: AtomicUsize,
+    // Link of the inbox the tasklet is pushed to.
+    next: AtomicPtr<Tasklet>,
+    // Only accessed by the poller which moves the state to RUNNING.
+    future: UnsafeCell<Option<BoxedFuture>>,
+    blocked: SpinLock<Option<ThreadNode>>,
 }
 
+// SAFETY: The future is only accessed by one poller at a time.
+unsafe impl Sync for Tasklet {}
+
 impl Tasklet {
-    pub fn new(future: Pin<Box<dyn Future<Output = ()>>>) -> Self {
+    fn new(future: BoxedFuture) -> Self {
         Self {
-            node: IlistHead::new(),
-            future,
-            lock: ISpinLock::new(),
-            blocked: None,
+            state: AtomicUsize::new(SCHEDULED),
+            next: AtomicPtr::new(ptr::null_mut()),
+            future: UnsafeCell::new(Some(future)),
+            blocked: SpinLock::new(None),
         }
     }
 
-    pub fn lock(&self) -> SpinLockGuard<'_, Tasklet> {
-        self.lock.irqsave_lock()
+    pub fn is_done(&self) -> bool {
+        self.state.load(Ordering::Acquire) == DONE
     }
 }
 
-type AsyncWorkQueue = ArcBufferingQueue<Tasklet, TaskletNode, 2>;
-static POLLER_STORAGE: SystemThreadStorage = SystemThreadStorage::new(ThreadKind::AsyncPoller);
-static mut POLLER: MaybeUninit<ThreadNode> = MaybeUninit::zeroed();
-static POLLER_WAKER: AtomicUsize = AtomicUsize::new(0);
-static_arc! {
-    ASYNC_WORK_QUEUE(AsyncWorkQueue, AsyncWorkQueue::new()),
+impl Wake for Tasklet {
+    fn wake(self: Arc<Self>) {
+        schedule(self);
+    }
+
+    fn wake_by_ref(self: &Arc<Self>) {
+        schedule(self.clone());
+    }
+}
+
+struct RunQueue {
+    // Stack of woken tasklets, pushed to without locks.
+    inbox: AtomicPtr<Tasklet>,
+    // Taken from by the poller of the core, and stolen from by others.
+    local: SpinLock<VecDeque<Arc<Tasklet>>>,
+}
+
+impl RunQueue {
+    const fn new() -> Self {
+        Self {
+            inbox: AtomicPtr::new(ptr::null_mut()),
+            local: SpinLock::new(VecDeque::new()),
+        }
+    }
+
+    fn push(&self, task: Arc<Tasklet>) {
+        let task = Arc::into_raw(task) as *mut Tasklet;
+        let mut head = self.inbox.load(Ordering::Relaxed);
+        loop {
+            // SAFETY: The tasklet is only in one inbox at a time.
+            unsafe { (*task).next.store(head, Ordering::Relaxed) };
+            match self
+                .inbox
+                .compare_exchange_weak(head, task, Ordering::Release, Ordering::Relaxed)
+            {
+                Ok(_) => return,
+                Err(h) => head = h,
+            }
+        }
+    }
+
+    // Take the whole inbox, oldest first.
+    fn take_inbox(&self) -> VecDeque<Arc<Tasklet>> {
+        let mut tasks = VecDeque::new();
+        let mut p = self.inbox.swap(ptr::null_mut(), Ordering::Acquire);
+        while !p.is_null() {
+            // SAFETY: Pushed by into_raw, and taken once by the swap.
+            let task = unsafe { Arc::from_raw(p) };
+            p = task.next.load(Ordering::Relaxed);
+            tasks.push_front(task);
+        }
+        tasks
+    }
 }
 
+static RUN_QUEUES: [RunQueue; NUM_CORES] = [const { RunQueue::new() }; NUM_CORES];
+static POLLER_STORAGES: [SystemThreadStorage; NUM_CORES] =
+    [const { SystemThreadStorage::new(ThreadKind::AsyncPoller) }; NUM_CORES];
+static mut POLLERS: [MaybeUninit<ThreadNode>; NUM_CORES] =
+    [const { MaybeUninit::zeroed() }; NUM_CORES];
+static POLLER_WAKER: AtomicUsize = AtomicUsize::new(0);
+
 pub(crate) fn init() {
-    ASYNC_WORK_QUEUE.init_queues();
-    let poller = thread::build_static_thread(
-        unsafe { &mut POLLER },
-        &POLLER_STORAGE,
-        MAX_THREAD_PRIORITY,
-        thread::CREATED,
-        Entry::C(poll),
-        ThreadKind::AsyncPoller,
-    );
-    let ok = scheduler::queue_ready_thread(thread::CREATED, poller);
-    debug_assert!(ok);
+    for i in 0..NUM_CORES {
+        let poller = thread::build_static_thread(
+            unsafe { &mut POLLERS[i] },
+            &POLLER_STORAGES[i],
+            MAX_THREAD_PRIORITY,
+            thread::CREATED,
+            Entry::Posix(poll, i as *mut c_void),
+            ThreadKind::AsyncPoller,
+        );
+        let ok = scheduler::queue_ready_thread(thread::CREATED, poller);
+        debug_assert!(ok);
+    }
 }
 
-fn create_tasklet(future: impl Future<Output = ()> + 'static) -> Arc<Tasklet> {
-    let future = Box::pin(future);
-    Arc::new(Tasklet::new(future))
+fn create_tasklet(future: impl Future<Output = ()> + Send + 'static) -> Arc<Tasklet> {
+    Arc::new(Tasklet::new(Box::pin(future)))
 }
 
 pub fn block_on(future: impl Future<Output = ()> + Send + 'static) {
     let t = scheduler::current_thread();
-    let mut task = create_tasklet(future);
-    task.lock().blocked = Some(t.clone());
+    let task = create_tasklet(future);
+    *task.blocked.irqsave_lock() = Some(t.clone());
     scheduler::suspend_me_with_hook(move || {
         let ok = t.transfer_state(thread::RUNNING, thread::SUSPENDED);
         assert!(ok);
-        enqueue_active_tasklet(task);
         #[cfg(debugging_scheduler)]
         crate::trace!(
             "[TH:0x{:x}] is waking up the poller",
             scheduler::current_thread_id()
         );
-        wake_poller();
+        enqueue(task);
     });
 }
 
+pub fn spawn(future: impl Future<Output = ()> + Send + 'static) -> Arc<Tasklet> {
+    let task = create_tasklet(future);
+    enqueue(task.clone());
+    task
+}
+
 fn wake_poller() {
     POLLER_WAKER.fetch_add(1, Ordering::Release);
     atomic_wait::atomic_wake(&POLLER_WAKER, 1);
 }
 
-pub fn spawn(future: impl Future<Output = ()> + Send + 'static) -> Arc<Tasklet> {
-    let task = create_tasklet(future);
-    enqueue_active_tasklet(task.clone());
+// Queue a tasklet in SCHEDULED state.
+fn enqueue(task: Arc<Tasklet>) {
+    RUN_QUEUES[arch::current_cpu_id()].push(task);
     wake_poller();
-    task
 }
 
-pub fn enqueue_active_tasklet(t: Arc<Tasklet>) {
-    #[cfg(debugging_scheduler)]
-    crate::trace!(
-        "[TH:0x{:x}] is enqueuing tasklet",
-        scheduler::current_thread_id()
-    );
-    let mut q = ASYNC_WORK_QUEUE.get_active_queue();
-    let _guard = t.lock();
-    q.push_back(t.clone());
-    #[cfg(debugging_scheduler)]
-    crate::trace!(
-        "[TH:0x{:x}] has enqueued tasklet",
-        scheduler::current_thread_id()
-    );
-}
-
-fn poll_inner() {
-    let mut ctx = Context::from_waker(Waker::noop());
-    let mut w = ASYNC_WORK_QUEUE.advance_active_queue();
-    for mut task in w.iter() {
-        let mut l = task.lock();
-        if let Poll::Ready(()) = l.future.as_mut().poll(&mut ctx) {
-            if let Some(t) = l.blocked.take() {
-                scheduler::queue_ready_thread(thread::SUSPENDED, t);
-            }
-            // If we detach the task what ever it's ready or
-            // pending, it would be edge-level triggered. Now
-            // we're using level-trigger mode conservatively.
-            AsyncWorkQueue::WorkList::detach(&task.clone());
-        } else {
-            // FIXME: This is not an efficient impl right now. We
-            // might need a waker for each future, so that the poller
-            // doesn't need to poll all futures when woken up.
+fn schedule(task: Arc<Tasklet>) {
+    let mut state = task.state.load(Ordering::Acquire);
+    loop {
+        let next = match state {
+            IDLE => SCHEDULED,
+            RUNNING => NOTIFIED,
+            // Already queued, will be polled again, or done.
+            _ => return,
+        };
+        match task
+            .state
+            .compare_exchange_weak(state, next, Ordering::AcqRel, Ordering::Acquire)
+        {
+            Ok(_) => break,
+            Err(s) => state = s,
+        }
+    }
+    if state == IDLE {
+        enqueue(task);
+    }
+}
+
+fn next_task(me: usize) -> Option<Arc<Tasklet>> {
+    let rq = &RUN_QUEUES[me];
+    {
+        let mut local = rq.local.lock();
+        if let Some(task) = local.pop_front() {
+            return Some(task);
+        }
+        local.append(&mut rq.take_inbox());
+        if let Some(task) = local.pop_front() {
+            return Some(task);
+        }
+    }
+    steal(me)
+}
+
+// Take the inbox of another core, or half of its local queue.
+fn steal(me: usize) -> Option<Arc<Tasklet>> {
+    for i in 1..NUM_CORES {
+        let victim = &RUN_QUEUES[(me + i) % NUM_CORES];
+        let mut stolen = victim.take_inbox();
+        if stolen.is_empty() {
+            let mut local = victim.local.lock();
+            let n = local.len().div_ceil(2);
+            stolen.extend(local.drain(..n));
+        }
+        if let Some(task) = stolen.pop_front() {
+            RUN_QUEUES[me].local.lock().append(&mut stolen);
+            return Some(task);
+        }
+    }
+    None
+}
+
+fn run(task: Arc<Tasklet>, me: usize) {
+    task.state.store(RUNNING, Ordering::Release);
+    let waker = Waker::from(task.clone());
+    let mut ctx = Context::from_waker(&waker);
+    // SAFETY: The future is only polled in RUNNING state, which only
+    // this poller moves the tasklet to.
+    let future = unsafe { &mut *task.future.get() };
+    let ready = future
+        .as_mut()
+        .is_none_or(|f| f.as_mut().poll(&mut ctx).is_ready());
+    if ready {
+        *future = None;
+        task.state.store(DONE, Ordering::Release);
+        if let Some(t) = task.blocked.irqsave_lock().take() {
+            scheduler::queue_ready_thread(thread::SUSPENDED, t);
         }
+        return;
+    }
+    if task
+        .state
+        .compare_exchange(RUNNING, IDLE, Ordering::AcqRel, Ordering::Acquire)
+        .is_err()
+    {
+        // Woken while being polled.
+        task.state.store(SCHEDULED, Ordering::Release);
+        RUN_QUEUES[me].local.lock().push_back(task);
     }
 }
 
-extern "C" fn poll() {
+extern "C" fn poll(arg: *mut c_void) {
+    let me = arg as usize;
     loop {
         let n = POLLER_WAKER.load(Ordering::Acquire);
-        poll_inner();
+        while let Some(task) = next_task(me) {
+            run(task, me);
+        }
         atomic_wait::atomic_wait(&POLLER_WAKER, n, None);
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use blueos_test_macro::test;
+    use core::sync::atomic::AtomicBool;
+
+    // Pending until woken once.
+    struct WakeOnce {
+        woken: Arc<AtomicBool>,
+    }
+
+    impl Future for WakeOnce {
+        type Output = ();
+
+        fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+            if self.woken.swap(true, Ordering::AcqRel) {
+                return Poll::Ready(());
+            }
+            cx.waker().wake_by_ref();
+            Poll::Pending
+        }
+    }
+
+    #[test]
+    fn test_woken_tasklet_is_polled_again() {
+        let woken = Arc::new(AtomicBool::new(false));
+        block_on(WakeOnce {
+            woken: woken.clone(),
+        });
+        assert!(woken.load(Ordering::Acquire));
+    }
+
+    #[test]
+    fn test_spawned_tasklets_finish() {
+        let count = Arc::new(AtomicUsize::new(0));
+        let tasks: alloc::vec::Vec<_> = (0..16)
+            .map(|_| {
+                let count = count.clone();
+                spawn(async move {
+                    count.fetch_add(1, Ordering::Relaxed);
+                })
+            })
+            .collect();
+        block_on(async move {
+            while !tasks.iter().all(|t| t.is_done()) {
+                sleep(1).await;
+            }
+        });
+        assert_eq!(count.load(Ordering::Relaxed), 16);
+    }
+}
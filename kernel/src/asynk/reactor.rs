@@ -0,0 +1,206 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Sources of wakeups for tasklets. An Event is signalled by interrupt
+// handlers and timers, and waited on either by threads, with
+// atomic_wait on its counter, or by tasklets, with wait().
+
+use crate::{
+    sync::{atomic_wait, SpinLock},
+    time::{get_sys_ticks, timer::Timer},
+    types::Arc,
+};
+use alloc::{boxed::Box, vec::Vec};
+use core::{
+    future::Future,
+    pin::Pin,
+    sync::atomic::{AtomicUsize, Ordering},
+    task::{Context, Poll, Waker},
+};
+
+pub struct Event {
+    // Bumped on every signal.
+    seq: AtomicUsize,
+    // Wakers of the tasklets waiting, and whether each has been woken.
+    // Woken ones are dropped by the next tasklet registering, so that a
+    // signal in an interrupt handler never drops the last reference to
+    // a tasklet.
+    wakers: SpinLock<Vec<(Waker, bool)>>,
+}
+
+impl Event {
+    pub const fn new() -> Self {
+        Self {
+            seq: AtomicUsize::new(0),
+            wakers: SpinLock::new(Vec::new()),
+        }
+    }
+
+    /// The counter of signals, for threads to atomic_wait on.
+    pub fn counter(&self) -> &AtomicUsize {
+        &self.seq
+    }
+
+    pub fn load(&self) -> usize {
+        self.seq.load(Ordering::Acquire)
+    }
+
+    /// Wake all threads and tasklets waiting. Safe to call from
+    /// interrupt handlers.
+    pub fn signal(&self) {
+        self.seq.fetch_add(1, Ordering::Release);
+        let _ = atomic_wait::atomic_wake(&self.seq, usize::MAX);
+        let mut wakers = self.wakers.irqsave_lock();
+        for (waker, woken) in wakers.iter_mut().filter(|(_, woken)| !*woken) {
+            waker.wake_by_ref();
+            *woken = true;
+        }
+    }
+
+    /// Wait until the event is signalled after `seen` is loaded.
+    pub fn wait(&self, seen: usize) -> Wait<'_> {
+        Wait { event: self, seen }
+    }
+
+    fn poll_wait(&self, seen: usize, cx: &mut Context<'_>) -> Poll<()> {
+        if self.load() != seen {
+            return Poll::Ready(());
+        }
+        let mut wakers = self.wakers.irqsave_lock();
+        // Signals bump the counter before taking the lock.
+        if self.load() != seen {
+            return Poll::Ready(());
+        }
+        wakers.retain(|(_, woken)| !woken);
+        if !wakers.iter().any(|(w, _)| w.will_wake(cx.waker())) {
+            wakers.push((cx.waker().clone(), false));
+        }
+        Poll::Pending
+    }
+}
+
+impl core::fmt::Debug for Event {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("Event").field("seq", &self.load()).finish()
+    }
+}
+
+impl Default for Event {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+pub struct Wait<'a> {
+    event: &'a Event,
+    seen: usize,
+}
+
+impl Future for Wait<'_> {
+    type Output = ();
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        self.event.poll_wait(self.seen, cx)
+    }
+}
+
+/// Wait for `ticks` ticks.
+pub fn sleep(ticks: usize) -> Sleep {
+    Sleep {
+        deadline: get_sys_ticks().saturating_add(ticks),
+        timer: None,
+    }
+}
+
+pub struct Sleep {
+    deadline: usize,
+    // Started on the first poll, signals the event on the deadline.
+    timer: Option<(Arc<Timer>, alloc::sync::Arc<Event>)>,
+}
+
+impl Future for Sleep {
+    type Output = ();
+
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<()> {
+        let now = get_sys_ticks();
+        if now >= self.deadline {
+            return Poll::Ready(());
+        }
+        if self.timer.is_none() {
+            let event = alloc::sync::Arc::new(Event::new());
+            let fired = event.clone();
+            let timer =
+                Timer::new_hard_oneshot(self.deadline - now, Box::new(move || fired.signal()));
+            timer.start();
+            self.timer = Some((timer, event));
+        }
+        let (_, event) = self.timer.as_ref().unwrap();
+        match event.poll_wait(0, cx) {
+            Poll::Ready(()) => Poll::Ready(()),
+            Poll::Pending if get_sys_ticks() >= self.deadline => Poll::Ready(()),
+            Poll::Pending => Poll::Pending,
+        }
+    }
+}
+
+impl Drop for Sleep {
+    fn drop(&mut self) {
+        if let Some((timer, _)) = self.timer.take() {
+            timer.stop();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::asynk;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_event_wakes_tasklet() {
+        static EVENT: Event = Event::new();
+        let seen = EVENT.load();
+        asynk::spawn(async {
+            asynk::sleep(1).await;
+            EVENT.signal();
+        });
+        asynk::block_on(async move { EVENT.wait(seen).await });
+        assert_ne!(EVENT.load(), seen);
+    }
+
+    #[test]
+    fn test_event_wakers_pruned() {
+        let event = Event::new();
+        let mut cx = Context::from_waker(Waker::noop());
+        assert!(event.poll_wait(0, &mut cx).is_pending());
+        assert!(event.poll_wait(0, &mut cx).is_pending());
+        assert_eq!(event.wakers.irqsave_lock().len(), 1);
+        event.signal();
+        // Woken wakers are kept until the next registration.
+        assert_eq!(event.wakers.irqsave_lock().len(), 1);
+        let seen = event.load();
+        assert!(event.poll_wait(seen, &mut cx).is_pending());
+        let wakers = event.wakers.irqsave_lock();
+        assert_eq!(wakers.len(), 1);
+        assert!(!wakers[0].1);
+    }
+
+    #[test]
+    fn test_sleep_until_deadline() {
+        let start = get_sys_ticks();
+        asynk::block_on(async { asynk::sleep(3).await });
+        assert!(get_sys_ticks() >= start + 3);
+    }
+}
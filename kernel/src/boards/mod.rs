@@ -19,10 +19,12 @@ pub(crate) use qemu_mps2_an385::{get_cycles_to_duration, get_cycles_to_ms, get_e
 
 #[cfg(target_board = "qemu_riscv64")]
 mod qemu_riscv64;
+#[cfg(all(target_board = "qemu_riscv64", tickless))]
+pub(crate) use qemu_riscv64::current_ns;
 #[cfg(target_board = "qemu_riscv64")]
 pub(crate) use qemu_riscv64::{
-    current_cycles, current_ticks, get_cycles_to_duration, get_cycles_to_ms, get_early_uart,
-    handle_plic_irq, init, set_timeout_after,
+    clear_ipi, current_cycles, current_ticks, get_cycles_to_duration, get_cycles_to_ms,
+    get_early_uart, handle_plic_irq, init, send_ipi, set_timeout_after,
 };
 
 #[cfg(target_board = "qemu_mps3_an547")]
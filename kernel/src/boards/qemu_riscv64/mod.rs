@@ -44,6 +44,20 @@ fn clock_timecmp_ptr(hart: usize) -> *mut usize {
     unsafe { (CLOCK_ADDR + 0x4000 + 8 * hart) as *mut usize }
 }
 
+#[inline]
+fn clock_msip_ptr(hart: usize) -> *mut u32 {
+    unsafe { (CLOCK_ADDR + 4 * hart) as *mut u32 }
+}
+
+#[cfg(scheduler = "percore")]
+pub(crate) fn send_ipi(hart: usize) {
+    unsafe { clock_msip_ptr(hart).write_volatile(1) };
+}
+
+pub(crate) fn clear_ipi(hart: usize) {
+    unsafe { clock_msip_ptr(hart).write_volatile(0) };
+}
+
 #[inline]
 pub fn current_ticks() -> usize {
     unsafe { (CLOCK_TIME as *const usize).read_volatile() }
@@ -83,6 +97,11 @@ pub(crate) fn handle_plic_irq(ctx: &Context, mcause: usize, mtval: usize) {
     PLIC.complete(cpu_id, PLIC.claim(cpu_id))
 }
 
+#[cfg(tickless)]
+pub(crate) fn current_ns() -> usize {
+    current_ticks() * NS_PER_TICK
+}
+
 pub(crate) fn set_timeout_after(ns: usize) {
     set_timecmp(current_ticks() + ns / NS_PER_TICK);
 }
@@ -38,7 +38,11 @@ pub(crate) fn init() {
     STAGING.run(3, true, || unsafe {
         arch::irq::init(config::GICD as u64, config::GICR as u64, NUM_CORES, false)
     });
-    STAGING.run(4, false, || arch::irq::cpu_init());
+    STAGING.run(4, false, || {
+        arch::irq::cpu_init();
+        #[cfg(scheduler = "percore")]
+        arch::init_reschedule_ipi();
+    });
     STAGING.run(5, false, || {
         time::systick_init(0);
     });
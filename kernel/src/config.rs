@@ -14,8 +14,13 @@
 
 // FIXME: We should use kconfig to generate this file.
 use crate::types::ThreadPriority;
+use blueos_kconfig::THREAD_PRIORITY_MAX;
 
-pub const MAX_THREAD_PRIORITY: ThreadPriority = (ThreadPriority::BITS - 1) as ThreadPriority;
+// Priorities are 0, the highest, to MAX_THREAD_PRIORITY, as many as
+// THREAD_PRIORITY_MAX configures.
+pub const MAX_THREAD_PRIORITY: ThreadPriority = (THREAD_PRIORITY_MAX - 1) as ThreadPriority;
+const _: () =
+    assert!(THREAD_PRIORITY_MAX >= 2 && THREAD_PRIORITY_MAX - 1 <= ThreadPriority::MAX as usize);
 pub const TASKLET_PRIORITY: ThreadPriority = MAX_THREAD_PRIORITY - 1;
 pub const TASKLET_STACK_SIZE: usize = 512;
 
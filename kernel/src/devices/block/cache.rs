@@ -0,0 +1,452 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A write-back buffer cache between Block and its driver. The device is
+// cached in buffers of BUFFER_SECTORS sectors, with per-sector valid and
+// dirty masks, so a write of whole sectors never reads the device and a
+// partial write only reads the buffer once. Buffers are evicted with the
+// CLOCK algorithm. Dirty sectors are written back on eviction or on
+// flush, the latter coalescing adjacent dirty sectors of all buffers
+// into as few requests as possible, submitted to the driver as one
+// batch. A read following the previous one reads ahead READ_AHEAD
+// buffers with one read_blocks call.
+
+use super::{BlockBuf, BlockDriverOps, BlockRequest};
+use alloc::{collections::BTreeMap, vec, vec::Vec};
+use core::{cmp::min, mem};
+use virtio_drivers::device::blk::SECTOR_SIZE;
+
+pub(crate) const BUFFER_SECTORS: usize = 8;
+pub(crate) const BUFFER_SIZE: usize = BUFFER_SECTORS * SECTOR_SIZE;
+const READ_AHEAD: usize = 4;
+// Largest write issued when flushing.
+const MAX_WRITE_SECTORS: usize = READ_AHEAD * BUFFER_SECTORS;
+
+type SectorMask = u8;
+const _: () = assert!(SectorMask::BITS as usize >= BUFFER_SECTORS);
+
+// Mask of sectors covered by [offset, offset + len) of a buffer.
+#[inline]
+fn sector_mask(offset: usize, len: usize) -> SectorMask {
+    let first = offset / SECTOR_SIZE;
+    let last = (offset + len).div_ceil(SECTOR_SIZE);
+    mask_of(last) & !mask_of(first)
+}
+
+// Mask of the first n sectors of a buffer.
+#[inline]
+fn mask_of(n: usize) -> SectorMask {
+    ((1u32 << n) - 1) as SectorMask
+}
+
+struct Buffer {
+    block: usize,
+    data: Vec<u8>,
+    valid: SectorMask,
+    dirty: SectorMask,
+    referenced: bool,
+}
+
+pub(crate) struct BufferCache {
+    buffers: Vec<Buffer>,
+    capacity: usize,
+    // Buffer index of each cached block.
+    index: BTreeMap<usize, usize>,
+    hand: usize,
+    nr_sectors: usize,
+    // Block following the last block read.
+    next_block: usize,
+    // For read-ahead and write coalescing.
+    scratch: Vec<u8>,
+}
+
+impl BufferCache {
+    pub fn new(nr_sectors: usize, capacity: usize) -> Self {
+        Self {
+            buffers: Vec::new(),
+            capacity: capacity.max(READ_AHEAD),
+            index: BTreeMap::new(),
+            hand: 0,
+            nr_sectors,
+            next_block: usize::MAX,
+            scratch: Vec::new(),
+        }
+    }
+
+    #[inline]
+    fn nr_blocks(&self) -> usize {
+        self.nr_sectors.div_ceil(BUFFER_SECTORS)
+    }
+
+    // Sectors of the device in `block`, the last block might be short.
+    #[inline]
+    fn sectors_in(&self, block: usize) -> usize {
+        min(
+            BUFFER_SECTORS,
+            self.nr_sectors.saturating_sub(block * BUFFER_SECTORS),
+        )
+    }
+
+    // Write back dirty sectors of the buffers with the given indexes,
+    // which must be sorted by block.
+    fn write_back<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+        slots: &[usize],
+    ) -> Result<(), E> {
+        let mut scratch = mem::take(&mut self.scratch);
+        scratch.clear();
+        // Runs of adjacent dirty sectors, as (first sector, sectors).
+        // Their data is laid out in the scratch buffer one after another.
+        let mut runs: Vec<(usize, usize)> = Vec::new();
+        for &slot in slots {
+            let b = &self.buffers[slot];
+            for s in 0..BUFFER_SECTORS {
+                if b.dirty & (1 << s) == 0 {
+                    continue;
+                }
+                let sector = b.block * BUFFER_SECTORS + s;
+                match runs.last_mut() {
+                    Some((start, len)) if *start + *len == sector && *len < MAX_WRITE_SECTORS => {
+                        *len += 1
+                    }
+                    _ => runs.push((sector, 1)),
+                }
+                scratch.extend_from_slice(&b.data[s * SECTOR_SIZE..(s + 1) * SECTOR_SIZE]);
+            }
+        }
+        // Write all runs with one batch, so the driver can keep them in
+        // flight together.
+        let mut reqs = Vec::with_capacity(runs.len());
+        let mut rest = &scratch[..];
+        for &(start, len) in runs.iter() {
+            let (data, tail) = rest.split_at(len * SECTOR_SIZE);
+            reqs.push(BlockRequest {
+                block_id: start,
+                buf: BlockBuf::Write(data),
+            });
+            rest = tail;
+        }
+        let result = drv.submit(&mut reqs);
+        self.scratch = scratch;
+        result?;
+        for &slot in slots {
+            self.buffers[slot].dirty = 0;
+        }
+        Ok(())
+    }
+
+    // Find a buffer to hold a new block.
+    fn victim<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+    ) -> Result<usize, E> {
+        if self.buffers.len() < self.capacity {
+            self.buffers.push(Buffer {
+                block: usize::MAX,
+                data: vec![0u8; BUFFER_SIZE],
+                valid: 0,
+                dirty: 0,
+                referenced: false,
+            });
+            return Ok(self.buffers.len() - 1);
+        }
+        loop {
+            let slot = self.hand;
+            self.hand = (self.hand + 1) % self.buffers.len();
+            let b = &mut self.buffers[slot];
+            if b.referenced {
+                b.referenced = false;
+                continue;
+            }
+            if b.dirty != 0 {
+                self.write_back(drv, &[slot])?;
+            }
+            let block = self.buffers[slot].block;
+            self.index.remove(&block);
+            return Ok(slot);
+        }
+    }
+
+    fn lookup<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+        block: usize,
+    ) -> Result<usize, E> {
+        if let Some(&slot) = self.index.get(&block) {
+            self.buffers[slot].referenced = true;
+            return Ok(slot);
+        }
+        let slot = self.victim(drv)?;
+        let b = &mut self.buffers[slot];
+        b.block = block;
+        b.valid = 0;
+        b.dirty = 0;
+        b.referenced = true;
+        self.index.insert(block, slot);
+        Ok(slot)
+    }
+
+    // Make sectors in `mask` of the buffer valid.
+    fn fill<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+        slot: usize,
+        mask: SectorMask,
+    ) -> Result<(), E> {
+        let b = &self.buffers[slot];
+        if b.valid & mask == mask {
+            return Ok(());
+        }
+        let (block, valid) = (b.block, b.valid);
+        let len = self.sectors_in(block) * SECTOR_SIZE;
+        if valid == 0 {
+            let b = &mut self.buffers[slot];
+            drv.read_blocks(block * BUFFER_SECTORS, &mut b.data[..len])?;
+        } else {
+            // Don't overwrite sectors already cached, they might be
+            // dirty.
+            let mut scratch = mem::take(&mut self.scratch);
+            scratch.resize(len, 0);
+            let result = drv.read_blocks(block * BUFFER_SECTORS, &mut scratch);
+            if result.is_ok() {
+                let b = &mut self.buffers[slot];
+                for s in 0..len / SECTOR_SIZE {
+                    if valid & (1 << s) == 0 {
+                        let range = s * SECTOR_SIZE..(s + 1) * SECTOR_SIZE;
+                        b.data[range.clone()].copy_from_slice(&scratch[range]);
+                    }
+                }
+            }
+            self.scratch = scratch;
+            result?;
+        }
+        self.buffers[slot].valid = mask_of(len / SECTOR_SIZE);
+        Ok(())
+    }
+
+    // Read uncached blocks starting from `block` with one request.
+    fn read_ahead<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+        block: usize,
+    ) -> Result<(), E> {
+        let end = min(block + READ_AHEAD, self.nr_blocks());
+        let n = (block..end)
+            .take_while(|b| !self.index.contains_key(b))
+            .count();
+        if n < 2 {
+            return Ok(());
+        }
+        let mut scratch = mem::take(&mut self.scratch);
+        let sectors = min(n * BUFFER_SECTORS, self.nr_sectors - block * BUFFER_SECTORS);
+        scratch.resize(sectors * SECTOR_SIZE, 0);
+        let mut result = drv.read_blocks(block * BUFFER_SECTORS, &mut scratch);
+        if result.is_ok() {
+            for (i, data) in scratch.chunks(BUFFER_SIZE).enumerate() {
+                let slot = match self.lookup(drv, block + i) {
+                    Ok(slot) => slot,
+                    Err(e) => {
+                        result = Err(e);
+                        break;
+                    }
+                };
+                let b = &mut self.buffers[slot];
+                b.data[..data.len()].copy_from_slice(data);
+                b.valid = mask_of(data.len() / SECTOR_SIZE);
+            }
+        }
+        self.scratch = scratch;
+        result
+    }
+
+    pub fn read<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+        pos: usize,
+        buf: &mut [u8],
+    ) -> Result<(), E> {
+        let mut done = 0;
+        while done < buf.len() {
+            let block = (pos + done) / BUFFER_SIZE;
+            let offset = (pos + done) % BUFFER_SIZE;
+            let n = min(BUFFER_SIZE - offset, buf.len() - done);
+            if block == self.next_block && !self.index.contains_key(&block) {
+                self.read_ahead(drv, block)?;
+            }
+            let slot = self.lookup(drv, block)?;
+            self.fill(drv, slot, sector_mask(offset, n))?;
+            buf[done..done + n].copy_from_slice(&self.buffers[slot].data[offset..offset + n]);
+            self.next_block = block + 1;
+            done += n;
+        }
+        Ok(())
+    }
+
+    pub fn write<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+        pos: usize,
+        buf: &[u8],
+    ) -> Result<(), E> {
+        let mut done = 0;
+        while done < buf.len() {
+            let block = (pos + done) / BUFFER_SIZE;
+            let offset = (pos + done) % BUFFER_SIZE;
+            let n = min(BUFFER_SIZE - offset, buf.len() - done);
+            let slot = self.lookup(drv, block)?;
+            let mask = sector_mask(offset, n);
+            // Sectors partially overwritten have to be read first.
+            let whole =
+                mask_of((offset + n) / SECTOR_SIZE) & !mask_of(offset.div_ceil(SECTOR_SIZE));
+            self.fill(drv, slot, mask & !whole)?;
+            let b = &mut self.buffers[slot];
+            b.data[offset..offset + n].copy_from_slice(&buf[done..done + n]);
+            b.valid |= mask;
+            b.dirty |= mask;
+            done += n;
+        }
+        Ok(())
+    }
+
+    // Write back all dirty sectors.
+    pub fn flush<E: embedded_io::Error>(
+        &mut self,
+        drv: &mut dyn BlockDriverOps<Error = E>,
+    ) -> Result<(), E> {
+        let slots: Vec<usize> = self
+            .index
+            .values()
+            .copied()
+            .filter(|&slot| self.buffers[slot].dirty != 0)
+            .collect();
+        if slots.is_empty() {
+            return Ok(());
+        }
+        self.write_back(drv, &slots)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::devices::block::ErrorType;
+    use blueos_test_macro::test;
+    use embedded_io::ErrorKind;
+
+    struct RamDisk {
+        data: Vec<u8>,
+        reads: usize,
+        writes: usize,
+    }
+
+    impl RamDisk {
+        fn new(sectors: usize) -> Self {
+            Self {
+                data: vec![0u8; sectors * SECTOR_SIZE],
+                reads: 0,
+                writes: 0,
+            }
+        }
+    }
+
+    impl ErrorType for RamDisk {
+        type Error = ErrorKind;
+    }
+
+    impl BlockDriverOps for RamDisk {
+        fn capacity(&self) -> u64 {
+            (self.data.len() / SECTOR_SIZE) as u64
+        }
+
+        fn sector_size(&self) -> u16 {
+            SECTOR_SIZE as u16
+        }
+
+        fn read_blocks(&mut self, block_id: usize, buf: &mut [u8]) -> Result<(), Self::Error> {
+            let start = block_id * SECTOR_SIZE;
+            buf.copy_from_slice(&self.data[start..start + buf.len()]);
+            self.reads += 1;
+            Ok(())
+        }
+
+        fn write_blocks(&mut self, block_id: usize, buf: &[u8]) -> Result<(), Self::Error> {
+            let start = block_id * SECTOR_SIZE;
+            self.data[start..start + buf.len()].copy_from_slice(buf);
+            self.writes += 1;
+            Ok(())
+        }
+
+        fn flush(&mut self) -> Result<(), Self::Error> {
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn test_sector_mask() {
+        assert_eq!(sector_mask(0, SECTOR_SIZE), 0b1);
+        assert_eq!(sector_mask(SECTOR_SIZE / 2, SECTOR_SIZE), 0b11);
+        assert_eq!(sector_mask(0, BUFFER_SIZE), SectorMask::MAX);
+        assert_eq!(mask_of(0), 0);
+    }
+
+    #[test]
+    fn test_write_back_and_coalesce() {
+        // The last buffer is short.
+        let mut disk = RamDisk::new(BUFFER_SECTORS * 8 + 3);
+        let mut cache = BufferCache::new(BUFFER_SECTORS * 8 + 3, 8);
+        let data: Vec<u8> = (0..BUFFER_SIZE * 3).map(|i| i as u8).collect();
+        let pos = SECTOR_SIZE * 3 + 7;
+        cache.write(&mut disk, pos, &data).unwrap();
+        // Only the partially written head and tail sectors are read.
+        assert_eq!(disk.writes, 0);
+        assert!(disk.reads <= 2);
+        let mut buf = vec![0u8; data.len()];
+        cache.read(&mut disk, pos, &mut buf).unwrap();
+        assert_eq!(buf, data);
+        cache.flush(&mut disk).unwrap();
+        // All dirty sectors are adjacent.
+        assert_eq!(disk.writes, 1);
+        assert_eq!(&disk.data[pos..pos + data.len()], &data[..]);
+        cache.flush(&mut disk).unwrap();
+        assert_eq!(disk.writes, 1);
+        let tail = disk.data.len() - 10;
+        cache.write(&mut disk, tail, &[7u8; 10]).unwrap();
+        cache.flush(&mut disk).unwrap();
+        assert_eq!(&disk.data[tail..], &[7u8; 10]);
+    }
+
+    #[test]
+    fn test_read_ahead_and_evict() {
+        let sectors = BUFFER_SECTORS * 32;
+        let mut disk = RamDisk::new(sectors);
+        for (i, b) in disk.data.iter_mut().enumerate() {
+            *b = (i / SECTOR_SIZE) as u8;
+        }
+        let mut cache = BufferCache::new(sectors, READ_AHEAD * 2);
+        let mut buf = vec![0u8; SECTOR_SIZE];
+        for s in 0..sectors {
+            cache.read(&mut disk, s * SECTOR_SIZE, &mut buf).unwrap();
+            assert!(buf.iter().all(|&b| b == s as u8));
+        }
+        // One read for the first buffer, then one per read-ahead window.
+        assert!(disk.reads <= 1 + 32 / READ_AHEAD + 1);
+        // Dirty buffers are written back when evicted.
+        cache.write(&mut disk, 0, &[0xaa; SECTOR_SIZE]).unwrap();
+        for s in (BUFFER_SECTORS..sectors).step_by(BUFFER_SECTORS) {
+            cache.read(&mut disk, s * SECTOR_SIZE, &mut buf).unwrap();
+        }
+        assert_eq!(&disk.data[..SECTOR_SIZE], &[0xaa; SECTOR_SIZE]);
+    }
+}
@@ -13,18 +13,23 @@
 // limitations under the License.
 
 use crate::{
+    asynk::Event,
     devices::{virtio::VirtioHal, Device, DeviceClass, DeviceId, DeviceManager},
-    sync::SpinLock,
+    sync::Mutex,
 };
-use alloc::{string::String, sync::Arc, vec};
-use core::cmp::min;
+use alloc::{boxed::Box, string::String, sync::Arc};
+use cache::BufferCache;
+use core::{cell::UnsafeCell, cmp::min};
 use embedded_io::{Error as IOError, ErrorKind};
+use virtio_blk::VirtioBlock;
 use virtio_drivers::{
     device::blk::{VirtIOBlk, SECTOR_SIZE},
     transport::SomeTransport,
-    Hal,
 };
 
+mod cache;
+pub(crate) mod virtio_blk;
+
 pub const VIRTUAL_STORAGE_NAME: &str = "virt-storage";
 
 #[derive(Debug, Clone, Eq, PartialEq, thiserror::Error)]
@@ -68,68 +73,89 @@ pub trait BlockDriverOps: Send + Sync + ErrorType {
     fn write_blocks(&mut self, block_id: usize, buf: &[u8]) -> Result<(), Self::Error>;
     /// Requests the device to flush any pending writes to storage.
     fn flush(&mut self) -> Result<(), Self::Error>;
-}
-
-impl<H: Hal> ErrorType for VirtIOBlk<H, SomeTransport<'static>> {
-    type Error = BlockError<virtio_drivers::Error>; // : io::Error
-}
-
-impl<H: Hal> BlockDriverOps for VirtIOBlk<H, SomeTransport<'static>> {
-    fn capacity(&self) -> u64 {
-        self.capacity()
-    }
-
-    fn read_blocks(&mut self, block_id: usize, buf: &mut [u8]) -> Result<(), Self::Error> {
-        match self.read_blocks(block_id, buf) {
-            Ok(_) => Ok(()),
-            Err(error) => Err(BlockError::Driver(error)),
-        }
-    }
-
-    fn write_blocks(&mut self, block_id: usize, buf: &[u8]) -> Result<(), Self::Error> {
-        match self.write_blocks(block_id, buf) {
-            Ok(_) => Ok(()),
-            Err(error) => Err(BlockError::Driver(error)),
+    /// Performs a batch of requests and returns when all of them are
+    /// done. Drivers able to keep several requests in flight override
+    /// this, the default performs them one by one.
+    fn submit(&mut self, reqs: &mut [BlockRequest<'_>]) -> Result<(), Self::Error> {
+        for req in reqs.iter_mut() {
+            match &mut req.buf {
+                BlockBuf::Read(buf) => self.read_blocks(req.block_id, buf)?,
+                BlockBuf::Write(buf) => self.write_blocks(req.block_id, buf)?,
+            }
         }
+        Ok(())
     }
+}
 
-    fn flush(&mut self) -> Result<(), Self::Error> {
-        match self.flush() {
-            Ok(_) => Ok(()),
-            Err(error) => Err(BlockError::Driver(error)),
-        }
-    }
+pub enum BlockBuf<'a> {
+    Read(&'a mut [u8]),
+    Write(&'a [u8]),
+}
 
-    fn sector_size(&self) -> u16 {
-        SECTOR_SIZE.try_into().unwrap()
-    }
+/// A request of a batch submitted to a block driver.
+pub struct BlockRequest<'a> {
+    pub block_id: usize,
+    pub buf: BlockBuf<'a>,
 }
 
 pub fn init_virtio_block(
     driver: VirtIOBlk<VirtioHal, SomeTransport<'static>>,
+    completions: Option<Arc<Event>>,
 ) -> Result<(), ErrorKind> {
-    let block = Block::new(VIRTUAL_STORAGE_NAME, Arc::new(SpinLock::new(driver)));
-    DeviceManager::get().register_device(String::from(VIRTUAL_STORAGE_NAME), Arc::new(block))
+    let driver = VirtioBlock::new(driver, completions);
+    let block = Arc::new(Block::new(VIRTUAL_STORAGE_NAME, Box::new(driver)));
+    let ok = block.init();
+    debug_assert!(ok);
+    DeviceManager::get().register_device(String::from(VIRTUAL_STORAGE_NAME), block)
+}
+
+struct BlockIo<E: embedded_io::Error> {
+    cache: BufferCache,
+    driver: Box<dyn BlockDriverOps<Error = E>>,
 }
 
 pub struct Block<E: embedded_io::Error, const SECTOR_SIZE: usize> {
-    driver: Arc<SpinLock<dyn BlockDriverOps<Error = E>>>,
+    // Drivers may sleep until requests complete, so the cache and the
+    // driver are guarded by a sleeping mutex rather than spin locks.
+    lock: Mutex,
+    io: UnsafeCell<BlockIo<E>>,
     name: String,
     total_size: u64, // in bytes
+    sector_size: u16,
 }
 
+// SAFETY: io is only accessed with lock held, and the mutex isn't
+// moved once initialized.
+unsafe impl<E: embedded_io::Error> Send for Block<E, SECTOR_SIZE> {}
+unsafe impl<E: embedded_io::Error> Sync for Block<E, SECTOR_SIZE> {}
+
 impl<E: embedded_io::Error> Block<E, SECTOR_SIZE> {
-    pub fn new(name: &str, driver: Arc<SpinLock<dyn BlockDriverOps<Error = E>>>) -> Self {
-        let total_size = {
-            let capacity = driver.lock().capacity();
-            capacity * SECTOR_SIZE as u64
-        };
+    pub fn new(name: &str, driver: Box<dyn BlockDriverOps<Error = E>>) -> Self {
+        let capacity = driver.capacity();
+        let total_size = capacity * SECTOR_SIZE as u64;
+        let sector_size = driver.sector_size();
+        let cache = BufferCache::new(capacity as usize, blueos_kconfig::BLOCK_CACHE_SIZE);
         Block {
-            driver,
+            lock: Mutex::new(),
+            io: UnsafeCell::new(BlockIo { cache, driver }),
             name: String::from(name),
             total_size,
+            sector_size,
         }
     }
+
+    /// Must be called once the block is at its final address.
+    pub fn init(&self) -> bool {
+        self.lock.init()
+    }
+
+    fn with_io<R>(&self, f: impl FnOnce(&mut BlockIo<E>) -> R) -> Result<R, ErrorKind> {
+        self.lock.lock().map_err(|_| ErrorKind::Other)?;
+        // SAFETY: The mutex is held.
+        let r = f(unsafe { &mut *self.io.get() });
+        let _ = self.lock.unlock();
+        Ok(r)
+    }
 }
 
 impl<E: embedded_io::Error> Device for Block<E, SECTOR_SIZE> {
@@ -151,17 +177,11 @@ impl<E: embedded_io::Error> Device for Block<E, SECTOR_SIZE> {
         if max_read == 0 {
             return Ok(0);
         }
-        // Calculate starting sector and offset
-        let start_sector = (pos / SECTOR_SIZE as u64) as usize;
-        let sector_offset = (pos % SECTOR_SIZE as u64) as usize;
-        let sectors_coverred = (sector_offset + max_read).div_ceil(SECTOR_SIZE);
-        let mut sector_buf = vec![0u8; sectors_coverred * SECTOR_SIZE];
-        self.driver
-            .lock()
-            .read_blocks(start_sector, &mut sector_buf)
-            .map_err(|e| IOError::kind(&e))?;
-        // Copy to output buffer
-        buf[..max_read].copy_from_slice(&sector_buf[sector_offset..sector_offset + max_read]);
+        self.with_io(|io| {
+            io.cache
+                .read(&mut *io.driver, pos as usize, &mut buf[..max_read])
+        })?
+        .map_err(|e| IOError::kind(&e))?;
         Ok(max_read)
     }
 
@@ -171,84 +191,39 @@ impl<E: embedded_io::Error> Device for Block<E, SECTOR_SIZE> {
         if total_write_size == 0 {
             return Ok(0);
         }
-        let mut data = &buf[..total_write_size];
-        let mut start_sector = (pos / SECTOR_SIZE as u64) as usize;
-        let sector_offset = (pos % SECTOR_SIZE as u64) as usize;
-
-        // 1. Write first sector
-        let mut write_size = min(SECTOR_SIZE - sector_offset, total_write_size);
-        let mut sector_buf = [0u8; SECTOR_SIZE];
-        if sector_offset != 0 || write_size != SECTOR_SIZE {
-            // If the content to be written cannot completely cover the sector, it needs to be read out first
-            self.driver
-                .lock()
-                .read_blocks(start_sector, &mut sector_buf)
-                .map_err(|e| IOError::kind(&e))?;
-        }
-        // Update the parts that need to be modified
-        sector_buf[sector_offset..sector_offset + write_size].copy_from_slice(&data[..write_size]);
-        // Write back to the modified sectors
-        self.driver
-            .lock()
-            .write_blocks(start_sector, &sector_buf)
-            .map_err(|e| IOError::kind(&e))?;
-        data = &data[write_size..];
-        start_sector += 1;
-        // 2. Write continuous sectors
-        let continuous_sectors = data.len() / SECTOR_SIZE;
-        if continuous_sectors != 0 {
-            write_size = SECTOR_SIZE * continuous_sectors;
-            let mut sector_buf = vec![0u8; write_size];
-            sector_buf[..write_size].copy_from_slice(&data[..write_size]);
-            // Write back to the modified sectors
-            self.driver
-                .lock()
-                .write_blocks(start_sector, &sector_buf)
-                .map_err(|e| IOError::kind(&e))?;
-            data = &data[write_size..];
-            start_sector += continuous_sectors;
-        }
-        // 3. Write last sector
-        write_size = data.len();
-        if write_size > 0 {
-            let mut sector_buf = [0u8; SECTOR_SIZE];
-            self.driver
-                .lock()
-                .read_blocks(start_sector, &mut sector_buf)
-                .map_err(|e| IOError::kind(&e))?;
-            // Update the parts that need to be modified
-            sector_buf[..write_size].copy_from_slice(&data[..write_size]);
-            // Write back to the modified sectors
-            self.driver
-                .lock()
-                .write_blocks(start_sector, &sector_buf)
-                .map_err(|e| IOError::kind(&e))?;
-        }
+        self.with_io(|io| {
+            io.cache
+                .write(&mut *io.driver, pos as usize, &buf[..total_write_size])
+        })?
+        .map_err(|e| IOError::kind(&e))?;
         Ok(total_write_size)
     }
 
     fn capacity(&self) -> Result<u64, ErrorKind> {
-        let driver = self.driver.lock();
-        Ok(driver.capacity())
+        Ok(self.total_size / SECTOR_SIZE as u64)
     }
 
     fn sector_size(&self) -> Result<u16, ErrorKind> {
-        let driver = self.driver.lock();
-        Ok(driver.sector_size())
+        Ok(self.sector_size)
     }
 
     fn sync(&self) -> Result<(), ErrorKind> {
-        let mut driver = self.driver.lock();
-        match driver.flush() {
-            Ok(_) => Ok(()),
-            Err(error) => Err(embedded_io::Error::kind(&error)),
-        }
+        self.with_io(|io| {
+            io.cache
+                .flush(&mut *io.driver)
+                .map_err(|e| IOError::kind(&e))?;
+            match io.driver.flush() {
+                Ok(_) => Ok(()),
+                Err(error) => Err(embedded_io::Error::kind(&error)),
+            }
+        })?
     }
 }
 
 #[cfg(test)]
 mod tests {
     use super::*;
+    use alloc::vec;
     use blueos_test_macro::test;
     use semihosting::println;
 
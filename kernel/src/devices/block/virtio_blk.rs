@@ -0,0 +1,229 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The virtio-blk driver. A batch of requests is put on the virtqueue as
+// far as descriptors allow, so the device works on several requests at
+// a time. The submitter sleeps until the device interrupts, and refills
+// the queue as requests complete. Without an interrupt, or when it
+// can't sleep, the submitter polls the used ring instead.
+
+use super::{BlockBuf, BlockDriverOps, BlockError, BlockRequest, ErrorType};
+use crate::{arch, asynk::Event, sync::atomic_wait};
+use alloc::{sync::Arc, vec::Vec};
+use virtio_drivers::{
+    device::blk::{BlkReq, BlkResp, VirtIOBlk, SECTOR_SIZE},
+    transport::SomeTransport,
+    Hal,
+};
+
+// Every request takes a descriptor for each of its header, data and
+// status.
+const DESCS_PER_REQUEST: usize = 3;
+// Wake up to poll now and then in case an interrupt is missed.
+const WAIT_TICKS: usize = 10;
+
+#[derive(Default)]
+struct Slot {
+    req: BlkReq,
+    resp: BlkResp,
+    token: u16,
+    index: usize,
+    busy: bool,
+}
+
+pub struct VirtioBlock<H: Hal> {
+    inner: VirtIOBlk<H, SomeTransport<'static>>,
+    // Signalled by the interrupt handler on every interrupt.
+    completions: Option<Arc<Event>>,
+}
+
+impl<H: Hal> VirtioBlock<H> {
+    pub fn new(
+        inner: VirtIOBlk<H, SomeTransport<'static>>,
+        completions: Option<Arc<Event>>,
+    ) -> Self {
+        Self { inner, completions }
+    }
+
+    /// The event signalled on completions, for tasklets to await.
+    pub fn completions(&self) -> Option<Arc<Event>> {
+        self.completions.clone()
+    }
+
+    // SAFETY: The buffer of `req` and `slot` must not be moved or
+    // dropped until the request completes.
+    unsafe fn start(
+        &mut self,
+        req: &mut BlockRequest<'_>,
+        slot: &mut Slot,
+    ) -> Result<u16, virtio_drivers::Error> {
+        match &mut req.buf {
+            BlockBuf::Read(buf) => {
+                self.inner
+                    .read_blocks_nb(req.block_id, &mut slot.req, buf, &mut slot.resp)
+            }
+            BlockBuf::Write(buf) => {
+                self.inner
+                    .write_blocks_nb(req.block_id, &mut slot.req, buf, &mut slot.resp)
+            }
+        }
+    }
+
+    // SAFETY: `slot` must be the one the request of `token` is started
+    // with.
+    unsafe fn complete(
+        &mut self,
+        req: &mut BlockRequest<'_>,
+        slot: &mut Slot,
+    ) -> Result<(), virtio_drivers::Error> {
+        match &mut req.buf {
+            BlockBuf::Read(buf) => {
+                self.inner
+                    .complete_read_blocks(slot.token, &slot.req, buf, &mut slot.resp)
+            }
+            BlockBuf::Write(buf) => {
+                self.inner
+                    .complete_write_blocks(slot.token, &slot.req, buf, &mut slot.resp)
+            }
+        }
+    }
+
+    fn wait(&self, seen: usize) {
+        match &self.completions {
+            // atomic_wait returns at once if an interrupt came after
+            // `seen` is loaded.
+            Some(completions) if arch::local_irq_enabled() && !crate::irq::is_in_irq() => {
+                let _ = atomic_wait(completions.counter(), seen, Some(WAIT_TICKS));
+            }
+            _ => core::hint::spin_loop(),
+        }
+    }
+}
+
+impl<H: Hal> ErrorType for VirtioBlock<H> {
+    type Error = BlockError<virtio_drivers::Error>; // : io::Error
+}
+
+impl<H: Hal> BlockDriverOps for VirtioBlock<H> {
+    fn capacity(&self) -> u64 {
+        self.inner.capacity()
+    }
+
+    fn read_blocks(&mut self, block_id: usize, buf: &mut [u8]) -> Result<(), Self::Error> {
+        self.submit(&mut [BlockRequest {
+            block_id,
+            buf: BlockBuf::Read(buf),
+        }])
+    }
+
+    fn write_blocks(&mut self, block_id: usize, buf: &[u8]) -> Result<(), Self::Error> {
+        self.submit(&mut [BlockRequest {
+            block_id,
+            buf: BlockBuf::Write(buf),
+        }])
+    }
+
+    fn submit(&mut self, reqs: &mut [BlockRequest<'_>]) -> Result<(), Self::Error> {
+        let depth = reqs
+            .len()
+            .min(self.inner.virt_queue_size() as usize / DESCS_PER_REQUEST)
+            .max(1);
+        // Slots are never moved once allocated, the device writes to
+        // them until requests complete.
+        let mut slots: Vec<Slot> = (0..depth).map(|_| Slot::default()).collect();
+        let mut free: Vec<usize> = (0..depth).rev().collect();
+        let mut next = 0;
+        let mut in_flight = 0;
+        let mut result = Ok(());
+        loop {
+            // Fill the queue up. Stop submitting on the first error, but
+            // requests in flight must complete before their buffers are
+            // released.
+            while next < reqs.len() && result.is_ok() {
+                let Some(s) = free.pop() else {
+                    break;
+                };
+                // SAFETY: Both outlive the loop, which doesn't return
+                // until all requests started complete.
+                match unsafe { self.start(&mut reqs[next], &mut slots[s]) } {
+                    Ok(token) => {
+                        slots[s].token = token;
+                        slots[s].index = next;
+                        slots[s].busy = true;
+                        next += 1;
+                        in_flight += 1;
+                    }
+                    Err(virtio_drivers::Error::QueueFull) if in_flight > 0 => {
+                        free.push(s);
+                        break;
+                    }
+                    Err(e) => {
+                        free.push(s);
+                        result = Err(BlockError::Driver(e));
+                    }
+                }
+            }
+            if in_flight == 0 {
+                return result;
+            }
+            let seen = self.completions.as_ref().map_or(0, |c| c.load());
+            let Some(token) = self.inner.peek_used() else {
+                self.wait(seen);
+                continue;
+            };
+            // The device is locked by the caller, every used buffer
+            // belongs to this batch.
+            let s = slots
+                .iter()
+                .position(|slot| slot.busy && slot.token == token)
+                .expect("virtio-blk: unknown token");
+            let index = slots[s].index;
+            // SAFETY: The request of `token` is started with slots[s].
+            if let Err(e) = unsafe { self.complete(&mut reqs[index], &mut slots[s]) } {
+                result = result.and(Err(BlockError::Driver(e)));
+            }
+            slots[s].busy = false;
+            free.push(s);
+            in_flight -= 1;
+        }
+    }
+
+    fn flush(&mut self) -> Result<(), Self::Error> {
+        match self.inner.flush() {
+            Ok(_) => Ok(()),
+            Err(error) => Err(BlockError::Driver(error)),
+        }
+    }
+
+    fn sector_size(&self) -> u16 {
+        SECTOR_SIZE.try_into().unwrap()
+    }
+}
+
+// Route the interrupt of the device at `header` to the current core.
+// Return the event of interrupts to wait on.
+#[cfg(target_arch = "aarch64")]
+pub(crate) fn enable_irq(
+    irq: crate::arch::irq::IrqNumber,
+    trigger: crate::arch::irq::IrqTrigger,
+    header: core::ptr::NonNull<virtio_drivers::transport::mmio::VirtIOHeader>,
+) -> Option<Arc<Event>> {
+    use alloc::boxed::Box;
+
+    let completions = Arc::new(Event::new());
+    let event = completions.clone();
+    let notify = move || event.signal();
+    crate::devices::virtio::enable_irq(irq, trigger, header, Box::new(notify))
+        .then_some(completions)
+}
@@ -12,7 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::error::Error;
+use crate::{
+    error::Error,
+    sync::poll::{PollWatch, POLLIN, POLLOUT},
+};
 use alloc::{collections::BTreeMap, string::String, sync::Arc};
 use core::{
     fmt::Debug,
@@ -186,6 +189,43 @@ pub trait Device: Send + Sync {
     }
     fn read(&self, pos: u64, buf: &mut [u8], is_nonblocking: bool) -> Result<usize, ErrorKind>;
     fn write(&self, pos: u64, buf: &[u8], is_nonblocking: bool) -> Result<usize, ErrorKind>;
+    /// Vectored read and write, stopping at the first short transfer.
+    /// Devices override these to move all buffers in one go.
+    fn readv(
+        &self,
+        pos: u64,
+        bufs: &mut [&mut [u8]],
+        is_nonblocking: bool,
+    ) -> Result<usize, ErrorKind> {
+        let mut done = 0;
+        for buf in bufs.iter_mut() {
+            let n = match self.read(pos + done as u64, buf, is_nonblocking) {
+                Ok(n) => n,
+                Err(_) if done > 0 => break,
+                Err(e) => return Err(e),
+            };
+            done += n;
+            if n < buf.len() {
+                break;
+            }
+        }
+        Ok(done)
+    }
+    fn writev(&self, pos: u64, bufs: &[&[u8]], is_nonblocking: bool) -> Result<usize, ErrorKind> {
+        let mut done = 0;
+        for buf in bufs.iter() {
+            let n = match self.write(pos + done as u64, buf, is_nonblocking) {
+                Ok(n) => n,
+                Err(_) if done > 0 => break,
+                Err(e) => return Err(e),
+            };
+            done += n;
+            if n < buf.len() {
+                break;
+            }
+        }
+        Ok(done)
+    }
     fn ioctl(&self, request: u32, arg: usize) -> Result<(), ErrorKind> {
         Err(ErrorKind::Unsupported)
     }
@@ -200,6 +240,16 @@ pub trait Device: Send + Sync {
     fn sync(&self) -> Result<(), ErrorKind> {
         Err(ErrorKind::Unsupported)
     }
+    /// Returns the address of the device memory at `pos` to map `len`
+    /// bytes of it in place, e.g., a framebuffer.
+    fn mmap(&self, pos: u64, len: usize) -> Result<usize, ErrorKind> {
+        Err(ErrorKind::Unsupported)
+    }
+    /// Returns the events the device is ready for, see sync::poll.
+    /// Devices which may block register `watch` to notify it.
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        POLLIN | POLLOUT
+    }
 }
 
 impl Debug for dyn Device {
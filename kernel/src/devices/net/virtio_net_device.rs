@@ -12,11 +12,22 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// The virtio-net datapath. The stack thread owns the device, so packets
+// move without locking. Receive buffers are posted once and reposted as
+// soon as smoltcp consumed them. Transmit buffers come from a pool and
+// are handed to the device without waiting, completed ones are reaped
+// on the next transmit. This lets smoltcp move bursts of packets per
+// poll.
+//
+// The header of a packet is the head of its buffer, so both directions
+// copy nothing but the header.
+
 use core::cell::RefCell;
 
 use crate::{
+    asynk::Event,
     devices::virtio::{self, VirtioHal},
-    net::net_interface::NetInterface,
+    net::{net_interface::NetInterface, net_manager},
     time::tick_get_millisecond,
 };
 use alloc::{boxed::Box, rc::Rc, vec, vec::Vec};
@@ -26,45 +37,172 @@ use smoltcp::{
     time::{Duration, Instant},
     wire::{EthernetAddress, IpAddress, IpCidr, Ipv4Address},
 };
-use spin::rwlock::RwLock;
-use virtio_drivers::{
-    device::net::{RxBuffer, VirtIONet},
-    transport::SomeTransport,
-};
+use spin::Mutex;
+use virtio_drivers::{device::net::VirtIONetRaw, transport::SomeTransport};
+
+const MTU: usize = 1500;
+// Large enough for the virtio-net header and an Ethernet frame, there's
+// no segmentation offload.
+const VIRTIO_NET_BUFFER_SIZE: usize = 2048;
+const VIRTIO_NET_QUEUE_SIZE: usize = 32;
 
-const VIRTIO_NET_BUFFER_SIZE: usize = 65536;
-const VIRTIO_NET_QUEUE_SIZE: usize = 16;
+type VirtIONetType = VirtIONetRaw<VirtioHal, SomeTransport<'static>, VIRTIO_NET_QUEUE_SIZE>;
 
-static VIRTIO_NET_DEVICES: RwLock<
-    Vec<VirtIONet<VirtioHal, SomeTransport<'static>, VIRTIO_NET_QUEUE_SIZE>>,
-> = RwLock::new(Vec::new());
-type VirtIONetType = VirtIONet<VirtioHal, SomeTransport<'static>, VIRTIO_NET_QUEUE_SIZE>;
+// Devices found, until the stack thread takes them.
+static VIRTIO_NET_DEVICES: Mutex<Vec<VirtioNet>> = Mutex::new(Vec::new());
+/// Signalled on every interrupt of virtio-net devices, for tasklets to
+/// await traffic.
+pub static VIRTIO_NET_EVENT: Event = Event::new();
 
-pub fn register_virtio_net_device(transport: SomeTransport<'static>) {
-    let mut guard = VIRTIO_NET_DEVICES.write();
-    guard.push(VirtIONet::new(transport, VIRTIO_NET_BUFFER_SIZE).unwrap());
+pub fn register_virtio_net_device(transport: SomeTransport<'static>, has_irq: bool) {
+    let raw = match VirtIONetRaw::new(transport) {
+        Ok(raw) => raw,
+        Err(e) => {
+            log::error!("Failed to init virtio net, {:?}", e);
+            return;
+        }
+    };
+    let net = match VirtioNet::new(raw) {
+        Ok(net) => net,
+        Err(e) => {
+            log::error!("Failed to post virtio net rx buffers, {:?}", e);
+            return;
+        }
+    };
+    VIRTIO_NET_DEVICES.lock().push(net);
+    if !has_irq {
+        net_manager::require_polling();
+    }
 }
 
-pub fn with_net_device<F, R>(index: usize, f: F) -> Option<R>
-where
-    F: FnOnce(&mut VirtIONetType) -> R,
-{
-    let mut guard = VIRTIO_NET_DEVICES.write();
-    guard.get_mut(index).map(f)
+// Route the interrupt of the device at `header` to the current core, so
+// that received packets and completed transmissions wake the network
+// stack and tasklets waiting on VIRTIO_NET_EVENT up.
+#[cfg(target_arch = "aarch64")]
+pub(crate) fn enable_irq(
+    irq: crate::arch::irq::IrqNumber,
+    trigger: crate::arch::irq::IrqTrigger,
+    header: core::ptr::NonNull<virtio_drivers::transport::mmio::VirtIOHeader>,
+) -> bool {
+    let notify = || {
+        net_manager::wake_up();
+        VIRTIO_NET_EVENT.signal();
+    };
+    crate::devices::virtio::enable_irq(irq, trigger, header, Box::new(notify))
 }
 
 pub fn net_dev_exist() -> bool {
-    VIRTIO_NET_DEVICES.read().len() > 0
+    !VIRTIO_NET_DEVICES.lock().is_empty()
+}
+
+fn take_net_device() -> Option<VirtioNet> {
+    let mut devices = VIRTIO_NET_DEVICES.lock();
+    (!devices.is_empty()).then(|| devices.remove(0))
+}
+
+struct VirtioNet {
+    raw: VirtIONetType,
+    // Buffers posted to the receive queue, by token.
+    rx_posted: Vec<Option<Vec<u8>>>,
+    // Buffers on the transmit queue, by token.
+    tx_in_flight: Vec<Option<Vec<u8>>>,
+    tx_pool: Vec<Vec<u8>>,
+}
+
+// SAFETY: The device is only used by one thread at a time, the registry
+// hands it over to the stack thread.
+unsafe impl Send for VirtioNet {}
+
+impl VirtioNet {
+    fn new(raw: VirtIONetType) -> Result<Self, virtio_drivers::Error> {
+        let mut net = Self {
+            raw,
+            rx_posted: (0..VIRTIO_NET_QUEUE_SIZE).map(|_| None).collect(),
+            tx_in_flight: (0..VIRTIO_NET_QUEUE_SIZE).map(|_| None).collect(),
+            tx_pool: Vec::new(),
+        };
+        for _ in 0..VIRTIO_NET_QUEUE_SIZE {
+            net.post_rx(vec![0; VIRTIO_NET_BUFFER_SIZE])?;
+        }
+        Ok(net)
+    }
+
+    fn post_rx(&mut self, mut buf: Vec<u8>) -> Result<(), virtio_drivers::Error> {
+        // SAFETY: The buffer is kept in rx_posted until the device
+        // returns it.
+        let token = unsafe { self.raw.receive_begin(&mut buf)? };
+        self.rx_posted[token as usize] = Some(buf);
+        Ok(())
+    }
+
+    // Return a received packet as its buffer, and the offset and length
+    // of the packet in it.
+    fn pop_rx(&mut self) -> Option<(Vec<u8>, usize, usize)> {
+        let token = self.raw.poll_receive()?;
+        let mut buf = self.rx_posted[token as usize]
+            .take()
+            .expect("virtio-net: unknown rx token");
+        // SAFETY: The buffer is the one posted with the token.
+        match unsafe { self.raw.receive_complete(token, &mut buf) } {
+            Ok((offset, len)) => Some((buf, offset, len)),
+            Err(e) => {
+                log::warn!("virtio-net: rx error {:?}", e);
+                self.repost_rx(buf);
+                None
+            }
+        }
+    }
+
+    fn repost_rx(&mut self, buf: Vec<u8>) {
+        if let Err(e) = self.post_rx(buf) {
+            log::error!("virtio-net: failed to repost rx buffer, {:?}", e);
+        }
+    }
+
+    fn reap_tx(&mut self) {
+        while let Some(token) = self.raw.poll_transmit() {
+            let buf = self.tx_in_flight[token as usize]
+                .take()
+                .expect("virtio-net: unknown tx token");
+            // SAFETY: The buffer is the one sent with the token.
+            let _ = unsafe { self.raw.transmit_complete(token, &buf) };
+            self.tx_pool.push(buf);
+        }
+    }
+
+    fn can_send(&mut self) -> bool {
+        self.reap_tx();
+        self.raw.can_send()
+    }
+
+    fn tx_buffer(&mut self) -> Vec<u8> {
+        self.reap_tx();
+        self.tx_pool
+            .pop()
+            .unwrap_or_else(|| vec![0; VIRTIO_NET_BUFFER_SIZE])
+    }
+
+    fn send(&mut self, buf: Vec<u8>, len: usize) {
+        // SAFETY: The buffer is kept in tx_in_flight until the device
+        // is done with it.
+        match unsafe { self.raw.transmit_begin(&buf[..len]) } {
+            Ok(token) => self.tx_in_flight[token as usize] = Some(buf),
+            Err(e) => {
+                log::warn!("virtio-net: tx dropped, {:?}", e);
+                self.tx_pool.push(buf);
+            }
+        }
+    }
 }
 
 pub struct VirtIONetDevice {
-    net_device_index: usize,
+    net: Rc<RefCell<VirtioNet>>,
 }
 
 impl VirtIONetDevice {
-    pub fn new(device_index: usize) -> Self {
+    fn new(net: VirtioNet) -> Self {
         Self {
-            net_device_index: device_index,
+            net: Rc::new(RefCell::new(net)),
         }
     }
 }
@@ -74,14 +212,13 @@ where
     'a: 'static,
 {
     pub fn create_virtio_device() -> Self {
-        let mut inner: VirtIONetDevice = VirtIONetDevice::new(0);
+        let net = take_net_device().expect("Found no virtio net device!");
+        // Get MAC address from VirtIO device
+        let mac_addr = net.raw.mac_address();
+        let mut inner = VirtIONetDevice::new(net);
         // Create Device
         let mut socket_set = SocketSet::new(vec![]);
 
-        // Get MAC address from VirtIO device
-        let mac_addr = with_net_device(0, |net| net.mac_address())
-            .unwrap_or([0x02, 0x00, 0x00, 0x00, 0x00, 0x01]);
-
         // Create interface
         let mut config = match inner.capabilities().medium {
             Medium::Ethernet => Config::new(EthernetAddress(mac_addr).into()),
@@ -139,69 +276,67 @@ impl Device for VirtIONetDevice {
         Self: 'a;
 
     fn receive(&mut self, _timestamp: Instant) -> Option<(Self::RxToken<'_>, Self::TxToken<'_>)> {
-        with_net_device(self.net_device_index, |net| {
-            if net.can_recv() {
-                if let Ok(rx_buf) = net.receive() {
-                    return Some((
-                        VirtIONetRxToken {
-                            device_index: self.net_device_index,
-                            buffer: rx_buf,
-                        },
-                        VirtIONetTxToken {
-                            device_index: self.net_device_index,
-                        },
-                    ));
-                }
-            }
-            None
-        })
-        .flatten()
+        let (buffer, offset, len) = self.net.borrow_mut().pop_rx()?;
+        Some((
+            VirtIONetRxToken {
+                net: self.net.clone(),
+                buffer: Some(buffer),
+                offset,
+                len,
+            },
+            VirtIONetTxToken {
+                net: self.net.clone(),
+            },
+        ))
     }
 
     fn transmit(&mut self, _timestamp: Instant) -> Option<Self::TxToken<'_>> {
-        with_net_device(self.net_device_index, |net| {
-            if net.can_send() {
-                Some(VirtIONetTxToken {
-                    device_index: self.net_device_index,
-                })
-            } else {
-                None
-            }
+        self.net.borrow_mut().can_send().then(|| VirtIONetTxToken {
+            net: self.net.clone(),
         })
-        .flatten()
     }
 
     fn capabilities(&self) -> DeviceCapabilities {
         let mut caps = DeviceCapabilities::default();
-        caps.max_transmission_unit = 1500;
-        caps.max_burst_size = Some(1);
+        caps.max_transmission_unit = MTU;
+        caps.max_burst_size = Some(VIRTIO_NET_QUEUE_SIZE);
         caps.medium = Medium::Ethernet;
         caps
     }
 }
 
 pub struct VirtIONetRxToken {
-    device_index: usize,
-    buffer: RxBuffer,
+    net: Rc<RefCell<VirtioNet>>,
+    // Reposted once the token is consumed or dropped.
+    buffer: Option<Vec<u8>>,
+    offset: usize,
+    len: usize,
 }
 
 impl RxToken for VirtIONetRxToken {
-    fn consume<R, F>(self, f: F) -> R
+    fn consume<R, F>(mut self, f: F) -> R
     where
         F: FnOnce(&[u8]) -> R,
     {
-        let packet = self.buffer.packet();
-
-        let result = f(packet);
-
-        // Recycle rx buffer to ensure virtqueue has space for new packets.
-        with_net_device(self.device_index, |net| net.recycle_rx_buffer(self.buffer));
+        let buffer = self.buffer.take().unwrap();
+        // The device isn't borrowed while smoltcp handles the packet,
+        // since it may transmit a reply right away.
+        let result = f(&buffer[self.offset..self.offset + self.len]);
+        self.net.borrow_mut().repost_rx(buffer);
         result
     }
 }
 
+impl Drop for VirtIONetRxToken {
+    fn drop(&mut self) {
+        if let Some(buffer) = self.buffer.take() {
+            self.net.borrow_mut().repost_rx(buffer);
+        }
+    }
+}
+
 pub struct VirtIONetTxToken {
-    device_index: usize,
+    net: Rc<RefCell<VirtioNet>>,
 }
 
 impl TxToken for VirtIONetTxToken {
@@ -209,12 +344,18 @@ impl TxToken for VirtIONetTxToken {
     where
         F: FnOnce(&mut [u8]) -> R,
     {
-        with_net_device(self.device_index, |net| {
-            let mut tx_buf = net.new_tx_buffer(len);
-            let result = f(tx_buf.packet_mut());
-            let _ = net.send(tx_buf);
-            result
-        })
-        .expect("Found no virtio net device!")
+        let mut buffer = self.net.borrow_mut().tx_buffer();
+        let offset = self
+            .net
+            .borrow()
+            .raw
+            .fill_buffer_header(&mut buffer)
+            .expect("virtio-net: tx buffer too small");
+        if buffer.len() < offset + len {
+            buffer.resize(offset + len, 0);
+        }
+        let result = f(&mut buffer[offset..offset + len]);
+        self.net.borrow_mut().send(buffer, offset + len);
+        result
     }
 }
@@ -12,12 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::devices::{
-    tty::{
-        serial,
-        termios::{CcIndex, Iflags},
+use crate::{
+    devices::{
+        tty::{
+            serial,
+            termios::{CcIndex, Iflags},
+        },
+        Device, DeviceClass, DeviceId,
     },
-    Device, DeviceClass, DeviceId,
+    sync::poll::PollWatch,
 };
 use alloc::{collections::VecDeque, string::String, sync::Arc};
 use core::sync::atomic::{AtomicUsize, Ordering};
@@ -209,4 +212,9 @@ impl Device for Tty {
     fn ioctl(&self, request: u32, arg: usize) -> Result<(), ErrorKind> {
         self.serial.ioctl(request, arg)
     }
+
+    // Ready as soon as the serial is, even if no line is complete.
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        self.serial.poll(watch)
+    }
 }
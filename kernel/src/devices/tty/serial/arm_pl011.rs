@@ -313,7 +313,7 @@ impl<'a> Uart<'a> {
             LineControlRegister::STP2
         } else {
             LineControlRegister::empty()
-        };
+        } | LineControlRegister::FEN;
 
         field!(self.regs, uartrsr_ecr).write(0);
         field!(self.regs, uartcr).write(ControlRegister::empty());
@@ -321,6 +321,10 @@ impl<'a> Uart<'a> {
         field!(self.regs, uartibrd).write(uartibrd);
         field!(self.regs, uartfbrd).write(uartfbrd);
         field!(self.regs, uartlcr_h).write(line_control);
+        // With the FIFOs on, the UART interrupts once per chunk rather
+        // than once per byte. Data left under the rx level raises the
+        // receive timeout interrupt once the line is idle.
+        self.set_interrupt_fifo_levels(FifoLevel::Bytes16, FifoLevel::Bytes8);
 
         field!(self.regs, uartcr)
             .write(ControlRegister::RXE | ControlRegister::TXE | ControlRegister::UARTEN);
@@ -617,9 +621,9 @@ impl UartOps for Driver<'_> {
     fn set_rx_interrupt(&mut self, enable: bool) {
         let mut masks = self.uart.interrupt_masks();
         if enable {
-            masks |= Interrupts::RXI;
+            masks |= Interrupts::RXI | Interrupts::RTI;
         } else {
-            masks &= !Interrupts::RXI;
+            masks &= !(Interrupts::RXI | Interrupts::RTI);
         }
         self.uart.set_interrupt_masks(masks);
     }
@@ -635,7 +639,8 @@ impl UartOps for Driver<'_> {
     }
 
     fn clear_rx_interrupt(&mut self) {
-        self.uart.clear_interrupts(Interrupts::RXI);
+        self.uart
+            .clear_interrupts(Interrupts::RXI | Interrupts::RTI);
     }
 
     fn clear_tx_interrupt(&mut self) {
@@ -13,10 +13,13 @@
 // limitations under the License.
 
 use crate::{
+    asynk::Event,
     devices::{tty::termios::Termios, Device, DeviceBase, DeviceClass, DeviceId, DeviceRequest},
     irq,
+    support::{gather, scatter},
     sync::{
         atomic_wait::{atomic_wait, atomic_wake},
+        poll::{PollQueue, PollWatch, POLLIN, POLLOUT},
         spinlock::SpinLock,
     },
 };
@@ -99,12 +102,14 @@ pub trait UartOps:
 struct SerialRxFifo {
     rb: BoxedRingBuffer,
     futex: AtomicUsize,
+    event: Event,
 }
 
 #[derive(Debug)]
 struct SerialTxFifo {
     rb: BoxedRingBuffer,
     futex: AtomicUsize,
+    event: Event,
 }
 
 impl SerialRxFifo {
@@ -112,6 +117,7 @@ impl SerialRxFifo {
         Self {
             rb: BoxedRingBuffer::new(size),
             futex: AtomicUsize::new(0),
+            event: Event::new(),
         }
     }
 }
@@ -121,6 +127,7 @@ impl SerialTxFifo {
         Self {
             rb: BoxedRingBuffer::new(size),
             futex: AtomicUsize::new(0),
+            event: Event::new(),
         }
     }
 }
@@ -131,6 +138,8 @@ pub struct Serial {
     pub termios: Termios,
     rx_fifo: SerialRxFifo,
     tx_fifo: SerialTxFifo,
+    // Polls waiting for either fifo.
+    poll_queue: PollQueue,
     pub uart_ops: Arc<SpinLock<dyn UartOps>>,
 }
 
@@ -142,6 +151,7 @@ impl Serial {
             termios,
             rx_fifo: SerialRxFifo::new(SERIAL_RX_FIFO_SIZE.max(SERIAL_RX_FIFO_MIN_SIZE)),
             tx_fifo: SerialTxFifo::new(SERIAL_TX_FIFO_SIZE.max(SERIAL_TX_FIFO_MIN_SIZE)),
+            poll_queue: PollQueue::new(),
             uart_ops,
         }
     }
@@ -168,8 +178,9 @@ impl Serial {
         Ok(())
     }
 
-    fn fifo_rx(&self, buf: &mut [u8], is_nonblocking: bool) -> Result<usize, SerialError> {
-        let len = buf.len();
+    // Read into all of `bufs` with one pass over the ring.
+    fn fifo_rx(&self, bufs: &mut [&mut [u8]], is_nonblocking: bool) -> Result<usize, SerialError> {
+        let len = bufs.iter().map(|buf| buf.len()).sum::<usize>();
         let mut count = 0;
         let mut reader = unsafe { self.rx_fifo.rb.reader() };
 
@@ -179,7 +190,7 @@ impl Serial {
             let mut n = 0;
             for slice in slices {
                 let slice_len = slice.len().min(len - count);
-                buf[count..count + slice_len].copy_from_slice(&slice[..slice_len]);
+                scatter(bufs, count, &slice[..slice_len]);
                 count += slice_len;
                 n += slice_len;
             }
@@ -200,8 +211,10 @@ impl Serial {
         Ok(count)
     }
 
-    fn fifo_tx(&self, buf: &[u8], is_nonblocking: bool) -> Result<usize, SerialError> {
-        let len = buf.len();
+    // Write all of `bufs`, kicking the transmitter once per fill of the
+    // ring rather than once per buffer.
+    fn fifo_tx(&self, bufs: &[&[u8]], is_nonblocking: bool) -> Result<usize, SerialError> {
+        let len = bufs.iter().map(|buf| buf.len()).sum::<usize>();
         let mut count = 0;
         let mut writer = unsafe { self.tx_fifo.rb.writer() };
 
@@ -214,7 +227,7 @@ impl Serial {
                     continue;
                 }
                 let slice_len = slice.len().min(len - count);
-                slice[..slice_len].copy_from_slice(&buf[count..count + slice_len]);
+                gather(bufs, count, &mut slice[..slice_len]);
                 count += slice_len;
                 n += slice_len;
             }
@@ -267,14 +280,28 @@ impl Serial {
             }
         }
 
-        if nbytes > 0 {
-            // TODO: add notify for poll/select
+        // Wake writers once half of the fifo is free.
+        let rb = &self.tx_fifo.rb;
+        if nbytes > 0 && rb.len() <= rb.capacity() / 2 {
             let _ = atomic_wake(&self.tx_fifo.futex, 1);
+            self.tx_fifo.event.signal();
+            self.poll_queue.notify(POLLOUT);
         }
 
         Ok(nbytes)
     }
 
+    /// Signalled when received data is put in the rx fifo, for tasklets
+    /// to await.
+    pub fn rx_event(&self) -> &Event {
+        &self.rx_fifo.event
+    }
+
+    /// Signalled when data in the tx fifo is sent.
+    pub fn tx_event(&self) -> &Event {
+        &self.tx_fifo.event
+    }
+
     /// this Function is called from the UART interrupt handler
     /// when an interrupt is received indicating that there is more data in the
     /// receive FIFO
@@ -296,9 +323,14 @@ impl Serial {
             }
         }
 
-        // TODO: add notify for poll/select
+        // The hardware FIFO is either drained, and no receive timeout
+        // follows to deliver the bytes later, or the rx fifo is full, so
+        // readers are woken once per interrupt. Batching comes from the
+        // FIFO levels the driver interrupts at.
         if nbytes > 0 {
             let _ = atomic_wake(&self.rx_fifo.futex, 1);
+            self.rx_fifo.event.signal();
+            self.poll_queue.notify(POLLIN);
         }
 
         Ok(nbytes)
@@ -347,15 +379,45 @@ impl Device for Serial {
     }
 
     fn read(&self, _pos: u64, buf: &mut [u8], is_nonblocking: bool) -> Result<usize, ErrorKind> {
-        self.fifo_rx(buf, is_nonblocking).map_err(|e| e.into())
+        self.fifo_rx(&mut [buf], is_nonblocking)
+            .map_err(|e| e.into())
+    }
+
+    fn readv(
+        &self,
+        _pos: u64,
+        bufs: &mut [&mut [u8]],
+        is_nonblocking: bool,
+    ) -> Result<usize, ErrorKind> {
+        self.fifo_rx(bufs, is_nonblocking).map_err(|e| e.into())
     }
 
     fn write(&self, _pos: u64, buf: &[u8], is_nonblocking: bool) -> Result<usize, ErrorKind> {
-        self.fifo_tx(buf, is_nonblocking).map_err(|e| e.into())
+        self.fifo_tx(&[buf], is_nonblocking).map_err(|e| e.into())
+    }
+
+    fn writev(&self, _pos: u64, bufs: &[&[u8]], is_nonblocking: bool) -> Result<usize, ErrorKind> {
+        self.fifo_tx(bufs, is_nonblocking).map_err(|e| e.into())
     }
 
     fn ioctl(&self, request: u32, arg: usize) -> Result<(), ErrorKind> {
         let mut uart_ops = self.uart_ops.irqsave_lock();
         uart_ops.ioctl(request, arg).map_err(|e| e.into())
     }
+
+    // Readable with any data received, writable with room in the tx
+    // fifo. Polls are notified when readers and writers are woken.
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        if let Some(watch) = watch {
+            self.poll_queue.register(watch);
+        }
+        let mut events = 0;
+        if !self.rx_fifo.rb.is_empty() {
+            events |= POLLIN;
+        }
+        if !self.tx_fifo.rb.is_full() {
+            events |= POLLOUT;
+        }
+        events
+    }
 }
@@ -15,7 +15,7 @@
 use crate::devices::block::init_virtio_block;
 use alloc::alloc::{alloc_zeroed, dealloc, handle_alloc_error};
 use core::{alloc::Layout, mem::size_of, ptr::NonNull};
-use flat_device_tree::Fdt;
+use flat_device_tree::{node::FdtNode, Fdt};
 use log::{debug, error, warn};
 use virtio_drivers::{
     device::blk::VirtIOBlk,
@@ -67,7 +67,7 @@ fn find_virtio_mmio_devices(fdt: &Fdt) {
                                     transport.version(),
                                     transport.read_device_features(),
                                 );
-                                init_virtio_device(transport.into());
+                                init_virtio_device(transport.into(), header, node);
                             }
                         }
                     }
@@ -79,13 +79,41 @@ fn find_virtio_mmio_devices(fdt: &Fdt) {
     }
 }
 
-fn init_virtio_device(transport: SomeTransport<'static>) {
+fn init_virtio_device(
+    transport: SomeTransport<'static>,
+    header: NonNull<VirtIOHeader>,
+    node: FdtNode,
+) {
     match transport.device_type() {
         DeviceType::Network => {
-            crate::devices::net::virtio_net_device::register_virtio_net_device(transport);
+            #[cfg(target_arch = "aarch64")]
+            let has_irq = irq_of(&node).is_some_and(|(irq, trigger)| {
+                crate::devices::net::virtio_net_device::enable_irq(irq, trigger, header)
+            });
+            #[cfg(not(target_arch = "aarch64"))]
+            let has_irq = {
+                let _ = (header, node);
+                false
+            };
+            if !has_irq {
+                warn!("No interrupt for virtio net, polling instead");
+            }
+            crate::devices::net::virtio_net_device::register_virtio_net_device(transport, has_irq);
         }
         DeviceType::Block => {
-            if let Err(e) = init_virtio_block(VirtIOBlk::new(transport).unwrap()) {
+            #[cfg(target_arch = "aarch64")]
+            let completions = irq_of(&node).and_then(|(irq, trigger)| {
+                crate::devices::block::virtio_blk::enable_irq(irq, trigger, header)
+            });
+            #[cfg(not(target_arch = "aarch64"))]
+            let completions = {
+                let _ = (header, node);
+                None
+            };
+            if completions.is_none() {
+                warn!("No interrupt for virtio blk, polling instead");
+            }
+            if let Err(e) = init_virtio_block(VirtIOBlk::new(transport).unwrap(), completions) {
                 error!("Failed to init virtio blk, {:?}", e);
             }
         }
@@ -95,6 +123,102 @@ fn init_virtio_device(transport: SomeTransport<'static>) {
     }
 }
 
+// Parse the first interrupt of a node, which is <type number flags> on
+// the GIC.
+#[cfg(target_arch = "aarch64")]
+fn irq_of(node: &FdtNode) -> Option<(crate::arch::irq::IrqNumber, crate::arch::irq::IrqTrigger)> {
+    use crate::arch::irq::{IrqNumber, IrqTrigger};
+    let value = node.property("interrupts")?.value;
+    let cell = |i: usize| {
+        let bytes = value.get(i * 4..i * 4 + 4)?;
+        Some(u32::from_be_bytes(bytes.try_into().unwrap()))
+    };
+    let irq = match (cell(0)?, cell(1)?) {
+        // SPI
+        (0, n) => IrqNumber::new(n + 32),
+        // PPI
+        (1, n) => IrqNumber::new(n + 16),
+        _ => return None,
+    };
+    // Bits 0 and 1 are for edge triggered interrupts.
+    let trigger = if cell(2)? & 0x3 != 0 {
+        IrqTrigger::Edge
+    } else {
+        IrqTrigger::Level
+    };
+    Some((irq, trigger))
+}
+
+#[cfg(target_arch = "aarch64")]
+pub(crate) use irq::enable_irq;
+
+#[cfg(target_arch = "aarch64")]
+mod irq {
+    use crate::{
+        arch::{
+            self,
+            irq::{self, IrqHandler, IrqNumber, IrqTrigger},
+        },
+        irq::IrqTrace,
+    };
+    use alloc::boxed::Box;
+    use core::ptr::NonNull;
+    use virtio_drivers::transport::mmio::VirtIOHeader;
+
+    // Offsets of registers in the virtio MMIO header.
+    const INTERRUPT_STATUS: usize = 0x60;
+    const INTERRUPT_ACK: usize = 0x64;
+
+    // The interrupt is acknowledged with the registers of the transport
+    // directly, since the driver might be locked by the thread
+    // interrupted.
+    struct VirtioIrq {
+        irq: IrqNumber,
+        header: NonNull<VirtIOHeader>,
+        notify: Box<dyn Fn() + Send + Sync>,
+    }
+
+    // SAFETY: The header is only accessed by volatile loads and stores.
+    unsafe impl Send for VirtioIrq {}
+    unsafe impl Sync for VirtioIrq {}
+
+    impl IrqHandler for VirtioIrq {
+        fn handle(&mut self) {
+            let _trace = IrqTrace::new(self.irq);
+            let base = self.header.as_ptr() as *mut u8;
+            // SAFETY: The header is mapped, InterruptStatus and
+            // InterruptACK are at these offsets of a virtio MMIO device.
+            unsafe {
+                let status = (base.add(INTERRUPT_STATUS) as *const u32).read_volatile();
+                (base.add(INTERRUPT_ACK) as *mut u32).write_volatile(status);
+            }
+            (self.notify)();
+        }
+    }
+
+    // Route the interrupt of the device at `header` to the current core,
+    // `notify` is called on every interrupt.
+    pub(crate) fn enable_irq(
+        irq: IrqNumber,
+        trigger: IrqTrigger,
+        header: NonNull<VirtIOHeader>,
+        notify: Box<dyn Fn() + Send + Sync>,
+    ) -> bool {
+        let handler = VirtioIrq {
+            irq,
+            header,
+            notify,
+        };
+        let cpu_id = arch::current_cpu_id();
+        irq::set_trigger(irq, cpu_id, trigger);
+        if irq::register_handler(irq, Box::new(handler)).is_err() {
+            return false;
+        }
+        irq::enable_irq_with_priority(irq, cpu_id, irq::Priority::Normal);
+        true
+    }
+}
+
 #[derive(Debug)]
 pub struct VirtioHal;
 
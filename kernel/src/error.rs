@@ -47,6 +47,8 @@ pub mod code {
     pub const EXDEV: super::Error = super::Error(-libc::EXDEV);
     pub const EILSEQ: super::Error = super::Error(-libc::EILSEQ);
     pub const ENOTSUP: super::Error = super::Error(-libc::ENOTSUP);
+    pub const EDEADLK: super::Error = super::Error(-libc::EDEADLK);
+    pub const EMFILE: super::Error = super::Error(-libc::EMFILE);
 }
 
 const UNKNOW_STR: &CStr = c"EUNKNOW ";
@@ -77,6 +79,8 @@ const ELOOP_STR: &CStr = c"Too many symbolic links encountered";
 const EXDEV_STR: &CStr = c"Cross-device link";
 const EILSEQ_STR: &CStr = c"Invalid data";
 const ENOTSUP_STR: &CStr = c"Not supported";
+const EDEADLK_STR: &CStr = c"Resource deadlock would occur";
+const EMFILE_STR: &CStr = c"Too many open files";
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 #[repr(transparent)]
@@ -121,6 +125,8 @@ impl Error {
             code::EXDEV => EXDEV_STR,
             code::EILSEQ => EILSEQ_STR,
             code::ENOTSUP => ENOTSUP_STR,
+            code::EDEADLK => EDEADLK_STR,
+            code::EMFILE => EMFILE_STR,
             _ => UNKNOW_STR,
         }
     }
@@ -32,6 +32,12 @@ impl IrqTrace {
 
     fn enter(&self) {
         let _ = IRQ_NEST_COUNT[arch::current_cpu_id()].fetch_add(1, Ordering::Relaxed);
+        #[cfg(sched_trace)]
+        crate::scheduler::trace::record(
+            crate::scheduler::trace::Kind::IrqEnter,
+            usize::from(self.irq_number),
+            0,
+        );
         #[cfg(procfs)]
         {
             let trace_info: &irq_trace::IrqTraceInfo =
@@ -43,6 +49,12 @@ impl IrqTrace {
 
     fn leave(&self) {
         let _ = IRQ_NEST_COUNT[arch::current_cpu_id()].fetch_sub(1, Ordering::Relaxed);
+        #[cfg(sched_trace)]
+        crate::scheduler::trace::record(
+            crate::scheduler::trace::Kind::IrqLeave,
+            usize::from(self.irq_number),
+            0,
+        );
         #[cfg(procfs)]
         {
             let current_cycle = time::get_sys_cycles();
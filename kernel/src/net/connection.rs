@@ -16,15 +16,19 @@ use crate::{
     error::{code, Error},
     net::{
         connection_err::ConnectionError,
-        net_manager::NetworkManager,
+        net_manager::{self, Engine, NetworkManager},
         port_generator::PORT_GENERATOR,
         socket::{
-            socket_err::SocketError, FnRecv, FnRecvWithEndpoint, FnSend, FnSendMsg, PosixSocket,
+            socket_err::SocketError, FnRecv, FnRecvBatch, FnRecvWithEndpoint, FnSend, FnSendMsg,
+            PosixSocket, SendBatch,
         },
         SocketDomain, SocketFd, SocketProtocol, SocketResult, SocketType,
     },
     scheduler::{self, yield_me},
-    sync::atomic_wait as futex,
+    sync::{
+        atomic_wait as futex,
+        poll::{PollSource, PollWatch, POLLOUT},
+    },
     thread::Thread,
 };
 use alloc::{boxed::Box, rc::Rc, sync::Arc};
@@ -40,6 +44,10 @@ use spin::Mutex;
 // For posix syscalls
 pub type ConnectionResult = Result<usize, ConnectionError>;
 
+// States of Connection::engine other than an engine index.
+const ENGINE_NONE: usize = usize::MAX;
+const ENGINE_CREATING: usize = usize::MAX - 1;
+
 pub struct Connection {
     socket_fd: SocketFd,
     socket_domain: SocketDomain,
@@ -51,6 +59,12 @@ pub struct Connection {
     recv_timeout: Mutex<Option<Duration>>, // block indefinitely as default
     send_timeout: Mutex<Option<Duration>>, // block indefinitely as default
     ipc_reply: Arc<OperationIPCReply>,
+    // Index of the engine the socket is created in, ENGINE_NONE until
+    // then and ENGINE_CREATING while the create request is in flight.
+    // Other requests wait on it as a futex meanwhile.
+    engine: AtomicUsize,
+    // Events the socket is ready for, published by its engine.
+    readiness: Arc<PollSource>,
 }
 
 impl Connection {
@@ -71,6 +85,12 @@ impl Connection {
             recv_timeout: Mutex::new(None),
             send_timeout: Mutex::new(None),
             ipc_reply: Arc::new(OperationIPCReply::new()),
+            engine: AtomicUsize::new(ENGINE_NONE),
+            // Datagrams can be sent before the socket is created.
+            readiness: Arc::new(PollSource::new(match socket_type {
+                SocketType::SockStream => 0,
+                _ => POLLOUT,
+            })),
         }
     }
 
@@ -79,17 +99,68 @@ impl Connection {
     }
 
     pub fn create(&mut self) -> ConnectionResult {
+        // With several engines, the socket is created once it's known
+        // which engine serves it.
+        if net_manager::single_engine() {
+            self.engine(None)?;
+        }
+        Ok(0)
+    }
+
+    // Return the engine of the socket. The socket is created in the
+    // engine serving `addr` by the first request needing it.
+    fn engine(&self, addr: Option<IpAddress>) -> Result<&'static Engine, ConnectionError> {
+        loop {
+            match self.engine.compare_exchange(
+                ENGINE_NONE,
+                ENGINE_CREATING,
+                Ordering::AcqRel,
+                Ordering::Acquire,
+            ) {
+                Ok(_) => break,
+                Err(ENGINE_CREATING) => {
+                    let _ = futex::atomic_wait(&self.engine, ENGINE_CREATING, None);
+                }
+                Err(i) => return Ok(net_manager::engine(i)),
+            }
+        }
+        let i = net_manager::route(self.socket_type, addr);
         let create_task = Operation::Create {
             socket_fd: self.socket_fd,
             socket_domain: self.socket_domain,
             socket_type: self.socket_type,
             socket_protocol: self.socket_protocol,
             ipc_reply: self.ipc_reply.clone(),
+            readiness: self.readiness.clone(),
         };
 
         log::debug!("[Socket {}] Create request queued", self.socket_fd);
 
-        self.ipc_reply.queue_and_wait(create_task)
+        let result = self
+            .ipc_reply
+            .queue_and_wait(net_manager::engine(i), create_task);
+        // A failed create is retried by the next request.
+        self.engine.store(
+            if result.is_ok() { i } else { ENGINE_NONE },
+            Ordering::Release,
+        );
+        let _ = futex::atomic_wake(&self.engine, usize::MAX);
+        result?;
+        Ok(net_manager::engine(i))
+    }
+
+    // Return the index of the engine the socket is created in, waiting
+    // for the create request in flight if any.
+    fn created_engine(&self) -> Option<usize> {
+        loop {
+            match self.engine.load(Ordering::Acquire) {
+                ENGINE_NONE => return None,
+                ENGINE_CREATING => {
+                    let _ = futex::atomic_wait(&self.engine, ENGINE_CREATING, None);
+                }
+                i => return Some(i),
+            }
+        }
     }
 
     pub fn bind(&self, local_endpoint: IpEndpoint) -> ConnectionResult {
@@ -121,6 +192,16 @@ impl Connection {
                 local_endpoint
             };
 
+            // With several engines, a stream socket bound to an
+            // unspecified address is created by listen() or connect(),
+            // whose engine depends on the peer.
+            if self.socket_type == SocketType::SockStream
+                && self.created_engine().is_none()
+                && local_endpoint.addr.is_none_or(|addr| addr.is_unspecified())
+            {
+                return Ok(0);
+            }
+
             let bind_task = Operation::Bind {
                 socket_fd: self.socket_fd,
                 local_endpoint,
@@ -130,7 +211,8 @@ impl Connection {
             log::debug!("[Socket {}] Bind request queued", self.socket_fd);
 
             // Wait for network stack response and return directly
-            self.ipc_reply.queue_and_wait(bind_task)
+            self.ipc_reply
+                .queue_and_wait(self.engine(local_endpoint.addr)?, bind_task)
         } else {
             Err(ConnectionError::UnsupportedSocketType(self.socket_type))
         }
@@ -142,6 +224,18 @@ impl Connection {
             None => return Err(ConnectionError::LockFail("local endpoint".into())),
         };
 
+        // Finish a bind left to listen().
+        let is_bound = self.created_engine().is_some();
+        let engine = self.engine(local_endpoint.addr)?;
+        if !is_bound {
+            let bind_task = Operation::Bind {
+                socket_fd: self.socket_fd,
+                local_endpoint,
+                ipc_reply: self.ipc_reply.clone(),
+            };
+            self.ipc_reply.queue_and_wait(engine, bind_task)?;
+        }
+
         let listen_task = Operation::Listen {
             socket_fd: self.socket_fd,
             local_endpoint,
@@ -151,7 +245,7 @@ impl Connection {
         log::debug!("[Socket {}] Listen request queued", self.socket_fd);
 
         // Wait for network stack response and return directly
-        self.ipc_reply.queue_and_wait(listen_task)
+        self.ipc_reply.queue_and_wait(engine, listen_task)
     }
 
     pub fn connect(&self, remote_endpoint: IpEndpoint) -> ConnectionResult {
@@ -180,7 +274,22 @@ impl Connection {
 
         log::debug!("[Socket {}] Connect request queued", self.socket_fd);
 
-        self.ipc_reply.queue_and_wait(connect_task)
+        self.ipc_reply
+            .queue_and_wait(self.engine(Some(remote_endpoint.addr))?, connect_task)
+    }
+
+    /// The events the socket is ready for, as last published by its
+    /// engine. With a watch, the engine is woken up to publish them.
+    pub fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        let events = self.readiness.poll(watch);
+        // If being created, it's published once created.
+        if watch.is_some() {
+            let i = self.engine.load(Ordering::Acquire);
+            if i != ENGINE_NONE && i != ENGINE_CREATING {
+                net_manager::engine(i).wake_up();
+            }
+        }
+        events
     }
 
     pub fn shutdown(&self) -> ConnectionResult {
@@ -193,8 +302,14 @@ impl Connection {
         // Log successful request submission
         log::debug!("[Socket {}] Shutdown request queued", self.socket_fd);
 
+        // Nothing to shut down if the socket isn't created yet
+        let Some(engine) = self.created_engine() else {
+            return Ok(0);
+        };
+
         // Await and return final shutdown status from network stack
-        self.ipc_reply.queue_and_wait(shutdown_task)
+        self.ipc_reply
+            .queue_and_wait(net_manager::engine(engine), shutdown_task)
     }
 
     pub fn recv(&self, f: FnRecv) -> ConnectionResult {
@@ -210,7 +325,7 @@ impl Connection {
         log::debug!("[Socket {}] Recv request queued", self.socket_fd);
 
         // Wait for network stack response and convert result
-        self.ipc_reply.queue_and_wait(recv_task)
+        self.ipc_reply.queue_and_wait(self.engine(None)?, recv_task)
     }
 
     pub fn recvfrom(&self, f: FnRecvWithEndpoint) -> ConnectionResult {
@@ -226,7 +341,7 @@ impl Connection {
         log::debug!("[Socket {}] RecvFrom request queued", self.socket_fd);
 
         // Wait for network stack response and convert result
-        self.ipc_reply.queue_and_wait(recv_task)
+        self.ipc_reply.queue_and_wait(self.engine(None)?, recv_task)
     }
 
     pub fn send(&self, f: FnSend, _flag: i32) -> ConnectionResult {
@@ -241,7 +356,7 @@ impl Connection {
         // Log successful request submission
         log::debug!("[Socket {}] Send request queued", self.socket_fd);
 
-        self.ipc_reply.queue_and_wait(send_task)
+        self.ipc_reply.queue_and_wait(self.engine(None)?, send_task)
     }
 
     pub fn sendto(
@@ -250,22 +365,7 @@ impl Connection {
         _flag: i32,
         remote_endpoint: IpEndpoint,
     ) -> ConnectionResult {
-        // Allocate dynamic port while not bound in UDP
-        let local_port = {
-            if self.socket_type == SocketType::SockDgram {
-                let mut endpoint = self.local_endpoint.lock();
-                if endpoint.is_none() {
-                    let local_port = PORT_GENERATOR.acquire_port(self.socket_type, 0)?;
-                    endpoint.replace((local_port).into());
-                    Some(local_port)
-                } else {
-                    // endpoint is some() means already bind
-                    None
-                }
-            } else {
-                None
-            }
-        };
+        let local_port = self.acquire_local_port()?;
 
         // Construct send request with buffer reference
         let sendto_task = Operation::SendTo {
@@ -284,7 +384,84 @@ impl Connection {
             message.len()
         );
 
-        self.ipc_reply.queue_and_wait(sendto_task)
+        self.ipc_reply
+            .queue_and_wait(self.engine(Some(remote_endpoint.addr))?, sendto_task)
+    }
+
+    // Allocate dynamic port while not bound in UDP, return the port to
+    // bind the socket to.
+    fn acquire_local_port(&self) -> Result<Option<u16>, ConnectionError> {
+        if self.socket_type != SocketType::SockDgram {
+            return Ok(None);
+        }
+        let mut endpoint = self.local_endpoint.lock();
+        if endpoint.is_none() {
+            let local_port = PORT_GENERATOR.acquire_port(self.socket_type, 0)?;
+            endpoint.replace((local_port).into());
+            Ok(Some(local_port))
+        } else {
+            // endpoint is some() means already bind
+            Ok(None)
+        }
+    }
+
+    // Send a batch of datagrams in one request, return the number sent.
+    // If `post` is set, return as soon as the request is queued, with
+    // the number queued, and drop datagrams the socket can't take.
+    pub fn sendmmsg(&self, msgs: SendBatch, post: bool) -> ConnectionResult {
+        let Some(&(first, _)) = msgs.first() else {
+            return Ok(0);
+        };
+        let local_port = self.acquire_local_port()?;
+        let engine = self.engine(Some(first.addr))?;
+        let count = msgs.len();
+
+        log::debug!(
+            "[Socket {}] SendMmsg request queued ({} messages)",
+            self.socket_fd,
+            count
+        );
+
+        if post {
+            // Nobody waits for the reply.
+            let sendmmsg_task = Operation::SendMmsg {
+                socket_fd: self.socket_fd,
+                msgs,
+                local_port,
+                is_nonblocking: true,
+                ipc_reply: Arc::new(OperationIPCReply::new()),
+            };
+            return engine
+                .enqueue(sendmmsg_task)
+                .map(|()| count)
+                .map_err(|_| ConnectionError::NetStackQueueFull);
+        }
+
+        let sendmmsg_task = Operation::SendMmsg {
+            socket_fd: self.socket_fd,
+            msgs,
+            local_port,
+            is_nonblocking: self.is_nonblocking.load(Ordering::Acquire),
+            ipc_reply: self.ipc_reply.clone(),
+        };
+        self.ipc_reply.queue_and_wait(engine, sendmmsg_task)
+    }
+
+    // Receive up to `vlen` datagrams in one request, return the number
+    // received.
+    pub fn recvmmsg(&self, f: FnRecvBatch, vlen: usize) -> ConnectionResult {
+        let recvmmsg_task = Operation::RecvMmsg {
+            socket_fd: self.socket_fd,
+            f,
+            vlen,
+            is_nonblocking: self.is_nonblocking.load(Ordering::Acquire),
+            ipc_reply: self.ipc_reply.clone(),
+        };
+
+        log::debug!("[Socket {}] RecvMmsg request queued", self.socket_fd);
+
+        self.ipc_reply
+            .queue_and_wait(self.engine(None)?, recvmmsg_task)
     }
 
     // ICMP/ICMPv6 only now
@@ -309,7 +486,8 @@ impl Connection {
         // Log successful request submission
         log::debug!("[Socket {}] SendMsg request queued", self.socket_fd);
 
-        self.ipc_reply.queue_and_wait(sendmsg_task)
+        self.ipc_reply
+            .queue_and_wait(self.engine(Some(remote_endpoint.addr))?, sendmsg_task)
     }
 
     pub fn recvmsg(&self, f: FnRecvWithEndpoint) -> ConnectionResult {
@@ -324,7 +502,8 @@ impl Connection {
         // Log successful request submission
         log::debug!("[Socket {}] RecvMsg request queued", self.socket_fd);
 
-        self.ipc_reply.queue_and_wait(sendmsg_task)
+        self.ipc_reply
+            .queue_and_wait(self.engine(None)?, sendmsg_task)
     }
 
     // Set recv timeout : ref to libc::SO_RCVTIMEO
@@ -380,13 +559,18 @@ impl Connection {
         ipc_reply: Arc<OperationIPCReply>,
         f: F,
     ) {
-        if let Some(posix_socket) = network_manager.borrow_mut().get_posix_socket(socket_fd) {
+        let posix_socket = network_manager.borrow().get_posix_socket(socket_fd);
+        if let Some(posix_socket) = posix_socket {
             if posix_socket.borrow().is_shutdown() {
                 log::debug!("Socket {} already shutdown", socket_fd);
                 return;
             }
 
             if let Some(result) = f(posix_socket) {
+                // Polls see the socket as the client will.
+                network_manager
+                    .borrow_mut()
+                    .publish_readiness(Some(socket_fd));
                 ipc_reply.wakeup_client(result, socket_fd);
             }
         } else {
@@ -395,8 +579,13 @@ impl Connection {
     }
 
     pub fn handle_socket_msg(network_manager: Rc<RefCell<NetworkManager<'static>>>) -> bool {
-        // one msg at a time , TODO batch
-        if let Some(socket_request) = NETSTACK_QUEUE.dequeue() {
+        let engine = network_manager.borrow().engine();
+        // Drain the queue, but only a queue worth at a time since
+        // requests handled might queue more.
+        for _ in 0..NETSTACK_QUEUE_SIZE {
+            let Some(socket_request) = engine.dequeue() else {
+                return true;
+            };
             match socket_request {
                 Operation::Create {
                     socket_fd,
@@ -404,17 +593,22 @@ impl Connection {
                     socket_type,
                     socket_protocol,
                     ipc_reply,
+                    readiness,
                 } => {
                     log::debug!("[Connection] handle Create socket_fd={}", socket_fd);
 
                     let network_manager_ref = network_manager.clone();
-                    let _ = network_manager.borrow_mut().create_posix_socket(
+                    let mut network_manager = network_manager.borrow_mut();
+                    if network_manager.create_posix_socket(
                         socket_fd,
                         network_manager_ref,
                         socket_domain,
                         socket_type,
                         socket_protocol,
-                    );
+                    ) == socket_fd
+                    {
+                        network_manager.add_poll_source(socket_fd, readiness);
+                    }
 
                     ipc_reply.wakeup_client(Ok(0), socket_fd);
                 }
@@ -673,6 +867,70 @@ impl Connection {
                         },
                     );
                 }
+                Operation::SendMmsg {
+                    socket_fd,
+                    msgs,
+                    local_port,
+                    is_nonblocking,
+                    ipc_reply,
+                } => {
+                    log::debug!("[Connection] handle SendMmsg socket_fd={}", socket_fd);
+
+                    Connection::with_posix_socket(
+                        network_manager.clone(),
+                        socket_fd,
+                        ipc_reply.clone(),
+                        |posix_socket| {
+                            let mut posix_socket = posix_socket.borrow_mut();
+                            let result = posix_socket.sendmmsg(
+                                msgs,
+                                local_port,
+                                is_nonblocking,
+                                ipc_reply.clone(),
+                            );
+
+                            if let Err(SocketError::WouldBlock) = result.as_ref() {
+                                log::debug!(
+                                    "[Connection] handle SendMmsg socket_fd={} , blocking wait for socket",
+                                    socket_fd,
+                                );
+                                None
+                            } else {
+                                Some(result)
+                            }
+                        },
+                    );
+                }
+                Operation::RecvMmsg {
+                    socket_fd,
+                    f,
+                    vlen,
+                    is_nonblocking,
+                    ipc_reply,
+                } => {
+                    log::debug!("[Connection] handle RecvMmsg socket_fd={}", socket_fd);
+
+                    Connection::with_posix_socket(
+                        network_manager.clone(),
+                        socket_fd,
+                        ipc_reply.clone(),
+                        |posix_socket| {
+                            let mut posix_socket = posix_socket.borrow_mut();
+                            let result =
+                                posix_socket.recvmmsg(f, vlen, is_nonblocking, ipc_reply.clone());
+
+                            if let Err(SocketError::WouldBlock) = result.as_ref() {
+                                log::debug!(
+                                    "[Connection] handle RecvMmsg socket_fd={} , blocking wait for socket",
+                                    socket_fd,
+                                );
+                                None
+                            } else {
+                                Some(result)
+                            }
+                        },
+                    );
+                }
                 Operation::Bind {
                     socket_fd,
                     local_endpoint,
@@ -706,6 +964,8 @@ impl Connection {
                 }
             }
         }
+        // Come back for the rest.
+        engine.wake_up();
         true
     }
 }
@@ -719,9 +979,10 @@ impl Drop for Connection {
     }
 }
 
-// MPSC Queue from heapless requires CAS atomic instructions which are not available on all architectures
-pub static NETSTACK_QUEUE: heapless::mpmc::MpMcQueue<Operation, 32> =
-    heapless::mpmc::MpMcQueue::<Operation, 32>::new();
+// Capacity of the request queue of an engine. The queue is an Mpsc,
+// which needs CAS atomic instructions, and its capacity must be a power
+// of two.
+pub(crate) const NETSTACK_QUEUE_SIZE: usize = 32;
 
 // for socket operation
 pub type OperationResult = Result<usize, SocketError>;
@@ -745,7 +1006,7 @@ impl OperationIPCReply {
         }
     }
 
-    fn queue_and_wait(&self, task: Operation) -> ConnectionResult {
+    fn queue_and_wait(&self, engine: &Engine, task: Operation) -> ConnectionResult {
         // Must store before enqueue, our connection suppose to be only one thread can write at one time
         while self.reply_futex.load(Ordering::Acquire) != STATE_IDLE {
             yield_me();
@@ -754,7 +1015,7 @@ impl OperationIPCReply {
             .store(STATE_WAITING_FOR_CONSUME, Ordering::Release);
 
         // Enqueue creation request to network loop
-        NETSTACK_QUEUE.enqueue(task).map_err(|_| {
+        engine.enqueue(task).map_err(|_| {
             // TODO when queue is full , return POSIX EAGAIN error
             //      user can retry in some calls like send/recv, but not for connect / bind which has state change
             self.reply_futex.store(STATE_IDLE, Ordering::Release);
@@ -848,6 +1109,7 @@ pub enum Operation {
         socket_type: SocketType,
         socket_protocol: SocketProtocol,
         ipc_reply: Arc<OperationIPCReply>,
+        readiness: Arc<PollSource>,
     },
     Listen {
         socket_fd: SocketFd,
@@ -921,6 +1183,23 @@ pub enum Operation {
         local_endpoint: IpListenEndpoint,
         ipc_reply: Arc<OperationIPCReply>,
     },
+
+    /// Send a batch of datagrams
+    /// only support for connectionless-mode socket like udp now
+    SendMmsg {
+        socket_fd: SocketFd,
+        msgs: SendBatch,
+        local_port: Option<u16>,
+        is_nonblocking: bool,
+        ipc_reply: Arc<OperationIPCReply>,
+    },
+    RecvMmsg {
+        socket_fd: SocketFd,
+        f: FnRecvBatch,
+        vlen: usize,
+        is_nonblocking: bool,
+        ipc_reply: Arc<OperationIPCReply>,
+    },
 }
 
 #[cfg(test)]
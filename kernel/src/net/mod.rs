@@ -382,6 +382,13 @@ pub struct SocketMsghdr {
     pub msg_flags: libc::c_int,
 }
 
+/// The struct mmsghdr of sendmmsg() and recvmmsg()
+#[repr(C)]
+pub struct SocketMmsghdr {
+    pub msg_hdr: SocketMsghdr,
+    pub msg_len: libc::c_uint,
+}
+
 impl core::fmt::Debug for SocketMsghdr {
     fn fmt(&self, f: &mut core::fmt::Formatter) -> core::fmt::Result {
         f.debug_struct("SocketMsghdr")
@@ -499,6 +506,9 @@ impl SocketMsghdr {
     }
 
     pub fn packet_len(&self) -> usize {
+        if self.msg_iov.is_null() {
+            return 0;
+        }
         unsafe { core::slice::from_raw_parts(self.msg_iov, self.msg_iovlen as usize) }
             .iter()
             .map(|iov| iov.iov_len)
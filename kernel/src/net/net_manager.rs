@@ -18,12 +18,16 @@ use crate::{
     allocator,
     config::MAX_THREAD_PRIORITY,
     net::{
-        connection::Connection,
+        connection::{Connection, Operation, NETSTACK_QUEUE_SIZE},
         net_interface::NetInterface,
         socket::{icmp::IcmpSocket, tcp::TcpSocket, udp::UdpSocket, PosixSocket},
         SocketDomain, SocketFd, SocketProtocol, SocketType,
     },
     scheduler,
+    sync::{
+        atomic_wait::{atomic_wait, atomic_wake},
+        poll::{PollSource, POLLHUP, POLLIN, POLLRDHUP},
+    },
     thread::{self, Builder as ThreadBuilder, Entry, Stack, SystemThreadStorage, ThreadNode},
     time::{tick_from_millisecond, tick_get_millisecond},
 };
@@ -32,11 +36,20 @@ use alloc::{
     collections::btree_map::BTreeMap,
     rc::Rc,
     string::{String, ToString},
+    sync::Arc,
     vec::Vec,
 };
+use blueos_infra::ring::Mpsc;
 use blueos_kconfig::NETWORK_STACK_SIZE;
-use core::{cell::RefCell, mem::MaybeUninit, time};
+use core::{
+    cell::RefCell,
+    ffi::c_void,
+    mem::MaybeUninit,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+    time,
+};
 use smoltcp::{
+    iface::PollResult,
     time::{Duration, Instant},
     wire::{IpAddress, IpEndpoint},
 };
@@ -44,8 +57,11 @@ use smoltcp::{
 const DEFAULT_DELAY_TIME_IN_MILLIS: u64 = 100;
 
 pub struct NetworkManager<'a> {
+    engine: usize,
     net_interfaces: Vec<Rc<RefCell<NetInterface<'a>>>>,
     socket_maps: BTreeMap<SocketFd, Rc<RefCell<dyn PosixSocket>>>,
+    // Where the readiness of sockets is published for polls.
+    poll_sources: BTreeMap<SocketFd, Arc<PollSource>>,
     default_interface: Option<Rc<RefCell<NetInterface<'a>>>>,
 }
 
@@ -54,18 +70,18 @@ where
     'a: 'static,
 {
     // Using Rc<RefCell<T>> while `static T` need T to impl Sync in rust
-    pub fn init() -> Rc<RefCell<NetworkManager<'a>>> {
-        let manager = NetworkManager::new();
+    pub fn init(engine: usize) -> Rc<RefCell<NetworkManager<'a>>> {
+        let manager = NetworkManager::new(engine);
         Rc::new(RefCell::new(manager))
     }
 
     // It will only access by a standalone tcp/ip stack thread, so no need for Critical Section .
-    fn new() -> Self {
+    fn new(engine: usize) -> Self {
         let mut net_interfaces = Vec::new();
         let socket_maps = BTreeMap::new();
         let mut default_interface = None;
 
-        // Add Loopback interface which always exist
+        // Add Loopback interface which always exist, in every engine
         let dev = NetInterface::create_loopback_interface();
         let rc = Rc::new(RefCell::new(dev));
         log::debug!("Add NetDevice : Loopback");
@@ -76,7 +92,7 @@ where
 
         // Add other interfaces which may not exist
         #[cfg(virtio)]
-        if net_dev_exist() {
+        if (!cfg!(net_stack_per_interface) || engine == DEVICE_ENGINE) && net_dev_exist() {
             let dev = NetInterface::create_virtio_device();
             let rc = Rc::new(RefCell::new(dev));
             net_interfaces.push(rc.clone());
@@ -87,12 +103,19 @@ where
         }
 
         Self {
+            engine,
             net_interfaces,
             socket_maps,
+            poll_sources: BTreeMap::new(),
             default_interface,
         }
     }
 
+    /// The engine running this stack.
+    pub fn engine(&self) -> &'static Engine {
+        &ENGINES[self.engine]
+    }
+
     pub fn create_posix_socket(
         &mut self,
         socket_fd: SocketFd,
@@ -136,6 +159,44 @@ where
         self.socket_maps.get(&socket_fd).cloned()
     }
 
+    pub fn add_poll_source(&mut self, socket_fd: SocketFd, source: Arc<PollSource>) {
+        self.poll_sources.insert(socket_fd, source);
+    }
+
+    /// Publish what socket `socket_fd`, or every socket if None, is
+    /// ready for. Only sockets being watched are looked at, sockets
+    /// shut down are hung up and forgotten.
+    pub fn publish_readiness(&mut self, socket_fd: Option<SocketFd>) {
+        let socket_maps = &self.socket_maps;
+        let publish = |socket_fd: &SocketFd, source: &mut Arc<PollSource>| -> bool {
+            let Some(socket) = socket_maps.get(socket_fd) else {
+                source.publish(POLLHUP);
+                return false;
+            };
+            let Ok(mut socket) = socket.try_borrow_mut() else {
+                return true;
+            };
+            if socket.is_shutdown() {
+                source.publish(POLLIN | POLLRDHUP | POLLHUP);
+                return false;
+            }
+            if source.is_watched() {
+                source.publish(socket.poll_events());
+            }
+            true
+        };
+        match socket_fd {
+            Some(socket_fd) => {
+                if let Some(source) = self.poll_sources.get_mut(&socket_fd) {
+                    if !publish(&socket_fd, source) {
+                        self.poll_sources.remove(&socket_fd);
+                    }
+                }
+            }
+            None => self.poll_sources.retain(publish),
+        }
+    }
+
     pub fn bind_defualt_smoltcp_interface(&self, socket_fd: SocketFd) {
         if let Some(socket) = self.socket_maps.get(&socket_fd) {
             // Use default net interface when we find no subnet match with remote_addr
@@ -195,10 +256,15 @@ where
         );
 
         let net_manager = network_manager.clone();
+        let engine = network_manager.borrow().engine();
 
         // Loop for request finish
         while is_forever || tick_get_millisecond() < timeout {
+            // Events after this point make the wait below return at once.
+            let seen = engine.events.load(Ordering::Acquire);
+
             // Step1 : poll smoltcp network stack
+            let mut changed = false;
             {
                 let network_manager = network_manager.borrow();
 
@@ -206,9 +272,10 @@ where
                     |interface| -> Result<(), String> {
                         let millis_i64 =
                             i64::try_from(tick_get_millisecond()).map_err(|e| e.to_string())?;
-                        interface
+                        let result = interface
                             .borrow_mut()
                             .poll(Instant::from_millis(millis_i64));
+                        changed |= matches!(result, PollResult::SocketStateChanged);
                         Ok(())
                     },
                 ) {
@@ -219,75 +286,192 @@ where
                 }
             }
 
-            // Step 2 : handle msg from event queue
+            // Step 2 : handle all msgs from event queue
             if !f(net_manager.clone()) {
                 log::warn!("[NetworkManager]: looper exit");
                 break;
             }
 
-            // Step3 : get next poll time from smoltcp network stack
-            {
+            // Sockets might have got ready by both steps above.
+            network_manager.borrow_mut().publish_readiness(None);
+
+            // Step3 : get next poll time from smoltcp network stack, None
+            // if only an event can make progress
+            let sleep_time = {
                 let network_manager = network_manager.borrow();
-                let sleep_time = network_manager
+                network_manager
                     .net_interfaces
                     .iter()
-                    .map(|interface| {
+                    .filter_map(|interface| {
                         let Ok(millis_i64) = i64::try_from(tick_get_millisecond()) else {
                             log::error!("[NetworkManager]: Interface poll_delay get ms fail");
-                            return DEFAULT_DELAY_TIME_IN_MILLIS;
+                            return Some(DEFAULT_DELAY_TIME_IN_MILLIS);
                         };
-
-                        match interface
+                        interface
                             .borrow_mut()
                             .poll_delay(Instant::from_millis(millis_i64))
-                        {
-                            Some(Duration::ZERO) => {
-                                log::debug!("[NetworkManager]: Inteface resuming");
-                                // Do next poll immediately
-                                0
-                            }
-                            Some(delay) => {
-                                log::debug!("[NetworkManager]: Inteface poll delay for {}", delay);
-                                // Do next poll after delay.millis()
-                                delay.millis()
-                            }
-                            None => {
-                                // Wait until there is a task before the next poll
-                                // TODO add trigger when enqueue task
-                                DEFAULT_DELAY_TIME_IN_MILLIS
-                            }
-                        }
+                            .map(|delay| delay.millis())
                     })
                     .min()
-                    .unwrap_or(DEFAULT_DELAY_TIME_IN_MILLIS);
+            };
+            // Sockets changing state might have more to send, e.g., over
+            // the loopback.
+            let sleep_time = if changed { Some(0) } else { sleep_time };
+            if sleep_time == Some(0) {
+                log::debug!("[NetworkManager]: Inteface resuming");
+                // Still yield so that threads of the same priority can
+                // queue requests.
+                scheduler::yield_me();
+                continue;
+            }
 
-                // Warning!!! Need to yield or sleep for a while , or other threads may have no change to insert msg to NETSTACK_QUEUE
-                if sleep_time == 0 {
-                    scheduler::yield_me();
-                } else {
-                    scheduler::suspend_me_for(tick_from_millisecond(
-                        sleep_time.min(DEFAULT_DELAY_TIME_IN_MILLIS) as usize,
-                    ));
-                }
+            // Devices without interrupt are polled now and then.
+            let mut sleep_time = if NEEDS_POLLING.load(Ordering::Relaxed) {
+                Some(sleep_time.map_or(DEFAULT_DELAY_TIME_IN_MILLIS, |t| {
+                    t.min(DEFAULT_DELAY_TIME_IN_MILLIS)
+                }))
+            } else {
+                sleep_time
+            };
+            if !is_forever {
+                let left = timeout.saturating_sub(tick_get_millisecond()) as u64;
+                sleep_time = Some(sleep_time.map_or(left, |t| t.min(left)));
             }
+            let _ = atomic_wait(
+                &engine.events,
+                seen,
+                sleep_time.map(|t| tick_from_millisecond(t as usize)),
+            );
+        }
+    }
+}
+
+// By default, one engine, i.e., a network stack thread with its own
+// interfaces, sockets and request queue, serves all interfaces. With
+// NET_STACK_PER_INTERFACE, a second engine serves the device, so local
+// and remote traffic are handled in parallel. Every engine has its own
+// loopback, hence the device engine is a full stack serving sockets of
+// any address, like the single engine. Only stream sockets bound or
+// connected to a loopback address live in the loopback engine, since
+// their peer is known to be there too.
+//
+// smoltcp sockets are polled through the interface they're added to,
+// and an interface can't be shared between threads, so connections of
+// the same interface stay on the same engine.
+#[cfg(not(net_stack_per_interface))]
+const NR_ENGINES: usize = 1;
+#[cfg(net_stack_per_interface)]
+const NR_ENGINES: usize = 2;
+
+const LOOPBACK_ENGINE: usize = 0;
+const DEVICE_ENGINE: usize = NR_ENGINES - 1;
+
+pub(crate) struct Engine {
+    queue: Mpsc<Operation, NETSTACK_QUEUE_SIZE>,
+    // Bumped whenever the engine has work to do, i.e., a request is
+    // queued or a device interrupts. The engine thread sleeps on it.
+    events: AtomicUsize,
+    // Id of the engine thread, 0 until it starts.
+    thread: AtomicUsize,
+}
+
+impl Engine {
+    const fn new() -> Self {
+        Self {
+            queue: Mpsc::new(),
+            events: AtomicUsize::new(0),
+            thread: AtomicUsize::new(0),
+        }
+    }
+
+    /// Queue a request and wake the engine up. Return the request if
+    /// the queue is full.
+    pub(crate) fn enqueue(&self, op: Operation) -> Result<(), Operation> {
+        self.queue.push(op)?;
+        self.wake_up();
+        Ok(())
+    }
+
+    pub(crate) fn dequeue(&self) -> Option<Operation> {
+        self.queue.pop()
+    }
+
+    /// Wake the engine thread up. Safe to call from interrupt handlers.
+    pub(crate) fn wake_up(&self) {
+        self.events.fetch_add(1, Ordering::Release);
+        let _ = atomic_wake(&self.events, 1);
+    }
+}
+
+static ENGINES: [Engine; NR_ENGINES] = [const { Engine::new() }; NR_ENGINES];
+// The engine of sockets whose address is unspecified or remote.
+static DEFAULT_ENGINE: AtomicUsize = AtomicUsize::new(LOOPBACK_ENGINE);
+// Set if some device can't interrupt.
+static NEEDS_POLLING: AtomicBool = AtomicBool::new(false);
+
+/// Whether all sockets live in the same engine.
+pub(crate) fn single_engine() -> bool {
+    DEFAULT_ENGINE.load(Ordering::Relaxed) == LOOPBACK_ENGINE
+}
+
+pub(crate) fn engine(i: usize) -> &'static Engine {
+    &ENGINES[i]
+}
+
+/// Return the index of the engine serving a socket of `socket_type`
+/// first used with `addr`. Datagrams of a socket may be sent to any
+/// address, so only stream sockets are served by the loopback engine.
+pub(crate) fn route(socket_type: SocketType, addr: Option<IpAddress>) -> usize {
+    match addr {
+        _ if NR_ENGINES == 1 || socket_type != SocketType::SockStream => {
+            DEFAULT_ENGINE.load(Ordering::Relaxed)
         }
+        Some(IpAddress::Ipv4(a)) if a.is_loopback() => LOOPBACK_ENGINE,
+        Some(IpAddress::Ipv6(a)) if a.is_loopback() => LOOPBACK_ENGINE,
+        _ => DEFAULT_ENGINE.load(Ordering::Relaxed),
     }
 }
 
-extern "C" fn net_stack_main_loop() {
-    log::debug!("[NetworkManager] enter");
-    let network_manager = NetworkManager::init();
+/// The engine running on the current thread. Only valid in engine
+/// threads.
+pub(crate) fn current_engine() -> &'static Engine {
+    let id = scheduler::current_thread_id();
+    ENGINES
+        .iter()
+        .find(|e| e.thread.load(Ordering::Relaxed) == id)
+        .unwrap_or(&ENGINES[DEFAULT_ENGINE.load(Ordering::Relaxed)])
+}
+
+/// Wake the engine serving network devices up. Safe to call from
+/// interrupt handlers.
+pub(crate) fn wake_up() {
+    ENGINES[DEVICE_ENGINE].wake_up();
+}
+
+/// Make the network stack poll devices periodically even if no event
+/// arrives.
+pub(crate) fn require_polling() {
+    NEEDS_POLLING.store(true, Ordering::Relaxed);
+}
+
+extern "C" fn net_stack_main_loop(arg: *mut c_void) {
+    let engine = arg as usize;
+    log::debug!("[NetworkManager {}] enter", engine);
+    ENGINES[engine]
+        .thread
+        .store(scheduler::current_thread_id(), Ordering::Relaxed);
+    let network_manager = NetworkManager::init(engine);
 
     NetworkManager::loop_within_single_thread(
         network_manager.clone(),
         0,
         |network_manager: Rc<RefCell<NetworkManager<'static>>>| -> bool {
-            // msg loop , one msg at a time
+            // msg loop , all queued msgs at a time
             Connection::handle_socket_msg(network_manager)
         },
     );
 
-    log::debug!("[NetworkManager] exit");
+    log::debug!("[NetworkManager {}] exit", engine);
 }
 
 #[repr(align(16))]
@@ -296,15 +480,25 @@ pub(crate) struct NetworkStack {
     pub(crate) rep: [u8; NETWORK_STACK_SIZE],
 }
 
-static mut NETWORK_STACK: NetworkStack = NetworkStack {
+static mut NETWORK_STACKS: [NetworkStack; NR_ENGINES] = [NetworkStack {
     rep: [0u8; NETWORK_STACK_SIZE],
-};
+}; NR_ENGINES];
 
 pub(crate) fn init() {
-    let t = ThreadBuilder::new(Entry::C(net_stack_main_loop))
-        .set_stack(Stack::Raw {
-            base: unsafe { NETWORK_STACK.rep.as_ptr() } as usize,
-            size: NETWORK_STACK_SIZE,
-        })
-        .start();
+    #[cfg(virtio)]
+    if net_dev_exist() {
+        DEFAULT_ENGINE.store(DEVICE_ENGINE, Ordering::Relaxed);
+    }
+    for engine in 0..NR_ENGINES {
+        // The device engine has nothing to serve without devices.
+        if engine != LOOPBACK_ENGINE && DEFAULT_ENGINE.load(Ordering::Relaxed) != engine {
+            continue;
+        }
+        let t = ThreadBuilder::new(Entry::Posix(net_stack_main_loop, engine as *mut c_void))
+            .set_stack(Stack::Raw {
+                base: unsafe { NETWORK_STACKS[engine].rep.as_ptr() } as usize,
+                size: NETWORK_STACK_SIZE,
+            })
+            .start();
+    }
 }
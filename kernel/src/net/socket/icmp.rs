@@ -12,15 +12,18 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::net::{
-    connection::{Operation, OperationIPCReply},
-    net_interface::NetInterface,
-    net_manager::NetworkManager,
-    socket::{
-        socket_err::SocketError, socket_waker, FnRecv, FnRecvWithEndpoint, FnSend, FnSendMsg,
-        PosixSocket,
+use crate::{
+    net::{
+        connection::{Operation, OperationIPCReply},
+        net_interface::NetInterface,
+        net_manager::NetworkManager,
+        socket::{
+            socket_err::SocketError, socket_waker, FnRecv, FnRecvWithEndpoint, FnSend, FnSendMsg,
+            PosixSocket,
+        },
+        SocketFd, SocketResult, SocketType,
     },
-    SocketFd, SocketResult, SocketType,
+    sync::poll::{POLLIN, POLLOUT},
 };
 use alloc::{boxed::Box, rc::Rc, sync::Arc, vec};
 use core::{
@@ -377,4 +380,18 @@ impl PosixSocket for IcmpSocket<'static> {
     fn is_shutdown(&self) -> bool {
         self.is_shutdown.get()
     }
+
+    fn poll_events(&mut self) -> u32 {
+        self.with(|socket, _| {
+            let mut events = 0;
+            if socket.can_recv() {
+                events |= POLLIN;
+            }
+            if socket.can_send() {
+                events |= POLLOUT;
+            }
+            Ok(events as usize)
+        })
+        .map_or(POLLOUT, |events| events as u32)
+    }
 }
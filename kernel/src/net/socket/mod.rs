@@ -20,7 +20,7 @@ use crate::net::{
     socket::socket_err::SocketError,
     SocketResult,
 };
-use alloc::{boxed::Box, rc::Rc, sync::Arc};
+use alloc::{boxed::Box, rc::Rc, sync::Arc, vec::Vec};
 use core::{cell::RefCell, net::SocketAddr};
 
 pub mod icmp;
@@ -33,6 +33,10 @@ pub(crate) type FnSend = Box<dyn FnOnce(&mut [u8]) -> (usize, usize) + Send>;
 pub(crate) type FnSendMsg = Box<dyn FnOnce(&mut [u8]) -> usize + Send>;
 pub(crate) type FnRecv = Box<dyn FnOnce(&mut [u8]) -> (usize, usize) + Send>;
 pub(crate) type FnRecvWithEndpoint = Box<dyn FnOnce(&[u8], IpEndpoint) -> usize + Send>;
+// Datagrams of sendmmsg(), with their destinations.
+pub(crate) type SendBatch = Vec<(IpEndpoint, Vec<u8>)>;
+// Called with the index of every datagram recvmmsg() receives.
+pub(crate) type FnRecvBatch = Box<dyn FnMut(usize, &[u8], IpEndpoint) -> usize + Send>;
 
 pub trait PosixSocket {
     // smoltcp need to bind socket with interface
@@ -100,6 +104,36 @@ pub trait PosixSocket {
         ipc_reply: Arc<OperationIPCReply>,
     ) -> SocketResult;
 
+    // Send datagrams in order, as many as the socket takes without
+    // blocking, return the number sent. Only block if none is sent.
+    fn sendmmsg(
+        &mut self,
+        _msgs: SendBatch,
+        _local_port: Option<u16>,
+        _is_nonblocking: bool,
+        _ipc_reply: Arc<OperationIPCReply>,
+    ) -> SocketResult {
+        Err(SocketError::PosixError(
+            -libc::EOPNOTSUPP,
+            "sendmmsg()".into(),
+        ))
+    }
+
+    // Receive up to `vlen` datagrams, return the number received. Only
+    // block if none is queued.
+    fn recvmmsg(
+        &mut self,
+        _f: FnRecvBatch,
+        _vlen: usize,
+        _is_nonblocking: bool,
+        _ipc_reply: Arc<OperationIPCReply>,
+    ) -> SocketResult {
+        Err(SocketError::PosixError(
+            -libc::EOPNOTSUPP,
+            "recvmmsg()".into(),
+        ))
+    }
+
     fn getsockname(&mut self, f: Box<dyn FnOnce(IpEndpoint) + Send>) -> SocketResult;
 
     fn getpeername(&mut self, f: Box<dyn FnOnce(IpEndpoint) + Send>) -> SocketResult;
@@ -107,4 +141,9 @@ pub trait PosixSocket {
     fn shutdown(&self) -> SocketResult;
 
     fn is_shutdown(&self) -> bool;
+
+    // The events of sync::poll the socket is ready for.
+    fn poll_events(&mut self) -> u32 {
+        0
+    }
 }
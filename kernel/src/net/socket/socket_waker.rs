@@ -19,7 +19,7 @@ use core::{
 };
 use spin::Mutex;
 
-use crate::net::connection::{Operation, NETSTACK_QUEUE};
+use crate::net::{connection::Operation, net_manager};
 
 pub struct SocketWaker {
     name: String,
@@ -47,7 +47,8 @@ impl SocketWaker {
         }
 
         if let Some(socket_operation) = self.socket_operation.borrow_mut().take() {
-            let _ = NETSTACK_QUEUE
+            // Wakers are woken by the engine polling the socket.
+            let _ = net_manager::current_engine()
                 .enqueue(socket_operation)
                 .map_err(|socket_operation| {
                     log::warn!("[SockerWaker] enqueue fail");
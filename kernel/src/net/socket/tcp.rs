@@ -12,18 +12,25 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::net::{
-    connection::{Operation, OperationIPCReply, OperationResult},
-    net_interface::NetInterface,
-    net_manager::NetworkManager,
-    port_generator::PORT_GENERATOR,
-    socket::{
-        socket_err::SocketError, socket_waker, FnRecv, FnRecvWithEndpoint, FnSend, FnSendMsg,
-        PosixSocket,
+#[cfg(kmem_cache)]
+use crate::allocator::{SOCKET_BUFFER_CACHE, SOCKET_BUFFER_SIZE};
+use crate::{
+    net::{
+        connection::{Operation, OperationIPCReply, OperationResult},
+        net_interface::NetInterface,
+        net_manager::NetworkManager,
+        port_generator::PORT_GENERATOR,
+        socket::{
+            socket_err::SocketError, socket_waker, FnRecv, FnRecvWithEndpoint, FnSend, FnSendMsg,
+            PosixSocket,
+        },
+        SocketDomain, SocketFd, SocketProtocol, SocketResult, SocketType,
     },
-    SocketDomain, SocketFd, SocketProtocol, SocketResult, SocketType,
+    sync::poll::{POLLHUP, POLLIN, POLLOUT, POLLRDHUP},
 };
-use alloc::{boxed::Box, format, rc::Rc, sync::Arc, vec};
+use alloc::{boxed::Box, format, rc::Rc, sync::Arc};
+#[cfg(kmem_cache)]
+use core::ptr::NonNull;
 use core::{
     cell::{Cell, RefCell},
     net::{Ipv4Addr, Ipv6Addr, SocketAddr},
@@ -34,13 +41,61 @@ use smoltcp::{
     socket::tcp::{self, State},
     wire::{IpAddress, IpEndpoint, IpListenEndpoint},
 };
+
+// The rx and tx buffers of a smoltcp socket, taken from the socket
+// buffer cache and given back on drop. They are lent to the smoltcp
+// socket and must only be dropped once it's removed from its socket set.
+#[cfg(kmem_cache)]
+struct SocketBuffers {
+    rx: NonNull<u8>,
+    tx: NonNull<u8>,
+}
+
+#[cfg(kmem_cache)]
+impl SocketBuffers {
+    fn new() -> Option<Self> {
+        let rx = SOCKET_BUFFER_CACHE.alloc()?;
+        let Some(tx) = SOCKET_BUFFER_CACHE.alloc() else {
+            unsafe { SOCKET_BUFFER_CACHE.free(rx.as_ptr()) };
+            return None;
+        };
+        unsafe {
+            rx.write_bytes(0, SOCKET_BUFFER_SIZE);
+            tx.write_bytes(0, SOCKET_BUFFER_SIZE);
+        }
+        Some(Self { rx, tx })
+    }
+
+    // SAFETY: The slices must not be used once the buffers are freed.
+    unsafe fn lend(&self) -> (&'static mut [u8], &'static mut [u8]) {
+        (
+            core::slice::from_raw_parts_mut(self.rx.as_ptr(), SOCKET_BUFFER_SIZE),
+            core::slice::from_raw_parts_mut(self.tx.as_ptr(), SOCKET_BUFFER_SIZE),
+        )
+    }
+}
+
+#[cfg(kmem_cache)]
+impl Drop for SocketBuffers {
+    fn drop(&mut self) {
+        unsafe {
+            SOCKET_BUFFER_CACHE.free(self.rx.as_ptr());
+            SOCKET_BUFFER_CACHE.free(self.tx.as_ptr());
+        }
+    }
+}
+
 pub struct TcpSocket<'a> {
     socket_fd: SocketFd,
     socket_domain: SocketDomain,
     is_shutdown: Rc<Cell<bool>>,
     network_manager: Rc<RefCell<NetworkManager<'a>>>,
-    smoltcp_socket_handle: Option<SocketHandle>,
+    // Taken once the smoltcp socket is removed from its set.
+    smoltcp_socket_handle: Cell<Option<SocketHandle>>,
     smoltcp_interface: Option<Rc<RefCell<NetInterface<'a>>>>,
+    // Dropped after the smoltcp socket is removed, see remove_smoltcp_socket.
+    #[cfg(kmem_cache)]
+    buffers: Cell<Option<SocketBuffers>>,
 }
 
 impl<'a> TcpSocket<'a>
@@ -59,8 +114,10 @@ where
             socket_domain,
             is_shutdown: Rc::new(is_shutdown),
             network_manager,
-            smoltcp_socket_handle: None,
+            smoltcp_socket_handle: Cell::new(None),
             smoltcp_interface: None,
+            #[cfg(kmem_cache)]
+            buffers: Cell::new(None),
         }
     }
 
@@ -70,16 +127,31 @@ where
             None => return None,
         };
 
+        // A socket created before, by a failed connect for example, is
+        // replaced.
+        self.remove_smoltcp_socket();
+
+        #[cfg(kmem_cache)]
+        let buffers = SocketBuffers::new()?;
+        #[cfg(kmem_cache)]
+        let tcp_socket = {
+            // SAFETY: The buffers are dropped once the socket is removed.
+            let (rx, tx) = unsafe { buffers.lend() };
+            tcp::Socket::new(tcp::SocketBuffer::new(rx), tcp::SocketBuffer::new(tx))
+        };
+        #[cfg(not(kmem_cache))]
         let tcp_socket = {
-            let tcp_rx_buffer = tcp::SocketBuffer::new(vec![0; 1024]);
-            let tcp_tx_buffer = tcp::SocketBuffer::new(vec![0; 1024]);
+            let tcp_rx_buffer = tcp::SocketBuffer::new(alloc::vec![0; 1024]);
+            let tcp_tx_buffer = tcp::SocketBuffer::new(alloc::vec![0; 1024]);
             tcp::Socket::new(tcp_rx_buffer, tcp_tx_buffer)
         };
 
         // Save socket handle
         let mut interface = interface.borrow_mut();
         if let Some(socket_handle) = interface.add_socket(tcp_socket) {
-            self.smoltcp_socket_handle.replace(socket_handle);
+            self.smoltcp_socket_handle.set(Some(socket_handle));
+            #[cfg(kmem_cache)]
+            self.buffers.set(Some(buffers));
             Some(socket_handle)
         } else {
             None
@@ -97,6 +169,7 @@ where
 
             let socket = socket_sets.get_mut::<tcp::Socket>(
                 self.smoltcp_socket_handle
+                    .get()
                     .ok_or(SocketError::InvalidHandle)?,
             );
 
@@ -107,8 +180,44 @@ where
     }
 }
 
+impl TcpSocket<'_> {
+    // Remove the smoltcp socket from its set, if any, and drop its
+    // buffers. If the set is in use, they are leaked rather than freed
+    // under the socket.
+    fn remove_smoltcp_socket(&self) {
+        let Some(socket_handle) = self.smoltcp_socket_handle.take() else {
+            return;
+        };
+        #[cfg(kmem_cache)]
+        let buffers = self.buffers.take();
+        let Some(interface) = &self.smoltcp_interface else {
+            return;
+        };
+        let Ok(mut interface) = interface.try_borrow_mut() else {
+            #[cfg(kmem_cache)]
+            core::mem::forget(buffers);
+            return;
+        };
+        let socket_sets = interface.socket_sets_mut();
+        let Ok(mut socket_sets) = socket_sets.try_borrow_mut() else {
+            #[cfg(kmem_cache)]
+            core::mem::forget(buffers);
+            return;
+        };
+        let _ = socket_sets.remove(socket_handle);
+    }
+}
+
+impl Drop for TcpSocket<'_> {
+    fn drop(&mut self) {
+        self.remove_smoltcp_socket();
+    }
+}
+
 impl PosixSocket for TcpSocket<'static> {
     fn bind_interface(&mut self, interface: Rc<RefCell<NetInterface<'static>>>) {
+        // The smoltcp socket is in the set of the previous interface.
+        self.remove_smoltcp_socket();
         // Save interface
         self.smoltcp_interface.replace(interface.clone());
     }
@@ -344,17 +453,17 @@ impl PosixSocket for TcpSocket<'static> {
             let socket_sets = interface.socket_sets_mut();
             let mut socket_sets = socket_sets.borrow_mut();
 
-            let socket = socket_sets.get_mut::<tcp::Socket>(
-                self.smoltcp_socket_handle
-                    .ok_or(SocketError::InvalidHandle)?,
-            );
+            let socket_handle = self
+                .smoltcp_socket_handle
+                .take()
+                .ok_or(SocketError::InvalidHandle)?;
+            let socket = socket_sets.get_mut::<tcp::Socket>(socket_handle);
 
             socket.close();
 
-            let _ = socket_sets.remove(
-                self.smoltcp_socket_handle
-                    .ok_or(SocketError::InvalidHandle)?,
-            );
+            let _ = socket_sets.remove(socket_handle);
+            #[cfg(kmem_cache)]
+            self.buffers.take();
             Ok(0)
         } else {
             Err(SocketError::InterfaceNoAvailable)
@@ -395,7 +504,7 @@ impl PosixSocket for TcpSocket<'static> {
             match remote_endpoint {
                 Some(endpoint) => f(endpoint),
                 None => {
-                    if socket.state() == tcp::State::Closed {
+                    if socket.state() == State::Closed {
                         return Err(SocketError::PosixError(
                             -libc::ENOTCONN,
                             "Tcp socket is no connected".into(),
@@ -419,4 +528,25 @@ impl PosixSocket for TcpSocket<'static> {
     fn is_shutdown(&self) -> bool {
         self.is_shutdown.get()
     }
+
+    // Reading the end of the stream doesn't block, so a peer closing
+    // makes the socket readable.
+    fn poll_events(&mut self) -> u32 {
+        self.with(|socket, _| {
+            let mut events = 0;
+            if socket.can_recv() {
+                events |= POLLIN;
+            }
+            if socket.can_send() {
+                events |= POLLOUT;
+            }
+            events |= match socket.state() {
+                State::CloseWait | State::LastAck => POLLIN | POLLRDHUP,
+                State::Closed | State::TimeWait => POLLIN | POLLRDHUP | POLLHUP,
+                _ => 0,
+            };
+            Ok(events as usize)
+        })
+        .map_or(0, |events| events as u32)
+    }
 }
@@ -12,15 +12,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::net::{
-    connection::{Operation, OperationIPCReply, OperationResult},
-    net_interface::NetInterface,
-    net_manager::NetworkManager,
-    socket::{
-        socket_err::SocketError, socket_waker, FnRecv, FnRecvWithEndpoint, FnSend, FnSendMsg,
-        PosixSocket,
+use crate::{
+    net::{
+        connection::{Operation, OperationIPCReply, OperationResult},
+        net_interface::NetInterface,
+        net_manager::NetworkManager,
+        socket::{
+            socket_err::SocketError, socket_waker, FnRecv, FnRecvBatch, FnRecvWithEndpoint, FnSend,
+            FnSendMsg, PosixSocket, SendBatch,
+        },
+        SocketDomain, SocketFd, SocketProtocol, SocketResult, SocketType,
     },
-    SocketDomain, SocketFd, SocketProtocol, SocketResult, SocketType,
+    sync::poll::{POLLIN, POLLOUT},
+    time::tick_get_millisecond,
 };
 use alloc::{boxed::Box, format, rc::Rc, sync::Arc, vec};
 use core::{
@@ -31,8 +35,15 @@ use core::{
 use smoltcp::{
     iface::{Interface, SocketHandle},
     socket::{icmp::Endpoint, udp},
+    time::Instant,
     wire::{IpAddress, IpEndpoint, IpListenEndpoint},
 };
+
+// Room for a few datagrams queued at a time, so batches of sendmmsg()
+// and recvmmsg() aren't dropped.
+const UDP_PACKETS: usize = 8;
+const UDP_BUFFER_SIZE: usize = 4096;
+
 pub struct UdpSocket<'a> {
     socket_fd: SocketFd,
     socket_domain: SocketDomain,
@@ -71,10 +82,14 @@ where
 
         // Create smoltcp udp::socket
         let udp_socket = {
-            let udp_rx_buffer =
-                udp::PacketBuffer::new(vec![udp::PacketMetadata::EMPTY], vec![0; 1024]);
-            let udp_tx_buffer =
-                udp::PacketBuffer::new(vec![udp::PacketMetadata::EMPTY], vec![0; 1024]);
+            let udp_rx_buffer = udp::PacketBuffer::new(
+                vec![udp::PacketMetadata::EMPTY; UDP_PACKETS],
+                vec![0; UDP_BUFFER_SIZE],
+            );
+            let udp_tx_buffer = udp::PacketBuffer::new(
+                vec![udp::PacketMetadata::EMPTY; UDP_PACKETS],
+                vec![0; UDP_BUFFER_SIZE],
+            );
             udp::Socket::new(udp_rx_buffer, udp_tx_buffer)
         };
 
@@ -107,6 +122,15 @@ where
             Err(SocketError::InterfaceNoAvailable)
         }
     }
+
+    // Move datagrams between the socket buffers and the device, so a
+    // batch isn't limited by the room of the socket buffers.
+    fn poll_interface(&self) {
+        if let Some(interface) = &self.smoltcp_interface {
+            let now = Instant::from_millis(tick_get_millisecond() as i64);
+            let _ = interface.borrow_mut().poll(now);
+        }
+    }
 }
 
 impl PosixSocket for UdpSocket<'static> {
@@ -334,6 +358,150 @@ impl PosixSocket for UdpSocket<'static> {
         })
     }
 
+    fn sendmmsg(
+        &mut self,
+        msgs: SendBatch,
+        local_port: Option<u16>,
+        is_nonblocking: bool,
+        ipc_reply: Arc<OperationIPCReply>,
+    ) -> SocketResult {
+        // Create smoltcp socket when no socket handle
+        if self.smoltcp_socket_handle.is_none() {
+            let _ = self.create_smoltcp_socket();
+        }
+        if let Some(local_port) = local_port {
+            log::debug!("binding on {}", local_port);
+            self.with(|socket, _| {
+                socket
+                    .bind(local_port)
+                    .map(|()| 0)
+                    .map_err(SocketError::SmoltcpUdpBindError)
+            })?;
+        }
+
+        let mut sent = 0;
+        while sent < msgs.len() {
+            let n = self.with(|socket, _| {
+                let mut n = 0;
+                for (remote_endpoint, message) in &msgs[sent..] {
+                    if !socket.can_send() {
+                        break;
+                    }
+                    match socket.send_slice(message, udp::UdpMetadata::from(*remote_endpoint)) {
+                        Ok(()) => n += 1,
+                        Err(e) if sent + n == 0 => return Err(SocketError::SmoltcpUdpSendError(e)),
+                        Err(_) => break,
+                    }
+                }
+                Ok(n)
+            })?;
+            if n == 0 {
+                break;
+            }
+            sent += n;
+            if sent < msgs.len() {
+                self.poll_interface();
+            }
+        }
+        if sent > 0 {
+            return Ok(sent);
+        }
+
+        if is_nonblocking {
+            // UDP is state-less socket , always return EAGAIN
+            return Err(SocketError::TryAgain);
+        }
+        let socket_fd = self.socket_fd;
+        let is_shutdown = self.is_shutdown.clone();
+        self.with(|socket, _| {
+            let wait_operation = Operation::SendMmsg {
+                socket_fd,
+                msgs,
+                // Bound above.
+                local_port: None,
+                is_nonblocking,
+                ipc_reply,
+            };
+            let waker = socket_waker::create_closure_waker(
+                "UDP sendmmsg()".into(),
+                Some(wait_operation),
+                is_shutdown,
+            );
+            socket.register_send_waker(&waker);
+            log::debug!(
+                "blocking : udp socket not ready for send_queue={:?}",
+                socket.send_queue()
+            );
+            Err(SocketError::WouldBlock)
+        })
+    }
+
+    fn recvmmsg(
+        &mut self,
+        mut f: FnRecvBatch,
+        vlen: usize,
+        is_nonblocking: bool,
+        ipc_reply: Arc<OperationIPCReply>,
+    ) -> SocketResult {
+        let mut received = 0;
+        while received < vlen {
+            let n = self.with(|socket, _| {
+                let mut n = 0;
+                while received + n < vlen && socket.can_recv() {
+                    match socket.recv() {
+                        Ok((payload, meta)) => {
+                            f(received + n, payload, meta.endpoint);
+                            n += 1;
+                        }
+                        Err(e) if received + n == 0 => {
+                            return Err(SocketError::SmoltcpUdpRecvError(e))
+                        }
+                        Err(_) => break,
+                    }
+                }
+                Ok(n)
+            })?;
+            if n == 0 {
+                break;
+            }
+            received += n;
+            // Take more from the device if the socket buffer is drained.
+            if received < vlen {
+                self.poll_interface();
+            }
+        }
+        if received > 0 {
+            return Ok(received);
+        }
+
+        if is_nonblocking {
+            // UDP is state-less socket , always return EAGAIN
+            return Err(SocketError::TryAgain);
+        }
+        let socket_fd = self.socket_fd;
+        let is_shutdown = self.is_shutdown.clone();
+        self.with(|socket, _| {
+            let wait_operation = Operation::RecvMmsg {
+                socket_fd,
+                f,
+                vlen,
+                is_nonblocking,
+                ipc_reply,
+            };
+            let waker = socket_waker::create_closure_waker(
+                "UDP recvmmsg()".into(),
+                Some(wait_operation),
+                is_shutdown,
+            );
+            socket.register_recv_waker(&waker);
+            log::debug!(
+                "blocking : no data for udp recvmmsg recv_queue={:?}",
+                socket.recv_queue()
+            );
+            Err(SocketError::WouldBlock)
+        })
+    }
+
     fn shutdown(&self) -> SocketResult {
         self.is_shutdown.set(true);
 
@@ -389,4 +557,19 @@ impl PosixSocket for UdpSocket<'static> {
     fn is_shutdown(&self) -> bool {
         self.is_shutdown.get()
     }
+
+    // Not bound yet, the first send binds it.
+    fn poll_events(&mut self) -> u32 {
+        self.with(|socket, _| {
+            let mut events = 0;
+            if socket.can_recv() {
+                events |= POLLIN;
+            }
+            if socket.can_send() {
+                events |= POLLOUT;
+            }
+            Ok(events as usize)
+        })
+        .map_or(POLLOUT, |events| events as u32)
+    }
 }
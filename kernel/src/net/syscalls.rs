@@ -17,14 +17,14 @@
 use crate::{
     error::{self, code},
     net::{
-        self, connection::Connection, SocketAddress, SocketDomain, SocketMsghdr, SocketProtocol,
-        SocketType, Timeval,
+        self, connection::Connection, SocketAddress, SocketDomain, SocketMmsghdr, SocketMsghdr,
+        SocketProtocol, SocketType, Timeval,
     },
     vfs::{alloc_sock_fd, free_sock_fd, get_sock_by_fd, sock_attach_to_fd},
 };
-use alloc::{boxed::Box, collections::btree_map::BTreeMap, sync::Arc};
+use alloc::{boxed::Box, collections::btree_map::BTreeMap, sync::Arc, vec, vec::Vec};
 use core::{
-    ffi::{c_char, c_int, c_size_t, c_ssize_t, c_void, CStr},
+    ffi::{c_char, c_int, c_size_t, c_ssize_t, c_uint, c_void, CStr},
     net::{Ipv4Addr, Ipv6Addr, SocketAddr, SocketAddrV4, SocketAddrV6},
     str::FromStr,
     sync::atomic::{AtomicI32, Ordering},
@@ -35,6 +35,13 @@ use smoltcp::wire::{IpAddress, IpEndpoint};
 use spin::rwlock::RwLock;
 
 const ONE_ELEMENT: usize = 1;
+// The most messages sendmmsg() and recvmmsg() take at a time
+const UIO_MAXIOV: usize = 1024;
+
+/// A flag of sendmmsg() beyond POSIX: return once the datagrams are
+/// queued to the network stack, without waiting for them to be sent.
+/// Datagrams the socket has no room for are dropped.
+pub const MSG_POST: c_int = 0x0100_0000;
 
 pub fn socket(domain: c_int, type_: c_int, protocol_: c_int) -> c_int {
     let Ok(socket_domain) = SocketDomain::try_from(domain) else {
@@ -61,6 +68,9 @@ pub fn socket(domain: c_int, type_: c_int, protocol_: c_int) -> c_int {
     }
 
     let socket = alloc_sock_fd(flags);
+    if socket < 0 {
+        return socket;
+    }
     let mut connection = Connection::new(socket, socket_domain, socket_type, socket_protocol);
 
     connection.set_is_nonblocking((type_ & libc::SO_NONBLOCK) != 0);
@@ -236,6 +246,118 @@ pub fn sendmsg(socket: c_int, message: *const libc::msghdr, flags: c_int) -> c_s
         .unwrap_or(-1)
 }
 
+pub fn sendmmsg(socket: c_int, msgvec: *mut SocketMmsghdr, vlen: c_uint, flags: c_int) -> c_int {
+    log::debug!(
+        "fd={}: sendmmsg {} messages (flags={})",
+        socket,
+        vlen,
+        flags
+    );
+
+    let Ok(connection) = get_sock_by_fd(socket) else {
+        log::error!("fd={}: not a valid file descriptor.", socket);
+        return -libc::EBADF;
+    };
+
+    // sendmmsg only support udp now
+    if connection.socket_type() != SocketType::SockDgram {
+        log::warn!("fd={}: socket protocol does not support sendmmsg()", socket);
+        return -libc::EOPNOTSUPP;
+    }
+
+    if msgvec.is_null() {
+        return -libc::EFAULT;
+    }
+    let vlen = (vlen as usize).min(UIO_MAXIOV);
+    let msgvec = unsafe { core::slice::from_raw_parts_mut(msgvec, vlen) };
+
+    // Copy the datagrams, the network stack may send them after we
+    // return.
+    let mut msgs = Vec::with_capacity(vlen);
+    for msg in msgvec.iter() {
+        let Some(remote_endpoint) = msg.msg_hdr.endpoint() else {
+            log::error!("fd={}: Parse endpoint fail", socket);
+            break;
+        };
+        let mut buffer = vec![0; msg.msg_hdr.packet_len()];
+        SocketMsghdr::gather_to_buffer(
+            msg.msg_hdr.msg_iov,
+            msg.msg_hdr.msg_iovlen as usize,
+            &mut buffer,
+        );
+        msgs.push((remote_endpoint, buffer));
+    }
+    if msgs.is_empty() && vlen > 0 {
+        return -libc::EDESTADDRREQ;
+    }
+
+    match connection.sendmmsg(msgs, flags & MSG_POST != 0) {
+        Ok(sent) => {
+            for msg in msgvec[..sent].iter_mut() {
+                msg.msg_len = msg.msg_hdr.packet_len() as c_uint;
+            }
+            sent as c_int
+        }
+        Err(_) => -1,
+    }
+}
+
+pub fn recvmmsg(
+    socket: c_int,
+    msgvec: *mut SocketMmsghdr,
+    vlen: c_uint,
+    flags: c_int,
+    timeout: *mut libc::timespec,
+) -> c_int {
+    log::debug!(
+        "fd={}: recvmmsg {} messages (flags={})",
+        socket,
+        vlen,
+        flags
+    );
+
+    let Ok(connection) = get_sock_by_fd(socket) else {
+        log::error!("fd={}: not a valid file descriptor.", socket);
+        return -libc::EBADF;
+    };
+
+    // recvmmsg only support udp now
+    if connection.socket_type() != SocketType::SockDgram {
+        log::warn!("fd={}: socket protocol does not support recvmmsg()", socket);
+        return -libc::EOPNOTSUPP;
+    }
+
+    if msgvec.is_null() {
+        return -libc::EFAULT;
+    }
+    let vlen = (vlen as usize).min(UIO_MAXIOV);
+    if vlen == 0 {
+        return 0;
+    }
+    if !timeout.is_null() {
+        log::warn!("fd={}: recvmmsg() timeout is not supported", socket);
+    }
+
+    // Like MSG_WAITFORONE, only wait for the first datagram.
+    let msgvec_ptr = msgvec as usize;
+    let recv_payload = Box::new(
+        move |i: usize, payload: &[u8], endpoint: IpEndpoint| -> usize {
+            let msg = unsafe { &mut *(msgvec_ptr as *mut SocketMmsghdr).add(i) };
+            if !msg.msg_hdr.msg_name.is_null() {
+                msg.msg_hdr.fill_ip_endpoint(endpoint);
+            }
+            let len = msg.msg_hdr.scatter_from_buffer(payload);
+            msg.msg_len = len as c_uint;
+            len
+        },
+    );
+
+    connection
+        .recvmmsg(recv_payload, vlen)
+        .map(|received| received.try_into().unwrap_or(-1))
+        .unwrap_or(-1)
+}
+
 pub fn recv(socket: c_int, buffer: *mut c_void, length: c_size_t, flags: c_int) -> c_ssize_t {
     log::debug!("fd={}: Receiving (flags={})", socket, flags);
 
@@ -13,7 +13,11 @@
 // limitations under the License.
 
 extern crate alloc;
-use crate::{support, thread, thread::ThreadNode, types::Uint};
+use crate::{
+    support, thread,
+    thread::ThreadNode,
+    types::{ThreadPriority, Uint},
+};
 use alloc::collections::LinkedList;
 use core::{cell::LazyCell, ops::DerefMut};
 use spin::Mutex;
@@ -36,8 +40,15 @@ pub fn queue_ready_thread(old_state: Uint, t: ThreadNode) -> bool {
     if !t.transfer_state(old_state, thread::READY) {
         return false;
     }
+    #[cfg(sched_trace)]
+    super::trace::wakeup(&t, old_state);
     let mut w = READY_QUEUE.lock();
     let mut rq = LazyCell::get_mut(w.deref_mut()).unwrap();
     rq.push_back(t);
     true
 }
+
+// Threads are scheduled in FIFO order regardless of their priorities.
+pub fn set_thread_priority(t: &ThreadNode, p: ThreadPriority) {
+    t.lock().set_priority(p);
+}
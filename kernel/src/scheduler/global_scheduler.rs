@@ -19,44 +19,54 @@ use crate::{
     thread::{Thread, ThreadNode},
     types::{ArcList, ThreadPriority, Uint},
 };
+use blueos_infra::bitmap::{groups_for, PriorityBitmap};
 use core::mem::MaybeUninit;
 
-static mut READY_TABLE: MaybeUninit<SpinLock<ReadyTable>> = MaybeUninit::zeroed();
+// Built in place, the queues of 256 priorities are too large for the
+// boot stack. They are linked by init().
+static mut READY_TABLE: MaybeUninit<SpinLock<ReadyTable>> =
+    MaybeUninit::new(SpinLock::new(ReadyTable::new()));
 
-type ReadyTableBitFields = u32;
+// One bit per priority, specialized for THREAD_PRIORITY_MAX.
+const NR_PRIORITIES: usize = MAX_THREAD_PRIORITY as usize + 1;
+type ReadyBitmap = PriorityBitmap<{ groups_for(NR_PRIORITIES) }>;
 
-#[allow(clippy::assertions_on_constants)]
 pub(super) fn init() {
-    assert!(ReadyTableBitFields::BITS >= ThreadPriority::BITS);
-    unsafe { READY_TABLE.write(SpinLock::new(ReadyTable::default())) };
     let mut w = unsafe { READY_TABLE.assume_init_ref().irqsave_lock() };
-    for i in 0..(MAX_THREAD_PRIORITY + 1) as usize {
+    for i in 0..NR_PRIORITIES {
         w.tables[i].init();
     }
 }
 
-#[derive(Debug, Default)]
+#[derive(Debug)]
 struct ReadyTable {
-    active_tables: ReadyTableBitFields,
-    tables: [ArcList<Thread, thread::OffsetOfSchedNode>; (MAX_THREAD_PRIORITY + 1) as usize],
+    active_tables: ReadyBitmap,
+    tables: [ArcList<Thread, thread::OffsetOfSchedNode>; NR_PRIORITIES],
 }
 
 impl ReadyTable {
+    const fn new() -> Self {
+        Self {
+            active_tables: ReadyBitmap::new(),
+            tables: [const { ArcList::const_new() }; NR_PRIORITIES],
+        }
+    }
+
     #[inline]
     fn clear_active_queue(&mut self, bit: u32) -> &mut Self {
-        self.active_tables &= !(1 << bit);
+        self.active_tables.clear(bit as usize);
         self
     }
 
     #[inline]
     fn set_active_queue(&mut self, bit: u32) -> &mut Self {
-        self.active_tables |= 1 << bit;
+        self.active_tables.set(bit as usize);
         self
     }
 
     #[inline]
     fn highest_active(&self) -> u32 {
-        self.active_tables.trailing_zeros()
+        self.active_tables.first().map_or(u32::MAX, |p| p as u32)
     }
 }
 
@@ -88,6 +98,8 @@ pub fn queue_ready_thread(old_state: Uint, t: ThreadNode) -> bool {
     if !t.transfer_state(old_state, thread::READY) {
         return false;
     }
+    #[cfg(sched_trace)]
+    super::trace::wakeup(&t, old_state);
     assert!(t.validate_saved_sp());
     let mut tbl = unsafe { READY_TABLE.assume_init_ref().irqsave_lock() };
     let priority = t.priority();
@@ -107,3 +119,28 @@ pub fn queue_ready_thread(old_state: Uint, t: ThreadNode) -> bool {
     }
     true
 }
+
+// Change the priority of `t` and move it to the queue of the new
+// priority if it's sitting in the ready table. The priority of a
+// thread is only changed with the ready table locked, so that a ready
+// thread is always found in the queue of its current priority.
+pub fn set_thread_priority(t: &ThreadNode, p: ThreadPriority) {
+    assert!(p <= MAX_THREAD_PRIORITY);
+    let mut tbl = unsafe { READY_TABLE.assume_init_ref().irqsave_lock() };
+    let old = t.priority();
+    if old == p {
+        return;
+    }
+    t.lock().set_priority(p);
+    if t.sched_node.is_detached() {
+        return;
+    }
+    let q = &mut tbl.tables[old as usize];
+    let ok = q.remove(t);
+    assert!(ok);
+    if q.is_empty() {
+        tbl.clear_active_queue(old as u32);
+    }
+    tbl.tables[p as usize].push_back(t.clone());
+    tbl.set_active_queue(p as u32);
+}
@@ -34,13 +34,19 @@ mod fifo;
 #[cfg(scheduler = "global")]
 mod global_scheduler;
 mod idle;
+#[cfg(scheduler = "percore")]
+mod percore_scheduler;
 pub use idle::get_idle_thread;
+#[cfg(sched_trace)]
+pub(crate) mod trace;
 mod wait_queue;
 
 #[cfg(scheduler = "fifo")]
 pub use fifo::*;
 #[cfg(scheduler = "global")]
 pub use global_scheduler::*;
+#[cfg(scheduler = "percore")]
+pub use percore_scheduler::*;
 pub(crate) use wait_queue::*;
 
 pub(crate) static mut RUNNING_THREADS: [MaybeUninit<ThreadNode>; NUM_CORES] =
@@ -52,6 +58,8 @@ pub(crate) fn init() {
     global_scheduler::init();
     #[cfg(scheduler = "fifo")]
     fifo::init();
+    #[cfg(scheduler = "percore")]
+    percore_scheduler::init();
 }
 
 pub(crate) struct ContextSwitchHookHolder<'a> {
@@ -61,7 +69,7 @@ pub(crate) struct ContextSwitchHookHolder<'a> {
     pub retiring_thread: Option<ThreadNode>,
     pub pending_thread: Option<ThreadNode>,
     pub closure: Option<Box<dyn FnOnce()>>,
-    pub dropper: Option<DefaultWaitQueueGuardDropper<'a>>,
+    pub lock: Option<&'a mut dyn SuspendLock>,
 }
 
 impl<'a> ContextSwitchHookHolder<'a> {
@@ -72,12 +80,12 @@ impl<'a> ContextSwitchHookHolder<'a> {
             retiring_thread: None,
             pending_thread: None,
             closure: None,
-            dropper: None,
+            lock: None,
         }
     }
 
-    pub fn set_dropper(&mut self, d: DefaultWaitQueueGuardDropper<'a>) -> &mut Self {
-        self.dropper = Some(d);
+    pub fn set_lock(&mut self, l: &'a mut dyn SuspendLock) -> &mut Self {
+        self.lock = Some(l);
         self
     }
 
@@ -117,10 +125,11 @@ pub(crate) extern "C" fn save_context_finish_hook(hook: Option<&mut ContextSwitc
     // ownership of all pending actions in the `hook`, so that these
     // actions are on current stack.
     let ready_thread = hook.ready_thread.take();
-    let retiring_thread = hook.retiring_thread.take();
+    #[allow(unused_mut)]
+    let mut retiring_thread = hook.retiring_thread.take();
     let closure = hook.closure.take();
     let pending_thread = hook.pending_thread.take();
-    let mut dropper = hook.dropper.take();
+    let lock = hook.lock.take();
     let next = hook.next_thread.take();
     compiler_fence(Ordering::SeqCst);
     let Some(mut next) = next else {
@@ -144,6 +153,8 @@ pub(crate) extern "C" fn save_context_finish_hook(hook: Option<&mut ContextSwitc
         let cycles = time::get_sys_cycles();
         old.lock().increment_cycles(cycles);
         next.lock().set_start_cycles(cycles);
+        #[cfg(sched_trace)]
+        trace::switch(&old, &next, cycles);
     }
     compiler_fence(Ordering::SeqCst);
     if let Some(t) = ready_thread {
@@ -162,16 +173,15 @@ pub(crate) extern "C" fn save_context_finish_hook(hook: Option<&mut ContextSwitc
     // irq_status arg indicating the irq status when entered the context switch
     // routine, and returning irq status indicating the irq status after leaving
     // the context switch routine.
-    if let Some(v) = dropper.as_mut() {
-        v.forget_irq()
+    if let Some(l) = lock {
+        l.release()
     }
-    drop(dropper);
     compiler_fence(Ordering::SeqCst);
     if let Some(f) = closure {
         f()
     }
     compiler_fence(Ordering::SeqCst);
-    if let Some(t) = retiring_thread {
+    if let Some(t) = &retiring_thread {
         let cleanup = t.lock().take_cleanup();
         if let Some(entry) = cleanup {
             match entry {
@@ -180,13 +190,15 @@ pub(crate) extern "C" fn save_context_finish_hook(hook: Option<&mut ContextSwitc
                 Entry::Posix(f, arg) => f(arg),
             }
         };
-        GlobalQueueVisitor::remove(&t);
+        GlobalQueueVisitor::remove(t);
         let ok = t.transfer_state(thread::RUNNING, thread::RETIRED);
         assert!(ok);
-        if ThreadNode::strong_count(&t) != 1 {
+        if ThreadNode::strong_count(t) != 1 {
             // TODO: Warn if there are still references to the thread.
         }
     }
+    #[cfg(thread_pool)]
+    thread::recycle(&mut retiring_thread);
 }
 
 // It's usually used in cortex-m's pendsv handler. It assumes current
@@ -212,6 +224,8 @@ pub(crate) extern "C" fn yield_me_and_return_next_sp(old_sp: usize) -> usize {
         next.saved_sp(),
         next.priority(),
     );
+    #[cfg(sched_trace)]
+    trace::switch(&old, &next, time::get_sys_cycles());
     old.lock().set_saved_sp(old_sp);
     let ok = queue_ready_thread(thread::RUNNING, old);
     assert!(ok);
@@ -253,6 +267,11 @@ pub fn yield_me() {
 fn yield_unconditionally() {
     assert!(arch::local_irq_enabled());
     let Some(next) = next_ready_thread() else {
+        #[cfg(tickless)]
+        if Thread::id(&current_thread()) == Thread::id(idle::current_idle_thread()) {
+            time::idle_tickless();
+            return;
+        }
         arch::idle();
         return;
     };
@@ -326,6 +345,18 @@ pub(crate) fn suspend_me_for(tick: usize) {
 }
 
 pub(crate) fn suspend_me_with_timeout(mut w: SpinLockGuard<'_, WaitQueue>, ticks: usize) -> bool {
+    let entry = Arc::new(WaitEntry {
+        wait_node: IlistHead::<WaitEntry, OffsetOfWait>::new(),
+        thread: current_thread(),
+    });
+    let ok = w.push_back(entry);
+    assert!(ok);
+    suspend_me_holding(w, ticks)
+}
+
+// Suspend current thread for at most `ticks` ticks with `w` held until
+// the context of current thread is saved. Return true if timed out.
+pub(crate) fn suspend_me_holding<T: ?Sized>(w: SpinLockGuard<'_, T>, ticks: usize) -> bool {
     assert!(ticks != 0);
     #[cfg(debugging_scheduler)]
     crate::trace!(
@@ -343,26 +374,19 @@ pub(crate) fn suspend_me_with_timeout(mut w: SpinLockGuard<'_, WaitQueue>, ticks
     let to_sp = next.saved_sp();
     let old = current_thread();
     let from_sp_ptr = old.saved_sp_ptr();
-    let entry = Arc::new(WaitEntry {
-        wait_node: IlistHead::<WaitEntry, OffsetOfWait>::new(),
-        thread: old.clone(),
-    });
-    let ok = w.push_back(entry);
-    assert!(ok);
     // old's context saving must happen before old is requeued to
     // ready queue.
     // Ideally, we need an API like
     // ```
     // switch_context(from_sp_mut, to_sp, w)
     // ```
-    // which is hard to implement in Rust. So we wrap all guards
+    // which is hard to implement in Rust. So we wrap the guard
     // inside a hook hodler and pass it by its
     // pointer. save_context_finish_hook is called during
     // switching context.
-    let mut dropper = DefaultWaitQueueGuardDropper::new();
-    dropper.add(w);
+    let mut lock = Some(w);
     let mut hook_holder = ContextSwitchHookHolder::new(next);
-    hook_holder.set_dropper(dropper);
+    hook_holder.set_lock(&mut lock);
     hook_holder.set_pending_thread(old.clone());
     let timed_out = Arc::new(AtomicBool::new(false));
     let timed_out_clone = timed_out.clone();
@@ -454,6 +478,8 @@ fn set_current_thread(t: ThreadNode) -> ThreadNode {
     let _dig = DisableInterruptGuard::new();
     let my_id = arch::current_cpu_id();
     assert!(t.validate_saved_sp());
+    #[cfg(scheduler = "percore")]
+    percore_scheduler::update_running_thread(&t);
     let old = unsafe { core::mem::replace(RUNNING_THREADS[my_id].assume_init_mut(), t) };
     // Do not validate sp here, since we might be using system stack,
     // like on cortex-m platform.
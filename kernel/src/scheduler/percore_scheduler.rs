@@ -0,0 +1,285 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Per-core ready queues. Every core owns a ReadyTable, so the common
+// paths, i.e., a core picking its next thread and a thread being woken
+// up on the core it last ran on, only touch a core-local lock. Priority
+// is strict within a core and approximate across cores: an idle core
+// steals from the busiest peer and a core queueing a thread which
+// outranks the one running remotely kicks the remote core with an IPI.
+
+use crate::{
+    arch,
+    config::MAX_THREAD_PRIORITY,
+    support::DisableInterruptGuard,
+    sync::spinlock::{SpinLock, SpinLockGuard},
+    thread,
+    thread::{Thread, ThreadNode},
+    types::{ArcList, ThreadPriority, Uint},
+};
+use blueos_infra::bitmap::{groups_for, PriorityBitmap};
+use blueos_kconfig::NUM_CORES;
+use core::{
+    mem::MaybeUninit,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+// Built in place, the queues of 256 priorities are too large for the
+// boot stack. They are linked by init().
+static mut READY_TABLES: [MaybeUninit<SpinLock<ReadyTable>>; NUM_CORES] =
+    [const { MaybeUninit::new(SpinLock::new(ReadyTable::new())) }; NUM_CORES];
+
+// Lock-free hints read by remote cores when picking a target to wake
+// a thread on or a victim to steal from. They might be stale, which
+// only leads to a suboptimal choice, never to an incorrect one.
+static CORE_HINTS: [CoreHint; NUM_CORES] = [const { CoreHint::new() }; NUM_CORES];
+
+// Prefer the local core over the affine core if the affine core has
+// this many more ready threads than the local one.
+const IMBALANCE_THRESHOLD: usize = 2;
+
+// One bit per priority, specialized for THREAD_PRIORITY_MAX.
+const NR_PRIORITIES: usize = MAX_THREAD_PRIORITY as usize + 1;
+type ReadyBitmap = PriorityBitmap<{ groups_for(NR_PRIORITIES) }>;
+
+struct CoreHint {
+    nr_ready: AtomicUsize,
+    running_priority: AtomicUsize,
+}
+
+impl CoreHint {
+    const fn new() -> Self {
+        Self {
+            nr_ready: AtomicUsize::new(0),
+            running_priority: AtomicUsize::new(MAX_THREAD_PRIORITY as usize),
+        }
+    }
+}
+
+pub(super) fn init() {
+    for i in 0..NUM_CORES {
+        let mut w = ready_table(i).irqsave_lock();
+        for j in 0..NR_PRIORITIES {
+            w.tables[j].init();
+        }
+    }
+}
+
+#[inline]
+fn ready_table(cpu: usize) -> &'static SpinLock<ReadyTable> {
+    unsafe { READY_TABLES[cpu].assume_init_ref() }
+}
+
+#[derive(Debug)]
+struct ReadyTable {
+    active_tables: ReadyBitmap,
+    tables: [ArcList<Thread, thread::OffsetOfSchedNode>; NR_PRIORITIES],
+}
+
+impl ReadyTable {
+    const fn new() -> Self {
+        Self {
+            active_tables: ReadyBitmap::new(),
+            tables: [const { ArcList::const_new() }; NR_PRIORITIES],
+        }
+    }
+
+    #[inline]
+    fn clear_active_queue(&mut self, bit: u32) -> &mut Self {
+        self.active_tables.clear(bit as usize);
+        self
+    }
+
+    #[inline]
+    fn set_active_queue(&mut self, bit: u32) -> &mut Self {
+        self.active_tables.set(bit as usize);
+        self
+    }
+
+    #[inline]
+    fn highest_active(&self) -> u32 {
+        self.active_tables.first().map_or(u32::MAX, |p| p as u32)
+    }
+
+    fn pop_highest(&mut self) -> Option<ThreadNode> {
+        let highest_active = self.highest_active();
+        if highest_active > MAX_THREAD_PRIORITY as u32 {
+            return None;
+        }
+        let q = &mut self.tables[highest_active as usize];
+        let next = q.pop_front();
+        assert!(next.is_some());
+        if q.is_empty() {
+            self.clear_active_queue(highest_active);
+        }
+        next
+    }
+
+    fn push(&mut self, t: ThreadNode) {
+        let priority = t.priority();
+        assert!(priority <= MAX_THREAD_PRIORITY);
+        let q = &mut self.tables[priority as usize];
+        q.push_back(t);
+        self.set_active_queue(priority as u32);
+    }
+}
+
+fn pop_from(cpu: usize) -> Option<ThreadNode> {
+    let mut tbl = ready_table(cpu).irqsave_lock();
+    let next = tbl.pop_highest()?;
+    CORE_HINTS[cpu].nr_ready.fetch_sub(1, Ordering::Relaxed);
+    Some(next)
+}
+
+// Steal the highest ready thread of the busiest peer.
+fn steal(me: usize) -> Option<ThreadNode> {
+    for _ in 0..NUM_CORES {
+        let mut victim = None;
+        let mut max = 0;
+        for i in 0..NUM_CORES {
+            if i == me {
+                continue;
+            }
+            let n = CORE_HINTS[i].nr_ready.load(Ordering::Relaxed);
+            if n > max {
+                max = n;
+                victim = Some(i);
+            }
+        }
+        let victim = victim?;
+        if let Some(t) = pop_from(victim) {
+            #[cfg(debugging_scheduler)]
+            crate::trace!(
+                "Core {} stole 0x{:x} from core {}",
+                me,
+                Thread::id(&t),
+                victim
+            );
+            return Some(t);
+        }
+        // The victim has been drained by someone else, retry since
+        // other peers might still have ready threads.
+    }
+    None
+}
+
+pub fn next_ready_thread() -> Option<ThreadNode> {
+    let _dig = DisableInterruptGuard::new();
+    let me = arch::current_cpu_id();
+    let next = pop_from(me).or_else(|| steal(me));
+    #[cfg(debugging_scheduler)]
+    crate::trace!(
+        "next_ready_thread on core {}: {:?}",
+        me,
+        next.as_ref().map(Thread::id)
+    );
+    let next = next?;
+    assert!(next.validate_saved_sp());
+    Some(next)
+}
+
+// New threads are queued on the local core. Woken threads are queued
+// on the core they last ran on to keep their cache footprint, unless
+// that core is notably busier than the local one.
+fn select_core(t: &ThreadNode, me: usize) -> usize {
+    let Some(affine) = t.last_cpu() else {
+        return me;
+    };
+    if affine == me {
+        return me;
+    }
+    let affine_load = CORE_HINTS[affine].nr_ready.load(Ordering::Relaxed);
+    let local_load = CORE_HINTS[me].nr_ready.load(Ordering::Relaxed);
+    if affine_load > local_load + IMBALANCE_THRESHOLD {
+        return me;
+    }
+    affine
+}
+
+// We only queue the thread if old_state equals thread's current state.
+pub fn queue_ready_thread(old_state: Uint, t: ThreadNode) -> bool {
+    assert!(old_state != thread::READY);
+    if !t.transfer_state(old_state, thread::READY) {
+        return false;
+    }
+    #[cfg(sched_trace)]
+    super::trace::wakeup(&t, old_state);
+    assert!(t.validate_saved_sp());
+    let _dig = DisableInterruptGuard::new();
+    let me = arch::current_cpu_id();
+    let target = select_core(&t, me);
+    let priority = t.priority();
+    {
+        let mut tbl = ready_table(target).irqsave_lock();
+        tbl.push(t);
+        CORE_HINTS[target].nr_ready.fetch_add(1, Ordering::Relaxed);
+        #[cfg(debugging_scheduler)]
+        crate::trace!(
+            "add pri {} to core {} get highest pri {}",
+            priority,
+            target,
+            tbl.highest_active()
+        );
+    }
+    if target != me
+        && (priority as usize) < CORE_HINTS[target].running_priority.load(Ordering::Relaxed)
+    {
+        arch::send_reschedule_ipi(target);
+    }
+    true
+}
+
+// Change the priority of `t` and move it to the queue of the new
+// priority if it's sitting in a ready table. All ready tables are
+// locked in core order, so that a ready thread is always found in the
+// queue of its current priority.
+pub fn set_thread_priority(t: &ThreadNode, p: ThreadPriority) {
+    assert!(p <= MAX_THREAD_PRIORITY);
+    let _dig = DisableInterruptGuard::new();
+    let mut tbls: [Option<SpinLockGuard<'_, ReadyTable>>; NUM_CORES] = [const { None }; NUM_CORES];
+    for (i, tbl) in tbls.iter_mut().enumerate() {
+        *tbl = Some(ready_table(i).lock());
+    }
+    let old = t.priority();
+    if old == p {
+        return;
+    }
+    t.lock().set_priority(p);
+    if t.sched_node.is_detached() {
+        return;
+    }
+    for tbl in tbls.iter_mut().flatten() {
+        let q = &mut tbl.tables[old as usize];
+        if !q.iter().any(|e| e.is(t)) {
+            continue;
+        }
+        let ok = q.remove(t);
+        assert!(ok);
+        if q.is_empty() {
+            tbl.clear_active_queue(old as u32);
+        }
+        tbl.push(t.clone());
+        return;
+    }
+}
+
+// Invoked by the context switch path once `t` becomes the running
+// thread of current core.
+pub(super) fn update_running_thread(t: &ThreadNode) {
+    let me = arch::current_cpu_id();
+    t.set_last_cpu(me);
+    CORE_HINTS[me]
+        .running_priority
+        .store(t.priority() as usize, Ordering::Relaxed);
+}
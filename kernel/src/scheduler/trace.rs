@@ -0,0 +1,217 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A binary trace of scheduling events. Every core records its events
+// in a ring of its own, timestamped by get_sys_cycles(), the newest
+// overwriting the oldest. Recording takes no lock, so it's cheap enough
+// to be left on, and works in interrupt handlers.
+//
+// Every slot carries the position it's written at, so a reader on
+// another core skips slots being overwritten.
+//
+// The time from a thread being made ready to it running is also kept
+// in log2 histograms per priority.
+
+use crate::{
+    arch,
+    config::MAX_THREAD_PRIORITY,
+    thread::{Thread, ThreadNode},
+    time, types,
+};
+use alloc::vec::Vec;
+use blueos_infra::ring::CachePadded;
+use blueos_kconfig::{NUM_CORES, SCHED_TRACE_ENTRIES};
+use core::{
+    cell::UnsafeCell,
+    mem::MaybeUninit,
+    ptr,
+    sync::atomic::{fence, AtomicU32, AtomicUsize, Ordering},
+};
+
+const _: () = assert!(SCHED_TRACE_ENTRIES.is_power_of_two());
+
+const NR_PRIORITIES: usize = MAX_THREAD_PRIORITY as usize + 1;
+pub(crate) const NR_BUCKETS: usize = usize::BITS as usize;
+
+#[derive(Clone, Copy, Debug, Eq, PartialEq)]
+pub(crate) enum Kind {
+    // From the thread `a` to the thread `b`.
+    Switch,
+    // The thread `a` is made ready from the state `b`.
+    Wakeup,
+    // The irq `a`.
+    IrqEnter,
+    IrqLeave,
+    // The timer at `a`.
+    Timer,
+    // On the address `a` holding `b`.
+    FutexWait,
+}
+
+impl Kind {
+    pub(crate) fn name(&self) -> &'static str {
+        match self {
+            Self::Switch => "switch",
+            Self::Wakeup => "wakeup",
+            Self::IrqEnter => "irq_enter",
+            Self::IrqLeave => "irq_leave",
+            Self::Timer => "timer",
+            Self::FutexWait => "futex_wait",
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug)]
+pub(crate) struct Event {
+    pub cycles: u64,
+    pub kind: Kind,
+    pub a: usize,
+    pub b: usize,
+}
+
+struct Slot {
+    // One after the position the event is written at, 0 while it's
+    // being written.
+    seq: AtomicUsize,
+    event: UnsafeCell<MaybeUninit<Event>>,
+}
+
+struct Ring {
+    head: AtomicUsize,
+    slots: [Slot; SCHED_TRACE_ENTRIES],
+}
+
+// SAFETY: Slots are checked with their sequence.
+unsafe impl Sync for Ring {}
+
+impl Ring {
+    const fn new() -> Self {
+        Self {
+            head: AtomicUsize::new(0),
+            slots: [const {
+                Slot {
+                    seq: AtomicUsize::new(0),
+                    event: UnsafeCell::new(MaybeUninit::uninit()),
+                }
+            }; SCHED_TRACE_ENTRIES],
+        }
+    }
+}
+
+static RINGS: [CachePadded<Ring>; NUM_CORES] = [const { CachePadded::new(Ring::new()) }; NUM_CORES];
+static LATENCIES: [[AtomicU32; NR_BUCKETS]; NR_PRIORITIES] =
+    [const { [const { AtomicU32::new(0) }; NR_BUCKETS] }; NR_PRIORITIES];
+
+fn record_at(cycles: u64, kind: Kind, a: usize, b: usize) {
+    let ring = &RINGS[arch::current_cpu_id()];
+    // Nested interrupts take slots of their own.
+    let pos = ring.head.fetch_add(1, Ordering::Relaxed);
+    let slot = &ring.slots[pos % SCHED_TRACE_ENTRIES];
+    slot.seq.store(0, Ordering::Relaxed);
+    fence(Ordering::Release);
+    let event = Event { cycles, kind, a, b };
+    // SAFETY: Readers discard the slot unless its sequence is the same
+    // before and after they read it.
+    unsafe { ptr::write_volatile(slot.event.get(), MaybeUninit::new(event)) };
+    slot.seq.store(pos.wrapping_add(1), Ordering::Release);
+}
+
+pub(crate) fn record(kind: Kind, a: usize, b: usize) {
+    record_at(time::get_sys_cycles(), kind, a, b);
+}
+
+pub(crate) fn wakeup(t: &ThreadNode, old_state: types::Uint) {
+    let cycles = time::get_sys_cycles();
+    // 0 is reserved for threads not woken.
+    t.set_woken_at(cycles as usize | 1);
+    record_at(cycles, Kind::Wakeup, Thread::id(t), old_state as usize);
+}
+
+pub(crate) fn switch(old: &ThreadNode, next: &ThreadNode, cycles: u64) {
+    let woken_at = next.woken_at();
+    if woken_at != 0 {
+        next.set_woken_at(0);
+        let latency = (cycles as usize).wrapping_sub(woken_at);
+        let bucket = (usize::BITS - latency.leading_zeros()) as usize;
+        let priority = (next.priority() as usize).min(NR_PRIORITIES - 1);
+        LATENCIES[priority][bucket.min(NR_BUCKETS - 1)].fetch_add(1, Ordering::Relaxed);
+    }
+    record_at(cycles, Kind::Switch, Thread::id(old), Thread::id(next));
+}
+
+/// Copy the events held by the ring of `cpu`, oldest first.
+pub(crate) fn events(cpu: usize) -> Vec<Event> {
+    let ring = &RINGS[cpu];
+    let head = ring.head.load(Ordering::Acquire);
+    let start = head.saturating_sub(SCHED_TRACE_ENTRIES);
+    let mut events = Vec::with_capacity(head - start);
+    for pos in start..head {
+        let slot = &ring.slots[pos % SCHED_TRACE_ENTRIES];
+        let seq = slot.seq.load(Ordering::Acquire);
+        if seq != pos.wrapping_add(1) {
+            continue;
+        }
+        // SAFETY: The event is only kept if the slot isn't written
+        // meanwhile.
+        let event = unsafe { ptr::read_volatile(slot.event.get()) };
+        fence(Ordering::Acquire);
+        if slot.seq.load(Ordering::Relaxed) == seq {
+            // SAFETY: Written before the sequence is published.
+            events.push(unsafe { event.assume_init() });
+        }
+    }
+    events
+}
+
+/// Wakeup to run latency counts of `priority`, the bucket `i` counts
+/// latencies under 2^i cycles.
+pub(crate) fn latencies(priority: usize) -> [u32; NR_BUCKETS] {
+    core::array::from_fn(|i| LATENCIES[priority][i].load(Ordering::Relaxed))
+}
+
+pub(crate) const fn nr_priorities() -> usize {
+    NR_PRIORITIES
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::scheduler;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_record_in_order() {
+        let _dig = crate::support::DisableInterruptGuard::new();
+        let cpu = arch::current_cpu_id();
+        record(Kind::FutexWait, 1, 2);
+        record(Kind::FutexWait, 3, 4);
+        let events = events(cpu);
+        let n = events.len();
+        assert!(n >= 2);
+        assert_eq!((events[n - 2].a, events[n - 1].a), (1, 3));
+        assert!(events[n - 2].cycles <= events[n - 1].cycles);
+    }
+
+    #[test]
+    fn test_latency_counted_on_switch() {
+        let t = scheduler::current_thread();
+        let priority = t.priority() as usize;
+        let before: u32 = latencies(priority).iter().sum();
+        t.set_woken_at(time::get_sys_cycles() as usize | 1);
+        switch(&t, &t, time::get_sys_cycles());
+        let after: u32 = latencies(priority).iter().sum();
+        assert_eq!(after, before + 1);
+        assert_eq!(t.woken_at(), 0);
+    }
+}
@@ -31,42 +31,21 @@ pub struct WaitEntry {
 impl !Send for WaitEntry {}
 impl !Sync for WaitEntry {}
 
-pub(crate) struct WaitQueueGuardDropper<'a, const N: usize> {
-    guards: [Option<SpinLockGuard<'a, WaitQueue>>; N],
-    num_active_guards: usize,
+// A lock held across the context switch of a thread being suspended.
+// It's released once the context of the thread is saved, so that
+// wakers holding the lock always see the thread suspended.
+pub(crate) trait SuspendLock {
+    fn release(&mut self);
 }
 
-impl<'a, const N: usize> WaitQueueGuardDropper<'a, N> {
-    pub const fn const_new() -> Self {
-        Self {
-            guards: [const { None }; N],
-            num_active_guards: 0,
-        }
-    }
-
-    pub const fn new() -> Self {
-        Self::const_new()
-    }
-
+impl<T: ?Sized> SuspendLock for Option<SpinLockGuard<'_, T>> {
     #[inline]
-    pub fn add(&mut self, w: SpinLockGuard<'a, WaitQueue>) -> bool {
-        if self.num_active_guards == N {
-            return false;
-        }
-        assert!(self.guards[self.num_active_guards].is_none());
-        self.guards[self.num_active_guards] = Some(w);
-        self.num_active_guards += 1;
-        true
-    }
-
-    #[inline]
-    pub fn forget_irq(&mut self) {
-        for i in 0..self.num_active_guards {
-            if let Some(v) = self.guards[i].as_mut() {
-                v.forget_irq()
-            }
-        }
+    fn release(&mut self) {
+        // Move the guard off the stack of the suspended thread first.
+        let Some(mut w) = self.take() else {
+            return;
+        };
+        w.forget_irq();
+        drop(w);
     }
 }
-
-pub(crate) type DefaultWaitQueueGuardDropper<'a> = WaitQueueGuardDropper<'a, 2>;
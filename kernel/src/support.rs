@@ -12,12 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::{
-    arch,
-    sync::spinlock::{SpinLock, SpinLockGuard},
-    thread::ThreadNode,
-    types::{Arc, ArcList, AtomicUint, IntrusiveAdapter, Uint},
-};
+use crate::{arch, thread::ThreadNode};
 use core::{
     mem::MaybeUninit,
     ptr::NonNull,
@@ -210,6 +205,46 @@ pub const fn is_aligned(addr: usize, align: usize) -> bool {
     align_offset(addr, align) == 0
 }
 
+/// Copy `src` into the concatenation of `bufs`, starting at byte `pos`
+/// of it. Return the number of bytes copied.
+pub fn scatter(bufs: &mut [&mut [u8]], mut pos: usize, src: &[u8]) -> usize {
+    let mut count = 0;
+    for buf in bufs.iter_mut() {
+        if count == src.len() {
+            break;
+        }
+        if pos >= buf.len() {
+            pos -= buf.len();
+            continue;
+        }
+        let n = (buf.len() - pos).min(src.len() - count);
+        buf[pos..pos + n].copy_from_slice(&src[count..count + n]);
+        count += n;
+        pos = 0;
+    }
+    count
+}
+
+/// Copy the concatenation of `bufs`, starting at byte `pos` of it, into
+/// `dst`. Return the number of bytes copied.
+pub fn gather(bufs: &[&[u8]], mut pos: usize, dst: &mut [u8]) -> usize {
+    let mut count = 0;
+    for buf in bufs.iter() {
+        if count == dst.len() {
+            break;
+        }
+        if pos >= buf.len() {
+            pos -= buf.len();
+            continue;
+        }
+        let n = (buf.len() - pos).min(dst.len() - count);
+        dst[count..count + n].copy_from_slice(&buf[pos..pos + n]);
+        count += n;
+        pos = 0;
+    }
+    count
+}
+
 /// Polyfill for <https://github.com/rust-lang/rust/issues/71941>
 #[inline]
 pub fn nonnull_slice_from_raw_parts<T>(ptr: NonNull<T>, len: usize) -> NonNull<[T]> {
@@ -270,53 +305,6 @@ impl Drop for PerCpuVarAccessGuard {
     }
 }
 
-pub(crate) struct ArcBufferingQueue<T: Sized, A: IntrusiveAdapter, const N: usize> {
-    queues: [SpinLock<ArcList<T, A>>; N],
-    active: AtomicUint,
-}
-
-impl<T: Sized, A: IntrusiveAdapter, const N: usize> Init for ArcBufferingQueue<T, A, N> {
-    fn init(&mut self) -> bool {
-        self.init_queues() == N
-    }
-}
-
-impl<T: Sized, A: IntrusiveAdapter, const N: usize> ArcBufferingQueue<T, A, N> {
-    #[inline]
-    pub const fn new() -> Self {
-        Self {
-            queues: [const { SpinLock::new(ArcList::new()) }; N],
-            active: AtomicUint::new(0),
-        }
-    }
-
-    pub fn init_queues(&self) -> usize {
-        let mut res = 0;
-        for i in 0..N {
-            if self.queues[i].lock().init() {
-                res += 1;
-            }
-        }
-        res
-    }
-
-    pub type WorkList = ArcList<T, A>;
-
-    #[inline]
-    #[allow(clippy::unnecessary_cast)]
-    pub fn advance_active_queue(&self) -> SpinLockGuard<'_, ArcList<T, A>> {
-        let i = self.active.fetch_add(1, Ordering::AcqRel) as usize;
-        self.queues[i % N].irqsave_lock()
-    }
-
-    #[inline]
-    #[allow(clippy::unnecessary_cast)]
-    pub fn get_active_queue(&self) -> SpinLockGuard<'_, ArcList<T, A>> {
-        let i = self.active.load(Ordering::Acquire) as usize;
-        self.queues[i % N].irqsave_lock()
-    }
-}
-
 pub trait Init {
     fn init(&mut self) -> bool;
 }
@@ -12,55 +12,173 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+// Waiting addresses are hashed into a fixed table of buckets, each
+// with its own lock. A waiter lives on the stack of the waiting thread
+// and is linked to the bucket of the address it waits on until it's
+// woken up, timed out or requeued to another bucket.
+
 extern crate alloc;
 use crate::{
-    arch, debug,
     error::{code, Error},
-    scheduler, static_arc, support,
-    sync::SpinLock,
+    scheduler,
+    sync::{SpinLock, SpinLockGuard},
     thread,
     thread::{Thread, ThreadNode},
     time::WAITING_FOREVER,
-    trace,
-    types::{impl_simple_intrusive_adapter, Arc, ArcList, ArcListIterator, IlistHead as ListHead},
+    types::impl_simple_intrusive_adapter,
+};
+use blueos_infra::list::typed_ilist::{ListHead, ListIterator};
+use core::{
+    ptr::NonNull,
+    sync::atomic::{AtomicUsize, Ordering},
 };
-use core::sync::atomic::{AtomicUsize, Ordering};
-use scheduler::WaitQueue;
-use support::PerCpu;
 
-impl_simple_intrusive_adapter!(Sync, AtomicWaitEntry, sync_node);
+#[cfg(target_pointer_width = "32")]
+const NR_BUCKETS_SHIFT: u32 = 4;
+#[cfg(target_pointer_width = "64")]
+const NR_BUCKETS_SHIFT: u32 = 6;
+const NR_BUCKETS: usize = 1 << NR_BUCKETS_SHIFT;
+
+impl_simple_intrusive_adapter!(OffsetOfWaiter, Waiter, node);
 
-type Head = ListHead<AtomicWaitEntry, Sync>;
-type EntryList = ArcList<AtomicWaitEntry, Sync>;
-type EntryNode = Arc<AtomicWaitEntry>;
+type Head = ListHead<Waiter, OffsetOfWaiter>;
+
+static BUCKETS: [Bucket; NR_BUCKETS] = [const { Bucket::new() }; NR_BUCKETS];
 
 #[derive(Debug)]
-pub struct AtomicWaitEntry {
-    pub sync_node: EntryList,
+struct Waiter {
+    node: Head,
+    // Both are protected by the lock of the bucket the waiter is
+    // linked to. They are changed when the waiter is requeued.
     addr: usize,
-    pending: SpinLock<WaitQueue>,
+    bucket: AtomicUsize,
+    thread: ThreadNode,
 }
 
-impl AtomicWaitEntry {
-    pub fn init(&self) -> bool {
-        return self.pending.irqsave_lock().init();
+#[derive(Debug)]
+struct WaiterList {
+    head: Head,
+    tail: Head,
+}
+
+impl WaiterList {
+    const fn new() -> Self {
+        Self {
+            head: Head::new(),
+            tail: Head::new(),
+        }
+    }
+
+    // Buckets are static, link the sentinels on first use.
+    #[inline]
+    fn init_once(&mut self) {
+        if self.head.next.is_none() {
+            ListHead::insert_after(&mut self.head, NonNull::from_mut(&mut self.tail));
+        }
+    }
+
+    #[inline]
+    fn push_back(&mut self, w: &mut Waiter) {
+        let ok = ListHead::insert_before(&mut self.tail, NonNull::from_mut(&mut w.node));
+        debug_assert!(ok);
     }
 
-    pub fn addr(&self) -> usize {
-        self.addr
+    #[inline]
+    fn iter(&self) -> ListIterator<Waiter, OffsetOfWaiter> {
+        ListIterator::new(&self.head, Some(NonNull::from_ref(&self.tail)))
     }
+}
 
-    pub fn new(addr: usize) -> Self {
+// Padded to avoid false sharing of locks of adjacent buckets.
+#[cfg_attr(target_pointer_width = "32", repr(align(32)))]
+#[cfg_attr(target_pointer_width = "64", repr(align(64)))]
+#[derive(Debug)]
+struct Bucket {
+    waiters: SpinLock<WaiterList>,
+}
+
+// SAFETY: Waiters are only accessed with the lock of the bucket held.
+unsafe impl Sync for Bucket {}
+
+impl Bucket {
+    const fn new() -> Self {
         Self {
-            sync_node: EntryList::new(),
-            addr,
-            pending: SpinLock::new(WaitQueue::new()),
+            waiters: SpinLock::const_new(WaiterList::new()),
         }
     }
 }
 
-static_arc! {
-    SYNC_ENTRIES(SpinLock<Head>, SpinLock::new(Head::new())),
+#[inline]
+fn bucket_of(addr: usize) -> usize {
+    // Fibonacci hashing, atomics are at least 4-byte aligned.
+    #[cfg(target_pointer_width = "32")]
+    const GOLDEN_RATIO: usize = 0x9e37_79b9;
+    #[cfg(target_pointer_width = "64")]
+    const GOLDEN_RATIO: usize = 0x9e37_79b9_7f4a_7c15;
+    (addr >> 2).wrapping_mul(GOLDEN_RATIO) >> (usize::BITS - NR_BUCKETS_SHIFT)
+}
+
+#[inline]
+fn lock_bucket(i: usize) -> SpinLockGuard<'static, WaiterList> {
+    let mut w = BUCKETS[i].waiters.irqsave_lock();
+    w.init_once();
+    w
+}
+
+// Lock both buckets in index order to avoid deadlock. The second guard
+// is None if both indices refer to the same bucket.
+fn lock_bucket_pair(
+    a: usize,
+    b: usize,
+) -> (
+    SpinLockGuard<'static, WaiterList>,
+    Option<SpinLockGuard<'static, WaiterList>>,
+) {
+    if a == b {
+        return (lock_bucket(a), None);
+    }
+    if a < b {
+        let wa = lock_bucket(a);
+        let wb = lock_bucket(b);
+        (wa, Some(wb))
+    } else {
+        let mut wb = lock_bucket(b);
+        let mut wa = lock_bucket(a);
+        // The first guard is dropped last, so it must restore the irq
+        // state saved by the first lock.
+        wa.take_irq_guard(&mut wb);
+        (wa, Some(wb))
+    }
+}
+
+// Wake up at most `how_many` waiters of `addr` in the bucket, the
+// bucket lock must be held.
+fn wake_locked(w: &mut WaiterList, addr: usize, how_many: usize) -> usize {
+    let mut woken = 0;
+    if how_many == 0 {
+        return 0;
+    }
+    for node in w.iter() {
+        let waiter = unsafe { (*node.as_ptr()).owner_mut() };
+        if waiter.addr != addr {
+            continue;
+        }
+        ListHead::detach(node);
+        // The waiter might have been timed out and is about to leave.
+        if scheduler::queue_ready_thread(thread::SUSPENDED, waiter.thread.clone()) {
+            woken += 1;
+            #[cfg(debugging_scheduler)]
+            crate::trace!(
+                "[TH:0x{:x}] Woken up 0x{:x}",
+                scheduler::current_thread_id(),
+                Thread::id(&waiter.thread)
+            );
+        }
+        if woken == how_many {
+            break;
+        }
+    }
+    woken
 }
 
 pub fn atomic_wait(atom: &AtomicUsize, val: usize, timeout: Option<usize>) -> Result<(), Error> {
@@ -68,47 +186,47 @@ pub fn atomic_wait(atom: &AtomicUsize, val: usize, timeout: Option<usize>) -> Re
     if current_val != val {
         return Err(code::EAGAIN);
     }
+    let addr = atom as *const _ as usize;
+    let b = bucket_of(addr);
     // We should not wait in IRQ.
-    let mut w = SYNC_ENTRIES.irqsave_lock();
+    let mut w = lock_bucket(b);
     // Make the second check.
     let current_val = atom.load(Ordering::Acquire);
     if current_val != val {
         return Err(code::EAGAIN);
     }
-    let mut entry = None;
-    let addr = atom as *const _ as usize;
-    for e in ArcListIterator::new(&*w, None) {
-        if e.addr() == addr {
-            entry = Some(e);
-            break;
-        }
-    }
-    let entry = entry.map_or_else(
-        || {
-            let entry = Arc::new(AtomicWaitEntry::new(addr));
-            entry.init();
-            EntryList::insert_after(&mut *w, entry.clone());
-            entry
-        },
-        |e| e,
-    );
-    let t = scheduler::current_thread();
-    let mut we = entry.pending.irqsave_lock();
-    we.take_irq_guard(&mut w);
-    drop(w);
+    let mut waiter = Waiter {
+        node: Head::new(),
+        addr,
+        bucket: AtomicUsize::new(b),
+        thread: scheduler::current_thread(),
+    };
+    w.push_back(&mut waiter);
+    #[cfg(sched_trace)]
+    crate::scheduler::trace::record(crate::scheduler::trace::Kind::FutexWait, addr, val);
     #[cfg(debugging_scheduler)]
     crate::trace!(
         "[TH:0x{:x}] will be waiting @ 0x{:x}",
         scheduler::current_thread_id(),
         addr
     );
-    if let Some(timeout) = timeout {
-        let res = scheduler::suspend_me_with_timeout(we, timeout);
-        if res {
-            return Err(code::ETIMEDOUT);
+    let timed_out = scheduler::suspend_me_holding(w, timeout.unwrap_or(WAITING_FOREVER));
+    // The waiter must be unlinked before it goes out of scope. It
+    // might have been requeued meanwhile, so make sure the bucket
+    // locked is the one it's linked to.
+    loop {
+        let b = waiter.bucket.load(Ordering::Acquire);
+        let _w = lock_bucket(b);
+        if waiter.bucket.load(Ordering::Relaxed) != b {
+            continue;
         }
-    } else {
-        let _ = scheduler::suspend_me_with_timeout(we, WAITING_FOREVER);
+        if !waiter.node.is_detached() {
+            ListHead::detach(NonNull::from_mut(&mut waiter.node));
+        }
+        break;
+    }
+    if timed_out {
+        return Err(code::ETIMEDOUT);
     }
     Ok(())
 }
@@ -124,46 +242,74 @@ pub fn atomic_wake(atom: &AtomicUsize, how_many: usize) -> Result<usize, Error>
         scheduler::current_thread_id(),
         addr
     );
-    let mut woken = 0;
-    let w = SYNC_ENTRIES.irqsave_lock();
-    for e in ArcListIterator::new(&*w, None) {
-        if e.addr() != addr {
-            continue;
-        }
-        let mut we = e.pending.irqsave_lock();
-        while let Some(next) = we.pop_front() {
-            if scheduler::queue_ready_thread(thread::SUSPENDED, next.thread.clone()) {
-                woken += 1;
-                #[cfg(debugging_scheduler)]
-                crate::trace!(
-                    "[TH:0x{:x}] Woken up 0x{:x}",
-                    scheduler::current_thread_id(),
-                    Thread::id(&next.thread)
-                );
+    let mut w = lock_bucket(bucket_of(addr));
+    let woken = wake_locked(&mut w, addr, how_many);
+    drop(w);
+    #[cfg(debugging_scheduler)]
+    crate::trace!(
+        "[TH:0x{:x}] woken up {} threads",
+        scheduler::current_thread_id(),
+        woken
+    );
+    scheduler::yield_me_now_or_later();
+    Ok(woken)
+}
+
+// Wake up at most `how_many` waiters of `atom` and move at most
+// `max_requeue` of the rest to wait on `target`, if `atom` still holds
+// `val`. Useful for condition variable broadcasts, where all but one
+// waiter would contend on the mutex again right after being woken up.
+// Return the number of waiters woken up and requeued.
+pub fn atomic_requeue(
+    atom: &AtomicUsize,
+    val: usize,
+    how_many: usize,
+    target: &AtomicUsize,
+    max_requeue: usize,
+) -> Result<usize, Error> {
+    let addr = atom as *const _ as usize;
+    let target_addr = target as *const _ as usize;
+    if addr == target_addr {
+        return Err(code::EINVAL);
+    }
+    let (from, to) = (bucket_of(addr), bucket_of(target_addr));
+    let (mut w, mut target_w) = lock_bucket_pair(from, to);
+    if atom.load(Ordering::Acquire) != val {
+        return Err(code::EAGAIN);
+    }
+    let woken = wake_locked(&mut w, addr, how_many);
+    let mut requeued = 0;
+    if max_requeue > 0 {
+        for node in w.iter() {
+            let waiter = unsafe { (*node.as_ptr()).owner_mut() };
+            if waiter.addr != addr {
+                continue;
             }
-            if woken == how_many {
+            waiter.addr = target_addr;
+            if let Some(target_w) = target_w.as_mut() {
+                ListHead::detach(node);
+                waiter.bucket.store(to, Ordering::Release);
+                target_w.push_back(waiter);
+            }
+            requeued += 1;
+            if requeued == max_requeue {
                 break;
             }
         }
-        if we.is_empty() {
-            EntryList::detach(&e.clone());
-        }
-        if woken == how_many {
-            break;
-        }
     }
+    drop(target_w);
     drop(w);
     #[cfg(debugging_scheduler)]
     crate::trace!(
-        "[TH:0x{:x}] woken up {} threads",
+        "[TH:0x{:x}] woken up {} threads, requeued {} threads",
         scheduler::current_thread_id(),
-        woken
+        woken,
+        requeued
     );
     scheduler::yield_me_now_or_later();
-    Ok(woken)
+    Ok(woken + requeued)
 }
 
-#[cfg(cortex_m)]
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -172,6 +318,7 @@ mod tests {
 
     static ATOM: AtomicUsize = AtomicUsize::new(0);
 
+    #[cfg(cortex_m)]
     #[test]
     fn test_atomic_wait_timeout() {
         let result = atomic_wait(&ATOM, 0, Some(10));
@@ -179,4 +326,48 @@ mod tests {
         assert_eq!(result.unwrap_err(), code::ETIMEDOUT);
         atomic_wake(&ATOM, 1);
     }
+
+    #[test]
+    fn test_atomic_wait_mismatch() {
+        assert_eq!(atomic_wait(&ATOM, 1, None).unwrap_err(), code::EAGAIN);
+        assert_eq!(atomic_wake(&ATOM, 1).unwrap(), 0);
+    }
+
+    static COND: AtomicUsize = AtomicUsize::new(0);
+    static MUTEX: AtomicUsize = AtomicUsize::new(0);
+    static GO: AtomicUsize = AtomicUsize::new(0);
+    static DONE: AtomicUsize = AtomicUsize::new(0);
+
+    #[test]
+    fn test_atomic_requeue() {
+        assert_eq!(
+            atomic_requeue(&COND, 0, 1, &COND, 1).unwrap_err(),
+            code::EINVAL
+        );
+        assert_eq!(
+            atomic_requeue(&COND, 1, 1, &MUTEX, 1).unwrap_err(),
+            code::EAGAIN
+        );
+        const N: usize = 3;
+        for _ in 0..N {
+            thread::spawn(|| {
+                while GO.load(Ordering::Acquire) == 0 {
+                    let _ = atomic_wait(&COND, 0, None);
+                }
+                DONE.fetch_add(1, Ordering::Release);
+            });
+        }
+        scheduler::suspend_me_for(10);
+        GO.store(1, Ordering::Release);
+        // Wake up one and move the rest to the mutex.
+        assert_eq!(atomic_requeue(&COND, 0, 1, &MUTEX, usize::MAX).unwrap(), N);
+        while DONE.load(Ordering::Acquire) != 1 {
+            scheduler::yield_me();
+        }
+        assert_eq!(atomic_wake(&COND, usize::MAX).unwrap(), 0);
+        assert_eq!(atomic_wake(&MUTEX, usize::MAX).unwrap(), N - 1);
+        while DONE.load(Ordering::Acquire) != N {
+            scheduler::yield_me();
+        }
+    }
 }
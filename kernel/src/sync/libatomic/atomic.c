@@ -35,6 +35,10 @@
 //  For operations that must be atomic on two locations, the lower lock is
 //  always acquired first, to avoid deadlock.
 //
+//  The locks are sequence locks, loads only read them and retry if a store
+//  ran meanwhile.  On single-core M-profile parts, masking interrupts does
+//  the job and no lock is taken at all.
+//
 //===----------------------------------------------------------------------===//
 
 #if __POINTER_WIDTH__ == 32
@@ -71,36 +75,105 @@ extern void enable_local_irq_restore(size_t);
 #pragma redefine_extname __atomic_is_lock_free_c SYMBOL_NAME(                  \
     __atomic_is_lock_free)
 
-/// Number of locks.  This allocates one page on 32-bit platforms, two on
-/// 64-bit.  This can be specified externally if a different trade between
-/// memory usage and contention probability is required for a given platform.
+/// M-profile parts run a single core, where masking interrupts is enough to
+/// make an access atomic, so they need no locks.  Define ATOMIC_SMP to use
+/// the locks anyway.
+#if defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M' &&                \
+    !defined(ATOMIC_SMP)
+#define ATOMIC_UNIPROCESSOR 1
+#endif
+
+/// Number of locks.  Every lock takes a cache line of its own, so that
+/// accesses through different locks don't contend for the same line.  This
+/// allocates one page with 64-byte lines.  This can be specified externally
+/// if a different trade between memory usage and contention probability is
+/// required for a given platform.
 #ifndef SPINLOCK_COUNT
-#define SPINLOCK_COUNT (1 << 10)
+#define SPINLOCK_COUNT (1 << 6)
+#endif
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
 #endif
 static const long SPINLOCK_MASK = SPINLOCK_COUNT - 1;
 
 ////////////////////////////////////////////////////////////////////////////////
-// Platform-specific lock implementation.  Falls back to spinlocks if none is
-// defined.  Each platform should define the Lock type, and corresponding
-// lock() and unlock() functions.
+// Platform-specific lock implementation.  Falls back to sequence locks if
+// none is defined.  Each platform should define the Lock type, and
+// corresponding lock(), unlock(), read_begin() and read_retry() functions.
+//
+// Writers take the lock with IRQs off, so a reader on the same core never
+// waits for a writer it interrupted.  Readers don't write the lock, they
+// retry if a writer ran while they copied.
 ////////////////////////////////////////////////////////////////////////////////
 _Static_assert(__atomic_always_lock_free(sizeof(uintptr_t), 0),
                "Implementation assumes lock-free pointer-size cmpxchg");
-typedef _Atomic(uintptr_t) Lock;
+typedef struct {
+  // Odd while a writer holds the lock.
+  _Atomic(uintptr_t) seq;
+} __attribute__((aligned(CACHE_LINE_SIZE))) Lock;
+
+#ifdef ATOMIC_UNIPROCESSOR
+__inline static size_t lock(Lock *l) {
+  (void)l;
+  return disable_local_irq_save();
+}
+__inline static void unlock(Lock *l, size_t irq_status) {
+  (void)l;
+  enable_local_irq_restore(irq_status);
+}
+/// Readers mask IRQs too, which only touches the state of the core.  The
+/// returned token is the IRQ status.
+__inline static uintptr_t read_begin(Lock *l) {
+  (void)l;
+  return disable_local_irq_save();
+}
+__inline static bool read_retry(Lock *l, uintptr_t token) {
+  (void)l;
+  enable_local_irq_restore(token);
+  return false;
+}
+static __inline Lock *lock_for_pointer(void *ptr) {
+  (void)ptr;
+  return 0;
+}
+#else
 /// Unlock a lock.  This is a release operation.
 __inline static void unlock(Lock *l, size_t irq_status) {
-  __c11_atomic_store(l, 0, __ATOMIC_RELEASE);
+  uintptr_t seq = __c11_atomic_load(&l->seq, __ATOMIC_RELAXED);
+  __c11_atomic_store(&l->seq, seq + 1, __ATOMIC_RELEASE);
   enable_local_irq_restore(irq_status);
 }
 /// Locks a lock.  In the current implementation, this is potentially
-/// unbounded in the contended case.
+/// unbounded in the contended case.  Waiters spin on loads, and only try to
+/// take the lock once it looks free.
 __inline static size_t lock(Lock *l) {
   size_t irq_status = disable_local_irq_save();
-  uintptr_t old = 0;
-  while (!__c11_atomic_compare_exchange_weak(l, &old, 1, __ATOMIC_ACQUIRE,
-                                             __ATOMIC_RELAXED))
-    old = 0;
-  return irq_status;
+  for (;;) {
+    uintptr_t seq = __c11_atomic_load(&l->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) == 0 &&
+        __c11_atomic_compare_exchange_weak(&l->seq, &seq, seq + 1,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      // Order the odd sequence before the stores of the writer, so a reader
+      // seeing any of them also sees it changed, as smp_wmb() does in
+      // write_seqcount_begin().
+      __c11_atomic_thread_fence(__ATOMIC_RELEASE);
+      return irq_status;
+    }
+  }
+}
+/// Start a read, return the sequence to check the read with.
+__inline static uintptr_t read_begin(Lock *l) {
+  for (;;) {
+    uintptr_t seq = __c11_atomic_load(&l->seq, __ATOMIC_ACQUIRE);
+    if ((seq & 1) == 0)
+      return seq;
+  }
+}
+/// Whether a writer ran since read_begin() returned `seq`, so the data read
+/// may be torn.
+__inline static bool read_retry(Lock *l, uintptr_t seq) {
+  __c11_atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __c11_atomic_load(&l->seq, __ATOMIC_RELAXED) != seq;
 }
 /// locks for atomic operations
 static Lock locks[SPINLOCK_COUNT];
@@ -121,6 +194,7 @@ static __inline Lock *lock_for_pointer(void *ptr) {
   // Return a pointer to the word to use
   return locks + (hash & SPINLOCK_MASK);
 }
+#endif
 
 /// Macros for determining whether a size is lock free.
 #define ATOMIC_ALWAYS_LOCK_FREE_OR_ALIGNED_LOCK_FREE(size, p)                  \
@@ -176,9 +250,11 @@ void __atomic_load_c(int size, void *src, void *dest, int model) {
   LOCK_FREE_CASES(src);
 #undef LOCK_FREE_ACTION
   Lock *l = lock_for_pointer(src);
-  size_t irq = lock(l);
-  memcpy(dest, src, size);
-  unlock(l, irq);
+  uintptr_t seq;
+  do {
+    seq = read_begin(l);
+    memcpy(dest, src, size);
+  } while (read_retry(l, seq));
 }
 
 /// An atomic store operation.  This is atomic with respect to the destination
@@ -260,9 +336,12 @@ void __atomic_exchange_c(int size, void *ptr, void *val, void *old, int model) {
     if (lockfree(src))                                                         \
       return __c11_atomic_load((_Atomic(type) *)src, model);                   \
     Lock *l = lock_for_pointer(src);                                           \
-    size_t irq = lock(l);                                                      \
-    type val = *src;                                                           \
-    unlock(l, irq);                                                            \
+    uintptr_t seq;                                                             \
+    type val;                                                                  \
+    do {                                                                       \
+      seq = read_begin(l);                                                     \
+      val = *(volatile type *)src;                                             \
+    } while (read_retry(l, seq));                                              \
     return val;                                                                \
   }
 OPTIMISED_CASES
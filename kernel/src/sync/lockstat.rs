@@ -0,0 +1,167 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Contention counters of spin locks by the call site taking them. Sites
+// are told by the location of the caller of lock(), and kept in a fixed
+// open addressing table claimed without locks, so that counting works
+// in any context, the allocator included. Acquisitions at sites not
+// fitting in the table are only counted as overflow.
+
+use alloc::vec::Vec;
+use blueos_kconfig::LOCK_STATS_SITES;
+use core::{
+    panic::Location,
+    ptr,
+    sync::atomic::{AtomicPtr, AtomicUsize, Ordering},
+};
+
+const _: () = assert!(LOCK_STATS_SITES.is_power_of_two());
+// Probes before a site is given up.
+const MAX_PROBES: usize = 8;
+
+pub(super) struct Site {
+    location: AtomicPtr<Location<'static>>,
+    acquisitions: AtomicUsize,
+    contentions: AtomicUsize,
+    spins: AtomicUsize,
+    max_hold_cycles: AtomicUsize,
+    max_irq_off_cycles: AtomicUsize,
+}
+
+impl Site {
+    const fn new() -> Self {
+        Self {
+            location: AtomicPtr::new(ptr::null_mut()),
+            acquisitions: AtomicUsize::new(0),
+            contentions: AtomicUsize::new(0),
+            spins: AtomicUsize::new(0),
+            max_hold_cycles: AtomicUsize::new(0),
+            max_irq_off_cycles: AtomicUsize::new(0),
+        }
+    }
+
+    #[inline]
+    pub(super) fn record_acquire(&self, spins: usize) {
+        self.acquisitions.fetch_add(1, Ordering::Relaxed);
+        if spins != 0 {
+            self.contentions.fetch_add(1, Ordering::Relaxed);
+            self.spins.fetch_add(spins, Ordering::Relaxed);
+        }
+    }
+
+    #[inline]
+    pub(super) fn record_release(&self, hold_cycles: usize, irq_off_cycles: Option<usize>) {
+        self.max_hold_cycles
+            .fetch_max(hold_cycles, Ordering::Relaxed);
+        if let Some(cycles) = irq_off_cycles {
+            self.max_irq_off_cycles.fetch_max(cycles, Ordering::Relaxed);
+        }
+    }
+}
+
+static SITES: [Site; LOCK_STATS_SITES] = [const { Site::new() }; LOCK_STATS_SITES];
+static OVERFLOW: AtomicUsize = AtomicUsize::new(0);
+
+/// Find or claim the site of `location`.
+pub(super) fn site(location: &'static Location<'static>) -> Option<&'static Site> {
+    let key = location as *const _ as *mut Location<'static>;
+    let hash = (key as usize >> 2).wrapping_mul(0x9e37_79b9);
+    for i in 0..MAX_PROBES {
+        let site = &SITES[hash.wrapping_add(i) & (LOCK_STATS_SITES - 1)];
+        let current = site.location.load(Ordering::Acquire);
+        if current == key {
+            return Some(site);
+        }
+        if current.is_null() {
+            match site.location.compare_exchange(
+                ptr::null_mut(),
+                key,
+                Ordering::AcqRel,
+                Ordering::Acquire,
+            ) {
+                Ok(_) => return Some(site),
+                Err(other) if other == key => return Some(site),
+                Err(_) => continue,
+            }
+        }
+    }
+    OVERFLOW.fetch_add(1, Ordering::Relaxed);
+    None
+}
+
+#[derive(Debug, Clone, Copy)]
+pub struct LockSiteStats {
+    pub location: &'static Location<'static>,
+    pub acquisitions: usize,
+    pub contentions: usize,
+    pub spins: usize,
+    pub max_hold_cycles: usize,
+    pub max_irq_off_cycles: usize,
+}
+
+/// Counters of all call sites seen, most contended first.
+pub fn lock_sites() -> Vec<LockSiteStats> {
+    let mut sites: Vec<LockSiteStats> = SITES
+        .iter()
+        .filter_map(|site| {
+            let location = site.location.load(Ordering::Acquire);
+            if location.is_null() {
+                return None;
+            }
+            Some(LockSiteStats {
+                // SAFETY: Only locations of 'static lifetime are stored.
+                location: unsafe { &*location },
+                acquisitions: site.acquisitions.load(Ordering::Relaxed),
+                contentions: site.contentions.load(Ordering::Relaxed),
+                spins: site.spins.load(Ordering::Relaxed),
+                max_hold_cycles: site.max_hold_cycles.load(Ordering::Relaxed),
+                max_irq_off_cycles: site.max_irq_off_cycles.load(Ordering::Relaxed),
+            })
+        })
+        .collect();
+    sites.sort_unstable_by(|a, b| {
+        b.spins
+            .cmp(&a.spins)
+            .then(b.acquisitions.cmp(&a.acquisitions))
+    });
+    sites
+}
+
+/// Acquisitions at sites the table has no room for.
+pub fn lock_sites_overflow() -> usize {
+    OVERFLOW.load(Ordering::Relaxed)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::sync::SpinLock;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_sites_told_by_caller() {
+        let lock = SpinLock::new(0);
+        let here = Location::caller();
+        for _ in 0..2 {
+            *lock.lock() += 1;
+        }
+        *lock.irqsave_lock() += 1;
+        let sites: Vec<_> = lock_sites()
+            .into_iter()
+            .filter(|s| s.location.file() == here.file())
+            .collect();
+        assert!(sites.iter().any(|s| s.acquisitions >= 2));
+        assert!(sites.len() >= 2);
+    }
+}
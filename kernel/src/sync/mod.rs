@@ -13,8 +13,18 @@
 // limitations under the License.
 
 pub mod atomic_wait;
-pub use atomic_wait::{atomic_wait, atomic_wake};
+#[cfg(lock_stats)]
+pub mod lockstat;
+pub use atomic_wait::{atomic_requeue, atomic_wait, atomic_wake};
+pub mod mutex;
+pub mod poll;
 pub mod semaphore;
 pub mod spinlock;
+pub use mutex::Mutex;
 pub use semaphore::Semaphore;
 pub use spinlock::{ISpinLock, SpinLock, SpinLockGuard};
+#[cfg(lock_stats)]
+pub use {
+    lockstat::{lock_sites, lock_sites_overflow, LockSiteStats},
+    spinlock::{LockStats, LockStatsSnapshot},
+};
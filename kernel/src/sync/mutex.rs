@@ -0,0 +1,456 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A sleeping mutex with priority inheritance. The owner word holds the
+// id of the owner thread, so an uncontended lock or unlock is a single
+// CAS. A contender spins for a while if the owner is running on
+// another core, then parks on the wait queue and lends its priority to
+// the owner. On unlock, ownership is handed over to the waiter with the
+// highest priority, so that a lower priority thread can't barge in.
+//
+// A waiter giving up, e.g. on timeout, takes back the priority it lent.
+// A thread boosted by several mutexes keeps the highest priority lent
+// to it until it releases the last of them. Inheritance isn't chained
+// through an owner blocked on yet another mutex.
+
+use super::SpinLock;
+use crate::{
+    error::{code, Error},
+    irq, scheduler,
+    scheduler::{OffsetOfWait, WaitEntry, WaitQueue},
+    thread,
+    thread::{GlobalQueueVisitor, Thread, ThreadNode},
+    time::WAITING_FOREVER,
+    types::{Arc, IlistHead, ThreadPriority},
+};
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+// Set in the owner word if the owner must take the slow path to unlock
+// the mutex. Thread ids are addresses of thread control blocks, so the
+// lowest bit is always free.
+pub(crate) const WAITERS: usize = 1;
+// Rounds a contender backs off while the owner is running before it
+// parks, and how long to watch the owner word in each round.
+const SPIN_ROUNDS: usize = 4;
+const SPIN_LIMIT: usize = 128;
+
+// Serializes priority changes made on behalf of mutexes.
+static PI_LOCK: SpinLock<()> = SpinLock::new(());
+
+#[derive(Debug)]
+pub(crate) struct MutexWaiters {
+    queue: WaitQueue,
+    // The owner boosted by waiters of this mutex, if any.
+    boosted: Option<ThreadNode>,
+    // Set once the waiters are dropped from a registry, see
+    // thread::posix.
+    pub stale: bool,
+}
+
+impl MutexWaiters {
+    pub const fn new() -> Self {
+        Self {
+            queue: WaitQueue::new(),
+            boosted: None,
+            stale: false,
+        }
+    }
+
+    pub fn init(&mut self) -> bool {
+        self.queue.init()
+    }
+
+    #[inline]
+    pub fn is_idle(&self) -> bool {
+        self.boosted.is_none() && self.queue.is_empty()
+    }
+
+    // The waiter with the highest priority, the earliest one among
+    // equals.
+    fn top(&self) -> Option<Arc<WaitEntry>> {
+        let mut top: Option<Arc<WaitEntry>> = None;
+        for e in self.queue.iter() {
+            if top
+                .as_ref()
+                .is_none_or(|t| e.thread.priority() < t.thread.priority())
+            {
+                top = Some(e);
+            }
+        }
+        top
+    }
+}
+
+#[derive(Debug)]
+pub struct Mutex {
+    // Id of the owner thread, 0 if unlocked.
+    owner: AtomicUsize,
+    pending: SpinLock<MutexWaiters>,
+}
+
+impl Mutex {
+    pub const fn const_new() -> Self {
+        Self {
+            owner: AtomicUsize::new(0),
+            pending: SpinLock::new(MutexWaiters::new()),
+        }
+    }
+
+    pub const fn new() -> Self {
+        Self::const_new()
+    }
+
+    pub fn init(&self) -> bool {
+        self.pending.irqsave_lock().init()
+    }
+
+    #[inline]
+    pub fn is_locked(&self) -> bool {
+        self.owner.load(Ordering::Relaxed) != 0
+    }
+
+    #[inline]
+    pub fn try_lock(&self) -> bool {
+        try_lock_word(&self.owner, scheduler::current_thread_id())
+    }
+
+    pub fn lock(&self) -> Result<(), Error> {
+        self.lock_timeout(WAITING_FOREVER)
+    }
+
+    pub fn lock_timeout(&self, ticks: usize) -> Result<(), Error> {
+        assert!(!irq::is_in_irq());
+        let me = scheduler::current_thread_id();
+        if try_lock_word(&self.owner, me) {
+            return Ok(());
+        }
+        lock_slow(&self.owner, me, &self.pending, ticks)
+    }
+
+    pub fn unlock(&self) -> Result<(), Error> {
+        let me = scheduler::current_thread_id();
+        if unlock_word(&self.owner, me) {
+            return Ok(());
+        }
+        unlock_slow(&self.owner, me, &self.pending)
+    }
+}
+
+impl !Send for Mutex {}
+unsafe impl Sync for Mutex {}
+
+#[inline]
+pub(crate) fn try_lock_word(word: &AtomicUsize, me: usize) -> bool {
+    word.compare_exchange(0, me, Ordering::Acquire, Ordering::Relaxed)
+        .is_ok()
+}
+
+#[inline]
+pub(crate) fn unlock_word(word: &AtomicUsize, me: usize) -> bool {
+    word.compare_exchange(me, 0, Ordering::Release, Ordering::Relaxed)
+        .is_ok()
+}
+
+// Take the mutex if it's unlocked, otherwise flag that the owner must
+// take the slow path to unlock it. Return the owner id if the mutex is
+// not taken.
+fn take_or_flag(word: &AtomicUsize, me: usize, has_waiters: bool) -> Option<usize> {
+    let mut cur = word.load(Ordering::Relaxed);
+    loop {
+        let new = match cur {
+            0 if has_waiters => me | WAITERS,
+            0 => me,
+            _ => cur | WAITERS,
+        };
+        if new == cur {
+            return Some(cur & !WAITERS);
+        }
+        match word.compare_exchange_weak(cur, new, Ordering::Acquire, Ordering::Relaxed) {
+            Ok(_) if cur == 0 => return None,
+            Ok(_) => return Some(cur & !WAITERS),
+            Err(v) => cur = v,
+        }
+    }
+}
+
+fn spin_on_owner(word: &AtomicUsize, owner: usize) {
+    for _ in 0..SPIN_LIMIT {
+        if word.load(Ordering::Relaxed) & !WAITERS != owner {
+            return;
+        }
+        core::hint::spin_loop();
+    }
+}
+
+fn inherit(w: &mut MutexWaiters, owner: &ThreadNode, p: ThreadPriority) {
+    let _pi = PI_LOCK.irqsave_lock();
+    // Smaller value means higher priority.
+    if owner.priority() <= p {
+        return;
+    }
+    if w.boosted.is_none() {
+        owner.lock().hold_boost();
+        w.boosted = Some(owner.clone());
+    }
+    scheduler::set_thread_priority(owner, p);
+}
+
+fn disinherit(w: &mut MutexWaiters) {
+    let Some(owner) = w.boosted.take() else {
+        return;
+    };
+    let _pi = PI_LOCK.irqsave_lock();
+    let Some(p) = owner.lock().drop_boost() else {
+        return;
+    };
+    scheduler::set_thread_priority(&owner, p);
+}
+
+// Recompute the priority lent to the owner once a waiter leaves. The
+// owner falls back to the highest priority of the waiters left, unless
+// other mutexes it holds are boosting it too.
+fn reinherit(w: &mut MutexWaiters) {
+    let Some(owner) = w.boosted.clone() else {
+        return;
+    };
+    let Some(top) = w.top() else {
+        disinherit(w);
+        return;
+    };
+    let _pi = PI_LOCK.irqsave_lock();
+    let Some(origin) = owner.lock().sole_boost_origin() else {
+        return;
+    };
+    let p = top.thread.priority();
+    if origin <= p {
+        drop(_pi);
+        disinherit(w);
+        return;
+    }
+    if owner.priority() != p {
+        scheduler::set_thread_priority(&owner, p);
+    }
+}
+
+// Lock or unlock the mutex owning `word` whose waiters are in
+// `pending`. Return EAGAIN if `pending` turns out to be stale.
+pub(crate) fn lock_slow(
+    word: &AtomicUsize,
+    me: usize,
+    pending: &SpinLock<MutexWaiters>,
+    ticks: usize,
+) -> Result<(), Error> {
+    let mut rounds = 0;
+    loop {
+        let mut w = pending.irqsave_lock();
+        if w.stale {
+            return Err(code::EAGAIN);
+        }
+        let has_waiters = !w.queue.is_empty();
+        let Some(owner_id) = take_or_flag(word, me, has_waiters) else {
+            return Ok(());
+        };
+        if owner_id == me {
+            return Err(code::EDEADLK);
+        }
+        // The owner word of a pthread mutex is in user memory, the id
+        // might be forged or left by a thread gone, so the owner is
+        // looked up among the live threads. The thread table isn't irq
+        // safe, `pending` is dropped meanwhile.
+        drop(w);
+        let owner = GlobalQueueVisitor::find(owner_id);
+        let mut w = pending.irqsave_lock();
+        if w.stale {
+            return Err(code::EAGAIN);
+        }
+        let cur = word.load(Ordering::Relaxed);
+        if cur != owner_id | WAITERS {
+            continue;
+        }
+        let Some(owner) = owner else {
+            // Nobody owns the mutex, take it over. A boost lent to the
+            // thread gone is gone with it.
+            w.boosted = None;
+            let new = if w.queue.is_empty() { me } else { me | WAITERS };
+            if word
+                .compare_exchange(cur, new, Ordering::Acquire, Ordering::Relaxed)
+                .is_ok()
+            {
+                return Ok(());
+            }
+            continue;
+        };
+        if rounds < SPIN_ROUNDS && owner.state() == thread::RUNNING {
+            drop(w);
+            drop(owner);
+            rounds += 1;
+            spin_on_owner(word, owner_id);
+            continue;
+        }
+        if ticks == 0 {
+            return Err(code::ETIMEDOUT);
+        }
+        let entry = Arc::new(WaitEntry {
+            wait_node: IlistHead::<WaitEntry, OffsetOfWait>::new(),
+            thread: scheduler::current_thread(),
+        });
+        let ok = w.queue.push_back(entry.clone());
+        assert!(ok);
+        inherit(&mut w, &owner, entry.thread.priority());
+        scheduler::suspend_me_holding(w, ticks);
+        let mut w = pending.irqsave_lock();
+        // The unlocker hands the mutex over before waking us up.
+        if word.load(Ordering::Relaxed) & !WAITERS == me {
+            return Ok(());
+        }
+        w.queue.remove(&entry);
+        reinherit(&mut w);
+        if ticks != WAITING_FOREVER {
+            return Err(code::ETIMEDOUT);
+        }
+    }
+}
+
+pub(crate) fn unlock_slow(
+    word: &AtomicUsize,
+    me: usize,
+    pending: &SpinLock<MutexWaiters>,
+) -> Result<(), Error> {
+    let mut w = pending.irqsave_lock();
+    if w.stale {
+        return Err(code::EAGAIN);
+    }
+    if word.load(Ordering::Relaxed) & !WAITERS != me {
+        return Err(code::EPERM);
+    }
+    disinherit(&mut w);
+    let next = loop {
+        let Some(e) = w.top() else {
+            break None;
+        };
+        let ok = w.queue.remove(&e);
+        assert!(ok);
+        let t = e.thread.clone();
+        if let Some(timer) = &t.timer {
+            timer.stop();
+        }
+        // The waiter might have been woken up by its timer.
+        if scheduler::queue_ready_thread(thread::SUSPENDED, t.clone()) {
+            break Some(t);
+        }
+    };
+    let Some(next) = next else {
+        word.store(0, Ordering::Release);
+        return Ok(());
+    };
+    let flag = if w.queue.is_empty() { 0 } else { WAITERS };
+    word.store(Thread::id(&next) | flag, Ordering::Release);
+    if let Some(e) = w.top() {
+        inherit(&mut w, &next, e.thread.priority());
+    }
+    drop(w);
+    scheduler::yield_me_now_or_later();
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::thread::Builder;
+    use blueos_test_macro::test;
+    use core::sync::atomic::AtomicBool;
+
+    #[test]
+    fn test_mutex_lock_unlock() {
+        let m = Mutex::new();
+        m.init();
+        assert!(!m.is_locked());
+        assert!(m.lock().is_ok());
+        assert!(m.is_locked());
+        assert!(!m.try_lock());
+        assert_eq!(m.lock(), Err(code::EDEADLK));
+        assert!(m.unlock().is_ok());
+        assert!(!m.is_locked());
+        assert_eq!(m.unlock(), Err(code::EPERM));
+        assert!(m.try_lock());
+        assert!(m.unlock().is_ok());
+    }
+
+    static MUTEX: Mutex = Mutex::const_new();
+    static LOCKED: AtomicBool = AtomicBool::new(false);
+    static DONE: AtomicBool = AtomicBool::new(false);
+
+    #[test]
+    fn test_mutex_priority_inheritance() {
+        MUTEX.init();
+        let me = scheduler::current_thread();
+        let my_priority = me.priority();
+        if my_priority == 0 {
+            return;
+        }
+        assert!(MUTEX.lock().is_ok());
+        // A waiter with higher priority than ours.
+        Builder::new(thread::Entry::Closure(alloc::boxed::Box::new(|| {
+            assert!(MUTEX.lock().is_ok());
+            LOCKED.store(true, Ordering::Release);
+            assert!(MUTEX.unlock().is_ok());
+            DONE.store(true, Ordering::Release);
+        })))
+        .set_priority(my_priority - 1)
+        .start();
+        while me.priority() == my_priority {
+            scheduler::yield_me();
+        }
+        assert_eq!(me.priority(), my_priority - 1);
+        assert!(!LOCKED.load(Ordering::Acquire));
+        assert!(MUTEX.unlock().is_ok());
+        assert_eq!(me.priority(), my_priority);
+        while !DONE.load(Ordering::Acquire) {
+            scheduler::yield_me();
+        }
+        assert!(LOCKED.load(Ordering::Acquire));
+        assert!(!MUTEX.is_locked());
+    }
+
+    static TIMED_MUTEX: Mutex = Mutex::const_new();
+    static TIMED_OUT: AtomicBool = AtomicBool::new(false);
+
+    #[test]
+    fn test_mutex_boost_dropped_on_timeout() {
+        TIMED_MUTEX.init();
+        let me = scheduler::current_thread();
+        let my_priority = me.priority();
+        if my_priority == 0 {
+            return;
+        }
+        assert!(TIMED_MUTEX.lock().is_ok());
+        Builder::new(thread::Entry::Closure(alloc::boxed::Box::new(|| {
+            assert_eq!(TIMED_MUTEX.lock_timeout(10), Err(code::ETIMEDOUT));
+            TIMED_OUT.store(true, Ordering::Release);
+        })))
+        .set_priority(my_priority - 1)
+        .start();
+        while me.priority() == my_priority {
+            scheduler::yield_me();
+        }
+        // The waiter gave up, so the boost is gone while we still hold
+        // the mutex.
+        while !TIMED_OUT.load(Ordering::Acquire) {
+            scheduler::yield_me();
+        }
+        assert_eq!(me.priority(), my_priority);
+        assert!(TIMED_MUTEX.unlock().is_ok());
+        assert_eq!(me.priority(), my_priority);
+    }
+}
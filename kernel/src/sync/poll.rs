@@ -0,0 +1,298 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Readiness notification for polling many files at once. A file tells
+// the events it's ready for when polled, and keeps the watches of the
+// polls interested in it in a PollQueue, notified when it gets ready.
+// A notified watch is queued once to the ready list of its poll, which
+// bumps a futex the poller waits on, so a poll only looks at the files
+// which got ready. Notifying doesn't allocate and is safe in interrupt
+// handlers, queues only hold weak references to watches.
+
+use crate::{
+    error::code,
+    sync::{
+        atomic_wait::{atomic_wait, atomic_wake},
+        SpinLock,
+    },
+};
+use alloc::{
+    collections::VecDeque,
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use core::sync::atomic::{AtomicBool, AtomicU32, AtomicUsize, Ordering};
+
+pub const POLLIN: u32 = 0x001;
+pub const POLLPRI: u32 = 0x002;
+pub const POLLOUT: u32 = 0x004;
+pub const POLLERR: u32 = 0x008;
+pub const POLLHUP: u32 = 0x010;
+pub const POLLRDHUP: u32 = 0x2000;
+
+// Reported whether asked for or not.
+const POLL_ALWAYS: u32 = POLLERR | POLLHUP;
+
+/// A file watched by a poll.
+#[derive(Debug)]
+pub struct PollWatch {
+    // Told back to the poll, e.g. the fd watched.
+    key: i32,
+    // Events the poll is interested in, 0 once disabled.
+    interest: AtomicU32,
+    // Whether the watch is in the ready list.
+    queued: AtomicBool,
+    ready: Weak<ReadyList>,
+}
+
+impl PollWatch {
+    pub fn new(key: i32, interest: u32, ready: &Arc<ReadyList>) -> Arc<Self> {
+        Arc::new(Self {
+            key,
+            interest: AtomicU32::new(interest),
+            queued: AtomicBool::new(false),
+            ready: Arc::downgrade(ready),
+        })
+    }
+
+    pub fn key(&self) -> i32 {
+        self.key
+    }
+
+    pub fn interest(&self) -> u32 {
+        self.interest.load(Ordering::Acquire)
+    }
+
+    pub fn set_interest(&self, interest: u32) {
+        self.interest.store(interest, Ordering::Release);
+    }
+
+    /// The events of `events` the poll is interested in.
+    pub fn filter(&self, events: u32) -> u32 {
+        match self.interest() {
+            0 => 0,
+            interest => events & (interest | POLL_ALWAYS),
+        }
+    }
+
+    /// Queue the watch to its poll and wake the poller up if `events`
+    /// are of interest.
+    pub fn notify(self: &Arc<Self>, events: u32) {
+        if self.filter(events) == 0 || self.queued.swap(true, Ordering::AcqRel) {
+            return;
+        }
+        if let Some(ready) = self.ready.upgrade() {
+            ready.push(self.clone(), true);
+        }
+    }
+
+    /// Queue the watch again without waking the poller, e.g. a level
+    /// triggered watch still ready, to be checked by the next poll.
+    pub fn requeue(self: &Arc<Self>) {
+        if self.queued.swap(true, Ordering::AcqRel) {
+            return;
+        }
+        if let Some(ready) = self.ready.upgrade() {
+            ready.push(self.clone(), false);
+        }
+    }
+}
+
+/// Watches of the polls waiting on a file.
+#[derive(Debug)]
+pub struct PollQueue {
+    watches: SpinLock<Vec<Weak<PollWatch>>>,
+}
+
+impl PollQueue {
+    pub const fn new() -> Self {
+        Self {
+            watches: SpinLock::new(Vec::new()),
+        }
+    }
+
+    /// Notify `watch` of later events, until its poll drops it.
+    pub fn register(&self, watch: &Arc<PollWatch>) {
+        let mut watches = self.watches.irqsave_lock();
+        watches.retain(|w| w.strong_count() > 0);
+        if !watches
+            .iter()
+            .any(|w| core::ptr::eq(w.as_ptr(), Arc::as_ptr(watch)))
+        {
+            watches.push(Arc::downgrade(watch));
+        }
+    }
+
+    pub fn is_watched(&self) -> bool {
+        self.watches
+            .irqsave_lock()
+            .iter()
+            .any(|w| w.strong_count() > 0)
+    }
+
+    /// Tell the watches the file is ready for `events`.
+    pub fn notify(&self, events: u32) {
+        let watches = self.watches.irqsave_lock();
+        for w in watches.iter() {
+            if let Some(w) = w.upgrade() {
+                w.notify(events);
+            }
+        }
+    }
+}
+
+impl Default for PollQueue {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// The watches of a poll which got ready, and the futex the poller
+/// waits on.
+#[derive(Debug)]
+pub struct ReadyList {
+    // Bumped whenever a watch is queued.
+    futex: AtomicUsize,
+    watches: SpinLock<VecDeque<Arc<PollWatch>>>,
+}
+
+impl ReadyList {
+    pub fn new() -> Arc<Self> {
+        Arc::new(Self {
+            futex: AtomicUsize::new(0),
+            watches: SpinLock::new(VecDeque::new()),
+        })
+    }
+
+    /// Make room for `n` watches. A watch is queued at most once, so
+    /// reserving for all watches of the poll keeps notifying from
+    /// allocating.
+    pub fn reserve(&self, n: usize) {
+        self.watches.irqsave_lock().reserve(n);
+    }
+
+    pub fn len(&self) -> usize {
+        self.watches.irqsave_lock().len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    fn push(&self, watch: Arc<PollWatch>, wake: bool) {
+        {
+            let mut watches = self.watches.irqsave_lock();
+            debug_assert!(watches.len() < watches.capacity());
+            watches.push_back(watch);
+        }
+        if wake {
+            self.futex.fetch_add(1, Ordering::Release);
+            let _ = atomic_wake(&self.futex, usize::MAX);
+        }
+    }
+
+    /// Take the first watch queued. It can be queued again once taken.
+    pub fn pop(&self) -> Option<Arc<PollWatch>> {
+        let watch = self.watches.irqsave_lock().pop_front()?;
+        watch.queued.store(false, Ordering::Release);
+        Some(watch)
+    }
+
+    /// The value to wait on before looking for ready watches.
+    pub fn seen(&self) -> usize {
+        self.futex.load(Ordering::Acquire)
+    }
+
+    /// Wait for a watch to be queued since `seen`, at most `timeout`
+    /// ticks. Return false on timeout.
+    pub fn wait(&self, seen: usize, timeout: Option<usize>) -> bool {
+        !matches!(
+            atomic_wait(&self.futex, seen, timeout),
+            Err(code::ETIMEDOUT)
+        )
+    }
+}
+
+/// The events last published by a file served elsewhere, e.g. a socket
+/// of the network stack, and the watches waiting on them.
+#[derive(Debug)]
+pub struct PollSource {
+    events: AtomicU32,
+    queue: PollQueue,
+}
+
+impl PollSource {
+    pub const fn new(events: u32) -> Self {
+        Self {
+            events: AtomicU32::new(events),
+            queue: PollQueue::new(),
+        }
+    }
+
+    pub fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        if let Some(watch) = watch {
+            self.queue.register(watch);
+        }
+        self.events.load(Ordering::Acquire)
+    }
+
+    pub fn is_watched(&self) -> bool {
+        self.queue.is_watched()
+    }
+
+    /// Publish the current events, watches are notified of the ones
+    /// which weren't there.
+    pub fn publish(&self, events: u32) {
+        let new = events & !self.events.swap(events, Ordering::AcqRel);
+        if new != 0 {
+            self.queue.notify(new);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_watch_queued_once() {
+        let ready = ReadyList::new();
+        ready.reserve(1);
+        let source = PollSource::new(0);
+        let watch = PollWatch::new(3, POLLIN, &ready);
+        assert_eq!(source.poll(Some(&watch)), 0);
+        assert!(source.is_watched());
+
+        let seen = ready.seen();
+        source.publish(POLLOUT);
+        assert!(ready.is_empty());
+        source.publish(POLLOUT | POLLIN);
+        source.publish(0);
+        source.publish(POLLIN);
+        assert_eq!(ready.len(), 1);
+        assert_ne!(ready.seen(), seen);
+
+        let w = ready.pop().unwrap();
+        assert_eq!(w.key(), 3);
+        assert!(ready.pop().is_none());
+        w.requeue();
+        assert_eq!(ready.len(), 1);
+
+        drop(w);
+        drop(ready.pop());
+        drop(watch);
+        assert!(!source.is_watched());
+    }
+}
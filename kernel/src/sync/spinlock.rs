@@ -12,29 +12,199 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-use crate::{
-    support::DisableInterruptGuard,
-    types::{IRwLock, IntrusiveAdapter, RwLock, RwLockWriteGuard},
-};
+// SpinLock spins on a test-and-set RwLock by default. With
+// TICKET_SPINLOCK, it's a ticket lock granting the lock in FIFO order,
+// so that no core is starved by others under contention. Local irq is
+// kept disabled for the whole acquire of irqsave_lock, since an ISR
+// taking the same lock behind our ticket would never get served.
+
+#[cfg(not(ticket_spinlock))]
+use crate::types::{IRwLock as IRawLock, RwLock as RawLock, RwLockWriteGuard as RawGuard};
+#[cfg(ticket_spinlock)]
+use crate::types::{ITicketLock as IRawLock, TicketLock as RawLock, TicketLockGuard as RawGuard};
+use crate::{support::DisableInterruptGuard, types::IntrusiveAdapter};
+#[cfg(not(lock_stats))]
+use core::marker::PhantomData;
 use core::{
     ops::{Deref, DerefMut},
     sync::atomic::{compiler_fence, Ordering},
 };
+#[cfg(lock_stats)]
+use {
+    super::lockstat::{self, Site},
+    crate::time,
+    core::{panic::Location, sync::atomic::AtomicUsize},
+};
 
 #[derive(Debug)]
 pub struct SpinLock<T: ?Sized> {
-    lock: RwLock<T>,
+    stats: LockStats,
+    lock: RawLock<T>,
 }
 
 // See https://doc.rust-lang.org/reference/destructors.html#r-destructors.operation for dropping orders.
 #[derive(Debug)]
 #[repr(C)]
 pub struct SpinLockGuard<'a, T: ?Sized> {
-    mutex_guard: RwLockWriteGuard<'a, T>,
+    held: Held<'a>,
+    mutex_guard: RawGuard<'a, T>,
     irq_guard: Option<DisableInterruptGuard>,
 }
 
-impl<T: ?Sized> SpinLockGuard<'_, T> {
+// Contention counters of a lock, only collected with LOCK_STATS. Hold
+// time is measured in system cycles. The call site taking the lock is
+// counted as well, see lockstat.
+#[cfg(lock_stats)]
+#[derive(Debug, Default)]
+pub struct LockStats {
+    acquisitions: AtomicUsize,
+    contentions: AtomicUsize,
+    spins: AtomicUsize,
+    max_hold_cycles: AtomicUsize,
+}
+
+#[cfg(lock_stats)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct LockStatsSnapshot {
+    pub acquisitions: usize,
+    pub contentions: usize,
+    pub spins: usize,
+    pub max_hold_cycles: usize,
+}
+
+#[cfg(lock_stats)]
+impl LockStats {
+    pub const fn new() -> Self {
+        Self {
+            acquisitions: AtomicUsize::new(0),
+            contentions: AtomicUsize::new(0),
+            spins: AtomicUsize::new(0),
+            max_hold_cycles: AtomicUsize::new(0),
+        }
+    }
+
+    #[track_caller]
+    #[inline]
+    fn record_acquire(&self, start: Stamp, spins: usize, irq_off: bool) -> Held<'_> {
+        self.acquisitions.fetch_add(1, Ordering::Relaxed);
+        if spins != 0 {
+            self.contentions.fetch_add(1, Ordering::Relaxed);
+            self.spins.fetch_add(spins, Ordering::Relaxed);
+        }
+        let site = lockstat::site(Location::caller());
+        if let Some(site) = site {
+            site.record_acquire(spins);
+        }
+        Held {
+            stats: self,
+            site,
+            since: time::get_sys_cycles(),
+            irq_off_since: irq_off.then_some(start.0),
+        }
+    }
+
+    pub fn snapshot(&self) -> LockStatsSnapshot {
+        LockStatsSnapshot {
+            acquisitions: self.acquisitions.load(Ordering::Relaxed),
+            contentions: self.contentions.load(Ordering::Relaxed),
+            spins: self.spins.load(Ordering::Relaxed),
+            max_hold_cycles: self.max_hold_cycles.load(Ordering::Relaxed),
+        }
+    }
+
+    pub fn reset(&self) {
+        self.acquisitions.store(0, Ordering::Relaxed);
+        self.contentions.store(0, Ordering::Relaxed);
+        self.spins.store(0, Ordering::Relaxed);
+        self.max_hold_cycles.store(0, Ordering::Relaxed);
+    }
+}
+
+// Taken before spinning, so that the time local irq is disabled for
+// includes the spins.
+#[cfg(lock_stats)]
+struct Stamp(u64);
+
+#[cfg(lock_stats)]
+impl Stamp {
+    #[inline]
+    fn now() -> Self {
+        Self(time::get_sys_cycles())
+    }
+}
+
+#[cfg(lock_stats)]
+struct Held<'a> {
+    stats: &'a LockStats,
+    site: Option<&'static Site>,
+    since: u64,
+    irq_off_since: Option<u64>,
+}
+
+#[cfg(lock_stats)]
+impl core::fmt::Debug for Held<'_> {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("Held").field("since", &self.since).finish()
+    }
+}
+
+#[cfg(lock_stats)]
+impl Drop for Held<'_> {
+    #[inline]
+    fn drop(&mut self) {
+        let now = time::get_sys_cycles();
+        let cycles = now.saturating_sub(self.since) as usize;
+        self.stats
+            .max_hold_cycles
+            .fetch_max(cycles, Ordering::Relaxed);
+        if let Some(site) = self.site {
+            let irq_off = self.irq_off_since.map(|t| now.saturating_sub(t) as usize);
+            site.record_release(cycles, irq_off);
+        }
+    }
+}
+
+#[cfg(not(lock_stats))]
+#[derive(Debug, Default)]
+pub struct LockStats;
+
+#[cfg(not(lock_stats))]
+impl LockStats {
+    pub const fn new() -> Self {
+        Self
+    }
+
+    #[inline(always)]
+    fn record_acquire(&self, _start: Stamp, _spins: usize, _irq_off: bool) -> Held<'_> {
+        Held(PhantomData)
+    }
+}
+
+#[cfg(not(lock_stats))]
+struct Stamp;
+
+#[cfg(not(lock_stats))]
+impl Stamp {
+    #[inline(always)]
+    fn now() -> Self {
+        Self
+    }
+}
+
+#[cfg(not(lock_stats))]
+#[derive(Debug)]
+struct Held<'a>(PhantomData<&'a LockStats>);
+
+impl<'a, T: ?Sized> SpinLockGuard<'a, T> {
+    #[inline]
+    fn new(mutex_guard: RawGuard<'a, T>, held: Held<'a>) -> Self {
+        Self {
+            held,
+            mutex_guard,
+            irq_guard: None,
+        }
+    }
+
     #[inline]
     pub fn take_irq_guard<S>(&mut self, other: &mut SpinLockGuard<'_, S>) {
         self.irq_guard = other.irq_guard.take();
@@ -59,7 +229,8 @@ impl<'a, T: 'a + ?Sized> DerefMut for SpinLockGuard<'a, T> {
 impl<T> SpinLock<T> {
     pub const fn const_new(val: T) -> Self {
         Self {
-            lock: RwLock::new(val),
+            stats: LockStats::new(),
+            lock: RawLock::new(val),
         }
     }
 
@@ -68,42 +239,95 @@ impl<T> SpinLock<T> {
     }
 }
 
+#[cfg(not(ticket_spinlock))]
 impl<T: ?Sized> SpinLock<T> {
+    #[inline]
+    fn raw_try_lock(&self) -> Option<RawGuard<'_, T>> {
+        self.lock.try_write()
+    }
+
+    #[inline]
+    fn raw_lock(&self) -> (RawGuard<'_, T>, usize) {
+        let mut spins = 0;
+        loop {
+            if let Some(g) = self.lock.try_write() {
+                return (g, spins);
+            }
+            spins += 1;
+            core::hint::spin_loop();
+        }
+    }
+}
+
+#[cfg(ticket_spinlock)]
+impl<T: ?Sized> SpinLock<T> {
+    #[inline]
+    fn raw_try_lock(&self) -> Option<RawGuard<'_, T>> {
+        self.lock.try_lock()
+    }
+
+    #[inline]
+    fn raw_lock(&self) -> (RawGuard<'_, T>, usize) {
+        self.lock.lock_and_count()
+    }
+}
+
+impl<T: ?Sized> SpinLock<T> {
+    #[cfg(lock_stats)]
+    #[inline]
+    pub fn stats(&self) -> &LockStats {
+        &self.stats
+    }
+
+    #[cfg_attr(lock_stats, track_caller)]
     pub fn try_irqsave_lock(&self) -> Option<SpinLockGuard<'_, T>> {
         let irq_guard = DisableInterruptGuard::new();
         compiler_fence(Ordering::SeqCst);
-        let mut guard = self.try_lock()?;
+        let mut guard = self.try_lock_with(true)?;
         assert!(guard.irq_guard.is_none());
         guard.irq_guard = Some(irq_guard);
         Some(guard)
     }
 
+    #[cfg_attr(lock_stats, track_caller)]
     pub fn irqsave_lock(&self) -> SpinLockGuard<'_, T> {
-        loop {
-            let Some(l) = self.try_irqsave_lock() else {
-                core::hint::spin_loop();
-                continue;
-            };
-            return l;
-        }
+        let irq_guard = DisableInterruptGuard::new();
+        compiler_fence(Ordering::SeqCst);
+        let mut guard = self.lock_with(true);
+        guard.irq_guard = Some(irq_guard);
+        guard
     }
 
+    #[cfg_attr(lock_stats, track_caller)]
     pub fn try_lock(&self) -> Option<SpinLockGuard<'_, T>> {
-        let mutex_guard = self.lock.try_write()?;
-        Some(SpinLockGuard {
-            irq_guard: None,
-            mutex_guard,
-        })
+        self.try_lock_with(false)
     }
 
+    #[cfg_attr(lock_stats, track_caller)]
     pub fn lock(&self) -> SpinLockGuard<'_, T> {
-        loop {
-            let Some(l) = self.try_lock() else {
-                core::hint::spin_loop();
-                continue;
-            };
-            return l;
-        }
+        self.lock_with(false)
+    }
+
+    #[cfg_attr(lock_stats, track_caller)]
+    #[inline]
+    fn try_lock_with(&self, irq_off: bool) -> Option<SpinLockGuard<'_, T>> {
+        let start = Stamp::now();
+        let mutex_guard = self.raw_try_lock()?;
+        Some(SpinLockGuard::new(
+            mutex_guard,
+            self.stats.record_acquire(start, 0, irq_off),
+        ))
+    }
+
+    #[cfg_attr(lock_stats, track_caller)]
+    #[inline]
+    fn lock_with(&self, irq_off: bool) -> SpinLockGuard<'_, T> {
+        let start = Stamp::now();
+        let (mutex_guard, spins) = self.raw_lock();
+        SpinLockGuard::new(
+            mutex_guard,
+            self.stats.record_acquire(start, spins, irq_off),
+        )
     }
 }
 
@@ -121,33 +345,69 @@ unsafe impl<T: ?Sized + Sync> Sync for SpinLock<T> {}
 
 #[derive(Default, Debug)]
 pub struct ISpinLock<T: Sized, A: IntrusiveAdapter> {
-    lock: IRwLock<T, A>,
+    stats: LockStats,
+    lock: IRawLock<T, A>,
 }
 
 impl<T: Sized, A: IntrusiveAdapter> ISpinLock<T, A> {
     pub const fn new() -> Self {
         Self {
-            lock: IRwLock::new(),
+            stats: LockStats::new(),
+            lock: IRawLock::new(),
         }
     }
 
+    #[cfg(lock_stats)]
     #[inline]
-    pub fn lock(&self) -> SpinLockGuard<'_, T> {
-        let l = self.lock.write();
-        SpinLockGuard {
-            mutex_guard: l,
-            irq_guard: None,
+    pub fn stats(&self) -> &LockStats {
+        &self.stats
+    }
+
+    #[cfg(not(ticket_spinlock))]
+    #[inline]
+    fn raw_lock(&self) -> (RawGuard<'_, T>, usize) {
+        let mut spins = 0;
+        loop {
+            if let Some(g) = self.lock.try_write() {
+                return (g, spins);
+            }
+            spins += 1;
+            core::hint::spin_loop();
         }
     }
 
+    #[cfg(ticket_spinlock)]
+    #[inline]
+    fn raw_lock(&self) -> (RawGuard<'_, T>, usize) {
+        self.lock.lock_and_count()
+    }
+
+    #[cfg_attr(lock_stats, track_caller)]
+    #[inline]
+    pub fn lock(&self) -> SpinLockGuard<'_, T> {
+        self.lock_with(false)
+    }
+
+    #[cfg_attr(lock_stats, track_caller)]
     #[inline]
     pub fn irqsave_lock(&self) -> SpinLockGuard<'_, T> {
         let irq_guard = DisableInterruptGuard::new();
         compiler_fence(Ordering::SeqCst);
-        let mut g = self.lock();
+        let mut g = self.lock_with(true);
         g.irq_guard = Some(irq_guard);
         g
     }
+
+    #[cfg_attr(lock_stats, track_caller)]
+    #[inline]
+    fn lock_with(&self, irq_off: bool) -> SpinLockGuard<'_, T> {
+        let start = Stamp::now();
+        let (mutex_guard, spins) = self.raw_lock();
+        SpinLockGuard::new(
+            mutex_guard,
+            self.stats.record_acquire(start, spins, irq_off),
+        )
+    }
 }
 
 unsafe impl<T: Sized + Send, A: IntrusiveAdapter> Send for ISpinLock<T, A> {}
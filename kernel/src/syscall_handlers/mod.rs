@@ -29,8 +29,8 @@ use blueos_header::{
 };
 use core::sync::atomic::AtomicUsize;
 use libc::{
-    addrinfo, c_char, c_int, c_ulong, c_void, clockid_t, mode_t, msghdr, off_t, sigset_t, size_t,
-    sockaddr, socklen_t, timespec, EINVAL,
+    addrinfo, c_char, c_int, c_uint, c_ulong, c_void, clockid_t, iovec, mode_t, msghdr, off_t,
+    sigset_t, size_t, sockaddr, socklen_t, timespec, EINVAL,
 };
 
 #[repr(C)]
@@ -178,9 +178,51 @@ atomic_wake(addr: usize, count: *mut usize) -> c_long {
     })
 });
 
-// Only for posix testsuite, we need to implement a stub for clock_gettime
+define_syscall_handler!(
+atomic_requeue(addr: usize, val: usize, count: *mut usize, target: usize, max_requeue: usize) -> c_long {
+    let how_many = unsafe { *count };
+    let atom = unsafe { &*(addr as *const AtomicUsize) };
+    let target = unsafe { &*(target as *const AtomicUsize) };
+    futex::atomic_requeue(atom, val, how_many, target, max_requeue).map_or_else(|e| e.to_errno() as c_long, |n| {
+        unsafe { *count = n };
+        0
+    })
+});
+
+define_syscall_handler!(
+pthread_mutex_lock(addr: usize, timeout: *const timespec) -> c_long {
+    // The timeout is an absolute CLOCK_REALTIME deadline, see
+    // clock_gettime.
+    let ticks = if timeout.is_null() {
+        time::WAITING_FOREVER
+    } else {
+        let deadline = unsafe { &*timeout };
+        let deadline = (deadline.tv_sec.max(0) as usize)
+            .saturating_mul(1000)
+            .saturating_add(deadline.tv_nsec.max(0) as usize / 1000000);
+        time::tick_from_millisecond(deadline.saturating_sub(time::tick_get_millisecond()))
+    };
+    let atom = unsafe { &*(addr as *const AtomicUsize) };
+    thread::posix::pthread_mutex_lock(atom, ticks).map_or_else(|e| e.to_errno() as c_long, |_| 0)
+});
+
+define_syscall_handler!(
+pthread_mutex_unlock(addr: usize) -> c_long {
+    let atom = unsafe { &*(addr as *const AtomicUsize) };
+    thread::posix::pthread_mutex_unlock(atom).map_or_else(|e| e.to_errno() as c_long, |_| 0)
+});
+
+// There is no RTC, all clocks count from boot, so that deadlines of
+// timed waits can be computed from them.
 define_syscall_handler!(
     clock_gettime(_clk_id: clockid_t, tp: *mut timespec) -> c_long {
+        if !tp.is_null() {
+            let ms = time::tick_get_millisecond();
+            unsafe {
+                (*tp).tv_sec = (ms / 1000) as _;
+                (*tp).tv_nsec = (ms % 1000 * 1000000) as _;
+            }
+        }
         0
 });
 
@@ -230,6 +272,77 @@ define_syscall_handler!(
     }
 );
 
+define_syscall_handler!(
+    fsync(fd: c_int) -> c_int {
+        vfs_syscalls::fsync(fd)
+    }
+);
+
+define_syscall_handler!(
+    mmap(addr: *mut c_void,
+        len: size_t,
+        prot: c_int,
+        flags: c_int,
+        fd: c_int,
+        offset: off_t) -> c_long {
+        vfs_syscalls::mmap(addr, len, prot, flags, fd, offset) as c_long
+    }
+);
+
+define_syscall_handler!(
+    munmap(addr: *mut c_void, len: size_t) -> c_int {
+        vfs_syscalls::munmap(addr, len)
+    }
+);
+
+define_syscall_handler!(
+    msync(addr: *mut c_void, len: size_t, flags: c_int) -> c_int {
+        vfs_syscalls::msync(addr, len, flags)
+    }
+);
+
+define_syscall_handler!(
+    readv(fd: c_int, iov: *const iovec, iovcnt: c_int) -> isize {
+        vfs_syscalls::readv(fd, iov, iovcnt)
+    }
+);
+
+define_syscall_handler!(
+    writev(fd: c_int, iov: *const iovec, iovcnt: c_int) -> isize {
+        vfs_syscalls::writev(fd, iov, iovcnt)
+    }
+);
+
+define_syscall_handler!(
+    pread(fd: c_int, buf: *mut c_void, count: size_t, offset: off_t) -> isize {
+        vfs_syscalls::pread(fd, buf as *mut u8, count, offset as i64)
+    }
+);
+
+define_syscall_handler!(
+    pwrite(fd: c_int, buf: *const c_void, count: size_t, offset: off_t) -> isize {
+        vfs_syscalls::pwrite(fd, buf as *const u8, count, offset as i64)
+    }
+);
+
+define_syscall_handler!(
+    epoll_create1(flags: c_int) -> c_int {
+        vfs_syscalls::epoll_create1(flags)
+    }
+);
+
+define_syscall_handler!(
+    epoll_ctl(epfd: c_int, op: c_int, fd: c_int, event: *const vfs_syscalls::EpollEvent) -> c_int {
+        vfs_syscalls::epoll_ctl(epfd, op, fd, event)
+    }
+);
+
+define_syscall_handler!(
+    epoll_wait(epfd: c_int, events: *mut vfs_syscalls::EpollEvent, maxevents: c_int, timeout: c_int) -> c_int {
+        vfs_syscalls::epoll_wait(epfd, events, maxevents, timeout)
+    }
+);
+
 async fn cleanup_for_exited_thread(exit_args: ExitArgs) {
     let Some(ref hook) = exit_args.exit_hook else {
         return;
@@ -491,6 +604,18 @@ define_syscall_handler!(
         net::syscalls::recvmsg(sockfd, message, flags)
     }
 );
+
+define_syscall_handler!(
+    sendmmsg(sockfd: c_int, msgvec: *mut net::SocketMmsghdr, vlen: c_uint, flags: c_int) -> c_int {
+        net::syscalls::sendmmsg(sockfd, msgvec, vlen, flags)
+    }
+);
+
+define_syscall_handler!(
+    recvmmsg(sockfd: c_int, msgvec: *mut net::SocketMmsghdr, vlen: c_uint, flags: c_int, timeout: *mut timespec) -> c_int {
+        net::syscalls::recvmmsg(sockfd, msgvec, vlen, flags, timeout)
+    }
+);
 // Socket syscall end
 
 // Netdb syscall begin
@@ -565,6 +690,22 @@ syscall_table! {
     (Recvmsg,recvmsg),
     (GetAddrinfo,getaddrinfo),
     (FreeAddrinfo,freeaddrinfo),
+    (AtomicRequeue,atomic_requeue),
+    (PthreadMutexLock,pthread_mutex_lock),
+    (PthreadMutexUnlock,pthread_mutex_unlock),
+    (Fsync, fsync),
+    (Mmap, mmap),
+    (Munmap, munmap),
+    (Msync, msync),
+    (Readv, readv),
+    (Writev, writev),
+    (Pread, pread),
+    (Pwrite, pwrite),
+    (Sendmmsg, sendmmsg),
+    (Recvmmsg, recvmmsg),
+    (EpollCreate1, epoll_create1),
+    (EpollCtl, epoll_ctl),
+    (EpollWait, epoll_wait),
 }
 
 // Begin syscall modules.
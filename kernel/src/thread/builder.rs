@@ -54,6 +54,12 @@ impl GlobalQueueVisitor<'_> {
         ThreadList::insert_after(&mut *w, t.clone())
     }
 
+    /// The live thread of `id`, if any.
+    pub fn find(id: usize) -> Option<ThreadNode> {
+        let w = GLOBAL_QUEUE.lock();
+        ArcListIterator::new(&*w, None).find(|t| Thread::id(t) == id)
+    }
+
     pub fn remove(t: &ThreadNode) -> bool {
         let mut w = GLOBAL_QUEUE.lock();
         for mut e in ArcListIterator::new(&*w, None) {
@@ -106,12 +112,22 @@ impl Builder {
     }
 
     pub fn build(mut self) -> ThreadNode {
-        let thread = ThreadNode::new(Thread::new(ThreadKind::Normal));
+        #[cfg(thread_pool)]
+        let pooled = super::pool::take(self.stack.is_none());
+        #[cfg(not(thread_pool))]
+        let pooled = None;
+        let thread = pooled.unwrap_or_else(|| ThreadNode::new(Thread::new(ThreadKind::Normal)));
         let mut w = thread.lock();
-        let stack = self.stack.take().map_or_else(
-            || Stack::Boxed(unsafe { Box::<AlignedStackStorage>::new_uninit().assume_init() }),
-            |v| v,
-        );
+        // Threads taken from the pool might bring a stack.
+        let stack = self
+            .stack
+            .take()
+            .unwrap_or_else(|| match core::mem::take(&mut w.stack) {
+                Stack::Boxed(boxed) => Stack::Boxed(boxed),
+                Stack::Raw { .. } => {
+                    Stack::Boxed(unsafe { Box::<AlignedStackStorage>::new_uninit().assume_init() })
+                }
+            });
         w.init(stack, self.entry);
         w.set_priority(self.priority);
         drop(w);
@@ -24,8 +24,14 @@ use alloc::boxed::Box;
 use core::sync::atomic::{AtomicI32, AtomicUsize, Ordering};
 
 mod builder;
-mod posix;
+#[cfg(thread_pool)]
+mod pool;
+pub(crate) mod posix;
 pub use builder::*;
+#[cfg(thread_pool)]
+pub(crate) use pool::recycle;
+#[cfg(thread_pool)]
+pub use pool::thread_pool_stats;
 use posix::*;
 
 pub type ThreadNode = Arc<Thread>;
@@ -97,6 +103,9 @@ pub const RUNNING: Uint = 2;
 pub const SUSPENDED: Uint = 3;
 pub const RETIRED: Uint = 4;
 
+#[cfg(scheduler = "percore")]
+const NO_CPU: Uint = Uint::MAX;
+
 // ThreadStats is protected by thread scheduler.
 #[derive(Debug, Default)]
 pub struct ThreadStats {
@@ -136,10 +145,21 @@ pub struct Thread {
     stack: Stack,
     saved_sp: usize,
     priority: ThreadPriority,
+    // The priority before being boosted by waiters of the mutexes
+    // this thread holds, and the number of such mutexes.
+    origin_priority: ThreadPriority,
+    nr_boosts: Uint,
     state: AtomicUint,
     preempt_count: AtomicUint,
     #[cfg(robin_scheduler)]
     robin_count: AtomicI32,
+    // The core this thread ran on most recently, NO_CPU if it has
+    // never run.
+    #[cfg(scheduler = "percore")]
+    last_cpu: AtomicUint,
+    // Low bits of the cycles the thread is made ready at.
+    #[cfg(sched_trace)]
+    woken_at: AtomicUsize,
     // FIXME: Using a rusty lock looks not flexible. Now we are using
     // a C-style intrusive lock. It's conventional to declare which
     // fields this lock is protecting. lock is protecting the
@@ -309,12 +329,18 @@ impl Thread {
             global: IlistHead::<Thread, OffsetOfGlobal>::new(),
             saved_sp: 0,
             priority: 0,
+            origin_priority: 0,
+            nr_boosts: 0,
             preempt_count: AtomicUint::new(0),
             posix_compat: None,
             stats: ThreadStats::new(),
             timer: None,
             #[cfg(robin_scheduler)]
             robin_count: AtomicI32::new(0),
+            #[cfg(scheduler = "percore")]
+            last_cpu: AtomicUint::new(NO_CPU),
+            #[cfg(sched_trace)]
+            woken_at: AtomicUsize::new(0),
             kind,
         }
     }
@@ -401,6 +427,35 @@ impl Thread {
         self.priority
     }
 
+    // Record one more held mutex boosting this thread.
+    #[inline]
+    pub(crate) fn hold_boost(&mut self) -> &mut Self {
+        if self.nr_boosts == 0 {
+            self.origin_priority = self.priority;
+        }
+        self.nr_boosts += 1;
+        self
+    }
+
+    // The priority before being boosted, if a single held mutex is
+    // boosting this thread.
+    #[inline]
+    pub(crate) fn sole_boost_origin(&self) -> Option<ThreadPriority> {
+        (self.nr_boosts == 1).then_some(self.origin_priority)
+    }
+
+    // Return the priority to restore if no held mutex is boosting
+    // this thread any more.
+    #[inline]
+    pub(crate) fn drop_boost(&mut self) -> Option<ThreadPriority> {
+        assert!(self.nr_boosts > 0);
+        self.nr_boosts -= 1;
+        if self.nr_boosts != 0 {
+            return None;
+        }
+        Some(self.origin_priority)
+    }
+
     #[inline]
     pub fn disable_preempt(&self) -> bool {
         self.preempt_count.fetch_add(1, Ordering::Acquire) == 0
@@ -429,6 +484,34 @@ impl Thread {
             .store(blueos_kconfig::ROBIN_SLICE as i32, Ordering::Relaxed);
     }
 
+    #[cfg(scheduler = "percore")]
+    #[inline]
+    pub fn last_cpu(&self) -> Option<usize> {
+        let cpu = self.last_cpu.load(Ordering::Relaxed);
+        if cpu == NO_CPU {
+            return None;
+        }
+        Some(cpu as usize)
+    }
+
+    #[cfg(scheduler = "percore")]
+    #[inline]
+    pub fn set_last_cpu(&self, cpu: usize) {
+        self.last_cpu.store(cpu as Uint, Ordering::Relaxed);
+    }
+
+    #[cfg(sched_trace)]
+    #[inline]
+    pub fn woken_at(&self) -> usize {
+        self.woken_at.load(Ordering::Relaxed)
+    }
+
+    #[cfg(sched_trace)]
+    #[inline]
+    pub fn set_woken_at(&self, cycles: usize) {
+        self.woken_at.store(cycles, Ordering::Relaxed);
+    }
+
     #[inline]
     pub fn increment_cycles(&mut self, cycles: u64) {
         self.stats.increment_cycles(cycles);
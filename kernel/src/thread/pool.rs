@@ -0,0 +1,167 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Per-core pools of retired threads, so that spawning a thread reuses
+// a control block, and its stack, instead of allocating them from the
+// heap. Threads are recycled when they retire if no one else refers to
+// them, and pooled by their stack class: threads given a stack by the
+// spawner keep none, the others keep their default sized one. A
+// thread taken from a pool is ready to be built as if it were new.
+//
+// Threads are pushed to the pool of the core they retire on, and taken
+// from the pool of the spawning core first, then from other cores.
+
+use super::{Stack, Thread, ThreadKind, ThreadNode, ThreadStats, CREATED};
+use crate::{arch, sync::SpinLock};
+use blueos_infra::ring::CachePadded;
+use blueos_kconfig::{NUM_CORES, THREAD_POOL_DEPTH};
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+// Threads without a stack of their own, and with a default one.
+const NR_CLASSES: usize = 2;
+
+struct Pool {
+    len: usize,
+    threads: [Option<ThreadNode>; THREAD_POOL_DEPTH],
+}
+
+impl Pool {
+    const fn new() -> Self {
+        Self {
+            len: 0,
+            threads: [const { None }; THREAD_POOL_DEPTH],
+        }
+    }
+}
+
+static POOLS: [CachePadded<SpinLock<[Pool; NR_CLASSES]>>; NUM_CORES] =
+    [const { CachePadded::new(SpinLock::new([const { Pool::new() }; NR_CLASSES])) }; NUM_CORES];
+static HITS: AtomicUsize = AtomicUsize::new(0);
+static MISSES: AtomicUsize = AtomicUsize::new(0);
+
+#[inline]
+fn class_of(stack: &Stack) -> usize {
+    match stack {
+        Stack::Raw { .. } => 0,
+        Stack::Boxed(_) => 1,
+    }
+}
+
+/// Take a retired thread, with a default stack if `with_stack`.
+pub(crate) fn take(with_stack: bool) -> Option<ThreadNode> {
+    let class = with_stack as usize;
+    let first = arch::current_cpu_id();
+    let t = (0..NUM_CORES).find_map(|i| {
+        let mut pools = POOLS[(first + i) % NUM_CORES].irqsave_lock();
+        let pool = &mut pools[class];
+        if pool.len == 0 {
+            return None;
+        }
+        pool.len -= 1;
+        pool.threads[pool.len].take()
+    });
+    let Some(t) = t else {
+        MISSES.fetch_add(1, Ordering::Relaxed);
+        return None;
+    };
+    HITS.fetch_add(1, Ordering::Relaxed);
+    #[cfg(thread_pool_zero_stack)]
+    if with_stack {
+        let w = t.lock();
+        // SAFETY: The stack isn't used by anyone since the thread
+        // retired.
+        unsafe { core::ptr::write_bytes(w.stack.base() as *mut u8, 0, w.stack.size()) };
+    }
+    Some(t)
+}
+
+/// Keep the retired `t` for later spawns. Returns false if it's still
+/// referred to elsewhere or there is no room, then it's left to the
+/// caller to drop.
+pub(crate) fn recycle(t: &mut Option<ThreadNode>) -> bool {
+    let Some(node) = t.as_ref() else {
+        return false;
+    };
+    if ThreadNode::strong_count(node) != 1 || !matches!(node.kind(), ThreadKind::Normal) {
+        return false;
+    }
+    let class = {
+        let mut w = node.lock();
+        let class = class_of(&w.stack);
+        // Stacks given by spawners are theirs.
+        if class == 0 {
+            w.stack = Stack::default();
+        }
+        reset(&mut w);
+        class
+    };
+    let mut pools = POOLS[arch::current_cpu_id()].irqsave_lock();
+    let pool = &mut pools[class];
+    if pool.len == THREAD_POOL_DEPTH {
+        return false;
+    }
+    pool.threads[pool.len] = t.take();
+    pool.len += 1;
+    true
+}
+
+// Bring `t` back to the state Thread::new() gives, except its stack.
+fn reset(t: &mut Thread) {
+    assert!(t.sched_node.is_detached());
+    assert!(t.global.is_detached());
+    t.timer = None;
+    t.cleanup = None;
+    t.saved_sp = 0;
+    t.priority = 0;
+    t.origin_priority = 0;
+    t.nr_boosts = 0;
+    t.posix_compat = None;
+    t.stats = ThreadStats::new();
+    t.preempt_count.store(0, Ordering::Relaxed);
+    #[cfg(robin_scheduler)]
+    t.robin_count.store(0, Ordering::Relaxed);
+    #[cfg(scheduler = "percore")]
+    t.last_cpu.store(super::NO_CPU, Ordering::Relaxed);
+    #[cfg(sched_trace)]
+    t.woken_at.store(0, Ordering::Relaxed);
+    t.state.store(CREATED, Ordering::Relaxed);
+}
+
+/// Spawns served from pools and from the heap since boot.
+pub fn thread_pool_stats() -> (usize, usize) {
+    (HITS.load(Ordering::Relaxed), MISSES.load(Ordering::Relaxed))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{scheduler, thread};
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_retired_thread_reused() {
+        static DONE: AtomicUsize = AtomicUsize::new(0);
+        for _ in 0..4 {
+            DONE.store(0, Ordering::Relaxed);
+            drop(thread::spawn(|| DONE.store(1, Ordering::Release)));
+            while DONE.load(Ordering::Acquire) == 0 {
+                scheduler::yield_me();
+            }
+            // Let the retiring hook finish.
+            scheduler::yield_me();
+        }
+        let (hits, _) = thread_pool_stats();
+        assert!(hits > 0);
+    }
+}
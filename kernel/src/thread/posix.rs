@@ -14,9 +14,102 @@
 
 extern crate alloc;
 
-use alloc::string::String;
+use crate::{
+    error::{code, Error},
+    scheduler,
+    sync::{mutex, mutex::MutexWaiters, SpinLock},
+    types::Arc,
+};
+use alloc::{collections::BTreeMap, string::String};
+use core::sync::atomic::{AtomicUsize, Ordering};
 
 #[derive(Debug)]
 pub(crate) struct PosixCompat {
     pub cwd: String,
 }
+
+// A pthread mutex is a word in user memory following the protocol of
+// the kernel mutex, so that userspace locks and unlocks it with a CAS
+// and only traps into the kernel on contention. Waiters of contended
+// words are allocated on demand and dropped once idle.
+struct PthreadMutexes(BTreeMap<usize, Arc<SpinLock<MutexWaiters>>>);
+
+unsafe impl Send for PthreadMutexes {}
+unsafe impl Sync for PthreadMutexes {}
+
+static PTHREAD_MUTEXES: SpinLock<PthreadMutexes> = SpinLock::new(PthreadMutexes(BTreeMap::new()));
+
+fn waiters_of(addr: usize) -> Arc<SpinLock<MutexWaiters>> {
+    let mut w = PTHREAD_MUTEXES.irqsave_lock();
+    if let Some(p) = w.0.get(&addr) {
+        return p.clone();
+    }
+    let p = Arc::new(SpinLock::new(MutexWaiters::new()));
+    p.irqsave_lock().init();
+    w.0.insert(addr, p.clone());
+    p
+}
+
+fn drop_idle_waiters(addr: usize) {
+    let mut w = PTHREAD_MUTEXES.irqsave_lock();
+    let Some(p) = w.0.get(&addr) else {
+        return;
+    };
+    {
+        let mut q = p.irqsave_lock();
+        if !q.is_idle() {
+            return;
+        }
+        q.stale = true;
+    }
+    w.0.remove(&addr);
+}
+
+pub(crate) fn pthread_mutex_lock(word: &AtomicUsize, ticks: usize) -> Result<(), Error> {
+    let me = scheduler::current_thread_id();
+    let addr = word as *const _ as usize;
+    loop {
+        if mutex::try_lock_word(word, me) {
+            return Ok(());
+        }
+        let pending = waiters_of(addr);
+        match mutex::lock_slow(word, me, &pending, ticks) {
+            Err(code::EAGAIN) => continue,
+            Err(code::ETIMEDOUT) => {
+                drop_idle_waiters(addr);
+                return Err(code::ETIMEDOUT);
+            }
+            res => return res,
+        }
+    }
+}
+
+pub(crate) fn pthread_mutex_unlock(word: &AtomicUsize) -> Result<(), Error> {
+    let me = scheduler::current_thread_id();
+    let addr = word as *const _ as usize;
+    if mutex::unlock_word(word, me) {
+        return Ok(());
+    }
+    loop {
+        let pending = {
+            let w = PTHREAD_MUTEXES.irqsave_lock();
+            let Some(p) = w.0.get(&addr) else {
+                // WAITERS is left by a contender which has given up.
+                // Contenders register themselves before flagging the
+                // word, so nobody can be parked on it.
+                return word
+                    .compare_exchange(me | mutex::WAITERS, 0, Ordering::Release, Ordering::Relaxed)
+                    .map_or(Err(code::EPERM), |_| Ok(()));
+            };
+            p.clone()
+        };
+        match mutex::unlock_slow(word, me, &pending) {
+            Err(code::EAGAIN) => continue,
+            res => {
+                drop(pending);
+                drop_idle_waiters(addr);
+                return res;
+            }
+        }
+    }
+}
@@ -12,8 +12,10 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#[cfg(profiler)]
+pub(crate) mod profile;
 pub(crate) mod systick;
-pub(crate) mod timer;
+pub mod timer;
 
 use crate::{arch, boards, scheduler, support::DisableInterruptGuard, thread::Thread};
 use blueos_kconfig::TICKS_PER_SECOND;
@@ -47,16 +49,43 @@ pub fn reset_systick() {
 
 pub extern "C" fn handle_tick_increment() {
     let _guard = DisableInterruptGuard::new();
+    #[cfg(profiler)]
+    profile::sample();
+    let need_schedule = handle_elapsed_ticks(1);
+    SYSTICK.reset_counter();
+    if need_schedule {
+        scheduler::yield_me_now_or_later();
+    }
+}
+
+fn handle_elapsed_ticks(elapsed_ticks: usize) -> bool {
     let mut need_schedule = false;
     // FIXME: aarch64 and riscv64 need to be supported
     if arch::current_cpu_id() == 0 {
-        let ticks = SYSTICK.increment_ticks();
+        let ticks = SYSTICK.increment_ticks(elapsed_ticks);
         need_schedule = timer::check_hard_timer(ticks);
     }
-    need_schedule = scheduler::handle_tick_increment(1) || need_schedule;
-    SYSTICK.reset_counter();
-    if need_schedule {
-        scheduler::yield_me_now_or_later();
+    scheduler::handle_tick_increment(elapsed_ticks) || need_schedule
+}
+
+// Idle without the periodic tick until the next timer deadline. Local
+// irq is kept disabled through the wait, which still returns once an irq
+// is pending, so that the elapsed ticks are caught up before the irq is
+// handled.
+#[cfg(tickless)]
+pub(crate) fn idle_tickless() {
+    let _guard = DisableInterruptGuard::new();
+    let idle_ticks = timer::get_next_timer_ticks().saturating_sub(get_sys_ticks());
+    if !SYSTICK.suspend_tick(idle_ticks) {
+        arch::idle_irq_disabled();
+        return;
+    }
+    arch::idle_irq_disabled();
+    let elapsed_ticks = SYSTICK.resume_tick();
+    if elapsed_ticks > 0 {
+        // Only the idle thread gets here, the scheduler picks threads
+        // woken up right after returning.
+        let _ = handle_elapsed_ticks(elapsed_ticks);
     }
 }
 
@@ -0,0 +1,78 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A sampling profiler. On every tick, each core records the pc the
+// tick interrupted in a ring of its own, the newest overwriting the
+// oldest. Only the core owning a ring writes to it, from its tick
+// handler, so a sample is a single store.
+
+use crate::arch;
+use alloc::vec::Vec;
+use blueos_infra::ring::CachePadded;
+use blueos_kconfig::{NUM_CORES, PROFILER_SAMPLES};
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+struct Samples {
+    head: AtomicUsize,
+    pcs: [AtomicUsize; PROFILER_SAMPLES],
+}
+
+static SAMPLES: [CachePadded<Samples>; NUM_CORES] = [const {
+    CachePadded::new(Samples {
+        head: AtomicUsize::new(0),
+        pcs: [const { AtomicUsize::new(0) }; PROFILER_SAMPLES],
+    })
+}; NUM_CORES];
+
+// Called in the tick handler.
+#[inline]
+pub(crate) fn sample() {
+    let pc = arch::interrupted_pc();
+    if pc == 0 {
+        return;
+    }
+    let samples = &SAMPLES[arch::current_cpu_id()];
+    let pos = samples.head.load(Ordering::Relaxed);
+    samples.pcs[pos % PROFILER_SAMPLES].store(pc, Ordering::Relaxed);
+    samples.head.store(pos.wrapping_add(1), Ordering::Release);
+}
+
+/// The pcs sampled on `cpu` and still held, and the number of samples
+/// ever taken there.
+pub(crate) fn samples(cpu: usize) -> (Vec<usize>, usize) {
+    let samples = &SAMPLES[cpu];
+    let head = samples.head.load(Ordering::Acquire);
+    let n = head.min(PROFILER_SAMPLES);
+    let pcs = samples.pcs[..n]
+        .iter()
+        .map(|pc| pc.load(Ordering::Relaxed))
+        .filter(|pc| *pc != 0)
+        .collect();
+    (pcs, head)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::scheduler;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_ticks_sampled() {
+        let taken = || (0..NUM_CORES).map(|cpu| samples(cpu).1).sum::<usize>();
+        let before = taken();
+        scheduler::suspend_me_for(4);
+        assert!(taken() > before);
+    }
+}
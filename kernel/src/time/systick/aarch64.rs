@@ -53,6 +53,10 @@ impl Systick {
             }
         }
         CNTP_TVAL_EL0.set(step);
+        #[cfg(tickless)]
+        unsafe {
+            *self.last_tick_at.get() = CNTPCT_EL0.get();
+        }
         CNTP_CTL_EL0.write(CNTP_CTL_EL0::ENABLE::Enabled);
         enable_irq_with_priority(self.irq_num, cpu_id, Priority::Normal);
         true
@@ -66,5 +70,39 @@ impl Systick {
 
     pub fn reset_counter(&self) {
         CNTP_TVAL_EL0.set(self.get_step() as u64);
+        // SAFETY: Only accessed with local irq disabled.
+        #[cfg(tickless)]
+        unsafe {
+            *self.last_tick_at.get() = CNTPCT_EL0.get();
+        }
+    }
+
+    // Stop the periodic tick and fire the next one `ticks` ticks after
+    // the last one at most. Return false if the tick is kept.
+    #[cfg(tickless)]
+    pub fn suspend_tick(&self, ticks: usize) -> bool {
+        let step = self.get_step() as u64;
+        // CNTP_TVAL_EL0 is a signed 32-bit down counter.
+        let ticks = core::cmp::min(ticks as u64, i32::MAX as u64 / step);
+        if ticks <= 1 {
+            return false;
+        }
+        let deadline = unsafe { *self.last_tick_at.get() } + ticks * step;
+        CNTP_TVAL_EL0.set(deadline.saturating_sub(CNTPCT_EL0.get()));
+        true
+    }
+
+    // Restore the periodic tick in phase with the last one and return
+    // the number of ticks elapsed since then.
+    #[cfg(tickless)]
+    pub fn resume_tick(&self) -> usize {
+        let step = self.get_step() as u64;
+        let now = CNTPCT_EL0.get();
+        // SAFETY: Only accessed with local irq disabled.
+        let last_tick_at = unsafe { &mut *self.last_tick_at.get() };
+        let elapsed = now.saturating_sub(*last_tick_at) / step;
+        *last_tick_at += elapsed * step;
+        CNTP_TVAL_EL0.set(*last_tick_at + step - now);
+        elapsed as usize
     }
 }
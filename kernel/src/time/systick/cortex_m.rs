@@ -14,18 +14,18 @@
 
 use crate::arch::irq::IRQ_PRIORITY_FOR_SCHEDULER;
 use cortex_m::{
-    peripheral::{scb::SystemHandler, syst::SystClkSource, SYST},
+    peripheral::{scb::SystemHandler, syst::SystClkSource, SCB, SYST},
     Peripherals,
 };
 
 pub const SYSTICK_IRQ_NUM: IrqNumber = IrqNumber::new(14);
+const SYST_COUNTER_MASK: u32 = 0x00ff_ffff;
 
 impl Systick {
     pub fn init(&self, sys_clock: u32, tick_per_second: u32) -> bool {
         let mut scb = unsafe { Peripherals::steal() };
 
         let reload = sys_clock / tick_per_second;
-        const SYST_COUNTER_MASK: u32 = 0x00ff_ffff;
         if reload > SYST_COUNTER_MASK {
             return false;
         }
@@ -56,4 +56,57 @@ impl Systick {
     pub fn reset_counter(&self) {
         // no need to reset counter
     }
+
+    // Stop the periodic tick and fire the next one `ticks` ticks after
+    // the last one at most. Return false if the tick is kept. SYST has
+    // no free running counter, so the span since the last tick is kept
+    // to count elapsed ticks.
+    #[cfg(tickless)]
+    pub fn suspend_tick(&self, ticks: usize) -> bool {
+        let mut syst = unsafe { Peripherals::steal() }.SYST;
+        let step = self.get_step() as u32;
+        let ticks = core::cmp::min(ticks, (SYST_COUNTER_MASK / step) as usize) as u32;
+        // A pending tick is left to the tick handler, which is not
+        // aware of a changed reload value.
+        if ticks <= 1 || SCB::is_pendst_pending() {
+            return false;
+        }
+        let passed = step - SYST::get_current();
+        let span = ticks * step;
+        // SAFETY: Only accessed with local irq disabled.
+        unsafe {
+            *self.last_tick_at.get() = span as u64;
+        }
+        syst.set_reload(span - passed);
+        syst.clear_current();
+        true
+    }
+
+    // Restore the periodic tick and return the number of ticks elapsed
+    // since the last one. The fraction of the current tick is lost.
+    // The tick pended by the expiry of the span is kept pending and the
+    // tick handler announces it, so it is not counted here.
+    #[cfg(tickless)]
+    pub fn resume_tick(&self) -> usize {
+        let mut syst = unsafe { Peripherals::steal() }.SYST;
+        let step = self.get_step() as u32;
+        let reload = SYST::get_reload();
+        let wrapped = syst.has_wrapped();
+        let counted = if wrapped {
+            reload
+        } else {
+            reload - SYST::get_current()
+        };
+        // SAFETY: Only accessed with local irq disabled.
+        let span = unsafe { *self.last_tick_at.get() } as u32;
+        let mut elapsed = (span - reload + counted) / step;
+        syst.set_reload(step);
+        syst.clear_current();
+        // If the span expires after the counter is read, the tick it
+        // pends is the one lost by the division above.
+        if wrapped {
+            elapsed -= 1;
+        }
+        elapsed as usize
+    }
 }
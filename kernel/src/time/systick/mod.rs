@@ -35,9 +35,15 @@ pub struct Systick {
     tick: AtomicUsize,
     irq_num: IrqNumber,
     step: UnsafeCell<usize>,
+    // Timestamp of the last tick, or the span programmed on cortex-m,
+    // used to count the ticks elapsed while the tick is stopped.
+    #[cfg(tickless)]
+    last_tick_at: UnsafeCell<u64>,
 }
 
-// SAFETY: step is only written once during initialization and then only read
+// SAFETY: step is only written once during initialization and then only read.
+// last_tick_at is only accessed with local irq disabled and tickless
+// is not available on SMP.
 unsafe impl Sync for Systick {}
 
 impl Systick {
@@ -46,6 +52,8 @@ impl Systick {
             irq_num,
             tick: AtomicUsize::new(0),
             step: UnsafeCell::new(0),
+            #[cfg(tickless)]
+            last_tick_at: UnsafeCell::new(0),
         }
     }
 
@@ -62,7 +70,7 @@ impl Systick {
         self.tick.load(Ordering::Relaxed)
     }
 
-    pub fn increment_ticks(&self) -> usize {
-        self.tick.fetch_add(1, Ordering::Relaxed) + 1
+    pub fn increment_ticks(&self, elapsed_ticks: usize) -> usize {
+        self.tick.fetch_add(elapsed_ticks, Ordering::Relaxed) + elapsed_ticks
     }
 }
@@ -29,6 +29,10 @@ impl Systick {
             *self.step.get() = step;
         }
         boards::set_timeout_after(step);
+        #[cfg(tickless)]
+        unsafe {
+            *self.last_tick_at.get() = boards::current_ns() as u64;
+        }
         let _ = get_boot_cycle_count();
         true
     }
@@ -39,5 +43,38 @@ impl Systick {
 
     pub fn reset_counter(&self) {
         boards::set_timeout_after(self.get_step());
+        // SAFETY: Only accessed with local irq disabled.
+        #[cfg(tickless)]
+        unsafe {
+            *self.last_tick_at.get() = boards::current_ns() as u64;
+        }
+    }
+
+    // Stop the periodic tick and fire the next one `ticks` ticks after
+    // the last one at most. Return false if the tick is kept.
+    #[cfg(tickless)]
+    pub fn suspend_tick(&self, ticks: usize) -> bool {
+        let step = self.get_step() as u64;
+        let ticks = core::cmp::min(ticks as u64, u32::MAX as u64);
+        if ticks <= 1 {
+            return false;
+        }
+        let deadline = unsafe { *self.last_tick_at.get() } + ticks * step;
+        boards::set_timeout_after(deadline.saturating_sub(boards::current_ns() as u64) as usize);
+        true
+    }
+
+    // Restore the periodic tick in phase with the last one and return
+    // the number of ticks elapsed since then.
+    #[cfg(tickless)]
+    pub fn resume_tick(&self) -> usize {
+        let step = self.get_step() as u64;
+        let now = boards::current_ns() as u64;
+        // SAFETY: Only accessed with local irq disabled.
+        let last_tick_at = unsafe { &mut *self.last_tick_at.get() };
+        let elapsed = now.saturating_sub(*last_tick_at) / step;
+        *last_tick_at += elapsed * step;
+        boards::set_timeout_after((*last_tick_at + step - now) as usize);
+        elapsed as usize
     }
 }
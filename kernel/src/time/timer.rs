@@ -22,13 +22,24 @@ use bitflags::bitflags;
 use core::{
     cmp, fmt,
     mem::MaybeUninit,
-    sync::atomic::{AtomicU32, Ordering},
+    sync::atomic::{AtomicU32, AtomicUsize, Ordering},
 };
 use log::warn;
 use sync::spinlock::SpinLock;
 use thread::{Entry, SystemThreadStorage, Thread, ThreadKind, ThreadNode};
 
-const TIMER_WHEEL_SIZE: u32 = 32;
+const WHEEL_BITS: u32 = 6;
+const WHEEL_SLOTS: usize = 1 << WHEEL_BITS;
+const WHEEL_MASK: usize = WHEEL_SLOTS - 1;
+const WHEEL_LEVELS: usize = 4;
+// The extra slot holds timers beyond the range of the top level.
+const NR_WHEEL_SLOTS: usize = WHEEL_LEVELS * WHEEL_SLOTS + 1;
+const OVERFLOW_SLOT: usize = NR_WHEEL_SLOTS - 1;
+const NO_SLOT: usize = usize::MAX;
+#[cfg(soft_timer)]
+const SOFT_TIMER_SLACK: usize = blueos_kconfig::SOFT_TIMER_SLACK;
+
+type WheelBitmap = u64;
 
 static HARD_TIMER_WHEEL: TimerWheel = TimerWheel::const_new();
 #[cfg(soft_timer)]
@@ -87,55 +98,240 @@ fn wakeup_soft_timer_thread() {
     debug_assert!(ok);
 }
 
+// A hierarchical timing wheel. Level n has WHEEL_SLOTS slots, each
+// covering WHEEL_SLOTS^n ticks. A timer is placed at the level of the
+// highest bit group in which its expiry differs from `clock`, so that
+// timers at a lower level always expire before timers at higher level
+// and slots of the same level are ordered by their index. Slots of
+// higher levels are cascaded to lower levels when `clock` enters the
+// range they cover. Timers out of the range of the top level are
+// parked in the overflow slot.
 struct TimerWheel {
-    wheel: SpinLock<[WheelTimerList; TIMER_WHEEL_SIZE as usize]>,
+    wheel: SpinLock<WheelState>,
+}
+
+struct WheelState {
+    // All ticks before clock have been processed.
+    clock: usize,
+    // Cached earliest expiry, None if it needs to be recomputed.
+    next_expiry: Option<usize>,
+    occupied: [WheelBitmap; WHEEL_LEVELS],
+    slots: [WheelTimerList; NR_WHEEL_SLOTS],
 }
 
 unsafe impl Sync for TimerWheel {}
 
+impl WheelState {
+    #[inline]
+    const fn shift(level: usize) -> u32 {
+        WHEEL_BITS * level as u32
+    }
+
+    #[inline]
+    fn level_index(&self, level: usize) -> usize {
+        (self.clock >> Self::shift(level)) & WHEEL_MASK
+    }
+
+    #[inline]
+    fn slot_is_empty(&self, slot: usize) -> bool {
+        self.slots[slot].iter().next().is_none()
+    }
+
+    fn slot_of(&self, expires: usize) -> usize {
+        let diff = expires ^ self.clock;
+        if diff < WHEEL_SLOTS {
+            return expires & WHEEL_MASK;
+        }
+        let level = ((usize::BITS - 1 - diff.leading_zeros()) / WHEEL_BITS) as usize;
+        if level >= WHEEL_LEVELS {
+            return OVERFLOW_SLOT;
+        }
+        level * WHEEL_SLOTS + ((expires >> Self::shift(level)) & WHEEL_MASK)
+    }
+
+    fn enqueue(&mut self, timer: Arc<Timer>, expires: usize) {
+        // Expired timers are fired on the next tick processed.
+        let expires = cmp::max(expires, self.clock);
+        let slot = self.slot_of(expires);
+        timer.expires.store(expires, Ordering::Relaxed);
+        // The timer might be restarted while it's still in the list of
+        // timers being fired, which fires it anyway.
+        if !self.slots[slot].push_back(timer.clone()) {
+            return;
+        }
+        timer.slot.store(slot, Ordering::Relaxed);
+        if slot != OVERFLOW_SLOT {
+            self.occupied[slot / WHEEL_SLOTS] |= 1 << (slot % WHEEL_SLOTS);
+        }
+        if let Some(next) = self.next_expiry {
+            self.next_expiry = Some(cmp::min(next, expires));
+        }
+    }
+
+    fn dequeue(&mut self, timer: &Arc<Timer>) {
+        let slot = timer.slot.swap(NO_SLOT, Ordering::Relaxed);
+        if slot == NO_SLOT {
+            return;
+        }
+        WheelTimerList::detach(timer);
+        if slot != OVERFLOW_SLOT && self.slot_is_empty(slot) {
+            self.occupied[slot / WHEEL_SLOTS] &= !(1 << (slot % WHEEL_SLOTS));
+        }
+        if self.next_expiry == Some(timer.expires.load(Ordering::Relaxed)) {
+            self.next_expiry = None;
+        }
+    }
+
+    // Moves all timers of the slot to the list.
+    fn drain_slot(&mut self, slot: usize, list: &mut WheelTimerList) {
+        if slot != OVERFLOW_SLOT {
+            self.occupied[slot / WHEEL_SLOTS] &= !(1 << (slot % WHEEL_SLOTS));
+        }
+        for timer in self.slots[slot].iter() {
+            timer.slot.store(NO_SLOT, Ordering::Relaxed);
+            WheelTimerList::detach(&timer);
+            list.push_back(timer);
+        }
+    }
+
+    fn cascade(&mut self, slot: usize) {
+        let mut pending = WheelTimerList::new();
+        pending.init();
+        self.drain_slot(slot, &mut pending);
+        while let Some(timer) = pending.pop_front() {
+            let expires = timer.expires.load(Ordering::Relaxed);
+            self.enqueue(timer, expires);
+        }
+    }
+
+    // Returns the first occupied slot of the level after the index of
+    // clock.
+    fn next_slot_of_level(&self, level: usize) -> Option<usize> {
+        let pending = self.occupied[level] & (WheelBitmap::MAX << self.level_index(level) << 1);
+        if pending == 0 {
+            return None;
+        }
+        Some(pending.trailing_zeros() as usize)
+    }
+
+    // The first tick after clock at which a slot has to be expired or
+    // cascaded.
+    fn next_event(&self) -> usize {
+        for level in 0..WHEEL_LEVELS {
+            if let Some(index) = self.next_slot_of_level(level) {
+                let upper = Self::shift(level) + WHEEL_BITS;
+                return (self.clock >> upper << upper) | (index << Self::shift(level));
+            }
+        }
+        if !self.slot_is_empty(OVERFLOW_SLOT) {
+            let span_mask = (1 << Self::shift(WHEEL_LEVELS)) - 1;
+            return (self.clock | span_mask).saturating_add(1);
+        }
+        usize::MAX
+    }
+
+    fn earliest_of_slot(&self, slot: usize) -> usize {
+        self.slots[slot]
+            .iter()
+            .map(|t| t.expires.load(Ordering::Relaxed))
+            .min()
+            .unwrap_or(usize::MAX)
+    }
+
+    fn earliest_expiry(&self) -> usize {
+        // All timers in a slot of level 0 expire at the same tick.
+        let index = self.level_index(0);
+        let pending = self.occupied[0] & (WheelBitmap::MAX << index);
+        if pending != 0 {
+            return (self.clock & !WHEEL_MASK) | pending.trailing_zeros() as usize;
+        }
+        for level in 1..WHEEL_LEVELS {
+            if let Some(index) = self.next_slot_of_level(level) {
+                return self.earliest_of_slot(level * WHEEL_SLOTS + index);
+            }
+        }
+        self.earliest_of_slot(OVERFLOW_SLOT)
+    }
+
+    // Moves clock to `clock`, cascading the slots whose range it enters,
+    // so that no slot of a higher level covers clock. Otherwise a clock
+    // left on a boundary would hide the timers of the slot still to be
+    // cascaded from earliest_expiry().
+    fn set_clock(&mut self, clock: usize) {
+        self.clock = clock;
+        let top_mask = (1 << Self::shift(WHEEL_LEVELS)) - 1;
+        if clock & top_mask == 0 {
+            self.cascade(OVERFLOW_SLOT);
+        }
+        for level in (1..WHEEL_LEVELS).rev() {
+            if clock & ((1 << Self::shift(level)) - 1) == 0 {
+                self.cascade(level * WHEEL_SLOTS + self.level_index(level));
+            }
+        }
+    }
+
+    // Moves timers expired up to now to the expired list. Empty ranges
+    // of the wheel are skipped, so catching up many ticks at once costs
+    // no more than the slots to expire or cascade.
+    fn advance(&mut self, now: usize, expired: &mut WheelTimerList) {
+        while self.clock <= now {
+            self.drain_slot(self.clock & WHEEL_MASK, expired);
+            let next = self.next_event();
+            if next > now {
+                self.set_clock(now + 1);
+                break;
+            }
+            self.set_clock(next);
+        }
+        // Only the timers expired are gone, so is the cached earliest
+        // expiry if it's among them.
+        if self.next_expiry.is_some_and(|next| next <= now) {
+            self.next_expiry = None;
+        }
+    }
+}
+
 impl TimerWheel {
     const fn const_new() -> Self {
         Self {
-            wheel: SpinLock::const_new(
-                [const { WheelTimerList::const_new() }; TIMER_WHEEL_SIZE as usize],
-            ),
+            wheel: SpinLock::const_new(WheelState {
+                clock: 0,
+                next_expiry: Some(usize::MAX),
+                occupied: [0; WHEEL_LEVELS],
+                slots: [const { WheelTimerList::const_new() }; NR_WHEEL_SLOTS],
+            }),
         }
     }
 
     fn init(&self) {
-        let mut wheel = self.wheel.irqsave_lock();
-        for i in 0..wheel.len() {
-            let ok = wheel[i].init();
+        let mut w = self.wheel.irqsave_lock();
+        w.clock = get_sys_ticks();
+        for i in 0..w.slots.len() {
+            let ok = w.slots[i].init();
             debug_assert!(ok);
         }
     }
 
     fn add_timer(&self, timer: Arc<Timer>, timeout_ticks: usize) {
-        let mut wheel = self.wheel.irqsave_lock();
-        let cursor = timeout_ticks & (TIMER_WHEEL_SIZE as usize - 1);
-        let it = wheel[cursor].iter();
-        for t in it {
-            if t.timeout_ticks() > timeout_ticks {
-                WheelTimerList::insert_before(
-                    unsafe { WheelTimerList::list_head_of_mut(&t) },
-                    timer,
-                );
-                return;
-            }
-        }
-        wheel[cursor].push_back(timer.clone());
+        #[cfg(soft_timer)]
+        let is_soft = timer.is_soft();
+        #[cfg(soft_timer)]
+        let timeout_ticks = if is_soft {
+            coalesce(timeout_ticks)
+        } else {
+            timeout_ticks
+        };
+        self.wheel.irqsave_lock().enqueue(timer, timeout_ticks);
         #[cfg(soft_timer)]
         {
-            if timer.is_soft() {
+            if is_soft {
                 wakeup_soft_timer_thread();
             }
         }
     }
 
     fn remove_timer(&self, timer: &Arc<Timer>) {
-        let lock = self.wheel.irqsave_lock();
-        WheelTimerList::detach(timer);
-        drop(lock);
+        self.wheel.irqsave_lock().dequeue(timer);
         #[cfg(soft_timer)]
         {
             if timer.is_soft() {
@@ -145,35 +341,22 @@ impl TimerWheel {
     }
 
     fn next_timeout(&self) -> usize {
-        let mut next_timeout_tick = usize::MAX;
-        let wheel = self.wheel.irqsave_lock();
-        for i in 0..TIMER_WHEEL_SIZE as usize {
-            if let Some(timer) = wheel[i].iter().next() {
-                let timeout_ticks = timer.timeout_ticks();
-                if timeout_ticks < next_timeout_tick {
-                    next_timeout_tick = timeout_ticks;
-                }
-            }
+        let mut w = self.wheel.irqsave_lock();
+        if let Some(next) = w.next_expiry {
+            return next;
         }
-        next_timeout_tick
+        let next = w.earliest_expiry();
+        w.next_expiry = Some(next);
+        next
     }
 
     fn check_timer(&self, current_ticks: usize) -> bool {
         let mut need_reschedule = false;
-        let cursor = current_ticks & (TIMER_WHEEL_SIZE as usize - 1);
         let mut task_list = WheelTimerList::new();
         task_list.init();
-        {
-            let wheel = self.wheel.irqsave_lock();
-            let mut iter = wheel[cursor].iter();
-            for timer in &mut iter {
-                if timer.timeout_ticks() > current_ticks {
-                    break;
-                }
-                WheelTimerList::detach(&timer);
-                task_list.push_back(timer);
-            }
-        }
+        self.wheel
+            .irqsave_lock()
+            .advance(current_ticks, &mut task_list);
 
         while let Some(timer) = task_list.pop_front() {
             timer.run();
@@ -186,6 +369,20 @@ impl TimerWheel {
     }
 }
 
+// Round the expiry of soft timers up to a multiple of SOFT_TIMER_SLACK,
+// so that soft timers expiring within the same granule are fired in
+// one batch by the soft timer thread.
+#[cfg(soft_timer)]
+#[inline]
+fn coalesce(timeout_ticks: usize) -> usize {
+    if SOFT_TIMER_SLACK <= 1 {
+        return timeout_ticks;
+    }
+    timeout_ticks
+        .checked_next_multiple_of(SOFT_TIMER_SLACK)
+        .unwrap_or(usize::MAX)
+}
+
 bitflags! {
     #[derive(Debug)]
     struct TimerFlags: u32 {
@@ -201,6 +398,9 @@ type WheelTimerList = ArcList<Timer, OffsetOfWheelNode>;
 #[derive(Debug)]
 pub struct Timer {
     pub wheel_node: IlistHead<Timer, OffsetOfWheelNode>, // lock by TimerWheel
+    // Slot and expiry in the wheel, lock by TimerWheel.
+    slot: AtomicUsize,
+    expires: AtomicUsize,
     flags: AtomicU32,
     inner: SpinLock<Inner>,
 }
@@ -247,6 +447,8 @@ impl Timer {
     fn new(interval: usize, flags: TimerFlags, callback: Box<dyn Fn() + Send + Sync>) -> Arc<Self> {
         Arc::new(Self {
             wheel_node: IlistHead::const_new(),
+            slot: AtomicUsize::new(NO_SLOT),
+            expires: AtomicUsize::new(0),
             flags: AtomicU32::new(flags.bits()),
             inner: SpinLock::new(Inner {
                 interval,
@@ -446,6 +648,12 @@ impl Timer {
                 .fetch_and(!TimerFlags::ACTIVATED.bits(), Ordering::Relaxed);
             let mut inner = self.inner.irqsave_lock();
             if let Some(callback) = inner.callback.take() {
+                #[cfg(sched_trace)]
+                crate::scheduler::trace::record(
+                    crate::scheduler::trace::Kind::Timer,
+                    self as *const _ as usize,
+                    0,
+                );
                 callback();
                 if self.is_periodic() {
                     inner.callback = Some(callback);
@@ -953,6 +1161,97 @@ mod tests {
         timer.stop();
     }
 
+    #[test]
+    fn test_timer_cascade() {
+        // Intervals beyond level 0 of the wheel get cascaded before
+        // being fired.
+        let intervals = [200, 70, 130, 65];
+        let mut timers = Vec::new();
+        let mut counters = Vec::new();
+        for interval in intervals {
+            let counter = Arc::new(AtomicUsize::new(0));
+            let timer = Timer::new_hard_oneshot(interval, create_test_callback(counter.clone()));
+            timer.start();
+            timers.push(timer);
+            counters.push(counter);
+        }
+        assert!(get_next_timer_ticks() <= timers[3].timeout_ticks());
+
+        scheduler::suspend_me_for(65);
+        assert_eq!(counters[3].load(Ordering::Relaxed), 1);
+        assert_eq!(counters[1].load(Ordering::Relaxed), 0);
+        scheduler::suspend_me_for(5);
+        assert_eq!(counters[1].load(Ordering::Relaxed), 1);
+        assert_eq!(counters[2].load(Ordering::Relaxed), 0);
+        scheduler::suspend_me_for(60);
+        assert_eq!(counters[2].load(Ordering::Relaxed), 1);
+        assert_eq!(counters[0].load(Ordering::Relaxed), 0);
+        scheduler::suspend_me_for(70);
+        assert_eq!(counters[0].load(Ordering::Relaxed), 1);
+    }
+
+    #[test]
+    fn test_timer_wheel_next_timeout() {
+        static WHEEL: TimerWheel = TimerWheel::const_new();
+        WHEEL.init();
+        let base = WHEEL.wheel.irqsave_lock().clock;
+        let counter = Arc::new(AtomicUsize::new(0));
+        let mut timers = Vec::new();
+        for delta in [5000, 100, 3, 70] {
+            let timer = Timer::new_hard_oneshot(delta, create_test_callback(counter.clone()));
+            timer
+                .flags
+                .fetch_or(TimerFlags::ACTIVATED.bits(), Ordering::Relaxed);
+            WHEEL.add_timer(timer.clone(), base + delta);
+            timers.push(timer);
+        }
+        assert_eq!(WHEEL.next_timeout(), base + 3);
+        // The cached earliest expiry must go with the timer removed.
+        WHEEL.remove_timer(&timers[2]);
+        assert_eq!(WHEEL.next_timeout(), base + 70);
+
+        assert!(!WHEEL.check_timer(base + 69));
+        assert_eq!(WHEEL.next_timeout(), base + 70);
+        assert!(WHEEL.check_timer(base + 70));
+        assert_eq!(counter.load(Ordering::Relaxed), 1);
+        assert_eq!(WHEEL.next_timeout(), base + 100);
+        // Catch up several levels in one go.
+        assert!(WHEEL.check_timer(base + 6000));
+        assert_eq!(counter.load(Ordering::Relaxed), 3);
+        assert_eq!(WHEEL.next_timeout(), usize::MAX);
+    }
+
+    #[test]
+    fn test_timer_wheel_next_timeout_on_boundary() {
+        static WHEEL: TimerWheel = TimerWheel::const_new();
+        WHEEL.init();
+        let base = {
+            let mut w = WHEEL.wheel.irqsave_lock();
+            let base = (w.clock | WHEEL_MASK) + 1;
+            w.clock = base + 10;
+            base
+        };
+        let counter = Arc::new(AtomicUsize::new(0));
+        let mut timers = Vec::new();
+        for expires in [63, 70] {
+            let timer = Timer::new_hard_oneshot(expires, create_test_callback(counter.clone()));
+            timer
+                .flags
+                .fetch_or(TimerFlags::ACTIVATED.bits(), Ordering::Relaxed);
+            WHEEL.add_timer(timer.clone(), base + expires);
+            timers.push(timer);
+        }
+        // Processing up to base + 63 leaves clock on the boundary of the
+        // slot holding the timer at base + 70.
+        assert!(WHEEL.check_timer(base + 63));
+        assert_eq!(WHEEL.wheel.irqsave_lock().clock, base + 64);
+        assert_eq!(WHEEL.next_timeout(), base + 70);
+        assert!(!WHEEL.check_timer(base + 69));
+        assert!(WHEEL.check_timer(base + 70));
+        assert_eq!(counter.load(Ordering::Relaxed), 2);
+        assert_eq!(WHEEL.next_timeout(), usize::MAX);
+    }
+
     #[cfg(soft_timer)]
     #[test]
     fn test_timer_soft_vs_hard() {
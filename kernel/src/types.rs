@@ -16,6 +16,7 @@ pub use blueos_infra::{
     impl_simple_intrusive_adapter,
     intrusive::Adapter as IntrusiveAdapter,
     list::typed_ilist::ListHead as IlistHead,
+    ticketlock::{ITicketLock, TicketLock, TicketLockGuard},
     tinyarc::{
         TinyArc as Arc, TinyArcInner as ArcInner, TinyArcList as ArcList,
         TinyArcListIterator as ArcListIterator,
@@ -15,7 +15,9 @@
 use crate::{
     devices::Device,
     error::{code, Error},
+    sync,
     vfs::{
+        dentry_table::{self, RenameGuard},
         fs::{FileSystem, FileSystemInfo},
         inode::InodeOps,
         inode_mode::{InodeFileType, InodeMode},
@@ -39,13 +41,36 @@ use delegate::delegate;
 use log::{debug, error, trace};
 use spin::RwLock;
 
-/// File system lookup cache
+// Holds the dir lock of a directory until dropped.
+struct DirGuard<'a>(&'a sync::Mutex);
+
+impl<'a> DirGuard<'a> {
+    fn lock(lock: &'a sync::Mutex) -> Self {
+        // Can't time out without a timeout.
+        let _ = lock.lock();
+        Self(lock)
+    }
+}
+
+impl Drop for DirGuard<'_> {
+    fn drop(&mut self) {
+        let _ = self.0.unlock();
+    }
+}
+
+/// File system lookup cache. Children are cached in the global dentry
+/// table, so lookups of cached names don't lock the directory.
 pub struct Dcache {
     // inode will never change after creation
     inode: Arc<dyn InodeOps>,
     // name and parent may change by rename, None means root directory
     name_and_parent: RwLock<Option<(String, Weak<Dcache>)>>,
-    children: RwLock<BTreeMap<String, Arc<Dcache>>>,
+    // Serializes changes of children and lookups missing the cache. It's
+    // held across inode operations, which may wait for block I/O, so it
+    // sleeps rather than spins.
+    dir_lock: sync::Mutex,
+    // Whether any entry of the dentry table refers to this as parent
+    has_children: AtomicBool,
     // When a child path becomes a mount point of other fs, it will be cached here
     overrided_children: RwLock<Option<BTreeMap<String, Arc<Dcache>>>>,
     // use to set parent in children
@@ -53,28 +78,41 @@ pub struct Dcache {
     is_mount_point: AtomicBool,
 }
 
+// SAFETY: The dir lock is !Send since it mustn't be moved once
+// initialized, and a Dcache is never moved out of its Arc.
+unsafe impl Send for Dcache {}
+
 impl Dcache {
     /// Create new directory node
     pub fn new(inode: Arc<dyn InodeOps>, name: String, parent: Weak<Dcache>) -> Arc<Self> {
-        Arc::new_cyclic(|weak_self| Self {
+        Self::init(Arc::new_cyclic(|weak_self| Self {
             inode,
             name_and_parent: RwLock::new(Some((name, parent))),
-            children: RwLock::new(BTreeMap::new()),
+            dir_lock: sync::Mutex::new(),
+            has_children: AtomicBool::new(false),
             this: weak_self.clone(),
             is_mount_point: AtomicBool::new(false),
             overrided_children: RwLock::new(None),
-        })
+        }))
     }
 
     pub fn new_root(inode: Arc<dyn InodeOps>) -> Arc<Self> {
-        Arc::new_cyclic(|weak_self| Self {
+        Self::init(Arc::new_cyclic(|weak_self| Self {
             inode,
             name_and_parent: RwLock::new(None),
-            children: RwLock::new(BTreeMap::new()),
+            dir_lock: sync::Mutex::new(),
+            has_children: AtomicBool::new(false),
             this: weak_self.clone(),
             is_mount_point: AtomicBool::new(false),
             overrided_children: RwLock::new(None),
-        })
+        }))
+    }
+
+    // The dir lock must be initialized at its final address.
+    fn init(dcache: Arc<Self>) -> Arc<Self> {
+        let ok = dcache.dir_lock.init();
+        debug_assert!(ok);
+        dcache
     }
 
     pub fn new_child<F>(
@@ -93,16 +131,14 @@ impl Dcache {
         if name == "." || name == ".." {
             return Err(code::EEXIST);
         }
-        let mut children = self.children.write();
-        if children.contains_key(name) {
+        let _dir = DirGuard::lock(&self.dir_lock);
+        if self.find_child(name).is_some() {
             return Err(code::EEXIST);
         }
         let inode =
             inode_creator().unwrap_or_else(|| self.inode.create(name, type_, mode).unwrap());
         let child = Self::new(inode, String::from(name), self.get_weak_ref());
-        if child.is_dcacheable() {
-            children.insert(String::from(name), child.clone());
-        }
+        self.cache_child(name, &child);
         Ok(child)
     }
 
@@ -115,17 +151,14 @@ impl Dcache {
         if self.inode.type_() != InodeFileType::Directory {
             return Err(code::ENOTDIR);
         }
-        let mut children = self.children.write();
-        if children.contains_key(name) {
+        let _dir = DirGuard::lock(&self.dir_lock);
+        if self.find_child(name).is_some() {
             return Err(code::EEXIST);
         }
 
         let inode = self.inode.create_device(name, mode, dev)?;
-        let name_str = String::from(name);
-        let child = Self::new(inode, name_str.clone(), self.get_weak_ref());
-        if child.is_dcacheable() {
-            children.insert(name_str, child.clone());
-        }
+        let child = Self::new(inode, String::from(name), self.get_weak_ref());
+        self.cache_child(name, &child);
         Ok(child)
     }
 
@@ -142,42 +175,88 @@ impl Dcache {
             return Err(code::ENOTDIR);
         }
 
-        let this = self.this.upgrade().unwrap();
         let entry = match name {
-            "." => this,
-            ".." => self.parent().unwrap_or(this),
-            name => {
-                // find in dcache first
-                match self.find_child(name) {
-                    Some(child) => child,
-                    None => {
-                        // lookup in filesystem
-                        let inode = self.inode.lookup(name)?;
-                        let entry = Dcache::new(inode, String::from(name), self.get_weak_ref());
-                        self.add_child(String::from(name), &entry);
-                        entry
-                    }
-                }
-            }
+            "." => self.this.upgrade().unwrap(),
+            ".." => self
+                .parent()
+                .unwrap_or_else(|| self.this.upgrade().unwrap()),
+            // find in dcache first
+            name => match dentry_table::get(self.key(), name) {
+                Some(Some(child)) => child,
+                Some(None) => return Err(code::ENOENT),
+                None => self.lookup_slow(name)?,
+            },
         };
 
         Ok(entry)
     }
 
+    // Lookup in filesystem and cache the result, including a missing name.
+    fn lookup_slow(&self, name: &str) -> Result<Arc<Dcache>, Error> {
+        let _dir = DirGuard::lock(&self.dir_lock);
+        // The name might be cached while waiting for the lock.
+        if let Some(entry) = dentry_table::get(self.key(), name) {
+            return entry.ok_or(code::ENOENT);
+        }
+        match self.inode.lookup(name) {
+            Ok(inode) => {
+                let entry = Dcache::new(inode, String::from(name), self.get_weak_ref());
+                self.cache_child(name, &entry);
+                Ok(entry)
+            }
+            Err(e) => {
+                if e == code::ENOENT && self.inode.is_negative_dcacheable() {
+                    self.has_children.store(true, Ordering::Relaxed);
+                    dentry_table::insert_negative(self.key(), name);
+                }
+                Err(e)
+            }
+        }
+    }
+
+    #[inline]
+    fn key(&self) -> usize {
+        self as *const Self as usize
+    }
+
+    // Cache the child if it's cacheable, otherwise forget any entry of
+    // the name, which might be negative.
+    fn cache_child(&self, name: &str, child: &Arc<Dcache>) {
+        if child.is_dcacheable() {
+            self.add_child(name, child);
+        } else {
+            drop(self.remove_child(name));
+        }
+    }
+
     /// Add child node
-    pub fn add_child(&self, name: String, child: &Arc<Dcache>) {
-        self.children.write().insert(name, child.clone());
+    pub fn add_child(&self, name: &str, child: &Arc<Dcache>) {
+        self.has_children.store(true, Ordering::Relaxed);
+        drop(dentry_table::insert(self.key(), name, child.clone()));
     }
 
     /// Remove child node
     pub fn remove_child(&self, name: &str) -> Option<Arc<Dcache>> {
-        self.children.write().remove(name)
+        dentry_table::remove(self.key(), name)
     }
 
     /// Find child node
     pub fn find_child(&self, name: &str) -> Option<Arc<Dcache>> {
-        let children = self.children.read();
-        children.get(name).cloned()
+        dentry_table::get(self.key(), name).flatten()
+    }
+
+    // Lock directories of a rename in address order.
+    fn lock_dirs<'a>(a: &'a Dcache, b: &'a Dcache) -> (DirGuard<'a>, Option<DirGuard<'a>>) {
+        if ptr::eq(a, b) {
+            return (DirGuard::lock(&a.dir_lock), None);
+        }
+        if a.key() < b.key() {
+            let first = DirGuard::lock(&a.dir_lock);
+            (first, Some(DirGuard::lock(&b.dir_lock)))
+        } else {
+            let first = DirGuard::lock(&b.dir_lock);
+            (first, Some(DirGuard::lock(&a.dir_lock)))
+        }
     }
 
     fn set_name_and_parent(&self, name: &str, parent: Weak<Self>) {
@@ -290,17 +369,18 @@ impl Dcache {
         if self.inode.type_() != InodeFileType::Directory {
             return Err(code::ENOTDIR);
         }
-        let mut children = self.children.write();
-        if children.contains_key(new_name) {
+        let _dir = DirGuard::lock(&self.dir_lock);
+        if self.find_child(new_name).is_some() {
             return Err(code::EEXIST);
         }
 
         self.inode.link(&old.inode, new_name)?;
-        let new_name_str = String::from(new_name);
-        let new_child = Self::new(old.inode.clone(), new_name_str.clone(), self.get_weak_ref());
-        if new_child.is_dcacheable() {
-            children.insert(new_name_str, new_child);
-        }
+        let new_child = Self::new(
+            old.inode.clone(),
+            String::from(new_name),
+            self.get_weak_ref(),
+        );
+        self.cache_child(new_name, &new_child);
         Ok(())
     }
 
@@ -309,8 +389,8 @@ impl Dcache {
         if self.inode.type_() != InodeFileType::Directory {
             return Err(code::ENOTDIR);
         }
-        let mut children = self.children.write();
-        let Some(child) = children.get(name) else {
+        let _dir = DirGuard::lock(&self.dir_lock);
+        let Some(child) = self.find_child(name) else {
             return Err(code::ENOENT);
         };
         if child.is_mount_point() {
@@ -318,7 +398,8 @@ impl Dcache {
         }
 
         self.inode.unlink(name)?;
-        children.remove(name);
+        let _seq = RenameGuard::new();
+        drop(self.remove_child(name));
         Ok(())
     }
 
@@ -326,15 +407,16 @@ impl Dcache {
         if self.inode.type_() != InodeFileType::Directory {
             return Err(code::ENOTDIR);
         }
-        let mut children = self.children.write();
-        let Some(child) = children.get(name) else {
+        let _dir = DirGuard::lock(&self.dir_lock);
+        let Some(child) = self.find_child(name) else {
             return Err(code::ENOENT);
         };
         if child.is_mount_point() {
             return Err(code::EBUSY);
         }
         self.inode.rmdir(name)?;
-        children.remove(name);
+        let _seq = RenameGuard::new();
+        drop(self.remove_child(name));
         Ok(())
     }
 
@@ -355,9 +437,9 @@ impl Dcache {
             return Err(code::EINVAL);
         }
 
-        let mut children = self.children.write();
-        let child = match children.get(old_name) {
-            Some(child) => child.clone(),
+        let _dirs = Self::lock_dirs(self, new_dir);
+        let child = match self.find_child(old_name) {
+            Some(child) => child,
             None => {
                 debug!("{} not found", old_name);
                 return Err(code::ENOENT);
@@ -370,27 +452,24 @@ impl Dcache {
 
         // rename in the same directory
         if ptr::addr_eq(self, Arc::as_ptr(new_dir)) && old_name != new_name {
-            if children.contains_key(new_name) {
+            if self.find_child(new_name).is_some() {
                 debug!("{} already exists", new_name);
                 return Err(code::EEXIST);
             }
             self.inode.rename(old_name, &self.inode, new_name)?;
-            children.remove(old_name);
-            if child.is_dcacheable() {
-                children.insert(String::from(new_name), child);
-            }
+            let _seq = RenameGuard::new();
+            drop(self.remove_child(old_name));
+            self.cache_child(new_name, &child);
         } else {
-            let mut new_children = new_dir.children.write();
-            if new_children.contains_key(new_name) {
+            if new_dir.find_child(new_name).is_some() {
                 debug!("{} already exists", new_name);
                 return Err(code::EEXIST);
             }
             self.inode.rename(old_name, &new_dir.inode, new_name)?;
-            children.remove(old_name);
+            let _seq = RenameGuard::new();
+            drop(self.remove_child(old_name));
             child.set_name_and_parent(new_name, new_dir.this.clone());
-            if child.is_dcacheable() {
-                new_children.insert(String::from(new_name), child);
-            }
+            new_dir.cache_child(new_name, &child);
         }
 
         Ok(())
@@ -402,23 +481,23 @@ impl Dcache {
         if overrided_children.is_none() {
             *overrided_children = Some(BTreeMap::new());
         }
-        let mut children = self.children.write();
-        if let Some(overrided_child) = children.remove(&name) {
+        let _dir = DirGuard::lock(&self.dir_lock);
+        if let Some(overrided_child) = self.remove_child(&name) {
             if let Some(overrided_children) = overrided_children.as_mut() {
                 overrided_children.insert(overrided_child.name(), overrided_child);
             }
         }
 
-        children.insert(name, mount_point);
+        self.add_child(&name, &mount_point);
         Ok(())
     }
 
     fn remove_mount_point(&self, name: String) -> Result<(), Error> {
-        let mut children = self.children.write();
+        let _dir = DirGuard::lock(&self.dir_lock);
         trace!(
             "Remove mount point: {} , {:?}",
             name,
-            children.remove(&name).unwrap()
+            self.remove_child(&name).unwrap()
         );
 
         let mut overrided_children = self.overrided_children.write();
@@ -429,7 +508,7 @@ impl Dcache {
                 name,
                 overrided_point
             );
-            children.insert(name, overrided_point);
+            self.add_child(&name, &overrided_point);
         }
 
         Ok(())
@@ -476,5 +555,8 @@ impl Debug for Dcache {
 impl Drop for Dcache {
     fn drop(&mut self) {
         trace!("Drop {:?}", self);
+        if self.has_children.load(Ordering::Relaxed) {
+            dentry_table::purge(self.key());
+        }
     }
 }
@@ -0,0 +1,244 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The global table of cached directory entries, hashed by parent and
+// name. An entry either refers to the child, or is negative, recording
+// that the name doesn't exist. Lookups only take the read lock of one
+// bucket and compare names in place, so walking cached paths doesn't
+// allocate or take any write lock.
+//
+// Entries are replaced and removed with the bucket locked, but the
+// entries taken out are dropped by the caller after unlocking, since
+// dropping a Dcache purges its own children from the table.
+//
+// Negative entries are capped per bucket, the one least recently looked
+// up is evicted to make room for a new one, so looking up many missing
+// names doesn't grow the table without bound.
+//
+// Renames and unlinks bump RENAME_SEQ around their changes, like a
+// sequence lock, so a path walk can tell whether the namespace changed
+// under it and walk again.
+
+use crate::vfs::dcache::Dcache;
+use alloc::{string::String, sync::Arc, vec::Vec};
+use core::sync::atomic::{AtomicUsize, Ordering};
+use spin::{Mutex, MutexGuard, RwLock};
+
+const NR_BUCKETS: usize = 256;
+const MAX_NEGATIVE_PER_BUCKET: usize = 8;
+
+struct Entry {
+    parent: usize,
+    hash: u32,
+    name: String,
+    // None for negative entries.
+    child: Option<Arc<Dcache>>,
+    // When a negative entry is last looked up, in NEGATIVE_CLOCK.
+    used: AtomicUsize,
+}
+
+struct Bucket {
+    entries: RwLock<Vec<Entry>>,
+}
+
+static TABLE: [Bucket; NR_BUCKETS] = [const {
+    Bucket {
+        entries: RwLock::new(Vec::new()),
+    }
+}; NR_BUCKETS];
+
+static NEGATIVE_CLOCK: AtomicUsize = AtomicUsize::new(0);
+static RENAME_SEQ: AtomicUsize = AtomicUsize::new(0);
+static RENAME_LOCK: Mutex<()> = Mutex::new(());
+
+// FNV-1a.
+#[inline]
+fn hash(parent: usize, name: &str) -> u32 {
+    let mut h: u32 = 0x811c9dc5 ^ (parent as u32) ^ ((parent >> 16) as u32);
+    for b in name.bytes() {
+        h = (h ^ b as u32).wrapping_mul(0x01000193);
+    }
+    h
+}
+
+#[inline]
+fn bucket(hash: u32) -> &'static Bucket {
+    &TABLE[hash as usize % NR_BUCKETS]
+}
+
+#[inline]
+fn matches(e: &Entry, parent: usize, hash: u32, name: &str) -> bool {
+    e.hash == hash && e.parent == parent && e.name == name
+}
+
+/// Look a name up in `parent`. Return None if the name isn't cached,
+/// Some(None) if it's cached as missing.
+pub(crate) fn get(parent: usize, name: &str) -> Option<Option<Arc<Dcache>>> {
+    let h = hash(parent, name);
+    let entries = bucket(h).entries.read();
+    let e = entries.iter().find(|e| matches(e, parent, h, name))?;
+    if e.child.is_none() {
+        e.used.store(
+            NEGATIVE_CLOCK.fetch_add(1, Ordering::Relaxed),
+            Ordering::Relaxed,
+        );
+    }
+    Some(e.child.clone())
+}
+
+/// Cache `child` as `name` of `parent`, replacing any entry of the name.
+/// Return the child replaced.
+#[must_use]
+pub(crate) fn insert(parent: usize, name: &str, child: Arc<Dcache>) -> Option<Arc<Dcache>> {
+    let h = hash(parent, name);
+    let mut entries = bucket(h).entries.write();
+    if let Some(e) = entries.iter_mut().find(|e| matches(e, parent, h, name)) {
+        return e.child.replace(child);
+    }
+    entries.push(Entry {
+        parent,
+        hash: h,
+        name: String::from(name),
+        child: Some(child),
+        used: AtomicUsize::new(0),
+    });
+    None
+}
+
+/// Cache `name` of `parent` as missing unless it's cached already,
+/// evicting the negative entry of the bucket least recently looked up
+/// if the bucket has too many.
+pub(crate) fn insert_negative(parent: usize, name: &str) {
+    let h = hash(parent, name);
+    let mut entries = bucket(h).entries.write();
+    if entries.iter().any(|e| matches(e, parent, h, name)) {
+        return;
+    }
+    let negatives = entries
+        .iter()
+        .enumerate()
+        .filter(|(_, e)| e.child.is_none());
+    if negatives.clone().count() >= MAX_NEGATIVE_PER_BUCKET {
+        let lru = negatives
+            .min_by_key(|(_, e)| e.used.load(Ordering::Relaxed))
+            .map(|(i, _)| i);
+        if let Some(i) = lru {
+            entries.swap_remove(i);
+        }
+    }
+    entries.push(Entry {
+        parent,
+        hash: h,
+        name: String::from(name),
+        child: None,
+        used: AtomicUsize::new(NEGATIVE_CLOCK.fetch_add(1, Ordering::Relaxed)),
+    });
+}
+
+/// Remove the entry of `name`, return the child removed.
+#[must_use]
+pub(crate) fn remove(parent: usize, name: &str) -> Option<Arc<Dcache>> {
+    let h = hash(parent, name);
+    let mut entries = bucket(h).entries.write();
+    let i = entries.iter().position(|e| matches(e, parent, h, name))?;
+    entries.swap_remove(i).child
+}
+
+/// Remove all entries of `parent`.
+pub(crate) fn purge(parent: usize) {
+    for b in TABLE.iter() {
+        let removed: Vec<Entry> = {
+            let mut entries = b.entries.write();
+            if !entries.iter().any(|e| e.parent == parent) {
+                continue;
+            }
+            let (removed, kept) = core::mem::take(&mut *entries)
+                .into_iter()
+                .partition(|e| e.parent == parent);
+            *entries = kept;
+            removed
+        };
+        drop(removed);
+    }
+}
+
+/// Brackets changes of the namespace which path walks must not miss.
+/// Such changes are serialized, so the sequence stays odd until the
+/// guard is dropped.
+pub(crate) struct RenameGuard(MutexGuard<'static, ()>);
+
+impl RenameGuard {
+    pub fn new() -> Self {
+        let guard = RENAME_LOCK.lock();
+        RENAME_SEQ.fetch_add(1, Ordering::AcqRel);
+        Self(guard)
+    }
+}
+
+impl Drop for RenameGuard {
+    fn drop(&mut self) {
+        RENAME_SEQ.fetch_add(1, Ordering::Release);
+    }
+}
+
+/// Start a walk. The sequence is odd while a rename is in progress.
+#[inline]
+pub(crate) fn read_begin() -> usize {
+    RENAME_SEQ.load(Ordering::Acquire)
+}
+
+/// Whether the namespace changed since `seq` was read.
+#[inline]
+pub(crate) fn read_retry(seq: usize) -> bool {
+    seq & 1 != 0 || RENAME_SEQ.load(Ordering::Acquire) != seq
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use alloc::format;
+    use blueos_test_macro::test;
+
+    fn nr_negative(parent: usize) -> usize {
+        TABLE
+            .iter()
+            .map(|b| {
+                b.entries
+                    .read()
+                    .iter()
+                    .filter(|e| e.parent == parent && e.child.is_none())
+                    .count()
+            })
+            .sum()
+    }
+
+    #[test]
+    fn test_negative_entries_bounded() {
+        static PARENT: u8 = 0;
+        let parent = &PARENT as *const u8 as usize;
+        let n = 16 * NR_BUCKETS * MAX_NEGATIVE_PER_BUCKET;
+        for i in 0..n {
+            let name = format!("missing{}", i);
+            if get(parent, &name).is_none() {
+                insert_negative(parent, &name);
+            }
+        }
+        assert!(nr_negative(parent) <= NR_BUCKETS * MAX_NEGATIVE_PER_BUCKET);
+        // The latest ones are kept.
+        let last = format!("missing{}", n - 1);
+        assert!(matches!(get(parent, &last), Some(None)));
+        purge(parent);
+        assert_eq!(nr_negative(parent), 0);
+    }
+}
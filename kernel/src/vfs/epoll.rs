@@ -0,0 +1,304 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Event polls behind epoll_create1(), epoll_ctl() and epoll_wait(). An
+// event poll watches files with the watches of sync::poll, and waits on
+// its ready list, so a wait costs as much as the files ready, however
+// many are watched. Watches are level triggered unless EPOLLET is
+// set: a watch still ready is queued again once reported. Files are
+// referred to weakly, a file closed is forgotten once all of its fds
+// are closed.
+
+use crate::{
+    error::{code, Error},
+    sync::poll::{PollWatch, ReadyList},
+    time,
+    vfs::file::{FileAttr, FileOps, OpenFlags},
+};
+use alloc::{
+    collections::BTreeMap,
+    sync::{Arc, Weak},
+};
+use core::sync::atomic::{AtomicI32, Ordering};
+use spin::Mutex;
+
+pub const EPOLL_CTL_ADD: i32 = 1;
+pub const EPOLL_CTL_DEL: i32 = 2;
+pub const EPOLL_CTL_MOD: i32 = 3;
+
+pub const EPOLLONESHOT: u32 = 1 << 30;
+pub const EPOLLET: u32 = 1 << 31;
+const EPOLL_FLAGS: u32 = EPOLLONESHOT | EPOLLET;
+
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct EpollEvent {
+    pub events: u32,
+    pub data: u64,
+}
+
+struct Entry {
+    file: Weak<dyn FileOps>,
+    watch: Arc<PollWatch>,
+    event: EpollEvent,
+}
+
+pub struct EventPoll {
+    entries: Mutex<BTreeMap<i32, Entry>>,
+    ready: Arc<ReadyList>,
+    open_flags: AtomicI32,
+}
+
+impl EventPoll {
+    pub fn new(flags: OpenFlags) -> Self {
+        Self {
+            entries: Mutex::new(BTreeMap::new()),
+            ready: ReadyList::new(),
+            open_flags: AtomicI32::new(flags.bits()),
+        }
+    }
+
+    pub fn ctl(
+        &self,
+        op: i32,
+        fd: i32,
+        file: Arc<dyn FileOps>,
+        event: EpollEvent,
+    ) -> Result<(), Error> {
+        // Polls waiting on each other could never be told apart from
+        // a loop, nesting isn't supported.
+        if file.downcast_ref::<EventPoll>().is_some() {
+            return Err(code::EINVAL);
+        }
+        let mut entries = self.entries.lock();
+        match op {
+            EPOLL_CTL_ADD => {
+                // The fd might have been closed and reused since.
+                if let Some(entry) = entries.get(&fd) {
+                    if entry.file.upgrade().is_some_and(|f| Arc::ptr_eq(&f, &file)) {
+                        return Err(code::EEXIST);
+                    }
+                }
+                let watch = PollWatch::new(fd, event.events & !EPOLL_FLAGS, &self.ready);
+                self.ready.reserve(entries.len() + 1);
+                watch.notify(file.poll(Some(&watch)));
+                entries.insert(
+                    fd,
+                    Entry {
+                        file: Arc::downgrade(&file),
+                        watch,
+                        event,
+                    },
+                );
+            }
+            EPOLL_CTL_MOD => {
+                let entry = entries.get_mut(&fd).ok_or(code::ENOENT)?;
+                entry.event = event;
+                entry.watch.set_interest(event.events & !EPOLL_FLAGS);
+                entry.watch.notify(file.poll(None));
+            }
+            EPOLL_CTL_DEL => {
+                let entry = entries.remove(&fd).ok_or(code::ENOENT)?;
+                entry.watch.set_interest(0);
+            }
+            _ => return Err(code::EINVAL),
+        }
+        Ok(())
+    }
+
+    /// Wait at most `timeout` ticks, forever if None, for watched files
+    /// to get ready, and report as many as `events` holds of them.
+    pub fn wait(&self, events: &mut [EpollEvent], timeout: Option<usize>) -> usize {
+        let deadline = timeout.map(|t| time::get_sys_ticks().saturating_add(t));
+        loop {
+            let seen = self.ready.seen();
+            let n = self.collect(events);
+            if n > 0 {
+                return n;
+            }
+            let left = deadline.map(|d| d.saturating_sub(time::get_sys_ticks()));
+            if left == Some(0) || !self.ready.wait(seen, left) {
+                return 0;
+            }
+        }
+    }
+
+    // Only the watches queued so far are looked at, the ones queued
+    // again meanwhile are left to the next wait.
+    fn collect(&self, events: &mut [EpollEvent]) -> usize {
+        let entries = self.entries.lock();
+        let mut n = 0;
+        for _ in 0..self.ready.len() {
+            if n == events.len() {
+                break;
+            }
+            let Some(watch) = self.ready.pop() else {
+                break;
+            };
+            let Some(entry) = entries
+                .get(&watch.key())
+                .filter(|e| Arc::ptr_eq(&e.watch, &watch))
+            else {
+                continue;
+            };
+            let Some(file) = entry.file.upgrade() else {
+                continue;
+            };
+            let ready = watch.filter(file.poll(None));
+            if ready == 0 {
+                continue;
+            }
+            events[n] = EpollEvent {
+                events: ready,
+                data: entry.event.data,
+            };
+            n += 1;
+            if entry.event.events & EPOLLONESHOT != 0 {
+                watch.set_interest(0);
+            } else if entry.event.events & EPOLLET == 0 {
+                watch.requeue();
+            }
+        }
+        n
+    }
+}
+
+impl FileOps for EventPoll {
+    fn stat(&self) -> FileAttr {
+        FileAttr::default()
+    }
+
+    fn flags(&self) -> OpenFlags {
+        OpenFlags::from_bits_truncate(self.open_flags.load(Ordering::Relaxed))
+    }
+
+    fn set_flags(&self, flags: OpenFlags) {
+        self.open_flags.store(flags.bits(), Ordering::Relaxed);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::sync::poll::{PollQueue, POLLIN, POLLOUT};
+    use blueos_test_macro::test;
+    use core::sync::atomic::AtomicU32;
+
+    struct Pipe {
+        events: AtomicU32,
+        queue: PollQueue,
+    }
+
+    impl Pipe {
+        fn set(&self, events: u32) {
+            self.events.store(events, Ordering::Release);
+            self.queue.notify(events);
+        }
+    }
+
+    impl FileOps for Pipe {
+        fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+            if let Some(watch) = watch {
+                self.queue.register(watch);
+            }
+            self.events.load(Ordering::Acquire)
+        }
+
+        fn stat(&self) -> FileAttr {
+            FileAttr::default()
+        }
+
+        fn flags(&self) -> OpenFlags {
+            OpenFlags::empty()
+        }
+
+        fn set_flags(&self, _flags: OpenFlags) {}
+    }
+
+    fn pipe() -> Arc<dyn FileOps> {
+        Arc::new(Pipe {
+            events: AtomicU32::new(0),
+            queue: PollQueue::new(),
+        })
+    }
+
+    fn set(file: &Arc<dyn FileOps>, events: u32) {
+        file.downcast_ref::<Pipe>().unwrap().set(events);
+    }
+
+    #[test]
+    fn test_only_ready_files_reported() {
+        let ep = EventPoll::new(OpenFlags::empty());
+        let files: alloc::vec::Vec<_> = (0..64).map(|_| pipe()).collect();
+        for (fd, file) in files.iter().enumerate() {
+            let event = EpollEvent {
+                events: POLLIN,
+                data: fd as u64,
+            };
+            ep.ctl(EPOLL_CTL_ADD, fd as i32, file.clone(), event)
+                .unwrap();
+        }
+        let mut out = [EpollEvent::default(); 8];
+        assert_eq!(ep.wait(&mut out, Some(0)), 0);
+
+        set(&files[42], POLLIN | POLLOUT);
+        assert_eq!(ep.wait(&mut out, Some(0)), 1);
+        assert_eq!(out[0].data, 42);
+        assert_eq!(out[0].events, POLLIN);
+        // Level triggered, still reported while readable.
+        assert_eq!(ep.wait(&mut out, Some(0)), 1);
+        set(&files[42], 0);
+        assert_eq!(ep.wait(&mut out, Some(0)), 0);
+
+        ep.ctl(EPOLL_CTL_DEL, 42, files[42].clone(), out[0])
+            .unwrap();
+        set(&files[42], POLLIN);
+        assert_eq!(ep.wait(&mut out, Some(0)), 0);
+    }
+
+    #[test]
+    fn test_edge_triggered_and_oneshot() {
+        let ep = EventPoll::new(OpenFlags::empty());
+        let (a, b) = (pipe(), pipe());
+        let et = EpollEvent {
+            events: POLLIN | EPOLLET,
+            data: 1,
+        };
+        let oneshot = EpollEvent {
+            events: POLLIN | EPOLLONESHOT,
+            data: 2,
+        };
+        ep.ctl(EPOLL_CTL_ADD, 1, a.clone(), et).unwrap();
+        ep.ctl(EPOLL_CTL_ADD, 2, b.clone(), oneshot).unwrap();
+        assert_eq!(
+            ep.ctl(EPOLL_CTL_ADD, 2, b.clone(), oneshot),
+            Err(code::EEXIST)
+        );
+
+        set(&a, POLLIN);
+        set(&b, POLLIN);
+        let mut out = [EpollEvent::default(); 4];
+        assert_eq!(ep.wait(&mut out, Some(0)), 2);
+        assert_eq!(ep.wait(&mut out, Some(0)), 0);
+
+        set(&a, POLLIN);
+        set(&b, POLLIN);
+        assert_eq!(ep.wait(&mut out, Some(0)), 1);
+        assert_eq!(out[0].data, 1);
+
+        ep.ctl(EPOLL_CTL_MOD, 2, b.clone(), oneshot).unwrap();
+        assert_eq!(ep.wait(&mut out, Some(1)), 1);
+        assert_eq!(out[0].data, 2);
+    }
+}
@@ -278,7 +278,12 @@ impl FileSystem for FatFileSystem {
     fn sync(&self) -> Result<(), Error> {
         let (internal_fs, _) = get_internal_fs_with_guard(&self.device_name);
         internal_fs.flush_fs_info()?;
-        Ok(())
+        // Write back the buffer cache of the device.
+        DeviceManager::get()
+            .get_block_device(&self.device_name)
+            .ok_or(code::ENODEV)?
+            .sync()
+            .map_err(|_| code::EIO)
     }
 
     fn root_inode(&self) -> Arc<dyn InodeOps> {
@@ -784,7 +789,8 @@ impl InodeOps for FatInode {
     }
 
     fn flush(&self) -> Result<(), Error> {
-        // Each write operation is submitted directly to virtio block, so we don't need to do anything here.
+        // Writes are kept in the buffer cache of the block device until
+        // fsync or sync.
         Ok(())
     }
 
@@ -12,16 +12,33 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-//! vfs_fd.rs  
+//! vfs_fd.rs
+//!
+//! The fd table is a two-level array of atomic pointers, so looking a fd
+//! up takes no lock. Chunks of the second level are allocated on demand
+//! and never freed. Changes of the table are serialized by a writer lock,
+//! which also keeps the bitmap of fds in use.
+//!
+//! A file taken out of the table may still be cloned by a concurrent
+//! lookup, so it's retired rather than dropped. Lookups count themselves
+//! per core in one of two counters picked by an epoch. Files retired
+//! before the epoch flips are dropped once the counters of the previous
+//! epoch drain, which is usually at once.
 
 use crate::{
+    arch,
     error::{code, Error},
     vfs::{file::FileOps, path},
 };
-use alloc::{sync::Arc, vec, vec::Vec};
-use core::ffi::c_int;
+use alloc::{boxed::Box, sync::Arc, vec::Vec};
+use blueos_kconfig::NUM_CORES;
+use core::{
+    ffi::c_int,
+    ptr,
+    sync::atomic::{AtomicPtr, AtomicUsize, Ordering},
+};
 use log::warn;
-use spin::{Mutex as SpinLock, Once};
+use spin::Mutex as SpinLock;
 
 /// Standard file descriptors
 pub const STDIN_FILENO: c_int = 0;
@@ -30,138 +47,322 @@ pub const STDERR_FILENO: c_int = 2;
 /// First available file descriptor
 pub const FIRST_FD: usize = 3;
 
+const FDS_PER_CHUNK: usize = 64;
+const NR_CHUNKS: usize = 64;
+/// Maximum number of file descriptors
+pub const MAX_FDS: usize = FDS_PER_CHUNK * NR_CHUNKS;
+
+type Slot = AtomicPtr<Arc<dyn FileOps>>;
+
+struct Chunk {
+    slots: [Slot; FDS_PER_CHUNK],
+}
+
+#[repr(align(64))]
+struct ReaderCount([AtomicUsize; 2]);
+
+struct Retired(*mut Arc<dyn FileOps>);
+
+// SAFETY: A retired file is only touched by the writer.
+unsafe impl Send for Retired {}
+
+impl Drop for Retired {
+    fn drop(&mut self) {
+        drop(unsafe { Box::from_raw(self.0) });
+    }
+}
+
+struct Writer {
+    // Bit i of used[j] is set if fd j * 64 + i is in use.
+    used: [u64; NR_CHUNKS],
+    count: usize,
+    // Retired since the epoch flipped.
+    pending: Vec<Retired>,
+    // Retired before the epoch flipped, dropped once the readers of the
+    // previous epoch leave.
+    waiting: Vec<Retired>,
+}
+
 /// File descriptor manager
 pub struct FdManager {
-    /// File descriptor table
-    fds: Vec<Option<Arc<dyn FileOps>>>,
-    /// Next available file descriptor
-    next_fd: usize,
+    chunks: [AtomicPtr<Chunk>; NR_CHUNKS],
+    epoch: AtomicUsize,
+    readers: [ReaderCount; NUM_CORES],
+    writer: SpinLock<Writer>,
+}
+
+struct ReadGuard<'a> {
+    count: &'a AtomicUsize,
+}
+
+impl Drop for ReadGuard<'_> {
+    #[inline]
+    fn drop(&mut self) {
+        self.count.fetch_sub(1, Ordering::SeqCst);
+    }
 }
 
 impl FdManager {
     /// Create new file descriptor manager
-    pub fn new() -> Self {
+    pub const fn new() -> Self {
         Self {
-            fds: vec![None; FIRST_FD + 1],
-            next_fd: FIRST_FD,
+            chunks: [const { AtomicPtr::new(ptr::null_mut()) }; NR_CHUNKS],
+            epoch: AtomicUsize::new(0),
+            readers: [const { ReaderCount([AtomicUsize::new(0), AtomicUsize::new(0)]) }; NUM_CORES],
+            writer: SpinLock::new(Writer {
+                used: [0; NR_CHUNKS],
+                count: 0,
+                pending: Vec::new(),
+                waiting: Vec::new(),
+            }),
         }
     }
 
-    pub fn init_stdio(&mut self) -> Result<(), Error> {
+    pub fn init_stdio(&self) -> Result<(), Error> {
         let stdin = path::open_path("/dev/console", libc::O_RDONLY, 0o666)?;
         let stdout = path::open_path("/dev/console", libc::O_WRONLY, 0o666)?;
         let stderr = path::open_path("/dev/console", libc::O_WRONLY, 0o666)?;
 
-        self.fds[STDIN_FILENO as usize] = Some(Arc::new(stdin));
-        self.fds[STDOUT_FILENO as usize] = Some(Arc::new(stdout));
-        self.fds[STDERR_FILENO as usize] = Some(Arc::new(stderr));
+        let mut w = self.writer.lock();
+        self.install(&mut w, STDIN_FILENO as usize, Arc::new(stdin));
+        self.install(&mut w, STDOUT_FILENO as usize, Arc::new(stdout));
+        self.install(&mut w, STDERR_FILENO as usize, Arc::new(stderr));
 
         Ok(())
     }
 
-    /// Allocate new file descriptor
-    pub fn alloc_fd(&mut self, file: Arc<dyn FileOps>) -> c_int {
-        let fd = self.next_fd;
-        self.fds[fd] = Some(file);
-        self.update_next_fd(fd);
+    /// Allocate the lowest free file descriptor. Return -EMFILE if the
+    /// table is full.
+    pub fn alloc_fd(&self, file: Arc<dyn FileOps>) -> c_int {
+        let mut w = self.writer.lock();
+        let Some(fd) = Self::find_free(&w, FIRST_FD) else {
+            warn!("[fd] alloc_fd: Too many open files");
+            return code::EMFILE.to_errno();
+        };
+        self.install(&mut w, fd, file);
         fd as c_int
     }
 
     /// Duplicate file descriptor
-    pub fn dup_fd(&mut self, fd: c_int, minfd: c_int, close_on_exec: bool) -> Result<c_int, Error> {
+    pub fn dup_fd(&self, fd: c_int, minfd: c_int, close_on_exec: bool) -> Result<c_int, Error> {
         let Some(file) = self.get_file_ops(fd) else {
             return Err(code::EBADF);
         };
-
-        let mut new_fd = minfd as usize;
-        if new_fd < FIRST_FD {
-            new_fd = FIRST_FD;
-        }
-        // find minfd
-        let len = self.fds.len();
-        while new_fd < len && self.fds[new_fd].is_some() {
-            new_fd += 1;
-        }
-        if new_fd >= len {
-            // add capacity by std Vec, so we just +1
-            self.fds.resize(new_fd + 1, None);
+        if minfd < 0 || minfd as usize >= MAX_FDS {
+            return Err(code::EINVAL);
         }
 
+        let mut w = self.writer.lock();
+        let Some(new_fd) = Self::find_free(&w, (minfd as usize).max(FIRST_FD)) else {
+            return Err(code::EMFILE);
+        };
+
         // do dup
         let file2 = file.dup(close_on_exec)?;
-        self.fds[new_fd] = Some(file2);
-        self.update_next_fd(new_fd);
+        self.install(&mut w, new_fd, file2);
         Ok(new_fd as c_int)
     }
 
-    /// Free file descriptor
-    pub fn free_fd(&mut self, fd: c_int) -> Result<(), Error> {
+    /// Free file descriptor, return the file it refers to
+    pub fn free_fd(&self, fd: c_int) -> Result<Arc<dyn FileOps>, Error> {
         // close stdio is allowed
-        if fd as usize >= self.fds.len() {
+        let Some(slot) = self.slot(fd) else {
             warn!("[fd] free_fd: Invalid fd: {}", fd);
             return Err(code::EBADF);
-        }
+        };
 
-        if self.fds[fd as usize].is_none() {
+        let mut w = self.writer.lock();
+        let p = slot.swap(ptr::null_mut(), Ordering::SeqCst);
+        if p.is_null() {
             warn!("[fd] free_fd: Fd {} not in use", fd);
             return Err(code::EBADF);
         }
-
-        self.fds[fd as usize] = None;
-        Ok(())
+        let fd = fd as usize;
+        w.used[fd / FDS_PER_CHUNK] &= !(1 << (fd % FDS_PER_CHUNK));
+        w.count -= 1;
+        // SAFETY: The pointer stays valid until it's reclaimed below.
+        let file = unsafe { (*p).clone() };
+        w.pending.push(Retired(p));
+        self.reclaim(&mut w);
+        Ok(file)
     }
 
     /// Get file operation
     pub fn get_file_ops(&self, fd: c_int) -> Option<Arc<dyn FileOps>> {
-        if fd < 0 || fd as usize >= self.fds.len() {
+        let Some(slot) = self.slot(fd) else {
             warn!("[fd] get_file_ops: Invalid fd: {}", fd);
             return None;
-        }
+        };
 
-        match self.fds[fd as usize].as_ref() {
-            Some(file) => Some(file.clone()),
-            None => {
-                warn!("[fd] get_file_ops: Fd {} not found", fd);
-                None
-            }
+        let _guard = self.read_lock();
+        let p = slot.load(Ordering::SeqCst);
+        if p.is_null() {
+            warn!("[fd] get_file_ops: Fd {} not found", fd);
+            return None;
         }
+        // SAFETY: The file isn't dropped while the guard is held.
+        Some(unsafe { (*p).clone() })
     }
 
     /// Check if file descriptor is valid
     pub fn is_valid_fd(&self, fd: c_int) -> bool {
-        fd >= 0 && (fd as usize) < self.fds.len() && self.fds[fd as usize].is_some()
+        self.slot(fd)
+            .is_some_and(|slot| !slot.load(Ordering::Acquire).is_null())
     }
 
     /// Get current number of allocated file descriptors
     pub fn count(&self) -> usize {
-        self.fds.iter().filter(|fd| fd.is_some()).count()
+        self.writer.lock().count
     }
 
-    fn update_next_fd(&mut self, new_fd: usize) {
-        let fds_len = self.fds.len();
-        // First try: find free fd from new_fd+1 to end
-        let next_fd = (new_fd + 1..fds_len)
-            .find(|&fd| self.fds[fd].is_none())
-            .unwrap_or_else(|| {
-                // Second try: find free fd from start to new_fd
-                (FIRST_FD..new_fd)
-                    .find(|&fd| self.fds[fd].is_none())
-                    .unwrap_or(fds_len) // If still not found, use fds_len
-            });
+    // Return the slot of `fd` if its chunk is allocated.
+    #[inline]
+    fn slot(&self, fd: c_int) -> Option<&Slot> {
+        if fd < 0 || fd as usize >= MAX_FDS {
+            return None;
+        }
+        let fd = fd as usize;
+        let chunk = self.chunks[fd / FDS_PER_CHUNK].load(Ordering::Acquire);
+        if chunk.is_null() {
+            return None;
+        }
+        // SAFETY: Chunks are never freed.
+        Some(unsafe { &(*chunk).slots[fd % FDS_PER_CHUNK] })
+    }
+
+    fn find_free(w: &Writer, from: usize) -> Option<usize> {
+        let mut i = from / FDS_PER_CHUNK;
+        let mut mask = !0u64 << (from % FDS_PER_CHUNK);
+        while i < NR_CHUNKS {
+            let free = !w.used[i] & mask;
+            if free != 0 {
+                return Some(i * FDS_PER_CHUNK + free.trailing_zeros() as usize);
+            }
+            i += 1;
+            mask = !0;
+        }
+        None
+    }
 
-        // Extend array if needed
-        if next_fd >= fds_len {
-            self.fds.resize(next_fd + 1, None);
+    fn install(&self, w: &mut Writer, fd: usize, file: Arc<dyn FileOps>) {
+        let i = fd / FDS_PER_CHUNK;
+        let mut chunk = self.chunks[i].load(Ordering::Acquire);
+        if chunk.is_null() {
+            chunk = Box::into_raw(Box::new(Chunk {
+                slots: [const { AtomicPtr::new(ptr::null_mut()) }; FDS_PER_CHUNK],
+            }));
+            self.chunks[i].store(chunk, Ordering::Release);
         }
+        let p = Box::into_raw(Box::new(file));
+        // SAFETY: Chunks are never freed.
+        let old = unsafe { (*chunk).slots[fd % FDS_PER_CHUNK].swap(p, Ordering::SeqCst) };
+        if old.is_null() {
+            w.used[i] |= 1 << (fd % FDS_PER_CHUNK);
+            w.count += 1;
+        } else {
+            w.pending.push(Retired(old));
+            self.reclaim(w);
+        }
+    }
+
+    #[inline]
+    fn read_lock(&self) -> ReadGuard<'_> {
+        let counts = &self.readers[arch::current_cpu_id()].0;
+        loop {
+            let epoch = self.epoch.load(Ordering::SeqCst);
+            let count = &counts[epoch & 1];
+            count.fetch_add(1, Ordering::SeqCst);
+            // Recheck so that the writer doesn't miss a reader that
+            // counts itself in the previous epoch.
+            if self.epoch.load(Ordering::SeqCst) == epoch {
+                return ReadGuard { count };
+            }
+            count.fetch_sub(1, Ordering::SeqCst);
+        }
+    }
+
+    // A reader might have moved to another core since it counted itself,
+    // so only the sum over all cores is meaningful.
+    fn readers_of(&self, parity: usize) -> usize {
+        self.readers.iter().fold(0usize, |sum, r| {
+            sum.wrapping_add(r.0[parity].load(Ordering::SeqCst))
+        })
+    }
 
-        self.next_fd = next_fd;
+    fn reclaim(&self, w: &mut Writer) {
+        let previous = (self.epoch.load(Ordering::SeqCst) + 1) & 1;
+        if !w.waiting.is_empty() && self.readers_of(previous) == 0 {
+            w.waiting.clear();
+        }
+        // The epoch only flips once the readers of the previous epoch
+        // left, so new readers start on a drained counter.
+        if w.waiting.is_empty() && !w.pending.is_empty() {
+            w.waiting = core::mem::take(&mut w.pending);
+            let previous = self.epoch.fetch_add(1, Ordering::SeqCst) & 1;
+            if self.readers_of(previous) == 0 {
+                w.waiting.clear();
+            }
+        }
     }
 }
 
 // Global file descriptor manager instance
 // TODO: FdManager is used for per process
-static FD_MANAGER: Once<SpinLock<FdManager>> = Once::new();
+static FD_MANAGER: FdManager = FdManager::new();
 /// Get file descriptor manager instance
-pub(crate) fn get_fd_manager() -> &'static SpinLock<FdManager> {
-    FD_MANAGER.call_once(|| SpinLock::new(FdManager::new()))
+pub(crate) fn get_fd_manager() -> &'static FdManager {
+    &FD_MANAGER
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::vfs::file::{FileAttr, OpenFlags};
+    use blueos_test_macro::test;
+
+    struct Dummy;
+
+    impl FileOps for Dummy {
+        fn stat(&self) -> FileAttr {
+            FileAttr::default()
+        }
+        fn flags(&self) -> OpenFlags {
+            OpenFlags::empty()
+        }
+        fn set_flags(&self, _flags: OpenFlags) {}
+    }
+
+    #[test]
+    fn test_fd_table_alloc_lowest() {
+        static FDS: FdManager = FdManager::new();
+        let file: Arc<dyn FileOps> = Arc::new(Dummy);
+        let a = FDS.alloc_fd(file.clone());
+        let b = FDS.alloc_fd(file.clone());
+        assert_eq!((a, b), (FIRST_FD as c_int, FIRST_FD as c_int + 1));
+        assert!(FDS.is_valid_fd(a));
+        assert_eq!(FDS.count(), 2);
+
+        // Freed fds are reused lowest first.
+        assert!(Arc::ptr_eq(&FDS.free_fd(a).unwrap(), &file));
+        assert!(FDS.free_fd(a).is_err());
+        assert!(FDS.get_file_ops(a).is_none());
+        assert_eq!(FDS.alloc_fd(file.clone()), a);
+
+        // Fds spill into a new chunk.
+        let mut fds = Vec::new();
+        for _ in 0..FDS_PER_CHUNK {
+            fds.push(FDS.alloc_fd(file.clone()));
+        }
+        assert_eq!(*fds.last().unwrap() as usize, FDS_PER_CHUNK + FIRST_FD + 1);
+        assert!(FDS.get_file_ops(*fds.last().unwrap()).is_some());
+        for fd in fds.into_iter().chain([a, b]) {
+            FDS.free_fd(fd).unwrap();
+        }
+        assert_eq!(FDS.count(), 0);
+        // All retired files are dropped with no reader around.
+        let w = FDS.writer.lock();
+        assert!(w.pending.is_empty() && w.waiting.is_empty());
+        drop(w);
+        assert_eq!(Arc::strong_count(&file), 1);
+    }
 }
@@ -14,6 +14,7 @@
 
 use crate::{
     error::{code, Error},
+    sync::poll::{PollWatch, POLLIN, POLLOUT},
     vfs::{
         dcache::Dcache,
         dirent::DirBufferReader,
@@ -156,6 +157,44 @@ pub trait FileOps: Send + Sync + Any {
         warn!("write is not implemented");
         Err(code::EINVAL)
     }
+    // Vectored I/O, stopping at the first short transfer.
+    fn readv(&self, bufs: &mut [&mut [u8]]) -> Result<usize, Error> {
+        let mut done = 0;
+        for buf in bufs.iter_mut() {
+            let n = match self.read(buf) {
+                Ok(n) => n,
+                Err(_) if done > 0 => break,
+                Err(e) => return Err(e),
+            };
+            done += n;
+            if n < buf.len() {
+                break;
+            }
+        }
+        Ok(done)
+    }
+    fn writev(&self, bufs: &[&[u8]]) -> Result<usize, Error> {
+        let mut done = 0;
+        for buf in bufs.iter() {
+            let n = match self.write(buf) {
+                Ok(n) => n,
+                Err(_) if done > 0 => break,
+                Err(e) => return Err(e),
+            };
+            done += n;
+            if n < buf.len() {
+                break;
+            }
+        }
+        Ok(done)
+    }
+    // Positional I/O, which neither uses nor moves the file offset.
+    fn read_at(&self, offset: usize, buf: &mut [u8]) -> Result<usize, Error> {
+        Err(code::ESPIPE)
+    }
+    fn write_at(&self, offset: usize, buf: &[u8]) -> Result<usize, Error> {
+        Err(code::ESPIPE)
+    }
     fn seek(&self, seek_from: SeekFrom) -> Result<usize, Error> {
         warn!("seek is not implemented");
         Err(code::ESPIPE)
@@ -178,6 +217,11 @@ pub trait FileOps: Send + Sync + Any {
         warn!("dup is not implemented");
         Err(code::EINVAL)
     }
+    // The events the file is ready for. With a watch, the file notifies
+    // it when it gets ready for more.
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        POLLIN | POLLOUT
+    }
     fn stat(&self) -> FileAttr;
     fn flags(&self) -> OpenFlags;
     fn set_flags(&self, flags: OpenFlags);
@@ -293,6 +337,53 @@ impl FileOps for File {
         Ok(ret)
     }
 
+    fn readv(&self, bufs: &mut [&mut [u8]]) -> Result<usize, Error> {
+        if !self.access_mode().is_readable() {
+            return Err(code::EACCES);
+        }
+        let mut offset = self.offset.lock();
+        let ret = self
+            .dcache
+            .inode()
+            .readv_at(*offset, bufs, self.is_nonblock())?;
+        *offset += ret;
+        Ok(ret)
+    }
+
+    fn writev(&self, bufs: &[&[u8]]) -> Result<usize, Error> {
+        if !self.access_mode().is_writable() {
+            return Err(code::EACCES);
+        }
+        let mut offset = self.offset.lock();
+        if self.open_flags().contains(OpenFlags::O_APPEND) {
+            *offset = self.dcache.size();
+        }
+        let ret = self
+            .dcache
+            .inode()
+            .writev_at(*offset, bufs, self.is_nonblock())?;
+        *offset += ret;
+        Ok(ret)
+    }
+
+    // The offset lock isn't taken, so threads sharing the file don't
+    // serialize on it.
+    fn read_at(&self, offset: usize, buf: &mut [u8]) -> Result<usize, Error> {
+        if !self.access_mode().is_readable() {
+            return Err(code::EACCES);
+        }
+        self.dcache.inode().read_at(offset, buf, self.is_nonblock())
+    }
+
+    fn write_at(&self, offset: usize, buf: &[u8]) -> Result<usize, Error> {
+        if !self.access_mode().is_writable() {
+            return Err(code::EACCES);
+        }
+        self.dcache
+            .inode()
+            .write_at(offset, buf, self.is_nonblock())
+    }
+
     fn seek(&self, pos: SeekFrom) -> Result<usize, Error> {
         let mut cur_offset = self.offset.lock();
         let new_offset: isize = match pos {
@@ -330,6 +421,10 @@ impl FileOps for File {
         self.dcache.inode().close()
     }
 
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        self.dcache.inode().poll(watch)
+    }
+
     fn resize(&self, new_size: usize) -> Result<(), Error> {
         if !self.access_mode().is_writable() {
             return Err(code::EACCES);
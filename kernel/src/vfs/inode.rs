@@ -15,11 +15,13 @@
 use crate::{
     devices::Device,
     error::{code, Error},
+    sync::poll::{PollWatch, POLLIN, POLLOUT},
     vfs::{
         dirent::DirBufferReader,
         file::FileAttr,
         fs::FileSystem,
         inode_mode::{mode_t, InodeFileType, InodeMode},
+        mmap::MmapMemory,
     },
 };
 use alloc::{string::String, sync::Arc};
@@ -112,6 +114,43 @@ pub trait InodeOps: Any + Sync + Send {
         warn!("write_at is not implemented");
         Err(code::EINVAL)
     }
+    // Vectored I/O from `offset`, stopping at the first short transfer.
+    // Inodes override these to serve all buffers under one lock.
+    fn readv_at(
+        &self,
+        offset: usize,
+        bufs: &mut [&mut [u8]],
+        nonblock: bool,
+    ) -> Result<usize, Error> {
+        let mut done = 0;
+        for buf in bufs.iter_mut() {
+            let n = match self.read_at(offset + done, buf, nonblock) {
+                Ok(n) => n,
+                Err(_) if done > 0 => break,
+                Err(e) => return Err(e),
+            };
+            done += n;
+            if n < buf.len() {
+                break;
+            }
+        }
+        Ok(done)
+    }
+    fn writev_at(&self, offset: usize, bufs: &[&[u8]], nonblock: bool) -> Result<usize, Error> {
+        let mut done = 0;
+        for buf in bufs.iter() {
+            let n = match self.write_at(offset + done, buf, nonblock) {
+                Ok(n) => n,
+                Err(_) if done > 0 => break,
+                Err(e) => return Err(e),
+            };
+            done += n;
+            if n < buf.len() {
+                break;
+            }
+        }
+        Ok(done)
+    }
     fn link(&self, old: &Arc<dyn InodeOps>, name: &str) -> Result<(), Error> {
         warn!("link is not implemented");
         Err(code::ENOTDIR)
@@ -172,6 +211,15 @@ pub trait InodeOps: Any + Sync + Send {
     fn fsync(&self) -> Result<(), Error> {
         Ok(())
     }
+    // Memory to map `len` bytes of the file from `offset` in place.
+    // None means the file is mapped with a copy of its contents.
+    fn mmap(&self, offset: usize, len: usize, shared: bool) -> Result<Option<MmapMemory>, Error> {
+        Ok(None)
+    }
+    // Regular files are always ready, devices tell.
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        POLLIN | POLLOUT
+    }
     fn lookup(&self, name: &str) -> Result<Arc<dyn InodeOps>, Error> {
         warn!("lookup is not implemented");
         Err(code::ENOTDIR)
@@ -183,6 +231,11 @@ pub trait InodeOps: Any + Sync + Send {
     fn is_dcacheable(&self) -> bool {
         true
     }
+    // Whether a failed lookup may be cached, i.e., names can't appear
+    // without going through the dcache.
+    fn is_negative_dcacheable(&self) -> bool {
+        self.is_dcacheable()
+    }
     fn fs(&self) -> Option<Arc<dyn FileSystem>>;
     fn ino(&self) -> InodeNo;
     fn type_(&self) -> InodeFileType;
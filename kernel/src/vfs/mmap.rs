@@ -0,0 +1,434 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Memory mappings of files. The kernel runs without paging, so a mapping
+// is a physically contiguous extent of pages set up at mmap time rather
+// than faulted in page by page.
+//
+// A file system with its own page store, i.e., tmpfs, moves the pages
+// of the range into the extent and keeps using them, so the file and its
+// shared mappings are the same memory. A device might expose its memory,
+// e.g., a framebuffer, which is mapped in place. Other files, e.g., on
+// FAT, are mapped with a copy read through the block cache. A shared
+// writable copy is written back on msync, fsync and munmap. There is no
+// dirty tracking without paging, so the whole range within the file is
+// written back.
+
+use crate::{
+    error::{code, Error},
+    sync::SpinLock,
+    vfs::inode::InodeOps,
+};
+use alloc::{
+    alloc::{alloc_zeroed, dealloc, handle_alloc_error},
+    sync::Arc,
+    vec::Vec,
+};
+use core::{
+    alloc::Layout,
+    cmp::min,
+    fmt::{self, Debug},
+    ptr::NonNull,
+    slice,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+pub(crate) const PAGE_SIZE: usize = 4096;
+
+pub(crate) const PROT_WRITE: i32 = 0x2;
+pub(crate) const MAP_SHARED: i32 = 0x01;
+pub(crate) const MAP_PRIVATE: i32 = 0x02;
+pub(crate) const MAP_FIXED: i32 = 0x10;
+pub(crate) const MAP_ANONYMOUS: i32 = 0x20;
+pub(crate) const MS_ASYNC: i32 = 1;
+pub(crate) const MS_INVALIDATE: i32 = 2;
+pub(crate) const MS_SYNC: i32 = 4;
+
+/// Physically contiguous pages, zeroed on allocation.
+pub(crate) struct Extent {
+    ptr: NonNull<u8>,
+    nr_pages: usize,
+    // Mappings of the extent alive.
+    mappings: AtomicUsize,
+}
+
+// SAFETY: The extent owns its memory, accesses to the contents are
+// synchronized by its users.
+unsafe impl Send for Extent {}
+unsafe impl Sync for Extent {}
+
+impl Extent {
+    fn layout(nr_pages: usize) -> Option<Layout> {
+        let size = nr_pages.checked_mul(PAGE_SIZE)?;
+        Layout::from_size_align(size, PAGE_SIZE).ok()
+    }
+
+    pub fn new(nr_pages: usize) -> Result<Arc<Self>, Error> {
+        let layout = Self::layout(nr_pages.max(1)).ok_or(code::ENOMEM)?;
+        // SAFETY: The layout has a non-zero size.
+        let ptr = NonNull::new(unsafe { alloc_zeroed(layout) }).ok_or(code::ENOMEM)?;
+        Ok(Arc::new(Self {
+            ptr,
+            nr_pages: nr_pages.max(1),
+            mappings: AtomicUsize::new(0),
+        }))
+    }
+
+    #[inline]
+    pub fn as_ptr(&self) -> *mut u8 {
+        self.ptr.as_ptr()
+    }
+
+    #[inline]
+    pub fn nr_pages(&self) -> usize {
+        self.nr_pages
+    }
+
+    #[inline]
+    pub fn is_mapped(&self) -> bool {
+        self.mappings.load(Ordering::Relaxed) != 0
+    }
+
+    #[inline]
+    fn as_slice(&self) -> &[u8] {
+        // SAFETY: The extent is allocated with this size.
+        unsafe { slice::from_raw_parts(self.as_ptr(), self.nr_pages * PAGE_SIZE) }
+    }
+}
+
+impl Drop for Extent {
+    fn drop(&mut self) {
+        // SAFETY: The memory is allocated with the same layout.
+        unsafe { dealloc(self.as_ptr(), Self::layout(self.nr_pages).unwrap()) };
+    }
+}
+
+/// A page of a file, which is a page of an extent. The extent might be
+/// mapped, then the contents change under the file.
+#[derive(Clone)]
+pub(crate) struct Page {
+    extent: Arc<Extent>,
+    index: usize,
+}
+
+impl Page {
+    /// Allocate a zeroed page, abort on OOM like Box does.
+    pub fn new() -> Self {
+        let Ok(extent) = Extent::new(1) else {
+            handle_alloc_error(Extent::layout(1).unwrap());
+        };
+        Self { extent, index: 0 }
+    }
+
+    /// Page `index` of `extent`.
+    pub fn of(extent: &Arc<Extent>, index: usize) -> Self {
+        assert!(index < extent.nr_pages);
+        Self {
+            extent: extent.clone(),
+            index,
+        }
+    }
+
+    #[inline]
+    pub fn extent(&self) -> &Arc<Extent> {
+        &self.extent
+    }
+
+    #[inline]
+    pub fn is(&self, extent: &Arc<Extent>, index: usize) -> bool {
+        Arc::ptr_eq(&self.extent, extent) && self.index == index
+    }
+
+    #[inline]
+    fn as_ptr(&self) -> *mut u8 {
+        // SAFETY: The page is within the extent.
+        unsafe { self.extent.as_ptr().add(self.index * PAGE_SIZE) }
+    }
+
+    #[inline]
+    pub fn as_slice(&self) -> &[u8] {
+        // SAFETY: The page is within the extent.
+        unsafe { slice::from_raw_parts(self.as_ptr(), PAGE_SIZE) }
+    }
+
+    #[inline]
+    pub fn as_mut_slice(&mut self) -> &mut [u8] {
+        // SAFETY: The page is within the extent, and no other page of the
+        // file refers to it.
+        unsafe { slice::from_raw_parts_mut(self.as_ptr(), PAGE_SIZE) }
+    }
+}
+
+impl Debug for Page {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        f.debug_struct("Page")
+            .field("addr", &self.as_ptr())
+            .finish()
+    }
+}
+
+/// Memory a file maps in place, returned by InodeOps::mmap.
+pub(crate) enum MmapMemory {
+    // Pages the file keeps using
+    Pages(Arc<Extent>),
+    // Device memory at the address
+    Device(usize),
+}
+
+enum Backing {
+    Shared(Arc<Extent>),
+    Copy(Arc<Extent>),
+    Device(usize),
+}
+
+struct Mapping {
+    addr: usize,
+    len: usize,
+    backing: Backing,
+    // The file mapped and the offset of the mapping in it
+    file: Option<(Arc<dyn InodeOps>, usize)>,
+    // Whether the copy is written back to the file
+    write_back: bool,
+}
+
+impl Mapping {
+    fn new(
+        len: usize,
+        backing: Backing,
+        file: Option<(Arc<dyn InodeOps>, usize)>,
+        write_back: bool,
+    ) -> Self {
+        let addr = match &backing {
+            Backing::Shared(extent) | Backing::Copy(extent) => {
+                extent.mappings.fetch_add(1, Ordering::Relaxed);
+                extent.as_ptr() as usize
+            }
+            Backing::Device(addr) => *addr,
+        };
+        Self {
+            addr,
+            len,
+            backing,
+            file,
+            write_back,
+        }
+    }
+
+    #[inline]
+    fn overlaps(&self, addr: usize, len: usize) -> bool {
+        self.addr < addr + len && addr < self.addr + self.len
+    }
+
+    // Write [from, from + len) of the mapping back within the file.
+    fn write_back(&self, from: usize, len: usize) -> Result<(), Error> {
+        let (Backing::Copy(extent), Some((inode, offset))) = (&self.backing, &self.file) else {
+            return Ok(());
+        };
+        if !self.write_back {
+            return Ok(());
+        }
+        let pos = offset + from;
+        let size = inode.size();
+        if pos >= size {
+            return Ok(());
+        }
+        let end = min(from + len, from + size - pos);
+        let mut buf = &extent.as_slice()[from..end];
+        let mut pos = pos;
+        while !buf.is_empty() {
+            let n = inode.write_at(pos, buf, false)?;
+            if n == 0 {
+                return Err(code::EIO);
+            }
+            buf = &buf[n..];
+            pos += n;
+        }
+        Ok(())
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        if let Backing::Shared(extent) | Backing::Copy(extent) = &self.backing {
+            extent.mappings.fetch_sub(1, Ordering::Relaxed);
+        }
+    }
+}
+
+// Mappings are shared with the writers writing them back unlocked, so
+// that they stay in the table meanwhile.
+static MAPPINGS: SpinLock<Vec<Arc<Mapping>>> = SpinLock::new(Vec::new());
+
+// Fill `extent` with the contents of the file from `offset`.
+fn read_in(inode: &Arc<dyn InodeOps>, offset: usize, extent: &Extent) -> Result<(), Error> {
+    // SAFETY: The extent isn't mapped yet.
+    let buf = unsafe { slice::from_raw_parts_mut(extent.as_ptr(), extent.nr_pages * PAGE_SIZE) };
+    let mut done = 0;
+    while done < buf.len() {
+        let n = inode.read_at(offset + done, &mut buf[done..], false)?;
+        if n == 0 {
+            break;
+        }
+        done += n;
+    }
+    Ok(())
+}
+
+/// Map `len` bytes of `file` from the offset, or anonymous memory if
+/// `file` is None. Return the address of the mapping.
+pub(crate) fn map(
+    file: Option<(Arc<dyn InodeOps>, usize)>,
+    len: usize,
+    shared: bool,
+    writable: bool,
+) -> Result<usize, Error> {
+    let nr_pages = len
+        .checked_next_multiple_of(PAGE_SIZE)
+        .ok_or(code::ENOMEM)?
+        / PAGE_SIZE;
+    let len = nr_pages * PAGE_SIZE;
+    let mapping = match file {
+        None => Mapping::new(len, Backing::Copy(Extent::new(nr_pages)?), None, false),
+        Some((inode, offset)) => match inode.mmap(offset, len, shared)? {
+            Some(MmapMemory::Pages(extent)) => {
+                debug_assert!(extent.nr_pages() >= nr_pages);
+                Mapping::new(len, Backing::Shared(extent), Some((inode, offset)), false)
+            }
+            Some(MmapMemory::Device(addr)) => {
+                Mapping::new(len, Backing::Device(addr), Some((inode, offset)), false)
+            }
+            None => {
+                let extent = Extent::new(nr_pages)?;
+                read_in(&inode, offset, &extent)?;
+                Mapping::new(
+                    len,
+                    Backing::Copy(extent),
+                    Some((inode, offset)),
+                    shared && writable,
+                )
+            }
+        },
+    };
+    let addr = mapping.addr;
+    MAPPINGS.irqsave_lock().push(Arc::new(mapping));
+    Ok(addr)
+}
+
+/// Unmap the mapping at `addr`, which must be unmapped as a whole.
+pub(crate) fn unmap(addr: usize, len: usize) -> Result<(), Error> {
+    let len = len
+        .checked_next_multiple_of(PAGE_SIZE)
+        .ok_or(code::EINVAL)?;
+    let mapping = {
+        let mut mappings = MAPPINGS.irqsave_lock();
+        let i = mappings
+            .iter()
+            .position(|m| m.addr == addr && m.len == len)
+            .ok_or(code::EINVAL)?;
+        mappings.swap_remove(i)
+    };
+    // Written back and freed with mappings unlocked, since writing might
+    // sleep. A writer still writing it back keeps the memory meanwhile.
+    mapping.write_back(0, mapping.len)
+}
+
+// Write back the part of a mapping within [addr, addr + len), where the
+// mapping is found by `select`. Return whether any mapping is selected.
+fn write_back_where<F>(select: F, addr: usize, len: usize, sync: bool) -> Result<bool, Error>
+where
+    F: Fn(&Mapping) -> bool,
+{
+    // Pin the mappings to write them back unlocked, so that they can be
+    // unmapped or synced by others meanwhile without being freed under
+    // the writer.
+    let selected: Vec<Arc<Mapping>> = MAPPINGS
+        .irqsave_lock()
+        .iter()
+        .filter(|m| select(m))
+        .cloned()
+        .collect();
+    let found = !selected.is_empty();
+    let mut result = Ok(());
+    for m in selected.iter() {
+        let from = addr.saturating_sub(m.addr);
+        let to = min(m.len, (addr + len).saturating_sub(m.addr));
+        result = result.and(m.write_back(from, to - from));
+        if sync {
+            if let Some((inode, _)) = &m.file {
+                result = result.and(inode.fsync());
+            }
+        }
+    }
+    result.map(|_| found)
+}
+
+/// Write back mappings within [addr, addr + len).
+pub(crate) fn sync(addr: usize, len: usize, flags: i32) -> Result<(), Error> {
+    if addr % PAGE_SIZE != 0
+        || flags & !(MS_ASYNC | MS_SYNC | MS_INVALIDATE) != 0
+        || flags & MS_ASYNC != 0 && flags & MS_SYNC != 0
+    {
+        return Err(code::EINVAL);
+    }
+    let end = addr.checked_add(len).ok_or(code::ENOMEM)?;
+    // Copies are written back synchronously either way, MS_SYNC also
+    // syncs the file.
+    let found = write_back_where(
+        |m| m.overlaps(addr, len),
+        addr,
+        end - addr,
+        flags & MS_SYNC != 0,
+    )?;
+    if !found && len != 0 {
+        return Err(code::ENOMEM);
+    }
+    Ok(())
+}
+
+/// Write back all mappings of `inode`, before the file is synced.
+pub(crate) fn sync_inode(inode: &Arc<dyn InodeOps>) -> Result<(), Error> {
+    let ptr = Arc::as_ptr(inode) as *const ();
+    write_back_where(
+        |m| {
+            m.write_back
+                && m.file
+                    .as_ref()
+                    .is_some_and(|(i, _)| Arc::as_ptr(i) as *const () == ptr)
+        },
+        0,
+        usize::MAX,
+        false,
+    )
+    .map(|_| ())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_mmap_anonymous() {
+        let addr = map(None, PAGE_SIZE + 1, false, true).unwrap();
+        assert_eq!(addr % PAGE_SIZE, 0);
+        // SAFETY: Two pages are mapped at addr.
+        let mem = unsafe { slice::from_raw_parts_mut(addr as *mut u8, 2 * PAGE_SIZE) };
+        assert!(mem.iter().all(|&b| b == 0));
+        mem.fill(0x5a);
+        assert_eq!(unmap(addr, PAGE_SIZE), Err(code::EINVAL));
+        assert_eq!(sync(addr, PAGE_SIZE, MS_SYNC), Ok(()));
+        assert_eq!(unmap(addr, 2 * PAGE_SIZE), Ok(()));
+        assert_eq!(sync(addr, PAGE_SIZE, MS_SYNC), Err(code::ENOMEM));
+    }
+}
@@ -26,8 +26,10 @@ use crate::{
 use log::{debug, error, warn};
 
 mod dcache;
+mod dentry_table;
 mod devfs;
 pub mod dirent;
+mod epoll;
 #[cfg(virtio)]
 mod fatfs;
 mod fd_manager;
@@ -35,6 +37,7 @@ mod file;
 mod fs;
 mod inode;
 mod inode_mode;
+pub(crate) mod mmap;
 mod mount;
 mod path;
 #[cfg(procfs)]
@@ -72,7 +75,7 @@ pub fn vfs_init() -> Result<(), Error> {
     devfs::init()?;
 
     debug!("init stdio");
-    let mut fd_manager = get_fd_manager().lock();
+    let fd_manager = get_fd_manager();
     fd_manager.init_stdio()?;
 
     #[cfg(virtio)]
@@ -17,6 +17,7 @@ use crate::{
     error::{code, Error},
     vfs::{
         dcache::Dcache,
+        dentry_table,
         file::{AccessMode, File, OpenFlags},
         inode_mode::{mode_t, InodeFileType, InodeMode},
         root::get_root_dir,
@@ -266,7 +267,24 @@ pub fn is_valid_path(path: &str) -> bool {
     true
 }
 
+// Walk again if a rename or an unlink raced with the walk, so the result
+// doesn't mix names from before and after the change. Give up retrying
+// under a storm of renames, a walk racing with them is as good as any.
+const MAX_WALK_RETRIES: usize = 4;
+
 fn lookup_in_dir(dir: &Arc<Dcache>, path: &str) -> Option<Arc<Dcache>> {
+    let mut retries = 0;
+    loop {
+        let seq = dentry_table::read_begin();
+        let result = walk_in_dir(dir, path);
+        if retries == MAX_WALK_RETRIES || !dentry_table::read_retry(seq) {
+            return result;
+        }
+        retries += 1;
+    }
+}
+
+fn walk_in_dir(dir: &Arc<Dcache>, path: &str) -> Option<Arc<Dcache>> {
     // TODO: add support for symlink
     let mut current = dir.clone();
     let mut cur_path = path;
@@ -376,4 +394,26 @@ mod tests {
         // Edge cases
         assert_eq!(join_path("", "bin"), Some("bin".to_string()));
     }
+
+    #[test]
+    fn test_lookup_cached_dentries() {
+        let root = get_root_dir();
+        // The miss is cached, but must not hide the file created later.
+        assert!(lookup_path("/dentry_test").is_none());
+        assert!(lookup_path("/dentry_test").is_none());
+        let mode = InodeMode::from_bits_truncate(0o644);
+        let file = root
+            .new_child("dentry_test", InodeFileType::Regular, mode, || None)
+            .unwrap();
+        let found = lookup_path("/dentry_test").unwrap();
+        assert!(Arc::ptr_eq(&file, &found));
+
+        root.link(&file, "dentry_test2").unwrap();
+        root.unlink("dentry_test").unwrap();
+        assert!(lookup_path("/dentry_test").is_none());
+        assert!(lookup_path("/dentry_test2").is_some());
+
+        root.unlink("dentry_test2").unwrap();
+        assert!(lookup_path("/dentry_test2").is_none());
+    }
 }
@@ -0,0 +1,91 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::{allocator, error::Error, time, vfs::procfs::ProcFileOps};
+use alloc::{string::String, vec::Vec};
+use blueos_kconfig::TICKS_PER_SECOND;
+use core::fmt::Write;
+
+pub(crate) struct AllocStat;
+
+impl ProcFileOps for AllocStat {
+    fn get_content(&self) -> Result<Vec<u8>, Error> {
+        let stats = allocator::alloc_stats();
+        let meminfo = allocator::memory_info();
+        // Rates are averaged since boot.
+        let seconds = (time::get_sys_ticks() / TICKS_PER_SECOND).max(1);
+        let mut result = String::with_capacity(64 * (allocator::NR_ALLOC_CLASSES + 8));
+        writeln!(
+            result,
+            "{:<10}{:>12}{:>12}{:>10}{:>10}{:>10}",
+            "# size", "allocs", "frees", "allocs/s", "frees/s", "failures"
+        )
+        .unwrap();
+        let last = stats.classes.len() - 1;
+        for (i, c) in stats.classes.iter().enumerate() {
+            if c.allocs == 0 && c.failures == 0 {
+                continue;
+            }
+            let size = if i == last {
+                String::from("larger")
+            } else {
+                alloc::format!("<={}", c.size)
+            };
+            writeln!(
+                result,
+                "{:<10}{:>12}{:>12}{:>10}{:>10}{:>10}",
+                size,
+                c.allocs,
+                c.frees,
+                c.allocs / seconds,
+                c.frees / seconds,
+                c.failures
+            )
+            .unwrap();
+        }
+        writeln!(result, "{:<16}{:>12}", "Live:", stats.live).unwrap();
+        writeln!(result, "{:<16}{:>12}", "Peak:", stats.peak).unwrap();
+        writeln!(result, "{:<16}{:>12}", "HeapUsed:", meminfo.used).unwrap();
+        writeln!(result, "{:<16}{:>12}", "HeapMaxUsed:", meminfo.max_used).unwrap();
+        // Bytes handed out by the heap beyond the requested ones, padding
+        // and cached blocks included.
+        writeln!(
+            result,
+            "{:<16}{:>12}",
+            "Overhead:",
+            meminfo.used.saturating_sub(stats.live)
+        )
+        .unwrap();
+        writeln!(result, "{:<16}{:>12}", "FragFailures:", stats.frag_failures).unwrap();
+        #[cfg(allocator = "buddy")]
+        writeln!(
+            result,
+            "{:<16}{:>10} %",
+            "PagesFrag:",
+            meminfo.pages.fragmentation()
+        )
+        .unwrap();
+        writeln!(
+            result,
+            "{:<16}{:>12} cycles, {} bytes",
+            "Slowest:", stats.slowest_cycles, stats.slowest_size
+        )
+        .unwrap();
+        Ok(result.as_bytes().to_vec())
+    }
+
+    fn set_content(&self, content: Vec<u8>) -> Result<usize, Error> {
+        Ok(0)
+    }
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::{error::Error, sync, vfs::procfs::ProcFileOps};
+use alloc::{format, string::String, vec::Vec};
+use core::fmt::Write;
+
+pub(crate) struct LockStat;
+
+impl ProcFileOps for LockStat {
+    fn get_content(&self) -> Result<Vec<u8>, Error> {
+        let sites = sync::lock_sites();
+        let mut result = String::with_capacity(96 * (sites.len() + 2));
+        writeln!(
+            result,
+            "{:<40}{:>12}{:>12}{:>12}{:>12}{:>12}",
+            "# site", "acquired", "contended", "spins", "max_hold", "max_irqoff"
+        )
+        .unwrap();
+        for s in sites.iter() {
+            writeln!(
+                result,
+                "{:<40}{:>12}{:>12}{:>12}{:>12}{:>12}",
+                format!("{}:{}", s.location.file(), s.location.line()),
+                s.acquisitions,
+                s.contentions,
+                s.spins,
+                s.max_hold_cycles,
+                s.max_irq_off_cycles
+            )
+            .unwrap();
+        }
+        writeln!(result, "# overflow {}", sync::lock_sites_overflow()).unwrap();
+        Ok(result.as_bytes().to_vec())
+    }
+
+    fn set_content(&self, content: Vec<u8>) -> Result<usize, Error> {
+        Ok(0)
+    }
+}
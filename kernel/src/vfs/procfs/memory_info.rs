@@ -34,6 +34,39 @@ impl ProcFileOps for MemoryInfo {
             meminfo.max_used / 1024
         )
         .unwrap();
+        #[cfg(allocator = "buddy")]
+        {
+            let pages = &meminfo.pages;
+            writeln!(result, "{:<14}{:>8}", "PagesFree:", pages.free_pages).unwrap();
+            writeln!(result, "{:<14}{:>8} %", "PagesFrag:", pages.fragmentation()).unwrap();
+            write!(result, "{:<14}", "BuddyFree:").unwrap();
+            for n in pages.free_blocks.iter() {
+                write!(result, " {}", n).unwrap();
+            }
+            writeln!(result).unwrap();
+        }
+        #[cfg(allocator_magazine)]
+        {
+            writeln!(
+                result,
+                "{:<14}{:>8} kB",
+                "MemCached:",
+                meminfo.cached / 1024
+            )
+            .unwrap();
+            for m in meminfo.magazines.iter() {
+                writeln!(
+                    result,
+                    "{:<14}hits {} misses {} flushes {} cached {}",
+                    format!("Magazine{}:", m.size),
+                    m.hits,
+                    m.misses,
+                    m.flushes,
+                    m.cached
+                )
+                .unwrap();
+            }
+        }
         Ok(result.as_bytes().to_vec())
     }
 
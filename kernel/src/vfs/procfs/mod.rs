@@ -12,13 +12,33 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#[cfg(alloc_stats)]
+mod allocstat;
+#[cfg(lock_stats)]
+mod lockstat;
 mod memory_info;
+#[cfg(profiler)]
+mod profile;
+#[cfg(kmem_cache)]
+mod slabinfo;
 mod stat;
 mod task;
+#[cfg(sched_trace)]
+mod trace;
 
+#[cfg(alloc_stats)]
+use allocstat::AllocStat;
+#[cfg(lock_stats)]
+use lockstat::LockStat;
 use memory_info::MemoryInfo;
+#[cfg(profiler)]
+use profile::Profile;
+#[cfg(kmem_cache)]
+use slabinfo::SlabInfo;
 use stat::SystemStat;
 use task::ProcTaskFile;
+#[cfg(sched_trace)]
+use trace::SchedTrace;
 
 use crate::{
     devices::Device,
@@ -136,6 +156,16 @@ impl ProcFileSystem {
 
         self.root.create_meminfo_file("meminfo")?;
         self.root.create_stat_file("stat")?;
+        #[cfg(kmem_cache)]
+        self.root.create_slabinfo_file("slabinfo")?;
+        #[cfg(sched_trace)]
+        self.root.create_trace_file("trace")?;
+        #[cfg(lock_stats)]
+        self.root.create_lockstat_file("lockstat")?;
+        #[cfg(alloc_stats)]
+        self.root.create_allocstat_file("allocstat")?;
+        #[cfg(profiler)]
+        self.root.create_profile_file("profile")?;
 
         // not support process yet, use thread info instead. and put all threads in /proc
         let mut global_queue_visitor = GlobalQueueVisitor::new();
@@ -274,6 +304,65 @@ impl ProcDir {
         Ok(inode)
     }
 
+    #[cfg(kmem_cache)]
+    pub fn create_slabinfo_file(&self, name: &str) -> Result<Arc<dyn InodeOps>, Error> {
+        if name.len() > NAME_MAX {
+            return Err(code::ENAMETOOLONG);
+        }
+        let ino = self.base.fs.upgrade().unwrap().alloc_inode_no();
+        let inode =
+            ProcFile::new(SlabInfo {}, ino, self.base.fs.clone(), true) as Arc<dyn InodeOps>;
+        self.insert(name, inode.clone());
+        Ok(inode)
+    }
+
+    #[cfg(sched_trace)]
+    pub fn create_trace_file(&self, name: &str) -> Result<Arc<dyn InodeOps>, Error> {
+        if name.len() > NAME_MAX {
+            return Err(code::ENAMETOOLONG);
+        }
+        let ino = self.base.fs.upgrade().unwrap().alloc_inode_no();
+        let inode =
+            ProcFile::new(SchedTrace {}, ino, self.base.fs.clone(), true) as Arc<dyn InodeOps>;
+        self.insert(name, inode.clone());
+        Ok(inode)
+    }
+
+    #[cfg(lock_stats)]
+    pub fn create_lockstat_file(&self, name: &str) -> Result<Arc<dyn InodeOps>, Error> {
+        if name.len() > NAME_MAX {
+            return Err(code::ENAMETOOLONG);
+        }
+        let ino = self.base.fs.upgrade().unwrap().alloc_inode_no();
+        let inode =
+            ProcFile::new(LockStat {}, ino, self.base.fs.clone(), true) as Arc<dyn InodeOps>;
+        self.insert(name, inode.clone());
+        Ok(inode)
+    }
+
+    #[cfg(alloc_stats)]
+    pub fn create_allocstat_file(&self, name: &str) -> Result<Arc<dyn InodeOps>, Error> {
+        if name.len() > NAME_MAX {
+            return Err(code::ENAMETOOLONG);
+        }
+        let ino = self.base.fs.upgrade().unwrap().alloc_inode_no();
+        let inode =
+            ProcFile::new(AllocStat {}, ino, self.base.fs.clone(), true) as Arc<dyn InodeOps>;
+        self.insert(name, inode.clone());
+        Ok(inode)
+    }
+
+    #[cfg(profiler)]
+    pub fn create_profile_file(&self, name: &str) -> Result<Arc<dyn InodeOps>, Error> {
+        if name.len() > NAME_MAX {
+            return Err(code::ENAMETOOLONG);
+        }
+        let ino = self.base.fs.upgrade().unwrap().alloc_inode_no();
+        let inode = ProcFile::new(Profile {}, ino, self.base.fs.clone(), true) as Arc<dyn InodeOps>;
+        self.insert(name, inode.clone());
+        Ok(inode)
+    }
+
     pub fn create_dir(&self, name: &str, is_dcacheable: bool) -> Result<Arc<Self>, Error> {
         if name.len() > NAME_MAX {
             return Err(code::ENAMETOOLONG);
@@ -402,6 +491,11 @@ impl InodeOps for ProcDir {
         Err(code::EPERM)
     }
 
+    // Entries of tasks are added and removed behind the dcache.
+    fn is_negative_dcacheable(&self) -> bool {
+        false
+    }
+
     delegate! {
         to self.base {
             fn inode_attr(&self) -> InodeAttr;
@@ -0,0 +1,59 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::{error::Error, time::profile, vfs::procfs::ProcFileOps};
+use alloc::{string::String, vec::Vec};
+use blueos_kconfig::NUM_CORES;
+use core::fmt::Write;
+
+// Samples held on all cores counted by pc, most frequent first. The pcs
+// are left to be symbolized with the kernel image, by addr2line.
+pub(crate) struct Profile;
+
+impl ProcFileOps for Profile {
+    fn get_content(&self) -> Result<Vec<u8>, Error> {
+        let mut pcs = Vec::new();
+        let mut result = String::with_capacity(256);
+        for cpu in 0..NUM_CORES {
+            let (samples, taken) = profile::samples(cpu);
+            writeln!(
+                result,
+                "# cpu{} {} held {} taken",
+                cpu,
+                samples.len(),
+                taken
+            )
+            .unwrap();
+            pcs.extend(samples);
+        }
+        pcs.sort_unstable();
+        let mut counts: Vec<(usize, usize)> = Vec::new();
+        for pc in pcs.iter() {
+            match counts.last_mut() {
+                Some((last, n)) if last == pc => *n += 1,
+                _ => counts.push((*pc, 1)),
+            }
+        }
+        counts.sort_unstable_by(|a, b| b.1.cmp(&a.1));
+        result.reserve(32 * counts.len());
+        for (pc, n) in counts.iter() {
+            writeln!(result, "{:>8} {:>3}% {:#x}", n, n * 100 / pcs.len(), pc).unwrap();
+        }
+        Ok(result.as_bytes().to_vec())
+    }
+
+    fn set_content(&self, content: Vec<u8>) -> Result<usize, Error> {
+        Ok(0)
+    }
+}
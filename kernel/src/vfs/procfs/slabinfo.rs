@@ -0,0 +1,50 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::{allocator, error::Error, vfs::procfs::ProcFileOps};
+use alloc::{string::String, vec::Vec};
+use core::fmt::Write;
+
+pub(crate) struct SlabInfo;
+
+impl ProcFileOps for SlabInfo {
+    fn get_content(&self) -> Result<Vec<u8>, Error> {
+        let caches = allocator::kmem_cache_info();
+        let mut result = String::with_capacity(64 * (caches.len() + 1));
+        writeln!(
+            result,
+            "{:<16}{:>10}{:>10}{:>10}{:>10}{:>8}",
+            "# name", "active", "total", "objsize", "slabsize", "slabs"
+        )
+        .unwrap();
+        for c in caches.iter() {
+            writeln!(
+                result,
+                "{:<16}{:>10}{:>10}{:>10}{:>10}{:>8}",
+                c.name,
+                c.active_objects,
+                c.slabs * c.objects_per_slab,
+                c.object_size,
+                c.slab_size,
+                c.slabs
+            )
+            .unwrap();
+        }
+        Ok(result.as_bytes().to_vec())
+    }
+
+    fn set_content(&self, content: Vec<u8>) -> Result<usize, Error> {
+        Ok(0)
+    }
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2025 vivo Mobile Communication Co., Ltd.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+use crate::{error::Error, scheduler::trace, vfs::procfs::ProcFileOps};
+use alloc::{string::String, vec::Vec};
+use blueos_kconfig::NUM_CORES;
+use core::fmt::Write;
+
+// Events of all cores merged by time, then the wakeup to run latency
+// histograms of the priorities having any.
+pub(crate) struct SchedTrace;
+
+impl ProcFileOps for SchedTrace {
+    fn get_content(&self) -> Result<Vec<u8>, Error> {
+        let mut events: Vec<(usize, trace::Event)> = (0..NUM_CORES)
+            .flat_map(|cpu| trace::events(cpu).into_iter().map(move |e| (cpu, e)))
+            .collect();
+        events.sort_by_key(|(_, e)| e.cycles);
+        let mut result = String::with_capacity(48 * (events.len() + 1));
+        writeln!(
+            result,
+            "# {:<4}{:>20} {:<12}{:>20}{:>20}",
+            "cpu", "cycles", "event", "a", "b"
+        )
+        .unwrap();
+        for (cpu, e) in events.iter() {
+            writeln!(
+                result,
+                "  {:<4}{:>20} {:<12}{:>#20x}{:>#20x}",
+                cpu,
+                e.cycles,
+                e.kind.name(),
+                e.a,
+                e.b
+            )
+            .unwrap();
+        }
+        writeln!(result, "# wakeup to run latency, cycles < 2^bucket: count").unwrap();
+        for priority in 0..trace::nr_priorities() {
+            let counts = trace::latencies(priority);
+            if counts.iter().all(|n| *n == 0) {
+                continue;
+            }
+            write!(result, "prio {:>3}:", priority).unwrap();
+            for (bucket, n) in counts.iter().enumerate().filter(|(_, n)| **n != 0) {
+                write!(result, " {}:{}", bucket, n).unwrap();
+            }
+            writeln!(result).unwrap();
+        }
+        Ok(result.into_bytes())
+    }
+
+    fn set_content(&self, content: Vec<u8>) -> Result<usize, Error> {
+        Ok(0)
+    }
+}
@@ -15,6 +15,7 @@
 use crate::{
     error::{code, Error},
     net::connection::Connection,
+    sync::poll::{PollWatch, POLLERR},
     vfs::{
         fd_manager::get_fd_manager,
         file::{FileAttr, FileOps, OpenFlags},
@@ -24,7 +25,7 @@ use crate::{
         utils::SeekFrom,
     },
 };
-use alloc::{boxed::Box, sync::Arc};
+use alloc::{boxed::Box, sync::Arc, vec::Vec};
 use core::sync::atomic::{AtomicI32, Ordering};
 use log::{debug, warn};
 use spin::Mutex;
@@ -140,6 +141,87 @@ impl FileOps for SocketFile {
         }
     }
 
+    // A vectored message is moved by a single closure, i.e., one
+    // round trip to the network stack for all of its parts.
+    fn readv(&self, bufs: &mut [&mut [u8]]) -> Result<usize, Error> {
+        let Some(socket) = self.socket() else {
+            warn!("SocketFile: No socket for readv operation.");
+            return Err(code::EINVAL);
+        };
+        let parts: Vec<(usize, usize)> = bufs
+            .iter_mut()
+            .map(|buf| (buf.as_mut_ptr() as usize, buf.len()))
+            .collect();
+        let f = move |net_buffer: &mut [u8]| -> (usize, usize) {
+            let mut copied = 0;
+            for (addr, len) in parts {
+                let n = len.min(net_buffer.len() - copied);
+                unsafe {
+                    core::ptr::copy_nonoverlapping(
+                        net_buffer[copied..].as_ptr(),
+                        addr as *mut u8,
+                        n,
+                    );
+                }
+                copied += n;
+                if copied == net_buffer.len() {
+                    break;
+                }
+            }
+            (copied, copied)
+        };
+
+        match socket.recv(Box::new(f)) {
+            Ok(recv_size) => Ok(recv_size),
+            Err(e) => {
+                warn!("SocketFile readv: connection.recv {}", e);
+                Err(code::ERROR)
+            }
+        }
+    }
+
+    fn writev(&self, bufs: &[&[u8]]) -> Result<usize, Error> {
+        let Some(socket) = self.socket() else {
+            warn!("SocketFile: No socket for writev operation.");
+            return Err(code::EINVAL);
+        };
+        let parts: Vec<(usize, usize)> = bufs
+            .iter()
+            .map(|buf| (buf.as_ptr() as usize, buf.len()))
+            .collect();
+        let flags = if self.is_nonblock() {
+            libc::MSG_DONTWAIT
+        } else {
+            0
+        };
+        let f = Box::new(move |net_buffer: &mut [u8]| -> (usize, usize) {
+            let mut copied = 0;
+            for (addr, len) in parts {
+                let n = len.min(net_buffer.len() - copied);
+                unsafe {
+                    core::ptr::copy_nonoverlapping(
+                        addr as *const u8,
+                        net_buffer[copied..].as_mut_ptr(),
+                        n,
+                    );
+                }
+                copied += n;
+                if copied == net_buffer.len() {
+                    break;
+                }
+            }
+            (copied, copied)
+        });
+
+        match socket.send(f, flags) {
+            Ok(sent) => Ok(sent),
+            Err(e) => {
+                warn!("SocketFile writev: connection.send {}", e);
+                Err(code::ERROR)
+            }
+        }
+    }
+
     fn seek(&self, seek_from: SeekFrom) -> Result<usize, Error> {
         warn!("Illegal seek on socket, seek is not implemented");
         Err(code::ESPIPE)
@@ -179,6 +261,11 @@ impl FileOps for SocketFile {
         Err(code::EINVAL)
     }
 
+    // Operations on a socket not attached yet fail at once.
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        self.socket().map_or(POLLERR, |socket| socket.poll(watch))
+    }
+
     fn stat(&self) -> FileAttr {
         self.inode.file_attr()
     }
@@ -203,18 +290,18 @@ pub fn alloc_sock_fd(flags: i32) -> i32 {
         }
     };
     let socket_file = Arc::new(SocketFile::new(socket_inode, flags.into()));
-    let mut fd_manager = get_fd_manager().lock();
+    let fd_manager = get_fd_manager();
     fd_manager.alloc_fd(socket_file)
 }
 
 pub fn free_sock_fd(fd: i32) -> Result<(), Error> {
-    let mut fd_manager = get_fd_manager().lock();
-    fd_manager.free_fd(fd)
+    let fd_manager = get_fd_manager();
+    fd_manager.free_fd(fd).map(|_| ())
 }
 
 pub fn sock_attach_to_fd(fd: i32, socket: Arc<Connection>) -> Result<i32, Error> {
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         fd_manager.get_file_ops(fd).ok_or(code::EBADF)?
     };
     let file_ops_ptr = Arc::as_ptr(&file_ops) as *const ();
@@ -229,7 +316,7 @@ pub fn sock_attach_to_fd(fd: i32, socket: Arc<Connection>) -> Result<i32, Error>
 
 pub fn get_sock_by_fd(fd: i32) -> Result<Arc<Connection>, Error> {
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         fd_manager.get_file_ops(fd).ok_or(code::EBADF)?
     };
     try_get_socket(&file_ops).ok_or_else(|| {
@@ -15,18 +15,21 @@
 //! C API for VFS operations  
 use crate::{
     error::code,
+    time,
     vfs::{
         dcache::Dcache,
         dirent::DirBufferReader,
+        epoll::{EventPoll, EPOLL_CTL_DEL},
         fd_manager::get_fd_manager,
         file::{File, FileAttr, FileOps, OpenFlags},
         fs::FileSystemInfo,
         inode_mode::{InodeFileType, InodeMode},
+        mmap::{self, MAP_ANONYMOUS, MAP_FIXED, MAP_PRIVATE, MAP_SHARED, PROT_WRITE},
         mount, path,
         utils::SeekFrom,
     },
 };
-use alloc::{slice, string::String, sync::Arc};
+use alloc::{slice, string::String, sync::Arc, vec::Vec};
 use core::{
     ffi::{c_char, c_int, c_ulong, c_void, CStr},
     mem::size_of,
@@ -36,6 +39,8 @@ use core::{
 use libc;
 use log::{debug, error, warn};
 
+pub use crate::vfs::epoll::EpollEvent;
+
 pub fn mount(
     device_name: *const c_char,
     path: *const c_char,
@@ -152,7 +157,7 @@ pub fn open(path: *const c_char, flags: c_int, mode: libc::mode_t) -> c_int {
         }
     };
 
-    let mut fd_manager = get_fd_manager().lock();
+    let fd_manager = get_fd_manager();
     let fd = fd_manager.alloc_fd(file);
     fd as i32
 }
@@ -164,14 +169,9 @@ pub fn creat(path: *const c_char, mode: libc::mode_t) -> c_int {
 
 /// Close a file descriptor
 pub fn close(fd: i32) -> i32 {
-    let file_ops = {
-        let mut fd_manager = get_fd_manager().lock();
-        let entry = match fd_manager.get_file_ops(fd) {
-            Some(entry) => entry,
-            None => return -libc::EBADF,
-        };
-        let _ = fd_manager.free_fd(fd);
-        entry
+    let file_ops = match get_fd_manager().free_fd(fd) {
+        Ok(entry) => entry,
+        Err(_) => return -libc::EBADF,
     };
 
     match file_ops.close() {
@@ -191,7 +191,7 @@ pub fn read(fd: i32, buf: *mut u8, count: usize) -> isize {
     }
 
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         match fd_manager.get_file_ops(fd) {
             Some(ops) => ops,
             None => return -libc::EBADF as isize,
@@ -216,7 +216,7 @@ pub fn write(fd: i32, buf: *const u8, count: usize) -> isize {
     }
 
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         match fd_manager.get_file_ops(fd) {
             Some(ops) => ops,
             None => return -libc::EBADF as isize,
@@ -230,6 +230,224 @@ pub fn write(fd: i32, buf: *const u8, count: usize) -> isize {
     }
 }
 
+// Parts of a vectored request are kept on stack up to this many.
+const UIO_FASTIOV: usize = 8;
+const IOV_MAX: c_int = 1024;
+
+fn iovecs<'a>(iov: *const libc::iovec, iovcnt: c_int) -> Result<&'a [libc::iovec], isize> {
+    if !(0..=IOV_MAX).contains(&iovcnt) {
+        return Err(-libc::EINVAL as isize);
+    }
+    if iovcnt == 0 {
+        return Ok(&[]);
+    }
+    if iov.is_null() {
+        return Err(-libc::EFAULT as isize);
+    }
+    let iovs = unsafe { slice::from_raw_parts(iov, iovcnt as usize) };
+    let mut total: usize = 0;
+    for v in iovs {
+        if v.iov_len > 0 && v.iov_base.is_null() {
+            return Err(-libc::EFAULT as isize);
+        }
+        total = match total.checked_add(v.iov_len) {
+            Some(total) if total <= isize::MAX as usize => total,
+            _ => return Err(-libc::EINVAL as isize),
+        };
+    }
+    Ok(iovs)
+}
+
+#[inline]
+unsafe fn iov_slice_mut<'a>(v: &libc::iovec) -> &'a mut [u8] {
+    if v.iov_len == 0 {
+        return &mut [];
+    }
+    slice::from_raw_parts_mut(v.iov_base as *mut u8, v.iov_len)
+}
+
+#[inline]
+unsafe fn iov_slice<'a>(v: &libc::iovec) -> &'a [u8] {
+    if v.iov_len == 0 {
+        return &[];
+    }
+    slice::from_raw_parts(v.iov_base as *const u8, v.iov_len)
+}
+
+/// Read into several buffers with one call
+pub fn readv(fd: i32, iov: *const libc::iovec, iovcnt: c_int) -> isize {
+    let iovs = match iovecs(iov, iovcnt) {
+        Ok(iovs) => iovs,
+        Err(e) => return e,
+    };
+
+    let file_ops = {
+        let fd_manager = get_fd_manager();
+        match fd_manager.get_file_ops(fd) {
+            Some(ops) => ops,
+            None => return -libc::EBADF as isize,
+        }
+    };
+
+    let mut fast: [&mut [u8]; UIO_FASTIOV] = Default::default();
+    let mut slow = Vec::new();
+    let bufs: &mut [&mut [u8]] = if iovs.len() <= UIO_FASTIOV {
+        for (buf, v) in fast.iter_mut().zip(iovs) {
+            *buf = unsafe { iov_slice_mut(v) };
+        }
+        &mut fast[..iovs.len()]
+    } else {
+        slow.extend(iovs.iter().map(|v| unsafe { iov_slice_mut(v) }));
+        &mut slow
+    };
+    match file_ops.readv(bufs) {
+        Ok(n) => n as isize,
+        Err(e) => e.to_errno() as isize,
+    }
+}
+
+/// Write several buffers with one call
+pub fn writev(fd: i32, iov: *const libc::iovec, iovcnt: c_int) -> isize {
+    let iovs = match iovecs(iov, iovcnt) {
+        Ok(iovs) => iovs,
+        Err(e) => return e,
+    };
+
+    let file_ops = {
+        let fd_manager = get_fd_manager();
+        match fd_manager.get_file_ops(fd) {
+            Some(ops) => ops,
+            None => return -libc::EBADF as isize,
+        }
+    };
+
+    let mut fast: [&[u8]; UIO_FASTIOV] = Default::default();
+    let mut slow = Vec::new();
+    let bufs: &[&[u8]] = if iovs.len() <= UIO_FASTIOV {
+        for (buf, v) in fast.iter_mut().zip(iovs) {
+            *buf = unsafe { iov_slice(v) };
+        }
+        &fast[..iovs.len()]
+    } else {
+        slow.extend(iovs.iter().map(|v| unsafe { iov_slice(v) }));
+        &slow
+    };
+    match file_ops.writev(bufs) {
+        Ok(n) => n as isize,
+        Err(e) => e.to_errno() as isize,
+    }
+}
+
+/// Read from a file at `offset`, leaving the file offset alone
+pub fn pread(fd: i32, buf: *mut u8, count: usize, offset: i64) -> isize {
+    if buf.is_null() || offset < 0 {
+        return -libc::EINVAL as isize;
+    }
+
+    let file_ops = {
+        let fd_manager = get_fd_manager();
+        match fd_manager.get_file_ops(fd) {
+            Some(ops) => ops,
+            None => return -libc::EBADF as isize,
+        }
+    };
+
+    if count == 0 {
+        return 0;
+    }
+    let slice = unsafe { slice::from_raw_parts_mut(buf, count) };
+    match file_ops.read_at(offset as usize, slice) {
+        Ok(n) => n as isize,
+        Err(e) => e.to_errno() as isize,
+    }
+}
+
+/// Write to a file at `offset`, leaving the file offset alone
+pub fn pwrite(fd: i32, buf: *const u8, count: usize, offset: i64) -> isize {
+    if buf.is_null() || offset < 0 {
+        return -libc::EINVAL as isize;
+    }
+
+    let file_ops = {
+        let fd_manager = get_fd_manager();
+        match fd_manager.get_file_ops(fd) {
+            Some(ops) => ops,
+            None => return -libc::EBADF as isize,
+        }
+    };
+
+    if count == 0 {
+        return 0;
+    }
+    let slice = unsafe { slice::from_raw_parts(buf, count) };
+    match file_ops.write_at(offset as usize, slice) {
+        Ok(n) => n as isize,
+        Err(e) => e.to_errno() as isize,
+    }
+}
+
+/// Create an event poll, the only flag is O_CLOEXEC
+pub fn epoll_create1(flags: c_int) -> c_int {
+    if flags & !libc::O_CLOEXEC != 0 {
+        return -libc::EINVAL;
+    }
+    let fd_manager = get_fd_manager();
+    fd_manager.alloc_fd(Arc::new(EventPoll::new(OpenFlags::from_bits_truncate(
+        flags,
+    ))))
+}
+
+/// Add, change or remove the watch of `fd` in event poll `epfd`
+pub fn epoll_ctl(epfd: c_int, op: c_int, fd: c_int, event: *const EpollEvent) -> c_int {
+    let (ep, file) = {
+        let fd_manager = get_fd_manager();
+        match (fd_manager.get_file_ops(epfd), fd_manager.get_file_ops(fd)) {
+            (Some(ep), Some(file)) => (ep, file),
+            _ => return -libc::EBADF,
+        }
+    };
+    let Some(ep) = ep.downcast_ref::<EventPoll>() else {
+        return -libc::EINVAL;
+    };
+    let event = if op == EPOLL_CTL_DEL {
+        EpollEvent::default()
+    } else if event.is_null() {
+        return -libc::EFAULT;
+    } else {
+        unsafe { *event }
+    };
+    match ep.ctl(op, fd, file, event) {
+        Ok(()) => 0,
+        Err(e) => e.to_errno(),
+    }
+}
+
+/// Wait at most `timeout` milliseconds, forever if negative, for files
+/// watched by `epfd` to get ready
+pub fn epoll_wait(epfd: c_int, events: *mut EpollEvent, maxevents: c_int, timeout: c_int) -> c_int {
+    if maxevents <= 0 {
+        return -libc::EINVAL;
+    }
+    if events.is_null() {
+        return -libc::EFAULT;
+    }
+    let ep = {
+        let fd_manager = get_fd_manager();
+        match fd_manager.get_file_ops(epfd) {
+            Some(ops) => ops,
+            None => return -libc::EBADF,
+        }
+    };
+    let Some(ep) = ep.downcast_ref::<EventPoll>() else {
+        return -libc::EINVAL;
+    };
+    let timeout = usize::try_from(timeout)
+        .ok()
+        .map(time::tick_from_millisecond);
+    let events = unsafe { slice::from_raw_parts_mut(events, maxevents as usize) };
+    ep.wait(events, timeout) as c_int
+}
+
 /// Seek in a file
 pub fn lseek(fd: i32, offset: i64, whence: i32) -> i64 {
     debug!(
@@ -249,7 +467,7 @@ pub fn lseek(fd: i32, offset: i64, whence: i32) -> i64 {
     };
 
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         match fd_manager.get_file_ops(fd) {
             Some(ops) => ops,
             None => return -libc::EBADF as i64,
@@ -287,7 +505,7 @@ pub fn ftruncate(fd: i32, length: libc::off_t) -> c_int {
     debug!("ftruncate: fd = {}, length = {}", fd, length);
 
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         match fd_manager.get_file_ops(fd) {
             Some(ops) => ops,
             None => return -libc::EBADF,
@@ -300,13 +518,117 @@ pub fn ftruncate(fd: i32, length: libc::off_t) -> c_int {
     }
 }
 
+/// Write back mappings and data of a file to its device
+pub fn fsync(fd: i32) -> c_int {
+    debug!("fsync: fd = {}", fd);
+
+    let file_ops = {
+        let fd_manager = get_fd_manager();
+        match fd_manager.get_file_ops(fd) {
+            Some(ops) => ops,
+            None => return -libc::EBADF,
+        }
+    };
+    let Some(file) = file_ops.downcast_ref::<File>() else {
+        return -libc::EINVAL;
+    };
+
+    let inode = file.dcache().inode();
+    match mmap::sync_inode(&inode).and_then(|_| inode.fsync()) {
+        Ok(_) => 0,
+        Err(e) => e.to_errno(),
+    }
+}
+
+/// Map a file, or anonymous memory with MAP_ANONYMOUS. Return the address
+/// of the mapping or a negative error code. `addr` is only a hint.
+pub fn mmap(
+    addr: *mut c_void,
+    len: usize,
+    prot: c_int,
+    flags: c_int,
+    fd: i32,
+    offset: libc::off_t,
+) -> isize {
+    debug!(
+        "mmap: addr = {:?}, len = {}, prot = {:#x}, flags = {:#x}, fd = {}, offset = {}",
+        addr, len, prot, flags, fd, offset
+    );
+    let shared = match flags & (MAP_SHARED | MAP_PRIVATE) {
+        MAP_SHARED => true,
+        MAP_PRIVATE => false,
+        _ => return -libc::EINVAL as isize,
+    };
+    // Without paging, a mapping can't be placed at a given address.
+    if len == 0 || flags & MAP_FIXED != 0 {
+        return -libc::EINVAL as isize;
+    }
+    if offset < 0 || offset as usize % mmap::PAGE_SIZE != 0 {
+        return -libc::EINVAL as isize;
+    }
+
+    let writable = prot & PROT_WRITE != 0;
+    let file = if flags & MAP_ANONYMOUS != 0 {
+        None
+    } else {
+        let file_ops = {
+            let fd_manager = get_fd_manager();
+            match fd_manager.get_file_ops(fd) {
+                Some(ops) => ops,
+                None => return -libc::EBADF as isize,
+            }
+        };
+        let Some(file) = file_ops.downcast_ref::<File>() else {
+            return -libc::ENODEV as isize;
+        };
+        if !matches!(
+            file.type_(),
+            InodeFileType::Regular | InodeFileType::CharDevice | InodeFileType::BlockDevice
+        ) {
+            return -libc::ENODEV as isize;
+        }
+        let access_mode = file.access_mode();
+        // Writes to a shared mapping reach the file.
+        if !access_mode.is_readable() || (shared && writable && !access_mode.is_writable()) {
+            return -libc::EACCES as isize;
+        }
+        Some((file.dcache().inode(), offset as usize))
+    };
+
+    match mmap::map(file, len, shared, writable) {
+        Ok(addr) => addr as isize,
+        Err(e) => e.to_errno() as isize,
+    }
+}
+
+/// Unmap a mapping as a whole, writing it back to the file if shared
+pub fn munmap(addr: *mut c_void, len: usize) -> c_int {
+    debug!("munmap: addr = {:?}, len = {}", addr, len);
+    match mmap::unmap(addr as usize, len) {
+        Ok(_) => 0,
+        Err(e) => e.to_errno(),
+    }
+}
+
+/// Write back mappings within [addr, addr + len) to their files
+pub fn msync(addr: *mut c_void, len: usize, flags: c_int) -> c_int {
+    debug!(
+        "msync: addr = {:?}, len = {}, flags = {:#x}",
+        addr, len, flags
+    );
+    match mmap::sync(addr as usize, len, flags) {
+        Ok(_) => 0,
+        Err(e) => e.to_errno(),
+    }
+}
+
 pub fn fcntl(fd: i32, cmd: c_int, args: usize) -> c_int {
     debug!("fcntl: fd = {}, cmd = {}, args = {}", fd, cmd, args);
     const FD_CLOEXEC: c_int = 1;
 
     match cmd {
         libc::F_DUPFD => {
-            let mut fd_manager = get_fd_manager().lock();
+            let fd_manager = get_fd_manager();
             let new_fd = match fd_manager.dup_fd(fd, args as c_int, false) {
                 Ok(fd) => fd,
                 Err(err) => return err.to_errno(),
@@ -314,7 +636,7 @@ pub fn fcntl(fd: i32, cmd: c_int, args: usize) -> c_int {
             new_fd as c_int
         }
         libc::F_DUPFD_CLOEXEC => {
-            let mut fd_manager = get_fd_manager().lock();
+            let fd_manager = get_fd_manager();
             let new_fd = match fd_manager.dup_fd(fd, args as c_int, true) {
                 Ok(fd) => fd,
                 Err(err) => return err.to_errno(),
@@ -322,7 +644,7 @@ pub fn fcntl(fd: i32, cmd: c_int, args: usize) -> c_int {
             new_fd as c_int
         }
         libc::F_GETFD => {
-            let fd_manager = get_fd_manager().lock();
+            let fd_manager = get_fd_manager();
             let fd_entry = match fd_manager.get_file_ops(fd) {
                 Some(entry) => entry,
                 None => return -libc::EBADF,
@@ -341,7 +663,7 @@ pub fn fcntl(fd: i32, cmd: c_int, args: usize) -> c_int {
 
             let is_cloexec = (args as c_int) & FD_CLOEXEC != 0;
 
-            let fd_manager = get_fd_manager().lock();
+            let fd_manager = get_fd_manager();
             let fd_entry = match fd_manager.get_file_ops(fd) {
                 Some(entry) => entry,
                 None => return -libc::EBADF,
@@ -354,7 +676,7 @@ pub fn fcntl(fd: i32, cmd: c_int, args: usize) -> c_int {
             0
         }
         libc::F_GETFL => {
-            let fd_manager = get_fd_manager().lock();
+            let fd_manager = get_fd_manager();
             let fd_entry = match fd_manager.get_file_ops(fd) {
                 Some(entry) => entry,
                 None => return -libc::EBADF,
@@ -363,7 +685,7 @@ pub fn fcntl(fd: i32, cmd: c_int, args: usize) -> c_int {
         }
         libc::F_SETFL => {
             // this operation can change only O_NONBLOCK for now
-            let fd_manager = get_fd_manager().lock();
+            let fd_manager = get_fd_manager();
             let fd_entry = match fd_manager.get_file_ops(fd) {
                 Some(entry) => entry,
                 None => return -libc::EBADF,
@@ -504,7 +826,7 @@ pub fn rmdir(path: *const c_char) -> c_int {
 
 pub fn getdents(fd: i32, buf: *mut u8, buf_len: usize) -> c_int {
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         match fd_manager.get_file_ops(fd) {
             Some(ops) => ops,
             None => return -libc::EBADF,
@@ -621,7 +943,7 @@ pub fn fstat(fd: i32, buf: *mut Stat) -> c_int {
     debug!("fstat: fd = {}", fd);
 
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         match fd_manager.get_file_ops(fd) {
             Some(ops) => ops,
             None => return -libc::EBADF,
@@ -703,7 +1025,7 @@ pub fn fstatfs(fd: i32, buf: *mut Statfs) -> c_int {
     debug!("fstat: fd = {}", fd);
 
     let file_ops = {
-        let fd_manager = get_fd_manager().lock();
+        let fd_manager = get_fd_manager();
         match fd_manager.get_file_ops(fd) {
             Some(ops) => ops,
             None => return -libc::EBADF,
@@ -1239,6 +1561,115 @@ mod tests {
         assert_eq!(result, code::EOK.to_errno());
     }
 
+    #[test]
+    fn test_mmap_shared_file() {
+        let result = mkdir(TEST_DIR, 0o755);
+        assert_eq!(result, code::EOK.to_errno());
+        let fd = open(TEST_PATH, libc::O_CREAT | libc::O_RDWR, 0o644);
+        assert!(fd > 0);
+        let data = [0x42u8; 100];
+        assert_eq!(write(fd, data.as_ptr(), data.len()), data.len() as isize);
+
+        // Invalid parameters
+        let null = core::ptr::null_mut();
+        let result = mmap(null, 0, PROT_WRITE, MAP_SHARED, fd, 0);
+        assert_eq!(result, code::EINVAL.to_errno() as isize);
+        let result = mmap(null, 100, PROT_WRITE, MAP_SHARED, fd, 1);
+        assert_eq!(result, code::EINVAL.to_errno() as isize);
+        let result = mmap(null, 100, PROT_WRITE, MAP_SHARED, -1, 0);
+        assert_eq!(result, code::EBADF.to_errno() as isize);
+
+        let addr = mmap(null, data.len(), PROT_WRITE, MAP_SHARED, fd, 0);
+        assert!(addr > 0);
+        let mem = unsafe { slice::from_raw_parts_mut(addr as *mut u8, data.len()) };
+        assert_eq!(mem, &data[..]);
+        // The mapping shares pages with tmpfs.
+        mem[0] = 0x24;
+        let mut buf = [0u8; 1];
+        assert_eq!(lseek(fd, 0, 0), 0);
+        assert_eq!(read(fd, buf.as_mut_ptr(), 1), 1);
+        assert_eq!(buf[0], 0x24);
+
+        let addr = addr as *mut c_void;
+        assert_eq!(msync(addr, data.len(), mmap::MS_SYNC), 0);
+        assert_eq!(fsync(fd), 0);
+        assert_eq!(munmap(addr, data.len()), 0);
+        assert_eq!(munmap(addr, data.len()), code::EINVAL.to_errno());
+
+        let result = close(fd);
+        assert_eq!(result, code::EOK.to_errno());
+        let result = unlink(TEST_PATH);
+        assert_eq!(result, code::EOK.to_errno());
+        let result = rmdir(TEST_DIR);
+        assert_eq!(result, code::EOK.to_errno());
+    }
+
+    #[test]
+    fn test_vectored_and_positional_io() {
+        let result = mkdir(TEST_DIR, 0o755);
+        assert_eq!(result, code::EOK.to_errno());
+        let fd = open(TEST_PATH, libc::O_CREAT | libc::O_RDWR, 0o644);
+        assert!(fd > 0);
+
+        let (a, b) = (*b"hello ", *b"world");
+        let iov = [
+            libc::iovec {
+                iov_base: a.as_ptr() as *mut c_void,
+                iov_len: a.len(),
+            },
+            libc::iovec {
+                iov_base: core::ptr::null_mut(),
+                iov_len: 0,
+            },
+            libc::iovec {
+                iov_base: b.as_ptr() as *mut c_void,
+                iov_len: b.len(),
+            },
+        ];
+        assert_eq!(writev(fd, iov.as_ptr(), 3), 11);
+        assert_eq!(lseek(fd, 0, libc::SEEK_CUR), 11);
+        assert_eq!(
+            writev(fd, iov.as_ptr(), -1),
+            code::EINVAL.to_errno() as isize
+        );
+
+        // Positional I/O leaves the offset alone.
+        let mut buf = [0u8; 5];
+        assert_eq!(pread(fd, buf.as_mut_ptr(), buf.len(), 6), 5);
+        assert_eq!(&buf, b"world");
+        assert_eq!(pwrite(fd, b"W".as_ptr(), 1, 6), 1);
+        assert_eq!(
+            pread(fd, buf.as_mut_ptr(), 1, -1),
+            code::EINVAL.to_errno() as isize
+        );
+        assert_eq!(lseek(fd, 0, libc::SEEK_CUR), 11);
+
+        // A short read stops at the end of the file.
+        let (mut x, mut y) = ([0u8; 8], [0u8; 8]);
+        let iov = [
+            libc::iovec {
+                iov_base: x.as_mut_ptr() as *mut c_void,
+                iov_len: x.len(),
+            },
+            libc::iovec {
+                iov_base: y.as_mut_ptr() as *mut c_void,
+                iov_len: y.len(),
+            },
+        ];
+        assert_eq!(lseek(fd, 0, libc::SEEK_SET), 0);
+        assert_eq!(readv(fd, iov.as_ptr(), 2), 11);
+        assert_eq!(&x, b"hello Wo");
+        assert_eq!(&y[..3], b"rld");
+        assert_eq!(readv(fd, iov.as_ptr(), 2), 0);
+
+        let result = close(fd);
+        assert_eq!(result, code::EOK.to_errno());
+        let result = unlink(TEST_PATH);
+        assert_eq!(result, code::EOK.to_errno());
+        let result = rmdir(TEST_DIR);
+        assert_eq!(result, code::EOK.to_errno());
+    }
+
     #[test]
     fn test_truncate_directory() {
         // Create directory
@@ -13,8 +13,10 @@
 // limitations under the License.
 
 use crate::{
+    allocator,
     devices::Device,
     error::{code, Error},
+    sync::poll::{PollWatch, POLLIN, POLLOUT},
     vfs::{
         dcache::Dcache,
         dirent::DirBufferReader,
@@ -22,6 +24,7 @@ use crate::{
         fs::{FileSystem, FileSystemInfo},
         inode::{InodeAttr, InodeNo, InodeOps},
         inode_mode::{InodeFileType, InodeMode},
+        mmap::{self, Extent, MmapMemory, Page},
         utils::NAME_MAX,
     },
 };
@@ -29,24 +32,29 @@ use alloc::{
     collections::BTreeMap,
     string::String,
     sync::{Arc, Weak},
-    vec::Vec,
 };
 use core::{
+    cmp::min,
     sync::atomic::{AtomicBool, AtomicUsize, Ordering},
     time::Duration,
 };
 use delegate::delegate;
+use embedded_io::ErrorKind;
 use log::{debug, trace, warn};
 use spin::RwLock;
 
 static MAGIC: usize = 0x01021994;
 const ROOT_INO: InodeNo = 1;
 const BLOCK_SIZE: usize = 4096;
+// Files are stored in pages of the block size, which can be mapped.
+const PAGE_SIZE: usize = mmap::PAGE_SIZE;
+// Holes of files read from here.
+static ZERO_PAGE: [u8; PAGE_SIZE] = [0; PAGE_SIZE];
 
 #[derive(Debug)]
 enum TmpFileData {
     Directory(TmpDir),
-    File(Vec<u8>),
+    File(TmpFile),
     Device(Arc<dyn Device>),
     // TODO: support symlink
     // SymLink(String),
@@ -60,6 +68,8 @@ pub struct TmpFileSystem {
     next_inode_no: AtomicUsize,
     fs_info: FileSystemInfo,
     is_mounted: AtomicBool,
+    // Pages allocated by all files
+    nr_pages: AtomicUsize,
 }
 
 impl TmpFileSystem {
@@ -83,6 +93,7 @@ impl TmpFileSystem {
             next_inode_no: AtomicUsize::new(ROOT_INO + 1),
             is_mounted: AtomicBool::new(false),
             fs_info: FileSystemInfo::new(MAGIC, 0, NAME_MAX, BLOCK_SIZE, 0),
+            nr_pages: AtomicUsize::new(0),
         })
     }
 
@@ -94,6 +105,14 @@ impl TmpFileSystem {
     fn check_mounted(&self) -> bool {
         self.is_mounted.load(Ordering::Relaxed)
     }
+
+    fn account_pages(&self, before: usize, after: usize) {
+        if after > before {
+            self.nr_pages.fetch_add(after - before, Ordering::Relaxed);
+        } else {
+            self.nr_pages.fetch_sub(before - after, Ordering::Relaxed);
+        }
+    }
 }
 
 impl FileSystem for TmpFileSystem {
@@ -121,7 +140,15 @@ impl FileSystem for TmpFileSystem {
         self.root.clone()
     }
     fn fs_info(&self) -> FileSystemInfo {
-        self.fs_info.clone()
+        // Pages are allocated from the heap, so tmpfs can grow as long
+        // as the heap has room.
+        let mem = allocator::memory_info();
+        let free = mem.total.saturating_sub(mem.used) / PAGE_SIZE;
+        let mut info = self.fs_info.clone();
+        info.blocks = self.nr_pages.load(Ordering::Relaxed) + free;
+        info.bfree = free;
+        info.bavail = free;
+        info
     }
     fn fs_type(&self) -> &str {
         "tmpfs"
@@ -155,6 +182,116 @@ impl TmpDir {
     }
 }
 
+/// Contents of a regular file, in pages indexed by offset. A page is
+/// allocated on the first write to it, pages never written are holes
+/// which read as zeros. Bytes of the last page beyond the end of file are
+/// kept zero, so extending the file exposes zeros. Pages of a range
+/// mapped shared are moved into the extent of the mapping.
+#[derive(Debug, Default)]
+struct TmpFile {
+    pages: BTreeMap<usize, Page>,
+    len: usize,
+}
+
+impl TmpFile {
+    fn len(&self) -> usize {
+        self.len
+    }
+
+    fn nr_pages(&self) -> usize {
+        self.pages.len()
+    }
+
+    /// Slices of the file covering [offset, offset + len) up to the end
+    /// of file, one per page, without copying.
+    fn slices(&self, offset: usize, len: usize) -> impl Iterator<Item = &[u8]> + '_ {
+        let end = min(offset.saturating_add(len), self.len);
+        let mut pos = min(offset, end);
+        core::iter::from_fn(move || {
+            if pos == end {
+                return None;
+            }
+            let start = pos % PAGE_SIZE;
+            let n = min(PAGE_SIZE - start, end - pos);
+            let page = match self.pages.get(&(pos / PAGE_SIZE)) {
+                Some(page) => page.as_slice(),
+                None => &ZERO_PAGE[..],
+            };
+            pos += n;
+            Some(&page[start..start + n])
+        })
+    }
+
+    fn read(&self, offset: usize, buf: &mut [u8]) -> usize {
+        let mut done = 0;
+        for slice in self.slices(offset, buf.len()) {
+            buf[done..done + slice.len()].copy_from_slice(slice);
+            done += slice.len();
+        }
+        done
+    }
+
+    fn write(&mut self, offset: usize, buf: &[u8]) {
+        let mut done = 0;
+        while done < buf.len() {
+            let pos = offset + done;
+            let start = pos % PAGE_SIZE;
+            let n = min(PAGE_SIZE - start, buf.len() - done);
+            let page = self.pages.entry(pos / PAGE_SIZE).or_insert_with(Page::new);
+            page.as_mut_slice()[start..start + n].copy_from_slice(&buf[done..done + n]);
+            done += n;
+        }
+        self.len = self.len.max(offset + buf.len());
+    }
+
+    fn truncate(&mut self, size: usize) {
+        if size < self.len {
+            drop(self.pages.split_off(&size.div_ceil(PAGE_SIZE)));
+            if let Some(page) = self.pages.get_mut(&(size / PAGE_SIZE)) {
+                page.as_mut_slice()[size % PAGE_SIZE..].fill(0);
+            }
+        }
+        // Growing leaves a hole.
+        self.len = size;
+    }
+
+    /// Move pages [first, first + nr) within the file into one extent to
+    /// be mapped, holes included. The range might be stored in such an
+    /// extent already. Fail with EINVAL if some of the pages is mapped
+    /// with another range, which can't be moved.
+    fn share(&mut self, first: usize, nr: usize) -> Result<Arc<Extent>, Error> {
+        let end = min(first + nr, self.len.div_ceil(PAGE_SIZE)).max(first);
+        if let Some(page) = self.pages.get(&first) {
+            let extent = page.extent().clone();
+            if extent.nr_pages() == nr
+                && (first..end).all(|i| {
+                    self.pages
+                        .get(&i)
+                        .is_some_and(|page| page.is(&extent, i - first))
+                })
+            {
+                return Ok(extent);
+            }
+        }
+        if (first..end).any(|i| {
+            self.pages
+                .get(&i)
+                .is_some_and(|page| page.extent().is_mapped())
+        }) {
+            return Err(code::EINVAL);
+        }
+        let extent = Extent::new(nr)?;
+        for i in first..end {
+            let mut page = Page::of(&extent, i - first);
+            if let Some(old) = self.pages.get(&i) {
+                page.as_mut_slice().copy_from_slice(old.as_slice());
+            }
+            self.pages.insert(i, page);
+        }
+        Ok(extent)
+    }
+}
+
 /// Inode in temporary filesystem
 #[derive(Debug)]
 struct TmpInode {
@@ -176,7 +313,7 @@ impl TmpInode {
         Arc::new_cyclic(|weak_inode| Self {
             inner: RwLock::new(InnerNode {
                 attr: InodeAttr::new(inode_no, InodeFileType::Regular, mode, uid, gid, 0),
-                data: TmpFileData::File(Vec::new()),
+                data: TmpFileData::File(TmpFile::default()),
             }),
             this: weak_inode.clone(),
             fs: fs.clone(),
@@ -272,14 +409,14 @@ impl InnerNode {
         }
     }
 
-    fn as_file(&self) -> Option<&Vec<u8>> {
+    fn as_file(&self) -> Option<&TmpFile> {
         match &self.data {
             TmpFileData::File(file) => Some(file),
             _ => None,
         }
     }
 
-    fn as_file_mut(&mut self) -> Option<&mut Vec<u8>> {
+    fn as_file_mut(&mut self) -> Option<&mut TmpFile> {
         match &mut self.data {
             TmpFileData::File(file) => Some(file),
             _ => None,
@@ -406,13 +543,7 @@ impl InodeOps for TmpInode {
             return Err(code::EISDIR);
         };
         debug_assert!(data.len() == inner.attr.size);
-        let file_size = inner.attr.size;
-        let read_pos = file_size.min(offset);
-        let read_end = file_size.min(offset + buf.len());
-        let read_size = read_end - read_pos;
-        buf[..read_size].copy_from_slice(&data[read_pos..read_end]);
-
-        Ok(read_size)
+        Ok(data.read(offset, buf))
     }
 
     fn write_at(&self, offset: usize, buf: &[u8], nonblock: bool) -> Result<usize, Error> {
@@ -423,26 +554,102 @@ impl InodeOps for TmpInode {
                 .map_err(Error::from);
         }
 
-        let write_end = offset + buf.len();
-        let need_resize;
-        {
-            let file_size = inner.attr.size;
-            let Some(data) = inner.as_file_mut() else {
-                warn!("write_at: inode is not a file");
-                return Err(code::EISDIR);
-            };
+        let Some(data) = inner.as_file_mut() else {
+            warn!("write_at: inode is not a file");
+            return Err(code::EISDIR);
+        };
+        let before = data.nr_pages();
+        data.write(offset, buf);
+        let (size, after) = (data.len(), data.nr_pages());
+        inner.attr.size = size;
+        inner.attr.blocks = after;
+        self.account_pages(before, after);
 
-            need_resize = write_end > file_size;
-            if need_resize {
-                data.resize(write_end, 0);
+        Ok(buf.len())
+    }
+
+    fn readv_at(
+        &self,
+        offset: usize,
+        bufs: &mut [&mut [u8]],
+        nonblock: bool,
+    ) -> Result<usize, Error> {
+        let inner = self.inner.read();
+        if let Some(device) = inner.as_device() {
+            return device
+                .readv(offset as u64, bufs, nonblock)
+                .map_err(Error::from);
+        }
+
+        let Some(data) = inner.as_file() else {
+            warn!("readv_at: inode is not a file");
+            return Err(code::EISDIR);
+        };
+        let mut done = 0;
+        for buf in bufs.iter_mut() {
+            let n = data.read(offset + done, buf);
+            done += n;
+            if n < buf.len() {
+                break;
             }
-            data[offset..write_end].copy_from_slice(buf);
         }
-        if need_resize {
-            inner.attr.size = write_end;
+        Ok(done)
+    }
+
+    fn writev_at(&self, offset: usize, bufs: &[&[u8]], nonblock: bool) -> Result<usize, Error> {
+        let mut inner = self.inner.write();
+        if let Some(device) = inner.as_device() {
+            return device
+                .writev(offset as u64, bufs, nonblock)
+                .map_err(Error::from);
         }
 
-        Ok(buf.len())
+        let Some(data) = inner.as_file_mut() else {
+            warn!("writev_at: inode is not a file");
+            return Err(code::EISDIR);
+        };
+        let before = data.nr_pages();
+        let mut done = 0;
+        for buf in bufs.iter() {
+            data.write(offset + done, buf);
+            done += buf.len();
+        }
+        let (size, after) = (data.len(), data.nr_pages());
+        inner.attr.size = size;
+        inner.attr.blocks = after;
+        self.account_pages(before, after);
+
+        Ok(done)
+    }
+
+    fn poll(&self, watch: Option<&Arc<PollWatch>>) -> u32 {
+        // The device might block, don't hold the inode meanwhile.
+        let device = self.inner.read().as_device().cloned();
+        device.map_or(POLLIN | POLLOUT, |device| device.poll(watch))
+    }
+
+    fn mmap(&self, offset: usize, len: usize, shared: bool) -> Result<Option<MmapMemory>, Error> {
+        let mut inner = self.inner.write();
+        if let Some(device) = inner.as_device() {
+            return match device.mmap(offset as u64, len) {
+                Ok(addr) => Ok(Some(MmapMemory::Device(addr))),
+                Err(ErrorKind::Unsupported) => Err(code::ENODEV),
+                Err(e) => Err(Error::from(e)),
+            };
+        }
+        // A private mapping is a copy.
+        if !shared {
+            return Ok(None);
+        }
+        let Some(data) = inner.as_file_mut() else {
+            return Err(code::ENODEV);
+        };
+        let before = data.nr_pages();
+        let extent = data.share(offset / PAGE_SIZE, len / PAGE_SIZE);
+        let after = data.nr_pages();
+        inner.attr.blocks = after;
+        self.account_pages(before, after);
+        extent.map(|extent| Some(MmapMemory::Pages(extent)))
     }
 
     fn link(&self, old: &Arc<dyn InodeOps>, name: &str) -> Result<(), Error> {
@@ -610,8 +817,12 @@ impl InodeOps for TmpInode {
             warn!("resize: inode is not a file");
             return Err(code::EISDIR);
         };
-        data.resize(size, 0);
+        let before = data.nr_pages();
+        data.truncate(size);
+        let after = data.nr_pages();
         inner.attr.size = size;
+        inner.attr.blocks = after;
+        self.account_pages(before, after);
         Ok(())
     }
 
@@ -669,8 +880,48 @@ impl InodeOps for TmpInode {
     }
 }
 
+impl TmpInode {
+    fn account_pages(&self, before: usize, after: usize) {
+        if let Some(fs) = self.fs.upgrade() {
+            fs.account_pages(before, after);
+        }
+    }
+}
+
 impl Drop for TmpInode {
     fn drop(&mut self) {
         trace!("Drop {:?}", self);
+        let pages = self.inner.get_mut().as_file().map_or(0, TmpFile::nr_pages);
+        self.account_pages(pages, 0);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use blueos_test_macro::test;
+
+    #[test]
+    fn test_tmp_file_sparse() {
+        let mut file = TmpFile::default();
+        // Write across a page boundary far from the start.
+        let offset = PAGE_SIZE * 10 - 3;
+        file.write(offset, &[1, 2, 3, 4, 5, 6]);
+        assert_eq!(file.len(), offset + 6);
+        assert_eq!(file.nr_pages(), 2);
+        let mut buf = vec![0xffu8; 16];
+        assert_eq!(file.read(offset - 10, &mut buf), 16);
+        assert_eq!(&buf[..10], &[0u8; 10]);
+        assert_eq!(&buf[10..], &[1, 2, 3, 4, 5, 6]);
+        assert_eq!(file.slices(0, usize::MAX).count(), 11);
+        // Shrink into the first page written, then grow again.
+        file.truncate(offset + 1);
+        assert_eq!(file.nr_pages(), 1);
+        file.truncate(offset + 6);
+        assert_eq!(file.read(offset, &mut buf), 6);
+        assert_eq!(&buf[..6], &[1, 0, 0, 0, 0, 0]);
+        file.truncate(0);
+        assert_eq!(file.nr_pages(), 0);
+        assert_eq!(file.read(0, &mut buf), 0);
     }
 }
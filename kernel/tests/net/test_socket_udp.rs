@@ -324,3 +324,126 @@ fn test_udp_ipv6_non_blocking() {
 
     let _ = futex::atomic_wait(&UDP_CLIENT_THREAD_FINISH, 0, None);
 }
+
+#[test]
+fn test_udp_mmsg_ipv4() {
+    const NR_MSGS: usize = 4;
+
+    let server_fd = net::syscalls::socket(AF_INET, libc::SOCK_DGRAM, 0);
+    let client_fd = net::syscalls::socket(AF_INET, libc::SOCK_DGRAM, 0);
+    assert!(server_fd >= 0 && client_fd >= 0);
+    let server_addr = net_utils::create_ipv4_sockaddr("127.0.0.1", 1236);
+    let client_addr = net_utils::create_ipv4_sockaddr("127.0.0.1", 1237);
+    for (fd, addr) in [(server_fd, &server_addr), (client_fd, &client_addr)] {
+        let bind_result = net::syscalls::bind(
+            fd,
+            addr as *const _ as *const libc::sockaddr,
+            mem::size_of::<libc::sockaddr>() as libc::socklen_t,
+        );
+        assert_eq!(bind_result, 0);
+    }
+
+    let mut payloads = [[0u8; 8]; NR_MSGS];
+    let mut iovs: [libc::iovec; NR_MSGS] = unsafe { mem::zeroed() };
+    let mut msgs: [net::SocketMmsghdr; NR_MSGS] = unsafe { mem::zeroed() };
+    for i in 0..NR_MSGS {
+        payloads[i] = [i as u8; 8];
+        iovs[i].iov_base = payloads[i].as_mut_ptr() as *mut c_void;
+        iovs[i].iov_len = payloads[i].len();
+        msgs[i].msg_hdr.msg_name = &server_addr as *const _ as *mut c_void;
+        msgs[i].msg_hdr.msg_namelen = mem::size_of::<libc::sockaddr>() as libc::socklen_t;
+        msgs[i].msg_hdr.msg_iov = &mut iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    let sent = net::syscalls::sendmmsg(client_fd, msgs.as_mut_ptr(), NR_MSGS as u32, 0);
+    assert_eq!(sent, NR_MSGS as i32);
+    assert!(msgs.iter().all(|m| m.msg_len == 8));
+
+    let mut buffers = [[0u8; 16]; NR_MSGS];
+    let mut received = 0;
+    while received < NR_MSGS {
+        let mut iovs: [libc::iovec; NR_MSGS] = unsafe { mem::zeroed() };
+        let mut msgs: [net::SocketMmsghdr; NR_MSGS] = unsafe { mem::zeroed() };
+        for i in 0..NR_MSGS - received {
+            iovs[i].iov_base = buffers[received + i].as_mut_ptr() as *mut c_void;
+            iovs[i].iov_len = buffers[received + i].len();
+            msgs[i].msg_hdr.msg_iov = &mut iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        let n = net::syscalls::recvmmsg(
+            server_fd,
+            msgs.as_mut_ptr(),
+            (NR_MSGS - received) as u32,
+            0,
+            core::ptr::null_mut(),
+        );
+        assert!(n > 0, "recvmmsg fail {}", n);
+        for m in &msgs[..n as usize] {
+            assert_eq!(m.msg_len, 8);
+        }
+        received += n as usize;
+    }
+    for (i, buffer) in buffers.iter().enumerate() {
+        assert_eq!(&buffer[..8], &[i as u8; 8]);
+    }
+
+    assert_eq!(net::syscalls::shutdown(client_fd, 0), 0);
+    assert_eq!(net::syscalls::shutdown(server_fd, 0), 0);
+}
+
+#[test]
+fn test_udp_epoll_ipv4() {
+    use blueos::vfs::syscalls::{self as vfs, EpollEvent};
+    const EPOLLIN: u32 = 0x001;
+    const EPOLL_CTL_ADD: i32 = 1;
+
+    let server_fd = net::syscalls::socket(AF_INET, libc::SOCK_DGRAM, 0);
+    let client_fd = net::syscalls::socket(AF_INET, libc::SOCK_DGRAM, 0);
+    assert!(server_fd >= 0 && client_fd >= 0);
+    let server_addr = net_utils::create_ipv4_sockaddr("127.0.0.1", 1238);
+    let bind_result = net::syscalls::bind(
+        server_fd,
+        &server_addr as *const _ as *const libc::sockaddr,
+        mem::size_of::<libc::sockaddr>() as libc::socklen_t,
+    );
+    assert_eq!(bind_result, 0);
+
+    let epfd = vfs::epoll_create1(0);
+    assert!(epfd >= 0);
+    let event = EpollEvent {
+        events: EPOLLIN,
+        data: server_fd as u64,
+    };
+    assert_eq!(vfs::epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &event), 0);
+    let mut events = [EpollEvent::default(); 4];
+    assert_eq!(vfs::epoll_wait(epfd, events.as_mut_ptr(), 4, 0), 0);
+
+    let bytes = b"epoll";
+    let sent = net::syscalls::sendto(
+        client_fd,
+        bytes.as_ptr() as *const c_void,
+        bytes.len(),
+        0,
+        &server_addr as *const _ as *const libc::sockaddr,
+        mem::size_of::<libc::sockaddr>() as libc::socklen_t,
+    );
+    assert_eq!(sent, bytes.len() as isize);
+    let n = vfs::epoll_wait(epfd, events.as_mut_ptr(), 4, 1000);
+    assert_eq!(n, 1);
+    assert_eq!(events[0].data, server_fd as u64);
+    assert_ne!(events[0].events & EPOLLIN, 0);
+
+    let mut buffer = [0u8; 16];
+    let received = net::syscalls::recv(
+        server_fd,
+        buffer.as_mut_ptr() as *mut c_void,
+        buffer.len(),
+        0,
+    );
+    assert_eq!(received, bytes.len() as isize);
+    assert_eq!(vfs::epoll_wait(epfd, events.as_mut_ptr(), 4, 0), 0);
+
+    assert_eq!(vfs::close(epfd), 0);
+    assert_eq!(net::syscalls::shutdown(client_fd, 0), 0);
+    assert_eq!(net::syscalls::shutdown(server_fd, 0), 0);
+}